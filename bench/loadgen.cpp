@@ -0,0 +1,508 @@
+// HTTP/1.1 load generator for a local server. Each thread drives its share of
+// the connections with epoll, either in closed loop (a new request as soon as
+// the previous response completes) or at a fixed total rate, where latency
+// is measured from the scheduled send time so a stalled server cannot hide
+// its queueing delay. Results are printed and optionally written as JSON.
+// With --hop, every scenario runs again through a proxy route prefix, and
+// the latency the extra hop adds is printed.
+//
+//   loadgen --port 8080 --scenario all --duration 10 --output run.json
+//   loadgen --port 8080 --scenario api --hop /svc
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "http_request.hpp"
+#include "stats.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+struct Scenario {
+    std::string name;
+    std::string method;
+    std::string path;
+    std::string body;
+};
+
+// Fixture served by the static-large scenario, created with --docroot
+constexpr const char* LARGE_FILE_NAME = "bench-large.bin";
+constexpr size_t LARGE_FILE_SIZE = 4 * 1024 * 1024;
+
+std::vector<Scenario> builtinScenarios() {
+    return {
+        {"health", "GET", "/health", ""},
+        {"api", "GET", "/api", ""},
+        {"static-small", "GET", "/static/test.html", ""},
+        {"static-large", "GET", std::string("/static/") + LARGE_FILE_NAME, ""},
+        {"echo", "POST", "/echo", std::string(256, 'x')},
+    };
+}
+
+struct Options {
+    std::string host = "127.0.0.1";
+    std::string port = "8080";
+    std::vector<Scenario> scenarios;
+    int connections = 64;
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    double duration = 10;
+    double rate = 0;   // requests per second over all connections; 0 is closed loop
+    bool keep_alive = true;
+    std::string hop;   // proxy route prefix the scenarios run through a second time
+    std::string output;
+};
+
+struct WorkerResult {
+    LatencyHistogram latency{};
+    uint64_t responses = 0;
+    uint64_t status_errors = 0;   // 4xx/5xx responses
+    uint64_t socket_errors = 0;   // failed connects, resets, malformed responses
+    uint64_t bytes_received = 0;
+};
+
+// One client connection; at most one request in flight
+struct ClientConnection {
+    int fd = -1;
+    std::string request;
+    size_t written = 0;
+    bool busy = false;
+    Clock::time_point started;
+
+    // Response being read
+    std::string head;
+    bool head_done = false;
+    size_t body_remaining = 0;
+    int status = 0;
+    bool server_closes = false;
+};
+
+class Worker {
+private:
+    const Options& options;
+    const Scenario& scenario;
+    const addrinfo* address;
+    int connection_count;
+    double rate;   // this worker's share of the total rate
+    Clock::time_point deadline;
+    int epoll_fd = -1;
+    std::vector<ClientConnection> connections;
+    std::deque<Clock::time_point> backlog;   // scheduled sends waiting for a free connection
+    std::string request_bytes;
+
+public:
+    WorkerResult result;
+
+    Worker(const Options& opts, const Scenario& sc, const addrinfo* addr, int conns, double worker_rate,
+           Clock::time_point end)
+        : options(opts), scenario(sc), address(addr), connection_count(conns), rate(worker_rate),
+          deadline(end) {
+        request_bytes = scenario.method + " " + scenario.path + " HTTP/1.1\r\nHost: " + options.host + "\r\n";
+        if (!options.keep_alive) request_bytes += "Connection: close\r\n";
+        if (!scenario.body.empty()) {
+            request_bytes += "Content-Type: text/plain\r\nContent-Length: " +
+                             std::to_string(scenario.body.size()) + "\r\n";
+        }
+        request_bytes += "\r\n" + scenario.body;
+    }
+
+    ~Worker() {
+        for (auto& conn : connections) {
+            if (conn.fd >= 0) close(conn.fd);
+        }
+        if (epoll_fd >= 0) close(epoll_fd);
+    }
+
+    bool connectSocket(ClientConnection& conn) {
+        conn.fd = socket(address->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (conn.fd < 0) return false;
+        int one = 1;
+        setsockopt(conn.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (connect(conn.fd, address->ai_addr, address->ai_addrlen) < 0 && errno != EINPROGRESS) {
+            close(conn.fd);
+            conn.fd = -1;
+            return false;
+        }
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        ev.data.ptr = &conn;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conn.fd, &ev);
+        return true;
+    }
+
+    void reconnect(ClientConnection& conn) {
+        if (conn.fd >= 0) close(conn.fd);
+        conn.fd = -1;
+        conn.busy = false;
+        if (!connectSocket(conn)) result.socket_errors++;
+    }
+
+    void startRequest(ClientConnection& conn, Clock::time_point scheduled) {
+        if (conn.fd < 0 && !connectSocket(conn)) {
+            result.socket_errors++;
+            return;
+        }
+        conn.request = request_bytes;
+        conn.written = 0;
+        conn.busy = true;
+        conn.started = scheduled;
+        conn.head.clear();
+        conn.head_done = false;
+        conn.body_remaining = 0;
+        conn.status = 0;
+        conn.server_closes = false;
+        writeRequest(conn);
+    }
+
+    void writeRequest(ClientConnection& conn) {
+        while (conn.busy && conn.written < conn.request.size()) {
+            ssize_t n = send(conn.fd, conn.request.data() + conn.written, conn.request.size() - conn.written,
+                             MSG_NOSIGNAL);
+            if (n > 0) {
+                conn.written += n;
+            } else if (n < 0 && errno == EINTR) {
+                continue;
+            } else {
+                if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                    result.socket_errors++;
+                    reconnect(conn);
+                }
+                return;
+            }
+        }
+    }
+
+    // Parses the status line and the headers the client cares about
+    bool parseHead(ClientConnection& conn) {
+        std::string_view head(conn.head);
+        if (head.size() < 12 || head.substr(0, 5) != "HTTP/") return false;
+        conn.status = std::atoi(conn.head.c_str() + 9);
+        size_t pos = head.find("\r\n") + 2;
+        while (pos < head.size()) {
+            size_t end = head.find("\r\n", pos);
+            if (end == std::string_view::npos || end == pos) break;
+            std::string_view line = head.substr(pos, end - pos);
+            size_t colon = line.find(':');
+            if (colon != std::string_view::npos) {
+                std::string_view name = line.substr(0, colon);
+                std::string_view value = line.substr(colon + 1);
+                while (!value.empty() && value.front() == ' ') value.remove_prefix(1);
+                if (equalsIgnoreCase(name, "Content-Length")) {
+                    conn.body_remaining = std::strtoull(std::string(value).c_str(), nullptr, 10);
+                } else if (equalsIgnoreCase(name, "Connection") && equalsIgnoreCase(value, "close")) {
+                    conn.server_closes = true;
+                }
+            }
+            pos = end + 2;
+        }
+        return true;
+    }
+
+    void completeResponse(ClientConnection& conn) {
+        auto now = Clock::now();
+        result.responses++;
+        if (conn.status >= 400) result.status_errors++;
+        result.latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(now - conn.started).count());
+        conn.busy = false;
+        if (conn.server_closes || !options.keep_alive) {
+            close(conn.fd);
+            conn.fd = -1;
+        }
+        if (now < deadline) dispatch(conn, now);
+    }
+
+    void readResponse(ClientConnection& conn) {
+        char buffer[65536];
+        while (conn.fd >= 0) {
+            ssize_t n = recv(conn.fd, buffer, sizeof(buffer), 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+            if (n <= 0) {
+                // Closed between requests is normal for keep-alive limits
+                if (conn.busy) result.socket_errors++;
+                reconnect(conn);
+                if (!conn.busy && Clock::now() < deadline) dispatch(conn, Clock::now());
+                return;
+            }
+            result.bytes_received += n;
+            if (!conn.busy) continue;
+
+            size_t used = 0;
+            if (!conn.head_done) {
+                size_t old_size = conn.head.size();
+                conn.head.append(buffer, n);
+                size_t end = conn.head.find("\r\n\r\n", old_size >= 3 ? old_size - 3 : 0);
+                if (end == std::string::npos) continue;
+                size_t head_size = end + 4;
+                used = head_size - old_size;
+                conn.head.resize(head_size);
+                conn.head_done = true;
+                if (!parseHead(conn)) {
+                    result.socket_errors++;
+                    reconnect(conn);
+                    return;
+                }
+            }
+            size_t body = std::min(conn.body_remaining, static_cast<size_t>(n) - used);
+            conn.body_remaining -= body;
+            if (conn.body_remaining == 0) completeResponse(conn);
+        }
+    }
+
+    // Gives an idle connection its next request: the oldest scheduled one in
+    // fixed-rate mode, a fresh one in closed loop
+    void dispatch(ClientConnection& conn, Clock::time_point now) {
+        if (rate <= 0) {
+            startRequest(conn, now);
+        } else if (!backlog.empty()) {
+            Clock::time_point scheduled = backlog.front();
+            backlog.pop_front();
+            startRequest(conn, scheduled);
+        }
+    }
+
+    void run() {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        connections.resize(connection_count);
+        for (auto& conn : connections) {
+            if (!connectSocket(conn)) result.socket_errors++;
+        }
+
+        auto now = Clock::now();
+        auto interval = rate > 0 ? std::chrono::nanoseconds(static_cast<int64_t>(1e9 / rate))
+                                 : std::chrono::nanoseconds(0);
+        auto next_send = now;
+        if (rate <= 0) {
+            for (auto& conn : connections) startRequest(conn, now);
+        }
+
+        epoll_event events[256];
+        while ((now = Clock::now()) < deadline) {
+            if (rate > 0) {
+                while (next_send <= now) {
+                    backlog.push_back(next_send);
+                    next_send += interval;
+                }
+                for (auto& conn : connections) {
+                    if (backlog.empty()) break;
+                    if (!conn.busy) dispatch(conn, now);
+                }
+            }
+
+            auto wait_until = std::min(deadline, rate > 0 ? next_send : deadline);
+            int timeout_ms = static_cast<int>(
+                std::chrono::duration_cast<std::chrono::milliseconds>(wait_until - now).count());
+            int count = epoll_wait(epoll_fd, events, 256, std::max(0, std::min(timeout_ms, 100)));
+            for (int i = 0; i < count; ++i) {
+                auto& conn = *static_cast<ClientConnection*>(events[i].data.ptr);
+                if (conn.fd < 0) continue;
+                if (events[i].events & EPOLLOUT) writeRequest(conn);
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) readResponse(conn);
+            }
+        }
+    }
+};
+
+struct RunResult {
+    Scenario scenario;
+    double seconds = 0;
+    HistogramSnapshot latency;
+    uint64_t responses = 0;
+    uint64_t status_errors = 0;
+    uint64_t socket_errors = 0;
+    uint64_t bytes_received = 0;
+};
+
+RunResult runScenario(const Options& options, const Scenario& scenario, const addrinfo* address) {
+    int threads = std::min(options.threads, options.connections);
+    auto start = Clock::now();
+    auto deadline = start + std::chrono::milliseconds(static_cast<int64_t>(options.duration * 1000));
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (int i = 0; i < threads; ++i) {
+        int conns = options.connections / threads + (i < options.connections % threads ? 1 : 0);
+        workers.push_back(std::make_unique<Worker>(options, scenario, address, conns,
+                                                   options.rate / threads, deadline));
+    }
+    std::vector<std::thread> running;
+    for (auto& worker : workers) running.emplace_back(&Worker::run, worker.get());
+    for (auto& thread : running) thread.join();
+
+    RunResult run;
+    run.scenario = scenario;
+    run.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    for (auto& worker : workers) {
+        run.latency.add(worker->result.latency);
+        run.responses += worker->result.responses;
+        run.status_errors += worker->result.status_errors;
+        run.socket_errors += worker->result.socket_errors;
+        run.bytes_received += worker->result.bytes_received;
+    }
+    return run;
+}
+
+std::string toJson(const Options& options, const std::vector<RunResult>& runs) {
+    std::string json = "{\n  \"runs\": [";
+    for (size_t i = 0; i < runs.size(); ++i) {
+        const RunResult& run = runs[i];
+        auto micros = [&](double q) { return std::to_string(run.latency.percentile(q) / 1000.0); };
+        double mean = run.latency.count ? run.latency.sum / 1000.0 / run.latency.count : 0;
+        json += std::string(i ? "," : "") + "\n    {\n"
+            "      \"scenario\": \"" + run.scenario.name + "\",\n"
+            "      \"method\": \"" + run.scenario.method + "\",\n"
+            "      \"path\": \"" + run.scenario.path + "\",\n"
+            "      \"mode\": \"" + (options.rate > 0 ? "rate" : "closed") + "\",\n"
+            "      \"target_rps\": " + std::to_string(options.rate) + ",\n"
+            "      \"connections\": " + std::to_string(options.connections) + ",\n"
+            "      \"threads\": " + std::to_string(std::min(options.threads, options.connections)) + ",\n"
+            "      \"keep_alive\": " + (options.keep_alive ? "true" : "false") + ",\n"
+            "      \"seconds\": " + std::to_string(run.seconds) + ",\n"
+            "      \"requests\": " + std::to_string(run.responses) + ",\n"
+            "      \"rps\": " + std::to_string(run.responses / run.seconds) + ",\n"
+            "      \"bytes_per_second\": " + std::to_string(run.bytes_received / run.seconds) + ",\n"
+            "      \"status_errors\": " + std::to_string(run.status_errors) + ",\n"
+            "      \"socket_errors\": " + std::to_string(run.socket_errors) + ",\n"
+            "      \"latency_us\": {\"mean\": " + std::to_string(mean) +
+            ", \"p50\": " + micros(0.5) + ", \"p90\": " + micros(0.9) + ", \"p99\": " + micros(0.99) +
+            ", \"p999\": " + micros(0.999) + ", \"max\": " + micros(1.0) + "}\n    }";
+    }
+    json += "\n  ]\n}\n";
+    return json;
+}
+
+// Creates the static-large fixture in the server's document root
+bool prepareDocumentRoot(const std::string& root) {
+    std::string path = root + "/" + LARGE_FILE_NAME;
+    std::ifstream existing(path, std::ios::binary | std::ios::ate);
+    if (existing && static_cast<size_t>(existing.tellg()) == LARGE_FILE_SIZE) return true;
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    std::string block(64 * 1024, '\0');
+    for (size_t i = 0; i < block.size(); ++i) block[i] = static_cast<char>('a' + i % 26);
+    for (size_t written = 0; written < LARGE_FILE_SIZE; written += block.size()) file << block;
+    return static_cast<bool>(file);
+}
+
+void usage(const char* program) {
+    std::cout << "Usage: " << program << " [options]\n"
+              << "Options:\n"
+              << "  --host HOST          Server address (default: 127.0.0.1)\n"
+              << "  --port PORT          Server port (default: 8080)\n"
+              << "  --scenario NAME      health, api, static-small, static-large, echo or all (default: health)\n"
+              << "  --path PATH          GET PATH instead of a named scenario\n"
+              << "  --connections N      Concurrent connections (default: 64)\n"
+              << "  --threads N          Client threads (default: CPU cores)\n"
+              << "  --duration SEC       Seconds per scenario (default: 10)\n"
+              << "  --rate RPS           Fixed total request rate; 0 runs closed loop (default: 0)\n"
+              << "  --no-keep-alive      One request per connection\n"
+              << "  --docroot DIR        Create the static-large fixture file in DIR first\n"
+              << "  --hop PREFIX         Also run each scenario through the proxy route at PREFIX\n"
+              << "  --output FILE        Write results as JSON\n";
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    std::string scenario_name = "health";
+    std::string docroot;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                usage(argv[0]);
+                exit(1);
+            }
+            return argv[++i];
+        };
+        if (arg == "--host") options.host = value();
+        else if (arg == "--port") options.port = value();
+        else if (arg == "--scenario") scenario_name = value();
+        else if (arg == "--path") options.scenarios.push_back({"custom", "GET", value(), ""});
+        else if (arg == "--connections") options.connections = std::max(1, std::stoi(value()));
+        else if (arg == "--threads") options.threads = std::max(1, std::stoi(value()));
+        else if (arg == "--duration") options.duration = std::stod(value());
+        else if (arg == "--rate") options.rate = std::stod(value());
+        else if (arg == "--no-keep-alive") options.keep_alive = false;
+        else if (arg == "--docroot") docroot = value();
+        else if (arg == "--hop") options.hop = value();
+        else if (arg == "--output") options.output = value();
+        else {
+            usage(argv[0]);
+            return arg == "-h" || arg == "--help" ? 0 : 1;
+        }
+    }
+
+    if (options.scenarios.empty()) {
+        for (const Scenario& scenario : builtinScenarios()) {
+            if (scenario_name == "all" || scenario.name == scenario_name) options.scenarios.push_back(scenario);
+        }
+        if (options.scenarios.empty()) {
+            std::cerr << "Unknown scenario: " << scenario_name << "\n";
+            return 1;
+        }
+    }
+    if (!docroot.empty() && !prepareDocumentRoot(docroot)) {
+        std::cerr << "Cannot create fixture in " << docroot << "\n";
+        return 1;
+    }
+
+    addrinfo hints{};
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* address = nullptr;
+    if (getaddrinfo(options.host.c_str(), options.port.c_str(), &hints, &address) != 0 || !address) {
+        std::cerr << "Cannot resolve " << options.host << ":" << options.port << "\n";
+        return 1;
+    }
+
+    auto print = [](const RunResult& run) {
+        printf("%-14s %10.0f req/s %9.1f MB/s  p50 %8.1fus  p99 %8.1fus  p999 %8.1fus  errors %llu/%llu\n",
+               run.scenario.name.c_str(), run.responses / run.seconds, run.bytes_received / run.seconds / 1e6,
+               run.latency.percentile(0.5) / 1000.0, run.latency.percentile(0.99) / 1000.0,
+               run.latency.percentile(0.999) / 1000.0, static_cast<unsigned long long>(run.status_errors),
+               static_cast<unsigned long long>(run.socket_errors));
+    };
+
+    std::vector<RunResult> runs;
+    for (const Scenario& scenario : options.scenarios) {
+        RunResult run = runScenario(options, scenario, address);
+        print(run);
+        runs.push_back(run);
+        if (options.hop.empty()) continue;
+
+        Scenario proxied = scenario;
+        proxied.name += "+hop";
+        proxied.path = options.hop + scenario.path;
+        RunResult hop = runScenario(options, proxied, address);
+        print(hop);
+        auto added = [&](double q) {
+            return (static_cast<double>(hop.latency.percentile(q)) - run.latency.percentile(q)) / 1000.0;
+        };
+        printf("%-14s added per hop  p50 %8.1fus  p99 %8.1fus\n", "", added(0.5), added(0.99));
+        runs.push_back(hop);
+    }
+    freeaddrinfo(address);
+
+    if (!options.output.empty()) {
+        std::ofstream out(options.output);
+        out << toJson(options, runs);
+        if (!out) {
+            std::cerr << "Cannot write " << options.output << "\n";
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+
+// Client IP as 16 bytes, IPv4 in its IPv4-mapped IPv6 form
+struct PeerAddress {
+    uint64_t high = 0;
+    uint64_t low = 0;
+
+    static PeerAddress from(const sockaddr_storage& address) {
+        PeerAddress peer;
+        if (address.ss_family == AF_INET6) {
+            const auto& v6 = reinterpret_cast<const sockaddr_in6&>(address);
+            memcpy(&peer.high, v6.sin6_addr.s6_addr, 8);
+            memcpy(&peer.low, v6.sin6_addr.s6_addr + 8, 8);
+        } else if (address.ss_family == AF_INET) {
+            const auto& v4 = reinterpret_cast<const sockaddr_in&>(address);
+            unsigned char mapped[8] = {0, 0, 0xff, 0xff};
+            memcpy(mapped + 4, &v4.sin_addr, 4);
+            memcpy(&peer.low, mapped, 8);
+        }
+        return peer;
+    }
+
+    bool operator==(const PeerAddress& other) const { return high == other.high && low == other.low; }
+};
+
+struct PeerAddressHash {
+    size_t operator()(const PeerAddress& peer) const {
+        return std::hash<uint64_t>()(peer.high * 0x9e3779b97f4a7c15ULL ^ peer.low);
+    }
+};
+
+// Caps on open connections, in total and per client IP, shared by all event
+// loops. The total is one atomic; per-IP counts live in mutex-guarded shards
+// that are only touched on accept and close, and only when that cap is set.
+class ConnectionLimiter {
+public:
+    enum class Verdict { ADMITTED, TOTAL_LIMIT, PEER_LIMIT };
+
+private:
+    static constexpr size_t SHARDS = 64;
+
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        std::unordered_map<PeerAddress, uint32_t, PeerAddressHash> counts;
+    };
+
+    const int max_total;      // 0: unlimited
+    const int max_per_peer;   // 0: unlimited
+    std::atomic<int> active{0};
+    std::array<Shard, SHARDS> shards;
+
+    Shard& shardFor(const PeerAddress& peer) { return shards[PeerAddressHash()(peer) % SHARDS]; }
+
+public:
+    ConnectionLimiter(int total_limit, int peer_limit) : max_total(total_limit), max_per_peer(peer_limit) {}
+
+    bool limitsPeers() const { return max_per_peer > 0; }
+
+    // Reserves a slot for a new connection; release() it when the connection
+    // closes. peer is ignored unless limitsPeers().
+    Verdict admit(const PeerAddress& peer) {
+        if (active.fetch_add(1, std::memory_order_relaxed) >= max_total && max_total > 0) {
+            active.fetch_sub(1, std::memory_order_relaxed);
+            return Verdict::TOTAL_LIMIT;
+        }
+        if (max_per_peer > 0) {
+            Shard& shard = shardFor(peer);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            uint32_t& count = shard.counts[peer];
+            if (count >= static_cast<uint32_t>(max_per_peer)) {
+                active.fetch_sub(1, std::memory_order_relaxed);
+                return Verdict::PEER_LIMIT;
+            }
+            ++count;
+        }
+        return Verdict::ADMITTED;
+    }
+
+    void release(const PeerAddress& peer) {
+        active.fetch_sub(1, std::memory_order_relaxed);
+        if (max_per_peer > 0) {
+            Shard& shard = shardFor(peer);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            auto it = shard.counts.find(peer);
+            if (it != shard.counts.end() && --it->second == 0) shard.counts.erase(it);
+        }
+    }
+};
+
+// Per-loop overload detector in the spirit of CoDel. The sample is how long
+// one pass over ready events took, which is how long the last of them waited
+// behind the others. Shedding starts once every pass for a full interval ran
+// over the target, and stops after an interval with none over it (or with
+// no pass at all, as when the loop went idle), so a briefly slow handler
+// never trips it and shedding doesn't flap per pass.
+class LoadShedder {
+private:
+    using Clock = std::chrono::steady_clock;
+    static constexpr auto INTERVAL = std::chrono::milliseconds(100);
+
+    Clock::duration target;   // zero: never shed
+    Clock::time_point above_since{};
+    Clock::time_point last_above{};
+    bool above = false;
+    bool shedding = false;
+
+public:
+    explicit LoadShedder(std::chrono::milliseconds queue_target) : target(queue_target) {}
+
+    bool isShedding(Clock::time_point now) const {
+        return shedding && now - last_above < INTERVAL;
+    }
+
+    void record(Clock::time_point pass_start, Clock::time_point now) {
+        if (target == Clock::duration::zero()) return;
+        if (now - pass_start > target) {
+            if (!above) above_since = now;
+            above = true;
+            last_above = now;
+            if (now - above_since >= INTERVAL) shedding = true;
+        } else {
+            above = false;
+            shedding = isShedding(now);
+        }
+    }
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+
+// Bump allocator for objects that live for one request, such as the
+// response's headers and body. Deallocation is a no-op and reset() reclaims
+// everything at once. Blocks are kept across resets (up to RETAIN_LIMIT
+// bytes), so a connection serving similar requests stops touching the heap
+// after the first one.
+class Arena : public std::pmr::memory_resource {
+private:
+    static constexpr size_t BLOCK_SIZE = 8 * 1024;
+    static constexpr size_t RETAIN_LIMIT = 64 * 1024;
+
+    struct Block {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+    std::vector<Block> blocks;
+    size_t current = 0;   // block being carved
+    size_t used = 0;      // bytes of it handed out
+
+    // Carves bytes from the current block, or returns null if they don't fit
+    void* carve(size_t bytes, size_t alignment) {
+        const Block& block = blocks[current];
+        auto base = reinterpret_cast<uintptr_t>(block.data.get());
+        uintptr_t start = (base + used + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1);
+        if (start + bytes > base + block.size) return nullptr;
+        used = start + bytes - base;
+        return reinterpret_cast<void*>(start);
+    }
+
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        for (; current < blocks.size(); ++current, used = 0) {
+            if (void* p = carve(bytes, alignment)) return p;
+        }
+        size_t size = std::max(BLOCK_SIZE, bytes + alignment);
+        blocks.push_back({std::unique_ptr<char[]>(new char[size]), size});
+        current = blocks.size() - 1;
+        used = 0;
+        return carve(bytes, alignment);
+    }
+
+    void do_deallocate(void*, size_t, size_t) override {}
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+public:
+    Arena() = default;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // Invalidates everything allocated so far. Blocks beyond the retain
+    // limit, e.g. from one unusually large response, go back to the heap.
+    void reset() {
+        size_t kept = 0, retained = 0;
+        for (; kept < blocks.size() && retained + blocks[kept].size <= RETAIN_LIMIT; ++kept) {
+            retained += blocks[kept].size;
+        }
+        blocks.resize(kept);
+        current = 0;
+        used = 0;
+    }
+};
@@ -0,0 +1,48 @@
+#include "blocking_pool.hpp"
+
+BlockingPool blocking_pool;
+
+void BlockingPool::work() {
+    while (true) {
+        BlockingJob* job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return head || stopping; });
+            if (!head) return;
+            job = head;
+            head = job->next;
+            if (!head) tail = nullptr;
+        }
+        job->run();
+    }
+}
+
+void BlockingPool::start(int count) {
+    if (running()) return;
+    for (int i = 0; i < count; ++i) threads.emplace_back(&BlockingPool::work, this);
+}
+
+// Jobs already queued still run, so no coroutine is left waiting on one
+void BlockingPool::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& thread : threads) thread.join();
+    threads.clear();
+}
+
+void BlockingPool::submit(BlockingJob& job) {
+    job.next = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (tail) {
+            tail->next = &job;
+        } else {
+            head = &job;
+        }
+        tail = &job;
+    }
+    wake.notify_one();
+}
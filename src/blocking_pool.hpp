@@ -0,0 +1,47 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Unit of work for the blocking pool. Jobs are linked into the queue
+// through next, so submitting one allocates nothing; the submitter keeps
+// the job alive until run() has returned.
+struct BlockingJob {
+    BlockingJob* next = nullptr;
+    virtual void run() = 0;
+
+protected:
+    ~BlockingJob() = default;
+};
+
+// Bounded set of threads for calls that would stall an event loop, such as
+// file system metadata lookups on a slow disk. Async handlers reach it with
+// co_await offload(...); jobs run in submission order, at most one per
+// thread at a time, and queue while every thread is busy.
+class BlockingPool {
+private:
+    std::mutex mutex;   // guards the queue and stopping
+    std::condition_variable wake;
+    BlockingJob* head = nullptr;
+    BlockingJob* tail = nullptr;
+    bool stopping = false;
+    std::vector<std::thread> threads;
+
+    void work();
+
+public:
+    ~BlockingPool() { stop(); }
+
+    // Starts count threads; with none, offloaded calls run inline on the loop
+    void start(int count);
+    void stop();
+
+    // Set before the event loops start and fixed afterwards
+    bool running() const { return !threads.empty(); }
+
+    void submit(BlockingJob& job);
+};
+
+extern BlockingPool blocking_pool;
@@ -0,0 +1,227 @@
+#pragma once
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+// Escaping policies for BodyWriter. Each says which bytes it rewrites, how
+// to spot them sixteen at a time where SSE2 is available, and what to write
+// in their place.
+
+// Contents of a JSON string: quote, backslash and control characters
+struct JsonEscape {
+    static bool isSpecial(unsigned char c) { return c == '"' || c == '\\' || c < 0x20; }
+
+#ifdef __SSE2__
+    static int specialMask(__m128i chunk) {
+        __m128i quote = _mm_cmpeq_epi8(chunk, _mm_set1_epi8('"'));
+        __m128i backslash = _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\\'));
+        // The saturating subtract leaves zero exactly for bytes below 0x20
+        __m128i control = _mm_cmpeq_epi8(_mm_subs_epu8(chunk, _mm_set1_epi8(0x1f)), _mm_setzero_si128());
+        return _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(quote, backslash), control));
+    }
+#endif
+
+    static void escape(std::pmr::string& out, unsigned char c) {
+        static constexpr char hex[] = "0123456789abcdef";
+        switch (c) {
+            case '"': out.append("\\\"", 2); break;
+            case '\\': out.append("\\\\", 2); break;
+            case '\n': out.append("\\n", 2); break;
+            case '\r': out.append("\\r", 2); break;
+            case '\t': out.append("\\t", 2); break;
+            default: {
+                const char escaped[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 15]};
+                out.append(escaped, sizeof(escaped));
+            }
+        }
+    }
+};
+
+// Text and attribute values in HTML
+struct HtmlEscape {
+    static bool isSpecial(unsigned char c) {
+        return c == '&' || c == '<' || c == '>' || c == '"' || c == '\'';
+    }
+
+#ifdef __SSE2__
+    static int specialMask(__m128i chunk) {
+        __m128i special = _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('&')),
+                                       _mm_cmpeq_epi8(chunk, _mm_set1_epi8('<')));
+        special = _mm_or_si128(special, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('>')));
+        special = _mm_or_si128(special, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('"')));
+        special = _mm_or_si128(special, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\'')));
+        return _mm_movemask_epi8(special);
+    }
+#endif
+
+    static void escape(std::pmr::string& out, unsigned char c) {
+        switch (c) {
+            case '&': out.append("&amp;", 5); break;
+            case '<': out.append("&lt;", 4); break;
+            case '>': out.append("&gt;", 4); break;
+            case '"': out.append("&quot;", 6); break;
+            default: out.append("&#39;", 5);
+        }
+    }
+};
+
+// Bytes written as they are, e.g. an already percent-encoded URL
+struct Raw {
+    std::string_view text;
+};
+
+// A number with a fixed count of decimals
+struct Fixed {
+    double value;
+    int precision;
+};
+
+// Builds a response body in one buffer from the resource given at
+// construction, normally the response's arena, so steady-state bodies cost
+// no heap allocation; take() hands the buffer to HTTPResponse::setBody
+// without a copy. write() accepts a mix of parts:
+//
+//   literals        char arrays and const char*, copied as they are
+//   strings/views   request and file system text, escaped by Escape
+//   integers, bool  formatted with to_chars
+//   Raw, Fixed      trusted bytes and fixed-point numbers
+//
+// The room taken by literals and numbers is summed at compile time, so each
+// write() reserves once and its appends don't reallocate unless escaping
+// expands the text.
+template <typename Escape>
+class BodyWriter {
+private:
+    std::pmr::string buffer;
+
+    template <typename T>
+    static constexpr bool is_literal = std::is_array_v<T> && std::is_same_v<std::remove_extent_t<T>, char>;
+
+    template <typename T>
+    static constexpr bool is_number = std::is_integral_v<T> && !std::is_same_v<T, bool> && !std::is_same_v<T, char>;
+
+    // Upper bound on the bytes of a part known from its type alone
+    template <typename T>
+    static constexpr size_t staticSize() {
+        if constexpr (is_literal<T>) {
+            return std::extent_v<T> - 1;
+        } else if constexpr (std::is_same_v<T, bool>) {
+            return 5;
+        } else if constexpr (std::is_same_v<T, char>) {
+            return 6;
+        } else if constexpr (is_number<T>) {
+            return std::numeric_limits<T>::digits10 + 2;
+        } else if constexpr (std::is_same_v<T, Fixed>) {
+            return 32;
+        } else {
+            return 0;
+        }
+    }
+
+    // Bytes of a part known only at run time; escaped text is counted at
+    // its unescaped length
+    template <typename T>
+    static size_t dynamicSize(const T& part) {
+        if constexpr (std::is_same_v<T, Raw>) {
+            return part.text.size();
+        } else if constexpr (std::is_same_v<T, const char*>) {
+            return std::char_traits<char>::length(part);
+        } else if constexpr (staticSize<T>() == 0) {
+            return std::string_view(part).size();
+        } else {
+            return 0;
+        }
+    }
+
+    // Grows geometrically, so a loop of small writes stays amortized
+    void reserveMore(size_t bytes) {
+        size_t needed = buffer.size() + bytes;
+        if (needed > buffer.capacity()) buffer.reserve(std::max(needed, 2 * buffer.capacity()));
+    }
+
+    // First byte in [p, end) that Escape rewrites, or end
+    static const char* findSpecial(const char* p, const char* end) {
+#ifdef __SSE2__
+        while (end - p >= 16) {
+            int mask = Escape::specialMask(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+            if (mask) return p + __builtin_ctz(mask);
+            p += 16;
+        }
+#endif
+        while (p < end && !Escape::isSpecial(static_cast<unsigned char>(*p))) ++p;
+        return p;
+    }
+
+    // Copies clean runs whole and escapes the bytes between them
+    void appendEscaped(std::string_view text) {
+        const char* p = text.data();
+        const char* end = p + text.size();
+        while (true) {
+            const char* special = findSpecial(p, end);
+            buffer.append(p, special - p);
+            if (special == end) return;
+            Escape::escape(buffer, static_cast<unsigned char>(*special));
+            p = special + 1;
+        }
+    }
+
+    template <typename T>
+    void put(const T& part) {
+        if constexpr (is_literal<T>) {
+            buffer.append(part, std::extent_v<T> - 1);
+        } else if constexpr (std::is_same_v<T, Raw>) {
+            buffer.append(part.text);
+        } else if constexpr (std::is_same_v<T, const char*>) {
+            buffer.append(part);
+        } else if constexpr (std::is_same_v<T, bool>) {
+            part ? buffer.append("true", 4) : buffer.append("false", 5);
+        } else if constexpr (std::is_same_v<T, char>) {
+            appendEscaped(std::string_view(&part, 1));
+        } else if constexpr (is_number<T>) {
+            char digits[staticSize<T>()];
+            auto result = std::to_chars(digits, digits + sizeof(digits), part);
+            buffer.append(digits, result.ptr - digits);
+        } else if constexpr (std::is_same_v<T, Fixed>) {
+            char digits[staticSize<T>()];
+            auto result = std::to_chars(digits, digits + sizeof(digits), part.value, std::chars_format::fixed,
+                                        part.precision);
+            buffer.append(digits, result.ec == std::errc() ? result.ptr - digits : 0);
+        } else {
+            appendEscaped(std::string_view(part));
+        }
+    }
+
+public:
+    explicit BodyWriter(std::pmr::memory_resource* memory = std::pmr::get_default_resource()) : buffer(memory) {}
+
+    template <typename... Parts>
+    BodyWriter& write(const Parts&... parts) {
+        static constexpr size_t static_bytes = (staticSize<Parts>() + ... + 0);
+        reserveMore(static_bytes + (dynamicSize(parts) + ... + 0));
+        (put(parts), ...);
+        return *this;
+    }
+
+    // Room for a body whose size is known up front, e.g. a listing page
+    void reserve(size_t bytes) { reserveMore(bytes); }
+
+    size_t size() const { return buffer.size(); }
+    std::string_view view() const { return buffer; }
+
+    // Moves the body out; the writer is empty afterwards
+    std::pmr::string take() { return std::move(buffer); }
+};
+
+using JsonWriter = BodyWriter<JsonEscape>;
+using HtmlWriter = BodyWriter<HtmlEscape>;
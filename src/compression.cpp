@@ -0,0 +1,54 @@
+#include "compression.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "logger.hpp"
+
+const char* encodingToken(ContentEncoding encoding) {
+    switch (encoding) {
+        case ContentEncoding::GZIP:   return "gzip";
+        case ContentEncoding::BROTLI: return "br";
+        default:                      return "identity";
+    }
+}
+
+const char* encodingSuffix(ContentEncoding encoding) {
+    return encoding == ContentEncoding::BROTLI ? ".br" : ".gz";
+}
+
+ContentEncoding negotiateEncoding(std::string_view accept_encoding) {
+    double gzip_q = -1, br_q = -1, any_q = -1;
+    
+    while (!accept_encoding.empty()) {
+        size_t comma = accept_encoding.find(',');
+        std::string_view item = accept_encoding.substr(0, comma);
+        accept_encoding = comma == std::string_view::npos ? std::string_view() : accept_encoding.substr(comma + 1);
+        
+        double q = 1;
+        size_t semicolon = item.find(';');
+        if (semicolon != std::string_view::npos) {
+            size_t q_pos = item.find("q=", semicolon);
+            if (q_pos != std::string_view::npos) q = std::atof(std::string(item.substr(q_pos + 2)).c_str());
+            item = item.substr(0, semicolon);
+        }
+        while (!item.empty() && (item.front() == ' ' || item.front() == '\t')) item.remove_prefix(1);
+        while (!item.empty() && (item.back() == ' ' || item.back() == '\t')) item.remove_suffix(1);
+        
+        if (equalsIgnoreCase(item, "gzip")) gzip_q = q;
+        else if (equalsIgnoreCase(item, "br")) br_q = q;
+        else if (item == "*") any_q = q;
+    }
+    
+    if (gzip_q < 0) gzip_q = any_q;
+    if (br_q < 0) br_q = any_q;
+#ifndef HAVE_BROTLI
+    br_q = -1;
+#endif
+    
+    if (br_q > 0 && br_q >= gzip_q) return ContentEncoding::BROTLI;
+    if (gzip_q > 0) return ContentEncoding::GZIP;
+    return ContentEncoding::IDENTITY;
+}
+
+Compressor compressor;
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "static_files.hpp"
+
+enum class ContentEncoding { IDENTITY, GZIP, BROTLI };
+
+const char* encodingToken(ContentEncoding encoding);
+
+// Extension of a precompressed sibling, e.g. app.js.br
+const char* encodingSuffix(ContentEncoding encoding);
+
+// Picks the best coding the client accepts (RFC 7231 5.3.4), preferring
+// brotli over gzip at equal quality
+ContentEncoding negotiateEncoding(std::string_view accept_encoding);
+
+// Compressed representation of a static file, either loaded from a
+// precompressed sibling or compressed on the fly. available is false when
+// the file has no worthwhile variant for the coding; that answer is cached too.
+struct EncodedVariant {
+    std::string source_etag;    // validator of the file it was made from
+    bool available = false;
+    std::string body;           // in-memory variant, or
+    std::string sibling_path;   // large precompressed sibling sent with sendfile
+    
+    size_t cost() const { return body.size() + sibling_path.size() + source_etag.size() + 64; }
+};
+
+// Response compression: gzip (and brotli when built with HAVE_BROTLI) for
+// compressible types between min_size and max_size bytes. max_size bounds the
+// CPU one response can spend on an event loop; larger files are only sent
+// compressed if a precompressed sibling exists.
+class Compressor {
+private:
+    static constexpr int GZIP_LEVEL = 6;
+    static constexpr int BROTLI_QUALITY = 5;
+    
+    size_t min_size = 1024;
+    size_t max_size = 1024 * 1024;
+    ShardedLruCache<EncodedVariant> variants;
+
+public:
+    void configure(size_t min_bytes, size_t max_bytes, size_t cache_bytes) {
+        min_size = min_bytes;
+        max_size = max_bytes;
+        variants.setCapacity(cache_bytes);
+    }
+    
+    bool shouldCompress(size_t size) const {
+        return max_size > 0 && size >= min_size && size <= max_size;
+    }
+    
+    static bool compress(ContentEncoding encoding, std::string_view input, std::string& output) {
+        if (encoding == ContentEncoding::GZIP) {
+            z_stream stream{};
+            // windowBits 15 + 16 selects the gzip wrapper
+            if (deflateInit2(&stream, GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+                return false;
+            }
+            output.resize(deflateBound(&stream, input.size()));
+            stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+            stream.avail_in = input.size();
+            stream.next_out = reinterpret_cast<Bytef*>(&output[0]);
+            stream.avail_out = output.size();
+            int result = deflate(&stream, Z_FINISH);
+            output.resize(stream.total_out);
+            deflateEnd(&stream);
+            return result == Z_STREAM_END;
+        }
+#ifdef HAVE_BROTLI
+        if (encoding == ContentEncoding::BROTLI) {
+            size_t encoded_size = BrotliEncoderMaxCompressedSize(input.size());
+            output.resize(encoded_size);
+            bool ok = BrotliEncoderCompress(BROTLI_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT,
+                                            input.size(), reinterpret_cast<const uint8_t*>(input.data()),
+                                            &encoded_size, reinterpret_cast<uint8_t*>(&output[0]));
+            output.resize(ok ? encoded_size : 0);
+            return ok;
+        }
+#endif
+        return false;
+    }
+    
+    // Variant of the file at path for encoding. contents holds the file's
+    // bytes when they are already in memory; otherwise they are read from fd.
+    std::shared_ptr<const EncodedVariant> variantFor(const std::string& path, ContentEncoding encoding,
+                                                     const FileInfo& info, std::string_view contents, int fd) {
+        std::string key = path + '\n' + encodingToken(encoding);
+        std::shared_ptr<const EncodedVariant> cached = variants.find(key);
+        if (cached && cached->source_etag == info.etag) return cached;
+        
+        auto variant = std::make_shared<EncodedVariant>();
+        variant->source_etag = info.etag;
+        
+        // A precompressed sibling wins unless it is older than the file
+        std::string sibling_path = path + encodingSuffix(encoding);
+        int sibling_fd = open(sibling_path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (sibling_fd >= 0) {
+            struct stat st;
+            if (fstat(sibling_fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_mtime >= info.mtime) {
+                variant->available = true;
+                if (!file_cache.accepts(st.st_size) || !readFile(sibling_fd, st.st_size, variant->body)) {
+                    variant->body.clear();
+                    variant->sibling_path = sibling_path;
+                }
+            }
+            close(sibling_fd);
+        }
+        
+        if (!variant->available && info.compressible && shouldCompress(info.size)) {
+            std::string loaded;
+            if (contents.empty() && fd >= 0 && readFile(fd, info.size, loaded)) contents = loaded;
+            if (contents.size() == info.size && compress(encoding, contents, variant->body) &&
+                variant->body.size() < info.size) {
+                variant->available = true;
+            } else {
+                variant->body.clear();
+            }
+        }
+        
+        variants.insert(key, variant);
+        return variant;
+    }
+};
+
+extern Compressor compressor;
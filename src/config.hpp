@@ -0,0 +1,269 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Configuration class
+class Config {
+private:
+    std::string document_root = ".";
+    int port = 8080;
+    std::string bind_address = "::";   // IPv6 any, dual-stack
+    bool ipv6_only = false;
+    int backlog = 4096;
+    bool reuse_port = true;   // one listener per event loop
+    bool tcp_nodelay = true;
+    int defer_accept = 0;     // seconds, 0: off
+    int fastopen_queue = 0;   // 0: off
+    int max_threads = std::max(1u, std::thread::hardware_concurrency());
+    int blocking_threads = 4;   // for calls async handlers offload, 0: inline
+    int keep_alive_timeout = 5;
+    int header_timeout = 10;    // first byte to complete request head
+    int body_timeout = 30;      // longest pause while reading a body
+    int write_timeout = 30;     // longest pause while the client isn't reading
+    int max_connections = 10000;        // 0: unlimited
+    int max_connections_per_ip = 0;     // 0: unlimited
+    int shed_delay_ms = 100;    // queueing delay that triggers load shedding, 0: off
+    int retry_after = 1;        // seconds, sent with 503
+    int max_keep_alive_requests = 100;
+    size_t max_header_size = 16 * 1024;
+    size_t max_body_size = 1024 * 1024;
+    size_t cache_size = 64 * 1024 * 1024;
+    size_t cache_max_file = 1024 * 1024;
+    size_t compress_min_size = 1024;
+    size_t compress_max_size = 1024 * 1024;
+    bool verbose = false;
+    std::string log_level = "info";
+    std::string log_file;   // empty: stdout
+    bool access_log = true;
+    std::string io_backend = "epoll";
+    bool http2 = true;            // h2c by prior knowledge or Upgrade
+    int http2_max_streams = 256;  // concurrent streams per HTTP/2 connection
+    std::vector<std::string> proxies;   // "PATTERN=UPSTREAM[,UPSTREAM...]"
+    std::string proxy_balance = "round-robin";
+    int proxy_timeout = 30;       // longest pause while an upstream reads or answers
+    int proxy_max_idle = 32;      // idle upstream connections per upstream and event loop
+    int proxy_max_fails = 3;      // failures in a row that take an upstream out
+    int proxy_fail_timeout = 10;  // seconds it stays out
+
+public:
+    static Config parseArgs(int argc, char* argv[]) {
+        Config config;
+        
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            
+            if (arg == "-p" || arg == "--port") {
+                if (i + 1 < argc) config.port = std::stoi(argv[++i]);
+            }
+            else if (arg == "-b" || arg == "--bind") {
+                if (i + 1 < argc) config.bind_address = argv[++i];
+            }
+            else if (arg == "--ipv6-only") {
+                config.ipv6_only = true;
+            }
+            else if (arg == "--backlog") {
+                if (i + 1 < argc) config.backlog = std::max(1, std::stoi(argv[++i]));
+            }
+            else if (arg == "--no-reuse-port") {
+                config.reuse_port = false;
+            }
+            else if (arg == "--no-tcp-nodelay") {
+                config.tcp_nodelay = false;
+            }
+            else if (arg == "--defer-accept") {
+                if (i + 1 < argc) config.defer_accept = std::max(0, std::stoi(argv[++i]));
+            }
+            else if (arg == "--fastopen") {
+                if (i + 1 < argc) config.fastopen_queue = std::max(0, std::stoi(argv[++i]));
+            }
+            else if (arg == "-d" || arg == "--directory") {
+                if (i + 1 < argc) config.document_root = argv[++i];
+            }
+            else if (arg == "-t" || arg == "--threads") {
+                if (i + 1 < argc) config.max_threads = std::max(1, std::stoi(argv[++i]));
+            }
+            else if (arg == "--blocking-threads") {
+                if (i + 1 < argc) config.blocking_threads = std::max(0, std::stoi(argv[++i]));
+            }
+            else if (arg == "--keep-alive-timeout") {
+                if (i + 1 < argc) config.keep_alive_timeout = std::max(1, std::stoi(argv[++i]));
+            }
+            else if (arg == "--header-timeout") {
+                if (i + 1 < argc) config.header_timeout = std::max(1, std::stoi(argv[++i]));
+            }
+            else if (arg == "--body-timeout") {
+                if (i + 1 < argc) config.body_timeout = std::max(1, std::stoi(argv[++i]));
+            }
+            else if (arg == "--write-timeout") {
+                if (i + 1 < argc) config.write_timeout = std::max(1, std::stoi(argv[++i]));
+            }
+            else if (arg == "--max-connections") {
+                if (i + 1 < argc) config.max_connections = std::max(0, std::stoi(argv[++i]));
+            }
+            else if (arg == "--max-connections-per-ip") {
+                if (i + 1 < argc) config.max_connections_per_ip = std::max(0, std::stoi(argv[++i]));
+            }
+            else if (arg == "--shed-delay") {
+                if (i + 1 < argc) config.shed_delay_ms = std::max(0, std::stoi(argv[++i]));
+            }
+            else if (arg == "--retry-after") {
+                if (i + 1 < argc) config.retry_after = std::max(0, std::stoi(argv[++i]));
+            }
+            else if (arg == "--max-requests") {
+                if (i + 1 < argc) config.max_keep_alive_requests = std::max(1, std::stoi(argv[++i]));
+            }
+            else if (arg == "--max-header-size") {
+                if (i + 1 < argc) config.max_header_size = std::stoul(argv[++i]);
+            }
+            else if (arg == "--max-body-size") {
+                if (i + 1 < argc) config.max_body_size = std::stoul(argv[++i]);
+            }
+            else if (arg == "--cache-size") {
+                if (i + 1 < argc) config.cache_size = std::stoul(argv[++i]);
+            }
+            else if (arg == "--cache-max-file") {
+                if (i + 1 < argc) config.cache_max_file = std::stoul(argv[++i]);
+            }
+            else if (arg == "--compress-min-size") {
+                if (i + 1 < argc) config.compress_min_size = std::stoul(argv[++i]);
+            }
+            else if (arg == "--compress-max-size") {
+                if (i + 1 < argc) config.compress_max_size = std::stoul(argv[++i]);
+            }
+            else if (arg == "--log-level") {
+                if (i + 1 < argc) config.log_level = argv[++i];
+            }
+            else if (arg == "--log-file") {
+                if (i + 1 < argc) config.log_file = argv[++i];
+            }
+            else if (arg == "--no-access-log") {
+                config.access_log = false;
+            }
+            else if (arg == "--io-backend") {
+                if (i + 1 < argc) config.io_backend = argv[++i];
+            }
+            else if (arg == "--no-http2") {
+                config.http2 = false;
+            }
+            else if (arg == "--http2-max-streams") {
+                if (i + 1 < argc) config.http2_max_streams = std::max(1, std::stoi(argv[++i]));
+            }
+            else if (arg == "--proxy") {
+                if (i + 1 < argc) config.proxies.push_back(argv[++i]);
+            }
+            else if (arg == "--proxy-balance") {
+                if (i + 1 < argc) config.proxy_balance = argv[++i];
+            }
+            else if (arg == "--proxy-timeout") {
+                if (i + 1 < argc) config.proxy_timeout = std::max(1, std::stoi(argv[++i]));
+            }
+            else if (arg == "--proxy-max-idle") {
+                if (i + 1 < argc) config.proxy_max_idle = std::max(0, std::stoi(argv[++i]));
+            }
+            else if (arg == "--proxy-max-fails") {
+                if (i + 1 < argc) config.proxy_max_fails = std::max(1, std::stoi(argv[++i]));
+            }
+            else if (arg == "--proxy-fail-timeout") {
+                if (i + 1 < argc) config.proxy_fail_timeout = std::max(1, std::stoi(argv[++i]));
+            }
+            else if (arg == "-v" || arg == "--verbose") {
+                config.verbose = true;
+            }
+            else if (arg == "-h" || arg == "--help") {
+                std::cout << "Usage: " << argv[0] << " [options]\n"
+                          << "Options:\n"
+                          << "  -p, --port PORT      Server port (default: 8080)\n"
+                          << "  -b, --bind ADDR      Listen address, IPv4 or IPv6 (default: :: dual-stack)\n"
+                          << "  --ipv6-only          Do not accept IPv4 on an IPv6 address\n"
+                          << "  --backlog N          Listen backlog (default: 4096)\n"
+                          << "  --no-reuse-port      One shared listener instead of one per event loop\n"
+                          << "  --no-tcp-nodelay     Leave Nagle's algorithm on\n"
+                          << "  --defer-accept SEC   Accept only once the request arrives (TCP_DEFER_ACCEPT, default: 0 off)\n"
+                          << "  --fastopen N         TCP Fast Open queue length (default: 0 off)\n"
+                          << "  -d, --directory DIR  Document root (default: .)\n"
+                          << "  -t, --threads N      Event loop threads (default: CPU cores)\n"
+                          << "  --blocking-threads N  Threads for blocking calls of async handlers, 0 inline (default: 4)\n"
+                          << "  --keep-alive-timeout SEC  Idle connection timeout (default: 5)\n"
+                          << "  --header-timeout SEC  Time allowed to send a request head (default: 10)\n"
+                          << "  --body-timeout SEC   Longest pause while sending a body (default: 30)\n"
+                          << "  --write-timeout SEC  Longest pause while reading a response (default: 30)\n"
+                          << "  --max-requests N     Requests per connection (default: 100)\n"
+                          << "  --max-connections N  Open connections, 503 above, 0 unlimited (default: 10000)\n"
+                          << "  --max-connections-per-ip N  Open connections per client IP, 0 unlimited (default: 0)\n"
+                          << "  --shed-delay MS      Queueing delay that sheds requests with 503, 0 off (default: 100)\n"
+                          << "  --retry-after SEC    Retry-After sent with 503 (default: 1)\n"
+                          << "  --max-header-size BYTES  Request head limit, 431 above (default: 16384)\n"
+                          << "  --max-body-size BYTES    Buffered body limit, 413 above (default: 1048576)\n"
+                          << "  --cache-size BYTES   Static file cache size, 0 disables; compressed variants and\n"
+                          << "                       cached route responses get a quarter each (default: 67108864)\n"
+                          << "  --cache-max-file BYTES  Largest file kept in the cache (default: 1048576)\n"
+                          << "  --compress-min-size BYTES  Smallest body compressed on the fly (default: 1024)\n"
+                          << "  --compress-max-size BYTES  Largest body compressed on the fly, 0 disables (default: 1048576)\n"
+                          << "  --log-level LEVEL    debug, info, warn or error (default: info)\n"
+                          << "  --log-file PATH      Append log output to PATH (default: stdout)\n"
+                          << "  --no-access-log      Do not log one line per request\n"
+                          << "  --io-backend NAME    epoll or io_uring, falls back to epoll (default: epoll)\n"
+                          << "  --no-http2           Serve HTTP/1.x only, no h2c\n"
+                          << "  --http2-max-streams N  Concurrent streams per HTTP/2 connection (default: 256)\n"
+                          << "  --proxy PATTERN=UPSTREAM[,UPSTREAM...]  Forward a route to HTTP/1.1 upstreams, host:port\n"
+                          << "                       or unix:/path, e.g. '/api/v2/*=10.0.0.5:9000' (repeatable)\n"
+                          << "  --proxy-balance MODE  round-robin or least-outstanding (default: round-robin)\n"
+                          << "  --proxy-timeout SEC  Longest wait on an upstream (default: 30)\n"
+                          << "  --proxy-max-idle N   Idle connections kept per upstream and thread (default: 32)\n"
+                          << "  --proxy-max-fails N  Failures in a row that take an upstream out (default: 3)\n"
+                          << "  --proxy-fail-timeout SEC  How long it stays out (default: 10)\n"
+                          << "  -v, --verbose        Enable verbose logging (same as --log-level debug)\n"
+                          << "  -h, --help          Show this help\n";
+                exit(0);
+            }
+        }
+        
+        return config;
+    }
+    
+    // Getters
+    int getPort() const { return port; }
+    std::string getBindAddress() const { return bind_address; }
+    bool isIpv6Only() const { return ipv6_only; }
+    int getBacklog() const { return backlog; }
+    bool isReusePort() const { return reuse_port; }
+    bool isTcpNoDelay() const { return tcp_nodelay; }
+    int getDeferAccept() const { return defer_accept; }
+    int getFastOpenQueue() const { return fastopen_queue; }
+    const std::string& getDocumentRoot() const { return document_root; }
+    int getMaxThreads() const { return max_threads; }
+    int getBlockingThreads() const { return blocking_threads; }
+    int getKeepAliveTimeout() const { return keep_alive_timeout; }
+    int getMaxKeepAliveRequests() const { return max_keep_alive_requests; }
+    int getHeaderTimeout() const { return header_timeout; }
+    int getBodyTimeout() const { return body_timeout; }
+    int getWriteTimeout() const { return write_timeout; }
+    int getMaxConnections() const { return max_connections; }
+    int getMaxConnectionsPerIp() const { return max_connections_per_ip; }
+    int getShedDelay() const { return shed_delay_ms; }
+    int getRetryAfter() const { return retry_after; }
+    size_t getMaxHeaderSize() const { return max_header_size; }
+    size_t getMaxBodySize() const { return max_body_size; }
+    size_t getCacheSize() const { return cache_size; }
+    size_t getCacheMaxFile() const { return cache_max_file; }
+    size_t getCompressMinSize() const { return compress_min_size; }
+    size_t getCompressMaxSize() const { return compress_max_size; }
+    bool isVerbose() const { return verbose; }
+    std::string getLogLevel() const { return log_level; }
+    std::string getLogFile() const { return log_file; }
+    bool isAccessLogEnabled() const { return access_log; }
+    std::string getIoBackend() const { return io_backend; }
+    bool isHttp2Enabled() const { return http2; }
+    int getHttp2MaxStreams() const { return http2_max_streams; }
+    const std::vector<std::string>& getProxies() const { return proxies; }
+    std::string getProxyBalance() const { return proxy_balance; }
+    int getProxyTimeout() const { return proxy_timeout; }
+    int getProxyMaxIdle() const { return proxy_max_idle; }
+    int getProxyMaxFails() const { return proxy_max_fails; }
+    int getProxyFailTimeout() const { return proxy_fail_timeout; }
+};
@@ -0,0 +1,247 @@
+#include "directory_index.hpp"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <unordered_set>
+
+#include "logger.hpp"
+
+DirectoryIndex directory_index;
+
+static constexpr uint32_t WATCH_MASK = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY |
+                                       IN_CLOSE_WRITE | IN_ATTRIB | IN_ONLYDIR | IN_DONT_FOLLOW |
+                                       IN_EXCL_UNLINK;
+static constexpr int POLL_MS = 200;   // how often the watcher checks for stop()
+
+static std::string childPath(const std::string& parent, std::string_view name) {
+    std::string path = parent;
+    if (!path.empty()) path += '/';
+    path += name;
+    return path;
+}
+
+// Symlinks are listed with their target's size and time but never treated
+// as directories, so the index cannot loop
+static bool statEntry(int dir_fd, const char* name, IndexEntry& entry) {
+    struct stat st;
+    if (fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) < 0) return false;
+    entry.name = name;
+    entry.is_directory = S_ISDIR(st.st_mode);
+    if (S_ISLNK(st.st_mode)) fstatat(dir_fd, name, &st, 0);
+    entry.size = st.st_size;
+    entry.mtime = st.st_mtime;
+    return true;
+}
+
+static bool listedBefore(const IndexEntry& a, const IndexEntry& b) {
+    if (a.is_directory != b.is_directory) return a.is_directory;
+    return a.name < b.name;
+}
+
+static bool readDirectory(const std::string& path, std::vector<IndexEntry>& entries) {
+    DIR* dir = opendir(path.c_str());
+    if (!dir) return false;
+    while (dirent* item = readdir(dir)) {
+        if (strcmp(item->d_name, ".") == 0 || strcmp(item->d_name, "..") == 0) continue;
+        IndexEntry entry;
+        if (statEntry(dirfd(dir), item->d_name, entry)) entries.push_back(std::move(entry));
+    }
+    closedir(dir);
+    return true;
+}
+
+void DirectoryIndex::watch(const std::string& relative) {
+    if (inotify_fd < 0) return;
+    int wd = inotify_add_watch(inotify_fd, fullPath(relative).c_str(), WATCH_MASK);
+    if (wd >= 0) {
+        watches[wd] = relative;
+    } else if (errno == ENOSPC && !watch_limit_reported) {
+        watch_limit_reported = true;
+        logger.warn("⚠️ inotify watch limit reached; /files may show stale listings below ", fullPath(relative));
+    }
+}
+
+// Replaces the snapshot of relative unless its entries are unchanged, which
+// keeps the old generation (and so clients' validators) valid
+bool DirectoryIndex::publish(const std::string& relative, std::vector<IndexEntry> entries, uint64_t gen) {
+    std::sort(entries.begin(), entries.end(), listedBefore);
+    std::shared_ptr<const DirectoryListing> current = find(relative);
+    if (current && current->entries == entries) return false;
+
+    auto listing = std::make_shared<DirectoryListing>();
+    listing->path = relative;
+    listing->generation = gen;
+    listing->entries = std::move(entries);
+    const std::vector<IndexEntry>& all = listing->entries;
+    listing->by_size.resize(all.size());
+    for (uint32_t i = 0; i < all.size(); ++i) listing->by_size[i] = i;
+    listing->by_mtime = listing->by_size;
+    std::stable_sort(listing->by_size.begin(), listing->by_size.end(),
+                     [&all](uint32_t a, uint32_t b) { return all[a].size < all[b].size; });
+    std::stable_sort(listing->by_mtime.begin(), listing->by_mtime.end(),
+                     [&all](uint32_t a, uint32_t b) { return all[a].mtime < all[b].mtime; });
+
+    std::lock_guard<std::mutex> lock(mutex);
+    listings[relative] = std::move(listing);
+    return true;
+}
+
+// Indexes and watches relative and every directory below it
+bool DirectoryIndex::scanTree(const std::string& relative, uint64_t gen, std::vector<std::string>& visited) {
+    // Watch first, so nothing created while reading is missed
+    watch(relative);
+    std::vector<IndexEntry> entries;
+    if (!readDirectory(fullPath(relative), entries)) return false;
+    visited.push_back(relative);
+
+    bool changed = false;
+    for (const IndexEntry& entry : entries) {
+        if (entry.is_directory) changed |= scanTree(childPath(relative, entry.name), gen, visited);
+    }
+    return publish(relative, std::move(entries), gen) || changed;
+}
+
+// Restats only the named entries of relative
+bool DirectoryIndex::update(const std::string& relative, const std::vector<std::string>& names, uint64_t gen) {
+    std::shared_ptr<const DirectoryListing> current = find(relative);
+    if (!current) return false;
+    int dir_fd = open(fullPath(relative).c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0) return false;
+
+    std::unordered_set<std::string_view> touched(names.begin(), names.end());
+    std::vector<IndexEntry> entries;
+    entries.reserve(current->entries.size() + touched.size());
+    for (const IndexEntry& entry : current->entries) {
+        if (!touched.count(entry.name)) entries.push_back(entry);
+    }
+    for (std::string_view name : touched) {
+        IndexEntry entry;
+        if (statEntry(dir_fd, std::string(name).c_str(), entry)) entries.push_back(std::move(entry));
+    }
+    close(dir_fd);
+    return publish(relative, std::move(entries), gen);
+}
+
+// Forgets relative and everything below it, e.g. after it was moved away
+void DirectoryIndex::dropTree(const std::string& relative) {
+    auto inside = [&relative](const std::string& path) {
+        return path == relative ||
+               (path.size() > relative.size() && path.compare(0, relative.size(), relative) == 0 &&
+                path[relative.size()] == '/');
+    };
+    for (auto it = watches.begin(); it != watches.end();) {
+        if (inside(it->second)) {
+            inotify_rm_watch(inotify_fd, it->first);
+            it = watches.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = listings.begin(); it != listings.end();) {
+        it = inside(it->first) ? listings.erase(it) : std::next(it);
+    }
+}
+
+void DirectoryIndex::rescan() {
+    std::vector<std::string> visited;
+    if (scanTree("", generation + 1, visited)) ++generation;
+
+    std::unordered_set<std::string> present(visited.begin(), visited.end());
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = listings.begin(); it != listings.end();) {
+        it = present.count(it->first) ? std::next(it) : listings.erase(it);
+    }
+}
+
+// Applies one read() worth of events. Names are collected per directory
+// first, so a burst of writes to one file costs a single restat.
+void DirectoryIndex::processEvents(const char* buffer, size_t length) {
+    std::unordered_map<std::string, std::vector<std::string>> changed;
+    std::vector<std::string> gone, created;
+
+    for (size_t offset = 0; offset < length;) {
+        const auto* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+        offset += sizeof(inotify_event) + event->len;
+
+        if (event->mask & IN_Q_OVERFLOW) {
+            logger.warn("⚠️ inotify queue overflowed, rescanning ", root);
+            rescan();
+            return;
+        }
+        auto it = watches.find(event->wd);
+        if (it == watches.end()) continue;
+        if (event->mask & IN_IGNORED) {
+            watches.erase(it);
+            continue;
+        }
+        if (event->len == 0) continue;
+
+        const std::string& directory = it->second;
+        changed[directory].emplace_back(event->name);
+        if (event->mask & IN_ISDIR) {
+            if (event->mask & (IN_DELETE | IN_MOVED_FROM)) gone.push_back(childPath(directory, event->name));
+            if (event->mask & (IN_CREATE | IN_MOVED_TO)) created.push_back(childPath(directory, event->name));
+        }
+    }
+
+    uint64_t gen = generation + 1;
+    bool any = false;
+    for (const std::string& path : gone) dropTree(path);
+    for (const auto& [directory, names] : changed) any |= update(directory, names, gen);
+    std::vector<std::string> visited;
+    for (const std::string& path : created) any |= scanTree(path, gen, visited);
+    if (any) generation = gen;
+}
+
+void DirectoryIndex::run() {
+    alignas(inotify_event) char buffer[64 * 1024];
+    int waited = 0;
+    while (running.load(std::memory_order_relaxed)) {
+        if (inotify_fd < 0) {
+            poll(nullptr, 0, POLL_MS);
+            if ((waited += POLL_MS) >= RESCAN_INTERVAL_MS) {
+                waited = 0;
+                rescan();
+            }
+            continue;
+        }
+        pollfd ready{inotify_fd, POLLIN, 0};
+        if (poll(&ready, 1, POLL_MS) <= 0) continue;
+        ssize_t length = read(inotify_fd, buffer, sizeof(buffer));
+        if (length > 0) processEvents(buffer, length);
+    }
+}
+
+void DirectoryIndex::start(const std::string& document_root) {
+    if (running.load()) return;
+    root = document_root;
+    while (root.size() > 1 && root.back() == '/') root.pop_back();
+    generation = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0) {
+        logger.warn("⚠️ inotify unavailable (", strerror(errno), "), /files rescans every ",
+                    RESCAN_INTERVAL_MS, " ms");
+    }
+    rescan();
+    running = true;
+    watcher = std::thread(&DirectoryIndex::run, this);
+}
+
+void DirectoryIndex::stop() {
+    if (!running.exchange(false)) return;
+    watcher.join();
+    if (inotify_fd >= 0) close(inotify_fd);
+    inotify_fd = -1;
+}
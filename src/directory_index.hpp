@@ -0,0 +1,105 @@
+#pragma once
+
+#include <ctime>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct IndexEntry {
+    std::string name;
+    bool is_directory = false;
+    uint64_t size = 0;
+    time_t mtime = 0;
+
+    bool operator==(const IndexEntry& other) const {
+        return name == other.name && is_directory == other.is_directory &&
+               size == other.size && mtime == other.mtime;
+    }
+};
+
+enum class IndexSort { NAME, SIZE, MTIME };
+
+// Immutable snapshot of one directory. Entries are held directories first,
+// then by name; the size and mtime orders are computed when the snapshot is
+// built, so rendering a page costs only the entries on it.
+struct DirectoryListing {
+    std::string path;          // relative to the root, "" for the root itself
+    uint64_t generation = 0;   // index generation in which it last changed
+    std::vector<IndexEntry> entries;
+    std::vector<uint32_t> by_size;
+    std::vector<uint32_t> by_mtime;
+
+    // i-th entry in the given order; descending reverses it
+    const IndexEntry& at(IndexSort sort, size_t i, bool descending) const {
+        if (descending) i = entries.size() - 1 - i;
+        switch (sort) {
+            case IndexSort::SIZE: return entries[by_size[i]];
+            case IndexSort::MTIME: return entries[by_mtime[i]];
+            default: return entries[i];
+        }
+    }
+};
+
+// In-memory index of every directory under the document root, kept current
+// by an inotify watcher thread so /files never touches the file system.
+// A change is applied to the affected directory only: the names it
+// mentions are restatted and a new snapshot of that directory replaces the
+// old one. Readers hold snapshots, so an update never blocks a request for
+// longer than a map lookup. Without inotify (or after its queue overflows)
+// the tree is rescanned, periodically in the former case.
+class DirectoryIndex {
+private:
+    static constexpr int RESCAN_INTERVAL_MS = 2000;   // polling without inotify
+
+    std::string root;
+    mutable std::mutex mutex;   // guards listings
+    std::unordered_map<std::string, std::shared_ptr<const DirectoryListing>> listings;
+
+    // Owned by the watcher thread once started. Generations start from the
+    // wall clock in microseconds, so they keep growing across restarts and
+    // can serve as validators.
+    uint64_t generation = 0;
+    int inotify_fd = -1;
+    std::unordered_map<int, std::string> watches;   // watch descriptor -> relative path
+    bool watch_limit_reported = false;
+
+    std::atomic<bool> running{false};
+    std::thread watcher;
+
+    std::string fullPath(const std::string& relative) const {
+        return relative.empty() ? root : root + "/" + relative;
+    }
+
+    void watch(const std::string& relative);
+    bool publish(const std::string& relative, std::vector<IndexEntry> entries, uint64_t gen);
+    bool scanTree(const std::string& relative, uint64_t gen, std::vector<std::string>& visited);
+    bool update(const std::string& relative, const std::vector<std::string>& names, uint64_t gen);
+    void dropTree(const std::string& relative);
+    void rescan();
+    void processEvents(const char* buffer, size_t length);
+    void run();
+
+public:
+    ~DirectoryIndex() { stop(); }
+
+    // Indexes document_root and starts following changes to it
+    void start(const std::string& document_root);
+    void stop();
+
+    // Snapshot of the directory at relative ("" for the root, no leading or
+    // trailing slash); null if there is no such directory
+    std::shared_ptr<const DirectoryListing> find(std::string_view relative) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = listings.find(std::string(relative));
+        return it != listings.end() ? it->second : nullptr;
+    }
+};
+
+extern DirectoryIndex directory_index;
@@ -0,0 +1,146 @@
+#include "event_loop.hpp"
+
+#include "body_writer.hpp"
+#include "logger.hpp"
+#include "response_cache.hpp"
+#include "stats.hpp"
+
+void Http1Writer::send(HTTPResponse& response, bool keep_alive) {
+    response.setHeader("Connection", keep_alive ? "keep-alive" : "close");
+    if (!responseHasBody(method, response.getStatusCode())) response.dropBody();
+    response.writeTo(out);
+}
+
+void Http1Writer::send(const CachedResponse& cached, bool keep_alive) {
+    cached.writeTo(out, keep_alive, responseHasBody(method, cached.status));
+}
+
+void logAccess(const HTTPRequest& request, int status, size_t bytes,
+               std::chrono::steady_clock::time_point started) {
+    if (!logger.accessEnabled()) return;
+    auto latency = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - started).count();
+    logger.access(request.method, request.path, status, bytes, latency);
+}
+
+// Compresses the response, fills the cache entry if there is one, and
+// hands it to writer
+static int deliver(HTTPRequest& request, HTTPResponse& response, std::optional<ResponseCache::Fill>& fill,
+                   bool& keep_alive, ResponseWriter& writer, std::chrono::steady_clock::time_point started) {
+    response.compressBody(request);
+    if (fill) fill->store(response);
+    
+    keep_alive = keep_alive && request.wantsKeepAlive();
+    size_t body_bytes = response.bodySize();
+    writer.send(response, keep_alive);
+    logAccess(request, response.getStatusCode(), body_bytes, started);
+    return response.getStatusCode();
+}
+
+// Answers a request whose handler threw
+static int deliverError(HTTPRequest& request, const Config& config, bool& keep_alive, ResponseWriter& writer,
+                        std::chrono::steady_clock::time_point started) {
+    HTTPResponse error_response(config.getDocumentRoot());
+    error_response.setStatus(500, "Internal Server Error");
+    error_response.setBody("<h1>500 - Server Error</h1>");
+    keep_alive = false;
+    stats.add(Counter::ERROR_RESPONSES);
+    size_t body_bytes = error_response.bodySize();
+    writer.send(error_response, false);
+    logAccess(request, 500, body_bytes, started);
+    return 500;
+}
+
+int handleRequest(HTTPRequest& request, const Router::Route* route, BodyStream* body_stream,
+                  const Config& config, bool& keep_alive, ResponseWriter& writer,
+                  std::pmr::memory_resource* memory, std::chrono::steady_clock::time_point started) {
+    stats.add(Counter::REQUESTS);
+    
+    try {
+        // Routes with a cache policy answer a hit with the stored bytes and
+        // skip the handler; on a miss this request fills the entry
+        std::optional<ResponseCache::Fill> fill;
+        if (route && route->cache.ttl.count() > 0 && !body_stream) {
+            std::shared_ptr<const CachedResponse> cached = response_cache.lookup(*route, request, fill);
+            if (cached) {
+                keep_alive = keep_alive && request.wantsKeepAlive();
+                writer.send(*cached, keep_alive);
+                stats.add(Counter::SUCCESS_RESPONSES);
+                logAccess(request, cached->status, cached->body.size(), started);
+                return cached->status;
+            }
+        }
+        
+        HTTPResponse response(config.getDocumentRoot(), memory);
+        
+        if (route) {
+            if (body_stream) {
+                body_stream->onComplete(request, response);
+            } else {
+                route->handler(request, response);
+            }
+            stats.add(Counter::SUCCESS_RESPONSES);
+        } else {
+            response.setStatus(404, "Not Found");
+            response.setHeader("Content-Type", "text/html");
+            HtmlWriter html(response.resource());
+            html.write(
+                "<html><head><title>404 Not Found</title><style>"
+                "body { font-family: Arial, sans-serif; text-align: center; padding: 50px; }"
+                "h1 { color: #dc3545; }"
+                "</style></head><body>"
+                "<h1>404 - Route Not Found</h1>"
+                "<p>Path: ", request.path, "</p>"
+                "<a href='/'>Go Home</a>"
+                "</body></html>"
+            );
+            response.setBody(html.take());
+            stats.add(Counter::ERROR_RESPONSES);
+        }
+        
+        return deliver(request, response, fill, keep_alive, writer, started);
+        
+    } catch (const std::exception& e) {
+        logger.error(e.what());
+        return deliverError(request, config, keep_alive, writer, started);
+    }
+}
+
+Task<int> handleRequestAsync(HTTPRequest& request, const Router::Route& route, const Config& config,
+                             bool& keep_alive, ResponseWriter& writer, std::pmr::memory_resource* memory,
+                             std::chrono::steady_clock::time_point started) {
+    stats.add(Counter::REQUESTS);
+    
+    try {
+        std::optional<ResponseCache::Fill> fill;
+        HTTPResponse response(config.getDocumentRoot(), memory);
+        co_await route.async(request, response);
+        stats.add(Counter::SUCCESS_RESPONSES);
+        co_return deliver(request, response, fill, keep_alive, writer, started);
+    } catch (const std::exception& e) {
+        logger.error(e.what());
+    }
+    co_return deliverError(request, config, keep_alive, writer, started);
+}
+
+std::string buildErrorResponse(int code, const Config& config) {
+    // Built in a stack arena: only the returned string reaches the heap
+    char storage[1024];
+    std::pmr::monotonic_buffer_resource memory(storage, sizeof(storage));
+    HTTPResponse response(config.getDocumentRoot(), &memory);
+    response.setStatus(code, reasonPhrase(code));
+    response.setHeader("Content-Type", "text/html");
+    response.setHeader("Connection", "close");
+    HtmlWriter html(&memory);
+    html.write("<h1>", code, " - ", reasonPhrase(code), "</h1>");
+    response.setBody(html.take());
+    return response.build();
+}
+
+std::string buildOverloadResponse(const Config& config) {
+    std::string body = "<h1>503 - Service Unavailable</h1>";
+    return "Retry-After: " + std::to_string(config.getRetryAfter()) + "\r\n"
+           "Content-Type: text/html\r\n"
+           "Content-Length: " + std::to_string(body.size()) + "\r\n"
+           "Connection: close\r\n\r\n" + body;
+}
@@ -0,0 +1,935 @@
+#pragma once
+
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <coroutine>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "admission.hpp"
+#include "arena.hpp"
+#include "config.hpp"
+#include "executor.hpp"
+#include "http2.hpp"
+#include "http_request.hpp"
+#include "http_response.hpp"
+#include "logger.hpp"
+#include "output_queue.hpp"
+#include "router.hpp"
+#include "stats.hpp"
+#include "task.hpp"
+#include "timer_wheel.hpp"
+
+// Writes HTTP/1.1 responses into a connection's output queue. Responses
+// that must not have a body (to HEAD, 1xx, 204, 304) go out without it,
+// or it would be read as the start of the next response.
+class Http1Writer : public ResponseWriter {
+private:
+    OutputQueue& out;
+    HTTPMethod method;
+
+public:
+    Http1Writer(OutputQueue& queue, HTTPMethod request_method) : out(queue), method(request_method) {}
+    void send(HTTPResponse& response, bool keep_alive) override;
+    void send(const CachedResponse& cached, bool keep_alive) override;
+};
+
+// Request handler: turns one request into a response handed to writer.
+// route is null when nothing matched; body_stream is set for streaming
+// routes. keep_alive is true on entry if the connection may stay open and is
+// updated with the final decision, which HTTP/1.1 announces in the
+// Connection header. The response is built in memory (normally the
+// connection's arena, reset per request). started is when the request head
+// arrived, for the access log latency. Returns the response status.
+int handleRequest(HTTPRequest& request, const Router::Route* route, BodyStream* body_stream,
+                  const Config& config, bool& keep_alive, ResponseWriter& writer,
+                  std::pmr::memory_resource* memory, std::chrono::steady_clock::time_point started);
+
+// Same for a route with an async handler, which may suspend. The response
+// is handed to writer when it completes, so writer, memory, request and
+// keep_alive must outlive the task.
+Task<int> handleRequestAsync(HTTPRequest& request, const Router::Route& route, const Config& config,
+                             bool& keep_alive, ResponseWriter& writer, std::pmr::memory_resource* memory,
+                             std::chrono::steady_clock::time_point started);
+
+// One access log line for a request answered started ago
+void logAccess(const HTTPRequest& request, int status, size_t bytes, std::chrono::steady_clock::time_point started);
+
+// Response for a request the parser rejected; the connection is closed after it
+std::string buildErrorResponse(int code, const Config& config);
+
+// Headers after the Date and the body of the 503 sent when the server sheds
+// load, rendered once at startup
+std::string buildOverloadResponse(const Config& config);
+
+// What a connection's timer guards: the next request, the rest of a request
+// head or body, or the client reading pending output
+enum class Timeout : uint8_t { IDLE, HEADER, BODY, WRITE };
+
+// Client connection, owned by exactly one event loop. Its timer hook links it
+// into the loop's timer wheel.
+struct Connection : TimerNode {
+    int fd;
+    PeerAddress peer;
+    Timeout timeout = Timeout::IDLE;
+    std::string in;
+    OutputQueue out;
+    HTTPRequestParser parser;
+    HTTPRequest request;
+    Arena arena;   // per-request response storage, reset before each handler runs
+    
+    // Current request once its head is parsed. The head stays at the front of
+    // in; buffered body bytes follow it, streamed ones are dropped once handled.
+    bool reading_body = false;
+    size_t head_size = 0;
+    size_t body_size = 0;
+    BodyDecoder body_decoder;
+    const Router::Route* route = nullptr;
+    std::unique_ptr<BodyStream> body_stream;
+    
+    int requests_served = 0;
+    bool closing = false;   // no more requests are read; close once out is flushed
+    std::chrono::steady_clock::time_point last_active = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point request_start;   // head of the current request parsed
+    std::chrono::steady_clock::time_point head_start;      // first byte of the current request
+    bool head_started = false;
+    uint64_t parse_ns = 0;
+    
+    // Responses queued but not yet fully sent, for send latency
+    std::vector<QueuedResponse> unsent;
+    
+    // Set once the connection has switched to HTTP/2; in then stays empty
+    std::unique_ptr<Http2Session> h2;
+    
+    // An HTTP/1.1 async handler runs as task. While it is suspended, or an
+    // HTTP/2 stream's is, awaiting_handler holds back timeouts and the close,
+    // and HTTP/1.1 bytes are kept in deferred, as the request's views point
+    // into in.
+    Task<void> task;
+    bool awaiting_handler = false;
+    std::string deferred;
+    bool scheduled = false;   // listed in the loop's resumed connections
+    
+    // A proxied response waits here for the client to take what is queued
+    std::coroutine_handle<> output_waiter;
+    size_t output_low_water = 0;
+    bool gone = false;   // the socket failed or was closed
+    
+    // A proxied request's body goes upstream as it arrives rather than being
+    // buffered whole: its decoded bytes wait after the head until the relay
+    // takes them, and reading pauses while PROXY_BODY_WINDOW of them wait
+    bool proxy_body = false;
+    int body_error = 0;   // status for a proxied body that failed midway
+    std::coroutine_handle<> body_waiter;
+    bool read_paused = false;
+    bool resume_reading = false;   // the backend should read again
+    
+    Connection(int client_fd, size_t max_header_size) : fd(client_fd), parser(max_header_size) {}
+    
+    // Coroutines still refer to the connection, so it must outlive its socket
+    bool hasTasks() const { return !task.done() || (h2 && h2->runningTasks() > 0); }
+};
+
+// HTTP side of a connection, shared by the I/O backends: received bytes go
+// through the parser and handlers into the connection's output queue, and
+// sent bytes are accounted for. Backends own the sockets and move the bytes.
+class RequestProcessor {
+protected:
+    static constexpr size_t PROXY_BODY_WINDOW = 256 * 1024;
+    
+    const Config& config;
+    const Router& router;
+    ConnectionLimiter& limiter;
+    TimerWheel timers;
+    LoadShedder shedder;
+    const std::string overload_response;
+    Executor executor;
+    std::vector<Connection*> resumed;   // async handlers finished in the last executor poll
+    
+    RequestProcessor(const Config& cfg, const Router& rt, ConnectionLimiter& connection_limiter)
+        : config(cfg), router(rt), limiter(connection_limiter),
+          shedder(std::chrono::milliseconds(cfg.getShedDelay())),
+          overload_response(buildOverloadResponse(cfg)) {}
+    
+    static uint64_t nanosSince(std::chrono::steady_clock::time_point start,
+                               std::chrono::steady_clock::time_point now) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count();
+    }
+    
+    // Answers with an error status and stops reading from the connection
+    void reject(Connection& conn, int code) {
+        conn.out.append(buildErrorResponse(code, config));
+        conn.closing = true;
+        stats.add(Counter::ERROR_RESPONSES);
+    }
+    
+    // Answers with the pre-rendered 503 instead of running the handler and
+    // stops reading from the connection
+    void shed(Connection& conn) {
+        conn.out.append(statusLine(503));
+        conn.out.append(*commonHeaders());
+        conn.out.append(overload_response);
+        conn.closing = true;
+        stats.add(Counter::REQUESTS_SHED);
+    }
+    
+    // Takes a freshly accepted socket under the connection caps, or answers
+    // it with the 503 and closes it. Returns false if it was refused.
+    bool admit(int fd, const sockaddr_storage& address, PeerAddress& peer) {
+        peer = PeerAddress::from(address);
+        switch (limiter.admit(peer)) {
+            case ConnectionLimiter::Verdict::ADMITTED: return true;
+            case ConnectionLimiter::Verdict::TOTAL_LIMIT: stats.add(Counter::CONNECTIONS_REJECTED); break;
+            case ConnectionLimiter::Verdict::PEER_LIMIT: stats.add(Counter::PEER_CONNECTIONS_REJECTED); break;
+        }
+        std::shared_ptr<const std::string> common = commonHeaders();
+        std::string_view status = statusLine(503);
+        iovec iov[] = {
+            {const_cast<char*>(status.data()), status.size()},
+            {const_cast<char*>(common->data()), common->size()},
+            {const_cast<char*>(overload_response.data()), overload_response.size()},
+        };
+        msghdr msg{};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 3;
+        // A new socket's send buffer is empty, so this never blocks
+        sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        close(fd);
+        return false;
+    }
+    
+    // Points the connection's timer at the deadline of whatever it waits for.
+    // A head must arrive whole within the header timeout; the other timeouts
+    // restart with every byte moved. writing is true while output is pending.
+    void updateTimer(Connection& conn, bool writing) {
+        // A handler at work may take as long as it needs, but not the client
+        // sending the body a proxy relays
+        if (conn.awaiting_handler && !writing && !(conn.proxy_body && conn.reading_body && conn.body_error == 0)) {
+            timers.cancel(conn);
+            return;
+        }
+        std::chrono::steady_clock::time_point deadline;
+        if (writing) {
+            conn.timeout = Timeout::WRITE;
+            deadline = conn.last_active + std::chrono::seconds(config.getWriteTimeout());
+        } else if (conn.reading_body) {
+            conn.timeout = Timeout::BODY;
+            deadline = conn.last_active + std::chrono::seconds(config.getBodyTimeout());
+        } else if (conn.head_started) {
+            conn.timeout = Timeout::HEADER;
+            deadline = conn.head_start + std::chrono::seconds(config.getHeaderTimeout());
+        } else {
+            conn.timeout = Timeout::IDLE;
+            deadline = conn.last_active + std::chrono::seconds(config.getKeepAliveTimeout());
+        }
+        timers.schedule(conn, deadline);
+    }
+    
+    // Counts an expired timer and stops reading. A client still sending its
+    // request is told so with a 408, by the relay for a proxied body; the
+    // backend then closes the connection, once the relay is done in that
+    // case. One that stopped reading gets a reset, so the kernel doesn't keep
+    // trickling the unsent output to it after the close.
+    void expire(Connection& conn) {
+        static constexpr Counter counters[] = {
+            Counter::IDLE_TIMEOUTS, Counter::HEADER_TIMEOUTS, Counter::BODY_TIMEOUTS, Counter::WRITE_TIMEOUTS
+        };
+        stats.add(counters[static_cast<size_t>(conn.timeout)]);
+        if (conn.h2) {
+            conn.h2->shutdown();
+        } else if (conn.timeout == Timeout::BODY && conn.proxy_body && conn.awaiting_handler) {
+            conn.body_error = 408;
+            wakeReader(conn);
+        } else if ((conn.timeout == Timeout::HEADER || conn.timeout == Timeout::BODY) && !conn.closing) {
+            reject(conn, 408);
+        } else if (conn.timeout == Timeout::WRITE) {
+            linger reset{1, 0};
+            setsockopt(conn.fd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+        }
+        conn.closing = true;
+    }
+    
+    // Sets up body decoding once the request head is parsed. Returns false
+    // if the request was rejected.
+    bool beginRequest(Connection& conn) {
+        conn.request_start = std::chrono::steady_clock::now();
+        if (shedder.isShedding(conn.request_start)) {
+            shed(conn);
+            return false;
+        }
+        conn.head_size = conn.parser.headSize();
+        conn.body_size = 0;
+        conn.parse_ns = conn.head_started ? nanosSince(conn.head_start, conn.request_start) : 0;
+        conn.parser.fillRequest(conn.in.data(), conn.request);
+        conn.route = router.find(conn.request);
+        
+        bool has_body = conn.parser.isChunked() || conn.parser.contentLength() > 0;
+        bool streaming = conn.route && conn.route->stream;
+        conn.proxy_body = has_body && conn.route && conn.route->proxy;
+        conn.body_error = 0;
+        size_t body_limit = streaming || conn.proxy_body ? SIZE_MAX : config.getMaxBodySize();
+        if (conn.parser.isChunked()) {
+            conn.body_decoder.startChunked(body_limit);
+        } else if (conn.parser.contentLength() > body_limit) {
+            reject(conn, 413);
+            return false;
+        } else {
+            conn.body_decoder.startLength(conn.parser.contentLength());
+        }
+        
+        if (has_body && conn.request.version == "HTTP/1.1" &&
+            equalsIgnoreCase(conn.request.getHeader("Expect"), "100-continue")) {
+            conn.out.append("HTTP/1.1 100 Continue\r\n\r\n");
+        }
+        
+        if (streaming) {
+            try {
+                conn.body_stream = conn.route->stream(conn.request);
+            } catch (const std::exception& e) {
+                logger.error(e.what());
+                reject(conn, 500);
+                return false;
+            }
+        }
+        conn.reading_body = true;
+        return true;
+    }
+    
+    // Decodes newly arrived body bytes: streamed routes get them right away,
+    // buffered routes keep them after the head
+    ParseStatus readBody(Connection& conn) {
+        size_t start = conn.head_size + conn.body_size;
+        size_t decoded = 0, consumed = 0;
+        ParseStatus status = conn.body_decoder.decode(&conn.in[start], conn.in.size() - start,
+                                                      decoded, consumed);
+        conn.in.erase(start + decoded, consumed - decoded);
+        
+        if (conn.body_stream) {
+            if (decoded > 0) {
+                try {
+                    conn.parser.fillRequest(conn.in.data(), conn.request);
+                    conn.body_stream->onData(conn.request, std::string_view(conn.in.data() + start, decoded));
+                } catch (const std::exception& e) {
+                    logger.error(e.what());
+                    reject(conn, 500);
+                    return ParseStatus::ERROR;
+                }
+            }
+            conn.in.erase(start, decoded);
+        } else {
+            conn.body_size += decoded;
+        }
+        
+        if (status == ParseStatus::ERROR) reject(conn, conn.body_decoder.errorStatus());
+        return status;
+    }
+    
+    // Decodes newly arrived body bytes of a proxied request for the relay,
+    // which answers a malformed body itself
+    void feedProxy(Connection& conn) {
+        size_t start = conn.head_size + conn.body_size;
+        size_t decoded = 0, consumed = 0;
+        ParseStatus status = conn.body_decoder.decode(&conn.in[start], conn.in.size() - start,
+                                                      decoded, consumed);
+        conn.in.erase(start + decoded, consumed - decoded);
+        conn.body_size += decoded;
+        if (status == ParseStatus::ERROR) {
+            conn.body_error = conn.body_decoder.errorStatus();
+            conn.closing = true;
+        }
+        if (status != ParseStatus::PARTIAL) conn.reading_body = false;
+        conn.read_paused = conn.reading_body && conn.body_size >= PROXY_BODY_WINDOW;
+        // Appending may have moved the head the request's views point into
+        conn.parser.fillRequest(conn.in.data(), conn.request);
+        wakeReader(conn);
+    }
+    
+    // Has the backend look at the connection once the coroutines that can
+    // run have: to send what they queued, or to go on once they are done
+    void schedule(Connection& conn) {
+        if (conn.scheduled) return;
+        conn.scheduled = true;
+        resumed.push_back(&conn);
+    }
+    
+    // Resumes a proxied response waiting for the client to catch up, and a
+    // proxied body waiting on a client that is gone
+    void wakeWriter(Connection& conn) {
+        if (conn.output_waiter && (conn.gone || conn.out.size() <= conn.output_low_water)) {
+            executor.post(std::exchange(conn.output_waiter, nullptr));
+        }
+        if (conn.gone) wakeReader(conn);
+    }
+    
+    // Resumes a proxy waiting for more of the request body
+    void wakeReader(Connection& conn) {
+        if (conn.body_waiter) executor.post(std::exchange(conn.body_waiter, nullptr));
+    }
+    
+    // A proxy relays into the connection's output queue as the upstream's
+    // response arrives, and waits while the client falls behind
+    class ProxyOutput : public ProxySink {
+    private:
+        RequestProcessor& processor;
+        Connection& conn;
+        bool wrote = false;
+        
+        struct OutputDrain {
+            Connection& conn;
+            size_t low_water;
+            bool await_ready() const { return conn.gone || conn.out.size() <= low_water; }
+            void await_suspend(std::coroutine_handle<> waiter) {
+                conn.output_waiter = waiter;
+                conn.output_low_water = low_water;
+            }
+            void await_resume() const {}
+        };
+    
+    public:
+        ProxyOutput(RequestProcessor& owner, Connection& connection) : processor(owner), conn(connection) {}
+        
+        void write(BodyPart part) override {
+            if (gone()) return;
+            wrote = true;
+            conn.out.append(std::move(part));
+            if (conn.awaiting_handler) processor.schedule(conn);
+        }
+        size_t pending() const override { return conn.out.size(); }
+        Task<void> drain(size_t low_water) override { co_await OutputDrain{conn, low_water}; }
+        bool gone() const override { return conn.gone || conn.fd < 0; }
+        
+        // Whether any of a response went out
+        bool started() const { return wrote; }
+    };
+    
+    // A proxy takes the request body from the connection's input as the
+    // client sends it, and has reading resume once it took half the window
+    class ProxyInput : public ProxySource {
+    private:
+        RequestProcessor& processor;
+        Connection& conn;
+        
+        struct BodyArrival {
+            Connection& conn;
+            bool await_ready() const {
+                return conn.body_size > 0 || !conn.reading_body || conn.body_error != 0 || conn.gone;
+            }
+            void await_suspend(std::coroutine_handle<> waiter) { conn.body_waiter = waiter; }
+            void await_resume() const {}
+        };
+    
+    public:
+        ProxyInput(RequestProcessor& owner, Connection& connection) : processor(owner), conn(connection) {}
+        
+        size_t length() const override {
+            return conn.parser.isChunked() ? SIZE_MAX : conn.parser.contentLength();
+        }
+        std::string_view available() const override {
+            return std::string_view(conn.in.data() + conn.head_size, conn.body_size);
+        }
+        void consume(size_t bytes) override {
+            conn.in.erase(conn.head_size, bytes);
+            conn.body_size -= bytes;
+            if (conn.read_paused && conn.body_size <= PROXY_BODY_WINDOW / 2) {
+                conn.read_paused = false;
+                conn.resume_reading = true;
+                processor.schedule(conn);
+            }
+        }
+        bool complete() const override { return !conn.reading_body && conn.body_error == 0; }
+        bool failed() const override { return conn.body_error != 0 || conn.gone || conn.fd < 0; }
+        int errorStatus() const override { return conn.body_error != 0 ? conn.body_error : 400; }
+        Task<void> wait() override { co_await BodyArrival{conn}; }
+    };
+    
+    // Runs the handler. An async one that suspends finishes the request
+    // from serveAsync() later on, a proxied one from serveProxy().
+    void finishRequest(Connection& conn) {
+        conn.parser.fillRequest(conn.in.data(), conn.request);
+        if (!conn.proxy_body) conn.request.body = std::string_view(conn.in.data() + conn.head_size, conn.body_size);
+        
+        bool keep_alive = ++conn.requests_served < config.getMaxKeepAliveRequests();
+        auto handler_start = std::chrono::steady_clock::now();
+        conn.arena.reset();
+        if (conn.route && (conn.route->proxy || conn.route->async)) {
+            conn.task = conn.route->proxy ? serveProxy(conn, keep_alive, handler_start)
+                                          : serveAsync(conn, keep_alive, handler_start);
+            conn.task.start();
+            conn.awaiting_handler = !conn.task.done();
+            if (!conn.awaiting_handler) conn.task = {};
+            return;
+        }
+        Http1Writer writer(conn.out, conn.request.method_id);
+        int status = handleRequest(conn.request, conn.route, conn.body_stream.get(), config,
+                                   keep_alive, writer, &conn.arena, conn.request_start);
+        endRequest(conn, keep_alive, status, handler_start);
+    }
+    
+    Task<void> serveAsync(Connection& conn, bool keep_alive, std::chrono::steady_clock::time_point handler_start) {
+        Http1Writer writer(conn.out, conn.request.method_id);
+        int status = co_await handleRequestAsync(conn.request, *conn.route, config, keep_alive, writer,
+                                                 &conn.arena, conn.request_start);
+        endRequest(conn, keep_alive, status, handler_start);
+        if (conn.awaiting_handler) schedule(conn);
+    }
+    
+    Task<void> serveProxy(Connection& conn, bool keep_alive, std::chrono::steady_clock::time_point handler_start) {
+        stats.add(Counter::REQUESTS);
+        keep_alive = keep_alive && conn.request.wantsKeepAlive();
+        ProxyOutput output(*this, conn);
+        ProxyInput input(*this, conn);
+        ProxyResult result;
+        try {
+            result = co_await conn.route->proxy->relay(conn.request, conn.proxy_body ? &input : nullptr, output,
+                                                       keep_alive);
+        } catch (const std::exception& e) {
+            logger.error(e.what());
+            keep_alive = false;
+            result.status = 500;
+            if (!output.started()) {
+                output.write(BodyPart::owned(buildErrorResponse(500, config)));
+            }
+        }
+        stats.add(result.answered ? Counter::SUCCESS_RESPONSES : Counter::ERROR_RESPONSES);
+        logAccess(conn.request, result.status, result.body_bytes, conn.request_start);
+        endRequest(conn, keep_alive, result.status, handler_start);
+        if (conn.awaiting_handler) schedule(conn);
+    }
+    
+    void endRequest(Connection& conn, bool keep_alive, int status,
+                    std::chrono::steady_clock::time_point handler_start) {
+        if (!keep_alive) conn.closing = true;
+        
+        auto now = std::chrono::steady_clock::now();
+        size_t route_id = conn.route ? conn.route->id : 0;
+        stats.recordLatency(Stage::PARSE, route_id, status, conn.parse_ns);
+        stats.recordLatency(Stage::HANDLER, route_id, status, nanosSince(handler_start, now));
+        conn.unsent.push_back({now, route_id, status});
+        
+        conn.in.erase(0, conn.head_size + conn.body_size);
+        // A pipelined request already in the buffer starts now
+        conn.head_started = !conn.in.empty();
+        conn.head_start = now;
+        conn.parser.reset();
+        conn.reading_body = false;
+        conn.route = nullptr;
+        conn.body_stream.reset();
+        conn.proxy_body = conn.read_paused = false;
+        conn.body_error = 0;
+    }
+    
+    // Keeps the connection's state in step with its HTTP/2 session, for the
+    // timers and the close
+    void afterHttp2(Connection& conn) {
+        if (conn.h2->finished()) conn.closing = true;
+        conn.awaiting_handler = conn.h2->awaitingHandlers();
+        conn.reading_body = conn.h2->awaitingRequests();
+        conn.head_started = conn.h2->hasPartialFrame();
+    }
+    
+    void startHttp2(Connection& conn) {
+        conn.h2 = std::make_unique<Http2Session>(config, router, shedder, conn.out, conn.arena, conn.unsent,
+                                                 [this, &conn] { schedule(conn); });
+        conn.h2->start();
+    }
+    
+    // A client with prior knowledge opens with the HTTP/2 preface. Returns
+    // true if it did, or if the bytes so far could still be its start.
+    bool detectHttp2(Connection& conn) {
+        size_t length = std::min(conn.in.size(), HTTP2_PREFACE.size());
+        if (HTTP2_PREFACE.substr(0, length) != std::string_view(conn.in).substr(0, length)) return false;
+        if (length < HTTP2_PREFACE.size()) return true;
+        
+        startHttp2(conn);
+        std::string received = std::move(conn.in);
+        conn.in.clear();
+        conn.h2->receive(received.data(), received.size());
+        afterHttp2(conn);
+        return true;
+    }
+    
+    // An HTTP/1.1 request without a body may ask to continue in HTTP/2
+    // (RFC 7540 3.2); settings receives its HTTP2-Settings payload
+    bool wantsHttp2(const Connection& conn, std::string& settings) const {
+        if (!config.isHttp2Enabled() || conn.body_stream || conn.body_size > 0 ||
+            conn.request.version != "HTTP/1.1") {
+            return false;
+        }
+        std::string_view connection = conn.request.getHeader("Connection");
+        return hasToken(conn.request.getHeader("Upgrade"), "h2c") && hasToken(connection, "Upgrade") &&
+               hasToken(connection, "HTTP2-Settings") &&
+               decodeHttp2Settings(conn.request.getHeader("HTTP2-Settings"), settings);
+    }
+    
+    // Answers 101 and the request itself as stream 1; bytes after the head
+    // belong to the session
+    void upgradeToHttp2(Connection& conn, const std::string& settings) {
+        conn.out.append("HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n");
+        ++conn.requests_served;
+        startHttp2(conn);
+        if (conn.h2->startUpgraded(settings, conn.request, conn.route)) {
+            std::string rest = conn.in.substr(conn.head_size);
+            conn.in.clear();
+            conn.h2->receive(rest.data(), rest.size());
+        }
+        conn.in.clear();
+        conn.parser.reset();
+        conn.route = nullptr;
+        afterHttp2(conn);
+    }
+    
+    // Answers every complete request in the input buffer, in order, so
+    // pipelined requests are served without another round trip
+    void processRequests(Connection& conn) {
+        while (!conn.closing && !conn.awaiting_handler) {
+            if (!conn.reading_body) {
+                if (conn.requests_served == 0 && config.isHttp2Enabled() && detectHttp2(conn)) return;
+                ParseStatus status = conn.parser.parse(conn.in.data(), conn.in.size());
+                if (status == ParseStatus::PARTIAL) break;
+                if (status == ParseStatus::ERROR) {
+                    reject(conn, conn.parser.errorStatus());
+                    break;
+                }
+                if (!beginRequest(conn)) break;
+                // A proxy starts relaying before the body is in
+                if (conn.proxy_body) {
+                    feedProxy(conn);
+                    finishRequest(conn);
+                    continue;
+                }
+            }
+            
+            if (readBody(conn) != ParseStatus::COMPLETE) break;
+            std::string settings;
+            conn.parser.fillRequest(conn.in.data(), conn.request);
+            if (wantsHttp2(conn, settings)) {
+                upgradeToHttp2(conn, settings);
+                return;
+            }
+            finishRequest(conn);
+        }
+        
+        if (conn.closing && !conn.awaiting_handler) conn.in.clear();
+    }
+    
+    // Feeds bytes read from the socket to the parser
+    void onReceived(Connection& conn, const char* data, size_t size) {
+        stats.add(Counter::BYTES_RECEIVED, size);
+        if (!conn.head_started) {
+            conn.head_start = std::chrono::steady_clock::now();
+            conn.head_started = true;
+        }
+        // Process as data arrives so streamed bodies are never buffered whole
+        if (conn.closing) return;
+        if (conn.h2) {
+            conn.h2->receive(data, size);
+            afterHttp2(conn);
+        } else if (conn.awaiting_handler && conn.proxy_body && conn.reading_body) {
+            conn.in.append(data, size);
+            feedProxy(conn);
+        } else if (conn.awaiting_handler) {
+            conn.deferred.append(data, size);
+        } else {
+            conn.in.append(data, size);
+            processRequests(conn);
+        }
+    }
+    
+    // The client won't send more; a proxied body it cut short fails
+    void onInputClosed(Connection& conn) {
+        conn.closing = true;
+        if (conn.proxy_body && conn.reading_body && conn.body_error == 0) {
+            conn.body_error = 400;
+            wakeReader(conn);
+        }
+    }
+    
+    // Accounts for bytes written to the socket; drained is true once the
+    // output queue is empty
+    void onSent(Connection& conn, size_t bytes_sent, bool drained) {
+        if (bytes_sent > 0) {
+            conn.last_active = std::chrono::steady_clock::now();
+            stats.add(Counter::BYTES_SENT, bytes_sent);
+        }
+        wakeWriter(conn);
+        if (drained && !conn.unsent.empty()) {
+            auto now = std::chrono::steady_clock::now();
+            for (const auto& response : conn.unsent) {
+                stats.recordLatency(Stage::SEND, response.route, response.status,
+                                    nanosSince(response.queued, now));
+            }
+            conn.unsent.clear();
+        }
+        // HTTP/2 frames more of its responses as the socket takes them
+        if (conn.h2) {
+            conn.h2->onSent(bytes_sent);
+            if (conn.h2->finished()) conn.closing = true;
+        }
+    }
+    
+    // Once a connection's async handlers finished: HTTP/1.1 goes on with the
+    // requests that arrived meanwhile, HTTP/2 sends the responses. An
+    // HTTP/1.1 proxy still relaying only needs its output sent.
+    void afterTasks(Connection& conn) {
+        if (conn.h2) {
+            conn.h2->collectTasks();
+            afterHttp2(conn);
+            return;
+        }
+        if (!conn.task.done()) return;
+        conn.task = {};
+        conn.awaiting_handler = false;
+        if (conn.closing) return;
+        conn.in.append(conn.deferred);
+        conn.deferred.clear();
+        conn.head_started = !conn.in.empty();
+        processRequests(conn);
+    }
+    
+    // Resumes the coroutines that can continue, then hands each connection
+    // whose handlers finished to the backend's after(conn) to flush
+    template <typename After>
+    void runTasks(std::chrono::steady_clock::time_point now, After&& after) {
+        executor.poll(now);
+        for (size_t i = 0; i < resumed.size(); ++i) {
+            Connection& conn = *resumed[i];
+            conn.scheduled = false;
+            afterTasks(conn);
+            after(conn);
+        }
+        resumed.clear();
+    }
+};
+
+// Edge-triggered epoll reactor. Each loop runs on its own thread, accepts
+// its own connections and owns them, so per-connection state is never shared.
+class EventLoop : private RequestProcessor {
+private:
+    static constexpr int MAX_EVENTS = 256;
+    
+    int listen_fd;
+    int epoll_fd = -1;
+    std::unordered_map<int, std::unique_ptr<Connection>> connections;
+    std::unordered_map<Connection*, std::unique_ptr<Connection>> orphans;   // closed, handlers still running
+    std::thread thread;
+    
+    // Accepts until the backlog is empty. With a shared listener another
+    // loop may have taken the connection first.
+    void acceptConnections() {
+        while (true) {
+            sockaddr_storage address{};
+            socklen_t address_size = sizeof(address);
+            int fd = accept4(listen_fd, reinterpret_cast<sockaddr*>(&address), &address_size,
+                             SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK) logger.error("❌ Accept failed: ", strerror(errno));
+                return;
+            }
+            PeerAddress peer;
+            if (!admit(fd, address, peer)) continue;
+            stats.add(Counter::CONNECTIONS_OPENED);
+            
+            auto conn = std::make_unique<Connection>(fd, config.getMaxHeaderSize());
+            conn->peer = peer;
+            epoll_event ev{};
+            ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            ev.data.ptr = conn.get();
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+                closeConnection(*conn);
+                continue;
+            }
+            updateTimer(*conn, false);
+            connections[fd] = std::move(conn);
+        }
+    }
+    
+    // A connection whose async handlers still run is kept, without its
+    // socket, until they are done
+    void closeConnection(Connection& conn) {
+        int fd = conn.fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        limiter.release(conn.peer);
+        stats.add(Counter::CONNECTIONS_CLOSED);
+        auto it = connections.find(fd);
+        conn.gone = true;
+        wakeWriter(conn);
+        if (it != connections.end() && conn.hasTasks()) {
+            conn.fd = -1;
+            conn.closing = true;
+            timers.cancel(conn);
+            orphans[&conn] = std::move(it->second);
+        }
+        connections.erase(fd);
+    }
+    
+    // A proxy that took enough of a request body has reading go on
+    void onTasksDone(Connection& conn) {
+        if (conn.fd >= 0 && std::exchange(conn.resume_reading, false)) {
+            onReadable(conn);
+        } else if (conn.fd >= 0) {
+            onWritable(conn);
+        } else if (!conn.hasTasks()) {
+            orphans.erase(&conn);
+        }
+    }
+    
+    // A 408 queued for a slow request gets one write attempt
+    void onTimeout(Connection& conn) {
+        expire(conn);
+        if (conn.body_error != 0) {
+            onWritable(conn);
+            return;
+        }
+        flush(conn);
+        closeConnection(conn);
+    }
+    
+    // Returns true once all pending output has been written. Sending may
+    // free room for more HTTP/2 frames, which are written in the same pass.
+    bool flush(Connection& conn) {
+        while (true) {
+            size_t bytes_sent = 0;
+            bool drained = conn.out.flush(conn.fd, bytes_sent);
+            int error = errno;
+            onSent(conn, bytes_sent, drained);
+            errno = error;
+            if (!drained || conn.out.empty()) return drained;
+        }
+    }
+    
+    // Returns false when the connection was closed
+    bool onReadable(Connection& conn) {
+        char buffer[8192];
+        bool peer_closed = false;
+        
+        while (!conn.read_paused) {
+            ssize_t bytes_read = recv(conn.fd, buffer, sizeof(buffer), 0);
+            if (bytes_read > 0) {
+                onReceived(conn, buffer, bytes_read);
+            } else if (bytes_read == 0) {
+                peer_closed = true;
+                break;
+            } else if (errno == EINTR) {
+                continue;
+            } else {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) peer_closed = true;
+                break;
+            }
+        }
+        conn.last_active = std::chrono::steady_clock::now();
+        
+        if (peer_closed) onInputClosed(conn);
+        return onWritable(conn);
+    }
+    
+    // Returns false when the connection was closed
+    bool onWritable(Connection& conn) {
+        if (flush(conn)) {
+            if (!conn.closing || conn.awaiting_handler) {
+                updateTimer(conn, false);
+                return true;
+            }
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            updateTimer(conn, true);
+            return true;
+        }
+        closeConnection(conn);
+        return false;
+    }
+
+public:
+    // listen_socket is this loop's own SO_REUSEPORT listener, or one shared
+    // by all loops
+    EventLoop(const Config& cfg, const Router& rt, ConnectionLimiter& limiter, int listen_socket)
+        : RequestProcessor(cfg, rt, limiter), listen_fd(listen_socket) {}
+    
+    ~EventLoop() {
+        if (epoll_fd >= 0) close(epoll_fd);
+    }
+    
+    bool start() {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd < 0 || !executor.open()) return false;
+        
+        // Level-triggered; EPOLLEXCLUSIVE wakes one loop per connection when
+        // the listener is shared
+        epoll_event ev{};
+        ev.events = EPOLLIN | (config.isReusePort() ? 0u : static_cast<uint32_t>(EPOLLEXCLUSIVE));
+        ev.data.ptr = nullptr;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) < 0) return false;
+        ev.events = EPOLLIN;
+        ev.data.ptr = &executor;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, executor.fd(), &ev) < 0) return false;
+        
+        thread = std::thread(&EventLoop::run, this);
+        thread.detach();
+        return true;
+    }
+    
+    void run() {
+        epoll_event events[MAX_EVENTS];
+        auto now = std::chrono::steady_clock::now();
+        executor.makeCurrent();
+        
+        while (true) {
+            // Sleep until the timer wheel or a sleeping handler next has
+            // work, rounded up to a millisecond
+            auto wake = std::min(timers.nextWakeup(), executor.nextDeadline());
+            auto wait = std::chrono::ceil<std::chrono::milliseconds>(wake - now);
+            int count = epoll_wait(epoll_fd, events, MAX_EVENTS, std::max<int>(0, wait.count()));
+            if (count < 0) {
+                if (errno == EINTR) continue;
+                logger.error("❌ epoll_wait failed");
+                return;
+            }
+            auto pass_start = std::chrono::steady_clock::now();
+            bool tasks_ready = false;
+            
+            for (int i = 0; i < count; ++i) {
+                if (events[i].data.ptr == nullptr) {
+                    acceptConnections();
+                    continue;
+                }
+                if (events[i].data.ptr == &executor) {
+                    tasks_ready = true;
+                    continue;
+                }
+                
+                Connection& conn = *static_cast<Connection*>(events[i].data.ptr);
+                uint32_t flags = events[i].events;
+                
+                if (flags & (EPOLLERR | EPOLLHUP)) {
+                    closeConnection(conn);
+                    continue;
+                }
+                if (flags & (EPOLLIN | EPOLLRDHUP)) {
+                    if (!onReadable(conn)) continue;
+                }
+                if (flags & EPOLLOUT) {
+                    onWritable(conn);
+                }
+            }
+            
+            now = std::chrono::steady_clock::now();
+            if (tasks_ready || executor.nextDeadline() <= now) {
+                runTasks(now, [this](Connection& conn) { onTasksDone(conn); });
+                now = std::chrono::steady_clock::now();
+            }
+            if (count > 0) shedder.record(pass_start, now);
+            timers.advance(now, [this](TimerNode& node) { onTimeout(static_cast<Connection&>(node)); });
+        }
+    }
+};
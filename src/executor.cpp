@@ -0,0 +1,134 @@
+#include "executor.hpp"
+
+#include <errno.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <functional>
+#include <system_error>
+
+static thread_local Executor* current_executor = nullptr;
+
+Executor::~Executor() {
+    if (event_fd >= 0) close(event_fd);
+    if (epoll_fd >= 0) close(epoll_fd);
+}
+
+bool Executor::open() {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd < 0 || event_fd < 0) return false;
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, event_fd, &ev) == 0;
+}
+
+Executor* Executor::current() {
+    return current_executor;
+}
+
+void Executor::makeCurrent() {
+    current_executor = this;
+}
+
+void Executor::post(std::coroutine_handle<> waiter) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        posted.push_back(waiter);
+    }
+    uint64_t one = 1;
+    while (write(event_fd, &one, sizeof(one)) < 0 && errno == EINTR) {}
+}
+
+void Executor::sleepUntil(Clock::time_point deadline, std::coroutine_handle<> waiter) {
+    sleepers.push_back({deadline, waiter});
+    std::push_heap(sleepers.begin(), sleepers.end(), std::greater<Sleeper>());
+}
+
+// A descriptor stays registered after its wait, disarmed, until it is
+// closed; the next wait on it only rearms it
+void Executor::watch(FdWait& wait) {
+    epoll_event ev{};
+    ev.events = wait.events | EPOLLONESHOT;
+    ev.data.ptr = &wait;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, wait.fd, &ev) == 0) return;
+    if (errno == ENOENT && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wait.fd, &ev) == 0) return;
+    throw std::system_error(errno, std::generic_category(), "epoll_ctl");
+}
+
+void Executor::watch(FdWait& wait, Clock::time_point deadline) {
+    watch(wait);
+    deadlines.schedule(wait, deadline);
+}
+
+void Executor::poll(Clock::time_point now) {
+    // The eventfd is drained before the queue is taken, so a post() racing
+    // with this leaves either its handle or a signal for the next poll
+    uint64_t count;
+    while (read(event_fd, &count, sizeof(count)) < 0 && errno == EINTR) {}
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        runnable.swap(posted);
+    }
+    for (std::coroutine_handle<> waiter : runnable) waiter.resume();
+    runnable.clear();
+
+    // A level-triggered loop would see the instance ready again, and an
+    // io_uring poll rearms, so events beyond one batch are never lost
+    epoll_event events[64];
+    int ready;
+    while ((ready = epoll_wait(epoll_fd, events, 64, 0)) < 0 && errno == EINTR) {}
+    for (int i = 0; i < ready; ++i) {
+        if (!events[i].data.ptr) continue;
+        FdWait& wait = *static_cast<FdWait*>(events[i].data.ptr);
+        wait.unlink();
+        wait.revents = events[i].events;
+        wait.waiter.resume();
+    }
+
+    while (!sleepers.empty() && sleepers.front().deadline <= now) {
+        std::pop_heap(sleepers.begin(), sleepers.end(), std::greater<Sleeper>());
+        std::coroutine_handle<> waiter = sleepers.back().waiter;
+        sleepers.pop_back();
+        waiter.resume();
+    }
+
+    // A wait that timed out leaves the epoll set, so a late event can't
+    // resume its coroutine a second time
+    deadlines.advance(now, [this](TimerNode& node) {
+        FdWait& wait = static_cast<FdWait&>(node);
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, wait.fd, nullptr);
+        wait.revents = 0;
+        wait.waiter.resume();
+    });
+}
+
+Task<ssize_t> asyncRecv(int fd, char* buffer, size_t size) {
+    while (true) {
+        ssize_t received = recv(fd, buffer, size, 0);
+        if (received >= 0) co_return received;
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) co_return -1;
+        co_await readable(fd);
+    }
+}
+
+Task<ssize_t> asyncSend(int fd, const char* data, size_t size) {
+    size_t sent = 0;
+    while (sent < size) {
+        ssize_t written = send(fd, data + sent, size - sent, MSG_NOSIGNAL);
+        if (written > 0) {
+            sent += written;
+        } else if (written < 0 && errno == EINTR) {
+            continue;
+        } else if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            co_await writable(fd);
+        } else {
+            co_return -1;
+        }
+    }
+    co_return static_cast<ssize_t>(sent);
+}
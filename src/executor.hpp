@@ -0,0 +1,211 @@
+#pragma once
+
+#include <sys/epoll.h>
+#include <sys/types.h>
+
+#include <algorithm>
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "blocking_pool.hpp"
+#include "task.hpp"
+#include "timer_wheel.hpp"
+
+// Resumes one event loop's suspended coroutines: those handed back by other
+// threads with post(), those whose sleep is over and those waiting for a
+// file descriptor. The loop watches fd() among its sockets, wakes no later
+// than nextDeadline() and then calls poll(). Everything but post() belongs
+// to the loop's thread, which makeCurrent() registers it for.
+class Executor {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // A coroutine waiting for events on a descriptor, see readable(). The
+    // timer hook is linked while the wait has a deadline.
+    struct FdWait : TimerNode {
+        int fd = -1;
+        uint32_t events = 0;
+        uint32_t revents = 0;   // stays 0 if the deadline passed first
+        std::coroutine_handle<> waiter;
+    };
+
+private:
+    struct Sleeper {
+        Clock::time_point deadline;
+        std::coroutine_handle<> waiter;
+        bool operator>(const Sleeper& other) const { return deadline > other.deadline; }
+    };
+
+    // Awaited descriptors are registered one-shot in an epoll instance of
+    // their own, next to the eventfd that post() signals
+    int epoll_fd = -1;
+    int event_fd = -1;
+    std::mutex mutex;   // guards posted
+    std::vector<std::coroutine_handle<>> posted;
+    std::vector<std::coroutine_handle<>> runnable;
+    std::vector<Sleeper> sleepers;   // min-heap by deadline
+    TimerWheel deadlines;            // fd waits that give up at some point
+
+public:
+    Executor() = default;
+    Executor(const Executor&) = delete;
+    Executor& operator=(const Executor&) = delete;
+    ~Executor();
+
+    bool open();
+    int fd() const { return epoll_fd; }
+
+    // The executor of the calling thread's loop, or null off the loops
+    static Executor* current();
+    void makeCurrent();
+
+    // Resumes waiter on this loop; callable from any thread
+    void post(std::coroutine_handle<> waiter);
+
+    void sleepUntil(Clock::time_point deadline, std::coroutine_handle<> waiter);
+
+    // Resumes wait.waiter once wait.fd reports one of wait.events, or with
+    // no events once deadline has passed
+    void watch(FdWait& wait);
+    void watch(FdWait& wait, Clock::time_point deadline);
+
+    // Earliest sleeper's deadline or next tick of the fd wait deadlines
+    Clock::time_point nextDeadline() const {
+        Clock::time_point wakeup = deadlines.nextWakeup();
+        return sleepers.empty() ? wakeup : std::min(wakeup, sleepers.front().deadline);
+    }
+
+    // Resumes every coroutine that can continue
+    void poll(Clock::time_point now);
+};
+
+// co_await sleepFor(duration) resumes the coroutine on its loop once the
+// duration has passed
+class SleepAwaiter {
+private:
+    Executor::Clock::time_point deadline;
+
+public:
+    explicit SleepAwaiter(Executor::Clock::time_point until) : deadline(until) {}
+
+    bool await_ready() const { return deadline <= Executor::Clock::now(); }
+    void await_suspend(std::coroutine_handle<> waiter) {
+        Executor* executor = Executor::current();
+        if (!executor) throw std::logic_error("sleepFor() outside an event loop");
+        executor->sleepUntil(deadline, waiter);
+    }
+    void await_resume() const {}
+};
+
+inline SleepAwaiter sleepFor(std::chrono::milliseconds duration) {
+    return SleepAwaiter(Executor::Clock::now() + duration);
+}
+
+// co_await readable(fd) or writable(fd) suspends until the non-blocking
+// descriptor is ready and yields the epoll events seen, which include
+// EPOLLERR and EPOLLHUP. Given a timeout, it yields 0 if that passes first;
+// timeouts have the timer wheel's 100 ms resolution.
+class FdAwaiter {
+private:
+    Executor::FdWait wait;
+    Executor::Clock::time_point deadline;
+
+public:
+    FdAwaiter(int fd, uint32_t events, Executor::Clock::time_point until = Executor::Clock::time_point::max())
+        : deadline(until) {
+        wait.fd = fd;
+        wait.events = events;
+    }
+
+    bool await_ready() const { return false; }
+    void await_suspend(std::coroutine_handle<> waiter) {
+        Executor* executor = Executor::current();
+        if (!executor) throw std::logic_error("fd wait outside an event loop");
+        wait.waiter = waiter;
+        if (deadline == Executor::Clock::time_point::max()) {
+            executor->watch(wait);
+        } else {
+            executor->watch(wait, deadline);
+        }
+    }
+    uint32_t await_resume() const { return wait.revents; }
+};
+
+inline FdAwaiter readable(int fd) { return FdAwaiter(fd, EPOLLIN | EPOLLRDHUP); }
+inline FdAwaiter writable(int fd) { return FdAwaiter(fd, EPOLLOUT); }
+
+inline FdAwaiter readable(int fd, std::chrono::milliseconds timeout) {
+    return FdAwaiter(fd, EPOLLIN | EPOLLRDHUP, Executor::Clock::now() + timeout);
+}
+inline FdAwaiter writable(int fd, std::chrono::milliseconds timeout) {
+    return FdAwaiter(fd, EPOLLOUT, Executor::Clock::now() + timeout);
+}
+
+// Reads what is available from a non-blocking socket, waiting for it if
+// there is nothing yet: the byte count, 0 at end of stream or -1 with errno
+Task<ssize_t> asyncRecv(int fd, char* buffer, size_t size);
+
+// Writes all of data to a non-blocking socket: its size, or -1 with errno
+Task<ssize_t> asyncSend(int fd, const char* data, size_t size);
+
+// co_await offload(fn) calls fn on the blocking pool and resumes the
+// coroutine on its own loop with fn's result, or with what fn threw. Off
+// the loops, or without pool threads, fn is called inline.
+template <typename Fn>
+class OffloadAwaiter : private BlockingJob {
+private:
+    using Result = std::invoke_result_t<Fn&>;
+
+    Fn fn;
+    Executor* executor = nullptr;
+    std::coroutine_handle<> waiter;
+    std::conditional_t<std::is_void_v<Result>, bool, std::optional<Result>> result{};
+    std::exception_ptr error;
+
+    void call() {
+        try {
+            if constexpr (std::is_void_v<Result>) {
+                fn();
+            } else {
+                result.emplace(fn());
+            }
+        } catch (...) {
+            error = std::current_exception();
+        }
+    }
+
+    void run() override {
+        call();
+        executor->post(waiter);
+    }
+
+public:
+    explicit OffloadAwaiter(Fn function) : fn(std::move(function)) {}
+
+    bool await_ready() {
+        executor = Executor::current();
+        if (executor && blocking_pool.running()) return false;
+        call();
+        return true;
+    }
+    void await_suspend(std::coroutine_handle<> awaiting) {
+        waiter = awaiting;
+        blocking_pool.submit(*this);
+    }
+    Result await_resume() {
+        if (error) std::rethrow_exception(error);
+        if constexpr (!std::is_void_v<Result>) return std::move(*result);
+    }
+};
+
+template <typename Fn>
+OffloadAwaiter<Fn> offload(Fn fn) {
+    return OffloadAwaiter<Fn>(std::move(fn));
+}
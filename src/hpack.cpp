@@ -0,0 +1,329 @@
+#include "hpack.hpp"
+
+#include <array>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// RFC 7541 Appendix A
+static const HeaderField STATIC_TABLE[HPACK_STATIC_TABLE_SIZE] = {
+    {":authority", ""}, {":method", "GET"}, {":method", "POST"}, {":path", "/"},
+    {":path", "/index.html"}, {":scheme", "http"}, {":scheme", "https"}, {":status", "200"},
+    {":status", "204"}, {":status", "206"}, {":status", "304"}, {":status", "400"},
+    {":status", "404"}, {":status", "500"}, {"accept-charset", ""}, {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""}, {"accept-ranges", ""}, {"accept", ""}, {"access-control-allow-origin", ""},
+    {"age", ""}, {"allow", ""}, {"authorization", ""}, {"cache-control", ""},
+    {"content-disposition", ""}, {"content-encoding", ""}, {"content-language", ""}, {"content-length", ""},
+    {"content-location", ""}, {"content-range", ""}, {"content-type", ""}, {"cookie", ""},
+    {"date", ""}, {"etag", ""}, {"expect", ""}, {"expires", ""},
+    {"from", ""}, {"host", ""}, {"if-match", ""}, {"if-modified-since", ""},
+    {"if-none-match", ""}, {"if-range", ""}, {"if-unmodified-since", ""}, {"last-modified", ""},
+    {"link", ""}, {"location", ""}, {"max-forwards", ""}, {"proxy-authenticate", ""},
+    {"proxy-authorization", ""}, {"range", ""}, {"referer", ""}, {"refresh", ""},
+    {"retry-after", ""}, {"server", ""}, {"set-cookie", ""}, {"strict-transport-security", ""},
+    {"transfer-encoding", ""}, {"user-agent", ""}, {"vary", ""}, {"via", ""},
+    {"www-authenticate", ""},
+};
+
+const HeaderField& hpackStaticEntry(size_t index) {
+    return STATIC_TABLE[index - 1];
+}
+
+// RFC 7541 Appendix B: code (right-aligned) and length in bits per symbol
+struct HuffmanCode {
+    uint32_t code;
+    uint8_t bits;
+};
+
+static const HuffmanCode HUFFMAN_CODES[257] = {
+    {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28},
+    {0xfffffe4, 28}, {0xfffffe5, 28}, {0xfffffe6, 28}, {0xfffffe7, 28},
+    {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+    {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28},
+    {0xfffffed, 28}, {0xfffffee, 28}, {0xfffffef, 28}, {0xffffff0, 28},
+    {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+    {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28},
+    {0xffffff8, 28}, {0xffffff9, 28}, {0xffffffa, 28}, {0xffffffb, 28},
+    {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+    {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11},
+    {0x3fa, 10}, {0x3fb, 10}, {0xf9, 8}, {0x7fb, 11},
+    {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+    {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6},
+    {0x1a, 6}, {0x1b, 6}, {0x1c, 6}, {0x1d, 6},
+    {0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8},
+    {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10},
+    {0x1ffa, 13}, {0x21, 6}, {0x5d, 7}, {0x5e, 7},
+    {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+    {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7},
+    {0x67, 7}, {0x68, 7}, {0x69, 7}, {0x6a, 7},
+    {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+    {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7},
+    {0xfc, 8}, {0x73, 7}, {0xfd, 8}, {0x1ffb, 13},
+    {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+    {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5},
+    {0x24, 6}, {0x5, 5}, {0x25, 6}, {0x26, 6},
+    {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7},
+    {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5},
+    {0x2b, 6}, {0x76, 7}, {0x2c, 6}, {0x8, 5},
+    {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+    {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15},
+    {0x7fc, 11}, {0x3ffd, 14}, {0x1ffd, 13}, {0xffffffc, 28},
+    {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+    {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23},
+    {0x3fffd6, 22}, {0x7fffda, 23}, {0x7fffdb, 23}, {0x7fffdc, 23},
+    {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+    {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23},
+    {0xffffee, 24}, {0x7fffe1, 23}, {0x7fffe2, 23}, {0x7fffe3, 23},
+    {0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23},
+    {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24},
+    {0x3fffda, 22}, {0x1fffdd, 21}, {0xfffe9, 20}, {0x3fffdb, 22},
+    {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+    {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24},
+    {0x1fffdf, 21}, {0x3fffdf, 22}, {0x7fffeb, 23}, {0x7fffec, 23},
+    {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21},
+    {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23},
+    {0xfffea, 20}, {0x3fffe2, 22}, {0x3fffe3, 22}, {0x3fffe4, 22},
+    {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+    {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19},
+    {0x3fffe7, 22}, {0x7ffff2, 23}, {0x3fffe8, 22}, {0x1ffffec, 25},
+    {0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27},
+    {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25},
+    {0x7fff2, 19}, {0x1fffe3, 21}, {0x3ffffe6, 26}, {0x7ffffe0, 27},
+    {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+    {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26},
+    {0xffffffd, 28}, {0x7ffffe3, 27}, {0x7ffffe4, 27}, {0x7ffffe5, 27},
+    {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21},
+    {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23},
+    {0x3fffea, 22}, {0x3fffeb, 22}, {0x1ffffee, 25}, {0x1ffffef, 25},
+    {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+    {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26},
+    {0x7ffffe7, 27}, {0x7ffffe8, 27}, {0x7ffffe9, 27}, {0x7ffffea, 27},
+    {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+    {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26},
+    {0x3fffffff, 30},   // EOS
+};
+
+// Binary decoding tree built from the code table. Each node holds the next
+// node for a 0 and a 1 bit; a negative entry -(symbol + 1) is a leaf.
+struct HuffmanTree {
+    std::vector<std::array<int, 2>> nodes;
+
+    HuffmanTree() {
+        nodes.push_back({0, 0});
+        for (int symbol = 0; symbol < 257; ++symbol) {
+            const HuffmanCode& code = HUFFMAN_CODES[symbol];
+            size_t node = 0;
+            for (int bit = code.bits - 1; bit >= 0; --bit) {
+                int branch = (code.code >> bit) & 1;
+                if (bit == 0) {
+                    nodes[node][branch] = -(symbol + 1);
+                } else {
+                    if (nodes[node][branch] == 0) {
+                        nodes[node][branch] = static_cast<int>(nodes.size());
+                        nodes.push_back({0, 0});
+                    }
+                    node = nodes[node][branch];
+                }
+            }
+        }
+    }
+};
+
+static const HuffmanTree& huffmanTree() {
+    static const HuffmanTree tree;
+    return tree;
+}
+
+// A string may end with up to 7 bits of padding, which must be the most
+// significant bits of EOS (all ones); EOS itself must not appear
+static bool huffmanDecode(std::string_view in, std::string& out) {
+    const HuffmanTree& tree = huffmanTree();
+    out.clear();
+    int node = 0;
+    int depth = 0;         // bits consumed since the last symbol
+    bool all_ones = true;  // and whether they were all ones
+    for (unsigned char byte : in) {
+        for (int bit = 7; bit >= 0; --bit) {
+            int branch = (byte >> bit) & 1;
+            int next = tree.nodes[node][branch];
+            ++depth;
+            all_ones = all_ones && branch;
+            if (next < 0) {
+                int symbol = -next - 1;
+                if (symbol == 256) return false;
+                out += static_cast<char>(symbol);
+                node = 0;
+                depth = 0;
+                all_ones = true;
+            } else if (next == 0) {
+                return false;
+            } else {
+                node = next;
+            }
+        }
+    }
+    return depth < 8 && all_ones;
+}
+
+static size_t huffmanLength(std::string_view in) {
+    uint64_t bits = 0;
+    for (unsigned char c : in) bits += HUFFMAN_CODES[c].bits;
+    return (bits + 7) / 8;
+}
+
+static void huffmanEncode(std::string& out, std::string_view in) {
+    uint64_t buffer = 0;
+    int pending = 0;
+    for (unsigned char c : in) {
+        const HuffmanCode& code = HUFFMAN_CODES[c];
+        buffer = (buffer << code.bits) | code.code;
+        pending += code.bits;
+        while (pending >= 8) {
+            pending -= 8;
+            out += static_cast<char>(buffer >> pending);
+        }
+    }
+    if (pending > 0) {
+        // Pad with the high bits of EOS
+        out += static_cast<char>((buffer << (8 - pending)) | (0xff >> pending));
+    }
+}
+
+void hpackEncodeInteger(std::string& out, uint8_t first_byte, int prefix_bits, uint64_t value) {
+    uint64_t max_prefix = (uint64_t(1) << prefix_bits) - 1;
+    if (value < max_prefix) {
+        out += static_cast<char>(first_byte | value);
+        return;
+    }
+    out += static_cast<char>(first_byte | max_prefix);
+    value -= max_prefix;
+    while (value >= 128) {
+        out += static_cast<char>((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+bool hpackDecodeInteger(std::string_view in, size_t& pos, int prefix_bits, uint64_t& value) {
+    if (pos >= in.size()) return false;
+    uint64_t max_prefix = (uint64_t(1) << prefix_bits) - 1;
+    value = static_cast<uint8_t>(in[pos++]) & max_prefix;
+    if (value < max_prefix) return true;
+    for (int shift = 0; shift <= 28; shift += 7) {
+        if (pos >= in.size()) return false;
+        uint8_t byte = static_cast<uint8_t>(in[pos++]);
+        value += static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;   // more than 2^35: no legitimate field gets near that
+}
+
+void hpackEncodeString(std::string& out, std::string_view value) {
+    size_t huffman_size = huffmanLength(value);
+    if (huffman_size < value.size()) {
+        hpackEncodeInteger(out, 0x80, 7, huffman_size);
+        huffmanEncode(out, value);
+    } else {
+        hpackEncodeInteger(out, 0x00, 7, value.size());
+        out += value;
+    }
+}
+
+bool hpackDecodeString(std::string_view in, size_t& pos, std::string& value) {
+    if (pos >= in.size()) return false;
+    bool huffman = static_cast<uint8_t>(in[pos]) & 0x80;
+    uint64_t length;
+    if (!hpackDecodeInteger(in, pos, 7, length) || length > in.size() - pos) return false;
+    std::string_view bytes = in.substr(pos, length);
+    pos += length;
+    if (huffman) return huffmanDecode(bytes, value);
+    value.assign(bytes);
+    return true;
+}
+
+bool HpackDecoder::lookup(size_t index, std::string_view& name, std::string_view& value) const {
+    if (index == 0) return false;
+    if (index <= HPACK_STATIC_TABLE_SIZE) {
+        const HeaderField& field = hpackStaticEntry(index);
+        name = field.name;
+        value = field.value;
+        return true;
+    }
+    index -= HPACK_STATIC_TABLE_SIZE + 1;
+    if (index >= table.count()) return false;
+    name = table.at(index).name;
+    value = table.at(index).value;
+    return true;
+}
+
+// Static table positions: full name/value pairs and the first entry per name
+struct StaticIndex {
+    std::unordered_map<std::string, size_t> fields;
+    std::unordered_map<std::string, size_t> names;
+
+    StaticIndex() {
+        for (size_t i = HPACK_STATIC_TABLE_SIZE; i >= 1; --i) {
+            const HeaderField& field = hpackStaticEntry(i);
+            if (!field.value.empty()) fields[field.name + '\0' + field.value] = i;
+            names[field.name] = i;
+        }
+    }
+};
+
+static const StaticIndex& staticIndex() {
+    static const StaticIndex index;
+    return index;
+}
+
+// Values that change from response to response would only churn the table
+static bool worthIndexing(std::string_view name) {
+    return name != "content-length" && name != "etag" && name != "last-modified" &&
+           name != "content-range" && name != "set-cookie" && name != "location";
+}
+
+void HpackEncoder::beginBlock(std::string& out) {
+    if (pending_limit == SIZE_MAX) return;
+    table.setMaxSize(pending_limit);
+    hpackEncodeInteger(out, 0x20, 5, pending_limit);
+    pending_limit = SIZE_MAX;
+}
+
+void HpackEncoder::encodeLiteral(std::string& out, size_t name_index, std::string_view name,
+                                 std::string_view value, bool indexed) {
+    if (indexed) {
+        hpackEncodeInteger(out, 0x40, 6, name_index);
+    } else {
+        hpackEncodeInteger(out, 0x00, 4, name_index);
+    }
+    if (name_index == 0) hpackEncodeString(out, name);
+    hpackEncodeString(out, value);
+    if (indexed) table.add(name, value);
+}
+
+void HpackEncoder::encode(std::string& out, std::string_view name, std::string_view value) {
+    const StaticIndex& statics = staticIndex();
+    thread_local std::string key;
+    key.assign(name).append(1, '\0').append(value);
+    auto exact = statics.fields.find(key);
+    if (exact != statics.fields.end()) {
+        hpackEncodeInteger(out, 0x80, 7, exact->second);
+        return;
+    }
+
+    size_t name_index = 0;
+    for (size_t i = 0; i < table.count(); ++i) {
+        const HeaderField& field = table.at(i);
+        if (field.name != name) continue;
+        if (field.value == value) {
+            hpackEncodeInteger(out, 0x80, 7, HPACK_STATIC_TABLE_SIZE + 1 + i);
+            return;
+        }
+        if (name_index == 0) name_index = HPACK_STATIC_TABLE_SIZE + 1 + i;
+    }
+    key.assign(name);
+    auto static_name = statics.names.find(key);
+    if (static_name != statics.names.end()) name_index = static_name->second;
+
+    bool indexed = worthIndexing(name) && name.size() + value.size() + 32 <= table.maxSize() / 2;
+    encodeLiteral(out, name_index, name, value, indexed);
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+
+// HPACK header compression for HTTP/2 (RFC 7541)
+
+struct HeaderField {
+    std::string name;
+    std::string value;
+
+    // Size counted against the table limit (RFC 7541 4.1)
+    size_t size() const { return name.size() + value.size() + 32; }
+};
+
+// Static table entry for index (1-based, up to HPACK_STATIC_TABLE_SIZE)
+constexpr size_t HPACK_STATIC_TABLE_SIZE = 61;
+const HeaderField& hpackStaticEntry(size_t index);
+
+// Dynamic table: newest entry first, oldest evicted to stay within the limit
+class HpackTable {
+private:
+    std::deque<HeaderField> entries;
+    size_t size = 0;
+    size_t max_size = 4096;
+
+    void evictTo(size_t limit) {
+        while (size > limit) {
+            size -= entries.back().size();
+            entries.pop_back();
+        }
+    }
+
+public:
+    size_t maxSize() const { return max_size; }
+    size_t count() const { return entries.size(); }
+    const HeaderField& at(size_t i) const { return entries[i]; }   // 0: newest
+
+    void setMaxSize(size_t limit) {
+        max_size = limit;
+        evictTo(limit);
+    }
+
+    // An entry larger than the whole table empties it (RFC 7541 4.4). The
+    // field is copied first: name may refer to an entry about to be evicted.
+    void add(std::string_view name, std::string_view value) {
+        HeaderField field{std::string(name), std::string(value)};
+        size_t entry_size = field.size();
+        evictTo(entry_size <= max_size ? max_size - entry_size : 0);
+        if (entry_size > max_size) return;
+        entries.push_front(std::move(field));
+        size += entry_size;
+    }
+};
+
+// Decodes header blocks. One decoder serves a connection: the dynamic table
+// carries over from block to block, so blocks must be decoded in the order
+// they arrive, even those of refused streams.
+class HpackDecoder {
+private:
+    HpackTable table;
+    size_t limit = 4096;   // SETTINGS_HEADER_TABLE_SIZE we announced
+    std::string name_buffer;
+    std::string value_buffer;
+
+    bool lookup(size_t index, std::string_view& name, std::string_view& value) const;
+
+public:
+    // Calls emit(name, value) for every field, with views valid only during
+    // the call. Returns false if the block is malformed, which is a
+    // connection error (COMPRESSION_ERROR).
+    template <typename Emit>
+    bool decode(std::string_view block, Emit&& emit);
+};
+
+// Encodes header blocks for one connection. Fields whose values repeat
+// from response to response are added to the dynamic table; per-response
+// values such as Content-Length are sent as literals without indexing.
+class HpackEncoder {
+private:
+    HpackTable table;
+    size_t pending_limit = SIZE_MAX;   // table size update owed at the next block
+
+    void encodeLiteral(std::string& out, size_t name_index, std::string_view name, std::string_view value,
+                       bool indexed);
+
+public:
+    // The peer's SETTINGS_HEADER_TABLE_SIZE. Tables above 4096 bytes buy
+    // little for responses, so that stays the cap.
+    void setLimit(size_t peer_limit) {
+        size_t limit = std::min<size_t>(peer_limit, 4096);
+        if (limit != table.maxSize()) pending_limit = limit;
+    }
+
+    // Starts a header block: emits a pending table size update first
+    void beginBlock(std::string& out);
+
+    // name must be lowercase
+    void encode(std::string& out, std::string_view name, std::string_view value);
+};
+
+// Primitive representations (RFC 7541 5). Decoders advance pos and return
+// false on truncated or oversized input.
+void hpackEncodeInteger(std::string& out, uint8_t first_byte, int prefix_bits, uint64_t value);
+bool hpackDecodeInteger(std::string_view in, size_t& pos, int prefix_bits, uint64_t& value);
+void hpackEncodeString(std::string& out, std::string_view value);
+bool hpackDecodeString(std::string_view in, size_t& pos, std::string& value);
+
+template <typename Emit>
+bool HpackDecoder::decode(std::string_view block, Emit&& emit) {
+    size_t pos = 0;
+    bool fields_seen = false;
+    while (pos < block.size()) {
+        uint8_t first = static_cast<uint8_t>(block[pos]);
+        uint64_t index;
+        std::string_view name, value;
+
+        if (first & 0x80) {
+            // Indexed field (6.1)
+            if (!hpackDecodeInteger(block, pos, 7, index) || !lookup(index, name, value)) return false;
+            emit(name, value);
+            fields_seen = true;
+            continue;
+        }
+        if ((first & 0xe0) == 0x20) {
+            // Dynamic table size update (6.3), only before the first field
+            if (fields_seen || !hpackDecodeInteger(block, pos, 5, index) || index > limit) return false;
+            table.setMaxSize(index);
+            continue;
+        }
+
+        // Literal with incremental indexing (6.2.1), without indexing (6.2.2)
+        // or never indexed (6.2.3)
+        bool indexing = (first & 0xc0) == 0x40;
+        if (!hpackDecodeInteger(block, pos, indexing ? 6 : 4, index)) return false;
+        if (index == 0) {
+            if (!hpackDecodeString(block, pos, name_buffer)) return false;
+            name = name_buffer;
+        } else if (!lookup(index, name, value)) {
+            return false;
+        }
+        if (!hpackDecodeString(block, pos, value_buffer)) return false;
+        value = value_buffer;
+        emit(name, value);
+        if (indexing) table.add(name, value);
+        fields_seen = true;
+    }
+    return true;
+}
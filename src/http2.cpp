@@ -0,0 +1,1030 @@
+#include "http2.hpp"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+
+#include "body_writer.hpp"
+#include "event_loop.hpp"
+#include "logger.hpp"
+#include "response_cache.hpp"
+
+// Frame types (RFC 9113 6, RFC 9218 7.1) and flags
+static constexpr uint8_t FRAME_DATA = 0x0;
+static constexpr uint8_t FRAME_HEADERS = 0x1;
+static constexpr uint8_t FRAME_PRIORITY = 0x2;
+static constexpr uint8_t FRAME_RST_STREAM = 0x3;
+static constexpr uint8_t FRAME_SETTINGS = 0x4;
+static constexpr uint8_t FRAME_PUSH_PROMISE = 0x5;
+static constexpr uint8_t FRAME_PING = 0x6;
+static constexpr uint8_t FRAME_GOAWAY = 0x7;
+static constexpr uint8_t FRAME_WINDOW_UPDATE = 0x8;
+static constexpr uint8_t FRAME_CONTINUATION = 0x9;
+static constexpr uint8_t FRAME_PRIORITY_UPDATE = 0x10;
+
+static constexpr uint8_t FLAG_END_STREAM = 0x1;
+static constexpr uint8_t FLAG_ACK = 0x1;
+static constexpr uint8_t FLAG_END_HEADERS = 0x4;
+static constexpr uint8_t FLAG_PADDED = 0x8;
+static constexpr uint8_t FLAG_PRIORITY = 0x20;
+
+// SETTINGS parameters (RFC 9113 6.5.2)
+static constexpr uint16_t SETTINGS_HEADER_TABLE_SIZE = 0x1;
+static constexpr uint16_t SETTINGS_ENABLE_PUSH = 0x2;
+static constexpr uint16_t SETTINGS_MAX_CONCURRENT_STREAMS = 0x3;
+static constexpr uint16_t SETTINGS_INITIAL_WINDOW_SIZE = 0x4;
+static constexpr uint16_t SETTINGS_MAX_FRAME_SIZE = 0x5;
+static constexpr uint16_t SETTINGS_MAX_HEADER_LIST_SIZE = 0x6;
+
+static uint32_t read32(const char* p) {
+    auto byte = [p](int i) { return static_cast<uint32_t>(static_cast<uint8_t>(p[i])); };
+    return byte(0) << 24 | byte(1) << 16 | byte(2) << 8 | byte(3);
+}
+
+static void put32(char* p, uint32_t value) {
+    p[0] = static_cast<char>(value >> 24);
+    p[1] = static_cast<char>(value >> 16);
+    p[2] = static_cast<char>(value >> 8);
+    p[3] = static_cast<char>(value);
+}
+
+static void putSetting(char* p, uint16_t id, uint32_t value) {
+    p[0] = static_cast<char>(id >> 8);
+    p[1] = static_cast<char>(id);
+    put32(p + 2, value);
+}
+
+bool decodeHttp2Settings(std::string_view header, std::string& payload) {
+    payload.clear();
+    uint32_t bits = 0;
+    int count = 0;
+    for (char c : header) {
+        int value;
+        if (c >= 'A' && c <= 'Z') value = c - 'A';
+        else if (c >= 'a' && c <= 'z') value = c - 'a' + 26;
+        else if (c >= '0' && c <= '9') value = c - '0' + 52;
+        else if (c == '-') value = 62;
+        else if (c == '_') value = 63;
+        else if (c == '=') break;   // padding is not expected, but harmless
+        else return false;
+        bits = bits << 6 | value;
+        count += 6;
+        if (count >= 8) {
+            count -= 8;
+            payload += static_cast<char>(bits >> count);
+        }
+    }
+    return payload.size() % 6 == 0;
+}
+
+// Field names must be lowercase tokens (RFC 9113 8.2.1)
+static bool validFieldName(std::string_view name) {
+    if (name.empty()) return false;
+    for (char c : name) {
+        auto byte = static_cast<unsigned char>(c);
+        if (byte <= 0x20 || byte >= 0x7f || c == ':' || (c >= 'A' && c <= 'Z')) return false;
+    }
+    return true;
+}
+
+static bool validFieldValue(std::string_view value) {
+    for (char c : value) {
+        if (c == '\0' || c == '\r' || c == '\n') return false;
+    }
+    return true;
+}
+
+// Headers that only describe an HTTP/1.1 connection (RFC 9113 8.2.2)
+static bool isConnectionSpecific(std::string_view name) {
+    return name == "connection" || name == "keep-alive" || name == "proxy-connection" ||
+           name == "transfer-encoding" || name == "upgrade";
+}
+
+// Applies a Priority field value (RFC 9218 4): "u=<0-7>" and "i"; unknown
+// members and parameters are ignored
+static void applyPriority(std::string_view value, Http2Stream& stream) {
+    while (!value.empty()) {
+        size_t comma = value.find(',');
+        std::string_view item = value.substr(0, comma);
+        while (!item.empty() && item.front() == ' ') item.remove_prefix(1);
+        while (!item.empty() && item.back() == ' ') item.remove_suffix(1);
+        if (item.size() == 3 && item[0] == 'u' && item[1] == '=' && item[2] >= '0' && item[2] <= '7') {
+            stream.urgency = item[2] - '0';
+        } else if (item == "i" || item == "i=?1") {
+            stream.incremental = true;
+        } else if (item == "i=?0") {
+            stream.incremental = false;
+        }
+        if (comma == std::string_view::npos) break;
+        value.remove_prefix(comma + 1);
+    }
+}
+
+// Bytes [offset, offset + length) of a shared or file part
+static BodyPart slice(const BodyPart& part, size_t offset, size_t length) {
+    if (part.isFile()) {
+        return BodyPart::file(FileRange{part.range.file, part.range.offset + static_cast<off_t>(offset), length});
+    }
+    return BodyPart::shared(part.owner, part.bytes().substr(offset, length));
+}
+
+// Hands a handler's response to the stream it answers
+class Http2StreamWriter : public ResponseWriter {
+private:
+    Http2Session& session;
+    Http2Stream& stream;
+
+public:
+    Http2StreamWriter(Http2Session& owner, Http2Stream& target) : session(owner), stream(target) {}
+    void send(HTTPResponse& response, bool) override { session.sendResponse(stream, response); }
+    void send(const CachedResponse& cached, bool) override { session.sendResponse(stream, cached); }
+};
+
+void Http2Session::write(std::string_view bytes) {
+    out.append(bytes);
+    queued += bytes.size();
+}
+
+void Http2Session::write(BodyPart part) {
+    queued += part.size();
+    out.append(std::move(part));
+}
+
+void Http2Session::writeFrameHeader(uint8_t type, uint8_t flags, uint32_t stream_id, size_t length) {
+    char header[9];
+    header[0] = static_cast<char>(length >> 16);
+    header[1] = static_cast<char>(length >> 8);
+    header[2] = static_cast<char>(length);
+    header[3] = static_cast<char>(type);
+    header[4] = static_cast<char>(flags);
+    put32(header + 5, stream_id);
+    write(std::string_view(header, sizeof(header)));
+}
+
+void Http2Session::writeFrame(uint8_t type, uint8_t flags, uint32_t stream_id, std::string_view payload) {
+    writeFrameHeader(type, flags, stream_id, payload.size());
+    write(payload);
+}
+
+void Http2Session::writeRstStream(uint32_t stream_id, Http2Error code) {
+    char payload[4];
+    put32(payload, static_cast<uint32_t>(code));
+    writeFrame(FRAME_RST_STREAM, 0, stream_id, std::string_view(payload, sizeof(payload)));
+}
+
+void Http2Session::writeWindowUpdate(uint32_t stream_id, uint32_t increment) {
+    char payload[4];
+    put32(payload, increment);
+    writeFrame(FRAME_WINDOW_UPDATE, 0, stream_id, std::string_view(payload, sizeof(payload)));
+}
+
+// HEADERS, then CONTINUATION frames if the block is larger than the peer's
+// frame size
+void Http2Session::writeHeaderBlock(uint32_t stream_id, std::string_view header_block, bool end_stream) {
+    uint8_t type = FRAME_HEADERS;
+    uint8_t flags = end_stream ? FLAG_END_STREAM : 0;
+    do {
+        std::string_view fragment = header_block.substr(0, peer_max_frame);
+        header_block.remove_prefix(fragment.size());
+        if (header_block.empty()) flags |= FLAG_END_HEADERS;
+        writeFrame(type, flags, stream_id, fragment);
+        type = FRAME_CONTINUATION;
+        flags = 0;
+    } while (!header_block.empty());
+}
+
+// Sends GOAWAY and gives up on every stream; the connection closes once
+// the output is written. Returns false for the caller to pass on.
+bool Http2Session::connectionError(Http2Error code) {
+    if (!goaway_sent) {
+        char payload[8];
+        put32(payload, last_stream_id);
+        put32(payload + 4, static_cast<uint32_t>(code));
+        writeFrame(FRAME_GOAWAY, 0, 0, std::string_view(payload, sizeof(payload)));
+        goaway_sent = true;
+    }
+    ready.clear();
+    for (auto& entry : streams) {
+        if (entry.second->running) {
+            entry.second->detached = true;
+            detached.push_back(std::move(entry.second));
+        }
+    }
+    streams.clear();
+    input.clear();
+    return false;
+}
+
+void Http2Session::start() {
+    stats.add(Counter::HTTP2_CONNECTIONS);
+    char payload[18];
+    putSetting(payload, SETTINGS_MAX_CONCURRENT_STREAMS, config.getHttp2MaxStreams());
+    putSetting(payload + 6, SETTINGS_INITIAL_WINDOW_SIZE, STREAM_WINDOW);
+    putSetting(payload + 12, SETTINGS_MAX_HEADER_LIST_SIZE, config.getMaxHeaderSize());
+    writeFrame(FRAME_SETTINGS, 0, 0, std::string_view(payload, sizeof(payload)));
+    writeWindowUpdate(0, CONNECTION_WINDOW - DEFAULT_WINDOW);
+    recv_window = CONNECTION_WINDOW;
+}
+
+bool Http2Session::startUpgraded(std::string_view settings, const HTTPRequest& request,
+                                 const Router::Route* route) {
+    if (!applySettings(settings)) return false;
+
+    // Stream 1 carries the upgrade request, already complete (RFC 9113 3.2)
+    auto stream = std::make_unique<Http2Stream>();
+    stream->id = last_stream_id = 1;
+    stream->remote_closed = true;
+    std::string& head = stream->head;
+    std::string_view target = request.path;
+    if (!request.query.empty()) {
+        target = std::string_view(request.path.data(), request.query.data() + request.query.size() - request.path.data());
+    }
+    head.append(request.method).append(target);
+    std::array<bool, HTTPRequest::MAX_HEADERS> skipped{};
+    for (size_t i = 0; i < request.header_count; ++i) {
+        std::string_view name = request.headers[i].name;
+        skipped[i] = equalsIgnoreCase(name, "Connection") || equalsIgnoreCase(name, "Upgrade") ||
+                     equalsIgnoreCase(name, "HTTP2-Settings") || equalsIgnoreCase(name, "Keep-Alive");
+        if (!skipped[i]) head.append(name).append(request.headers[i].value);
+    }
+
+    HTTPRequest& copy = stream->request;
+    size_t pos = 0;
+    auto take = [&head, &pos](size_t length) {
+        std::string_view part = std::string_view(head).substr(pos, length);
+        pos += length;
+        return part;
+    };
+    copy.method = take(request.method.size());
+    copy.method_id = request.method_id;
+    copy.path = take(request.path.size());
+    if (!request.query.empty()) {
+        take(1);
+        copy.query = take(request.query.size());
+    }
+    copy.version = "HTTP/2.0";
+    for (size_t i = 0; i < request.header_count; ++i) {
+        if (skipped[i]) continue;
+        HTTPHeader& header = copy.headers[copy.header_count++];
+        header.name = take(request.headers[i].name.size());
+        header.value = take(request.headers[i].value.size());
+    }
+
+    Http2Stream& added = addStream(std::move(stream));
+    applyPriority(added.request.getHeader("priority"), added);
+    added.route = route;
+    dispatch(added);
+    return true;
+}
+
+void Http2Session::receive(const char* data, size_t size) {
+    if (goaway_sent) return;
+    input.append(data, size);
+    size_t pos = 0;
+
+    if (!preface_received) {
+        size_t length = std::min(input.size(), HTTP2_PREFACE.size());
+        if (HTTP2_PREFACE.substr(0, length) != std::string_view(input).substr(0, length)) {
+            connectionError(Http2Error::PROTOCOL_ERROR);
+            return;
+        }
+        if (length < HTTP2_PREFACE.size()) return;
+        preface_received = true;
+        pos = HTTP2_PREFACE.size();
+    }
+
+    while (input.size() - pos >= 9) {
+        const char* header = input.data() + pos;
+        size_t length = static_cast<size_t>(static_cast<uint8_t>(header[0])) << 16 |
+                        static_cast<size_t>(static_cast<uint8_t>(header[1])) << 8 |
+                        static_cast<uint8_t>(header[2]);
+        if (length > MAX_FRAME_SIZE) {
+            connectionError(Http2Error::FRAME_SIZE_ERROR);
+            return;
+        }
+        if (input.size() - pos - 9 < length) break;
+        auto type = static_cast<uint8_t>(header[3]);
+        auto flags = static_cast<uint8_t>(header[4]);
+        uint32_t stream_id = read32(header + 5) & 0x7fffffff;
+        pos += 9 + length;
+        if (!processFrame(type, flags, stream_id, std::string_view(header + 9, length))) return;
+    }
+    input.erase(0, pos);
+    pump();
+}
+
+void Http2Session::onSent(size_t bytes) {
+    // Bytes queued before the session started are sent first
+    queued -= std::min(queued, bytes);
+    pump();
+}
+
+void Http2Session::shutdown() {
+    connectionError(Http2Error::NO_ERROR);
+}
+
+void Http2Session::collectTasks() {
+    for (Http2Stream* stream : finished_tasks) endTask(*stream);
+    finished_tasks.clear();
+    pump();
+}
+
+bool Http2Session::processFrame(uint8_t type, uint8_t flags, uint32_t stream_id, std::string_view payload) {
+    // A header block is sent as contiguous frames (RFC 9113 6.10), and the
+    // client's SETTINGS come before anything else (3.4)
+    if (continued_stream != 0 && type != FRAME_CONTINUATION) return connectionError(Http2Error::PROTOCOL_ERROR);
+    if (!settings_received && type != FRAME_SETTINGS) return connectionError(Http2Error::PROTOCOL_ERROR);
+
+    // Strips the padding of DATA and HEADERS frames
+    auto unpad = [&payload, flags]() {
+        if (!(flags & FLAG_PADDED)) return true;
+        if (payload.empty()) return false;
+        size_t padding = static_cast<uint8_t>(payload[0]);
+        if (padding >= payload.size()) return false;
+        payload = payload.substr(1, payload.size() - 1 - padding);
+        return true;
+    };
+
+    switch (type) {
+        case FRAME_DATA: {
+            size_t frame_length = payload.size();
+            if (stream_id == 0 || !unpad()) return connectionError(Http2Error::PROTOCOL_ERROR);
+            return onData(stream_id, flags & FLAG_END_STREAM, payload, frame_length);
+        }
+        case FRAME_HEADERS: {
+            if (stream_id == 0 || !unpad()) return connectionError(Http2Error::PROTOCOL_ERROR);
+            // Only the weight of an RFC 7540 priority is used; 0 marks a
+            // stream depending on itself
+            uint16_t weight = 0xffff;
+            if (flags & FLAG_PRIORITY) {
+                if (payload.size() < 5) return connectionError(Http2Error::FRAME_SIZE_ERROR);
+                bool self = (read32(payload.data()) & 0x7fffffff) == stream_id;
+                weight = self ? 0 : static_cast<uint8_t>(payload[4]) + 1;
+                payload.remove_prefix(5);
+            }
+            if (flags & FLAG_END_HEADERS) return onHeaderBlock(stream_id, payload, flags & FLAG_END_STREAM, weight);
+            continued_stream = stream_id;
+            continued_end_stream = flags & FLAG_END_STREAM;
+            continued_weight = weight;
+            continued_block.assign(payload);
+            return true;
+        }
+        case FRAME_CONTINUATION: {
+            if (continued_stream == 0 || stream_id != continued_stream) {
+                return connectionError(Http2Error::PROTOCOL_ERROR);
+            }
+            continued_block += payload;
+            if (continued_block.size() > 4 * config.getMaxHeaderSize()) {
+                return connectionError(Http2Error::ENHANCE_YOUR_CALM);
+            }
+            if (!(flags & FLAG_END_HEADERS)) return true;
+            continued_stream = 0;
+            return onHeaderBlock(stream_id, continued_block, continued_end_stream, continued_weight);
+        }
+        case FRAME_PRIORITY: {
+            if (stream_id == 0) return connectionError(Http2Error::PROTOCOL_ERROR);
+            // Priorities of streams not open are not remembered
+            auto it = streams.find(stream_id);
+            if (it == streams.end()) return true;
+            if (payload.size() != 5) {
+                resetStream(*it->second, Http2Error::FRAME_SIZE_ERROR);
+                return true;
+            }
+            if ((read32(payload.data()) & 0x7fffffff) == stream_id) {
+                resetStream(*it->second, Http2Error::PROTOCOL_ERROR);
+                return true;
+            }
+            it->second->weight = static_cast<uint8_t>(payload[4]) + 1;
+            it->second->incremental = true;
+            return true;
+        }
+        case FRAME_RST_STREAM: {
+            if (stream_id == 0 || stream_id > last_stream_id) return connectionError(Http2Error::PROTOCOL_ERROR);
+            if (payload.size() != 4) return connectionError(Http2Error::FRAME_SIZE_ERROR);
+            auto it = streams.find(stream_id);
+            if (it != streams.end()) eraseStream(*it->second);
+            return true;
+        }
+        case FRAME_SETTINGS: {
+            if (stream_id != 0) return connectionError(Http2Error::PROTOCOL_ERROR);
+            if (flags & FLAG_ACK) {
+                return payload.empty() || connectionError(Http2Error::FRAME_SIZE_ERROR);
+            }
+            if (payload.size() % 6 != 0) return connectionError(Http2Error::FRAME_SIZE_ERROR);
+            if (!applySettings(payload)) return false;
+            settings_received = true;
+            writeFrame(FRAME_SETTINGS, FLAG_ACK, 0, {});
+            return true;
+        }
+        case FRAME_PUSH_PROMISE:
+            return connectionError(Http2Error::PROTOCOL_ERROR);
+        case FRAME_PING: {
+            if (stream_id != 0) return connectionError(Http2Error::PROTOCOL_ERROR);
+            if (payload.size() != 8) return connectionError(Http2Error::FRAME_SIZE_ERROR);
+            if (!(flags & FLAG_ACK)) writeFrame(FRAME_PING, FLAG_ACK, 0, payload);
+            return true;
+        }
+        case FRAME_GOAWAY: {
+            if (stream_id != 0) return connectionError(Http2Error::PROTOCOL_ERROR);
+            if (payload.size() < 8) return connectionError(Http2Error::FRAME_SIZE_ERROR);
+            goaway_received = true;
+            return true;
+        }
+        case FRAME_WINDOW_UPDATE:
+            return onWindowUpdate(stream_id, payload);
+        case FRAME_PRIORITY_UPDATE: {
+            if (stream_id != 0) return connectionError(Http2Error::PROTOCOL_ERROR);
+            if (payload.size() < 4) return connectionError(Http2Error::FRAME_SIZE_ERROR);
+            uint32_t prioritized = read32(payload.data()) & 0x7fffffff;
+            if (prioritized == 0) return connectionError(Http2Error::PROTOCOL_ERROR);
+            auto it = streams.find(prioritized);
+            if (it != streams.end()) applyPriority(payload.substr(4), *it->second);
+            return true;
+        }
+        default:
+            // Unknown frame types are ignored (RFC 9113 4.1)
+            return true;
+    }
+}
+
+bool Http2Session::applySettings(std::string_view payload) {
+    if (payload.size() % 6 != 0) return connectionError(Http2Error::FRAME_SIZE_ERROR);
+    for (size_t i = 0; i < payload.size(); i += 6) {
+        uint16_t id = static_cast<uint8_t>(payload[i]) << 8 | static_cast<uint8_t>(payload[i + 1]);
+        uint32_t value = read32(payload.data() + i + 2);
+        switch (id) {
+            case SETTINGS_HEADER_TABLE_SIZE:
+                encoder.setLimit(value);
+                break;
+            case SETTINGS_ENABLE_PUSH:
+                if (value > 1) return connectionError(Http2Error::PROTOCOL_ERROR);
+                break;
+            case SETTINGS_INITIAL_WINDOW_SIZE: {
+                if (value > MAX_WINDOW) return connectionError(Http2Error::FLOW_CONTROL_ERROR);
+                // Applies to every open stream, in either direction (6.9.2)
+                int64_t delta = static_cast<int64_t>(value) - initial_window;
+                for (auto& entry : streams) {
+                    entry.second->send_window += delta;
+                    if (entry.second->send_window > MAX_WINDOW) {
+                        return connectionError(Http2Error::FLOW_CONTROL_ERROR);
+                    }
+                }
+                initial_window = value;
+                break;
+            }
+            case SETTINGS_MAX_FRAME_SIZE:
+                if (value < 16384 || value > 0xffffff) return connectionError(Http2Error::PROTOCOL_ERROR);
+                peer_max_frame = value;
+                break;
+            default:
+                // MAX_CONCURRENT_STREAMS limits pushes, which are never
+                // sent; MAX_HEADER_LIST_SIZE is advisory
+                break;
+        }
+    }
+    return true;
+}
+
+bool Http2Session::onHeaderBlock(uint32_t stream_id, std::string_view header_block, bool end_stream,
+                                 uint16_t weight) {
+    auto it = streams.find(stream_id);
+    if (it == streams.end() && stream_id > last_stream_id) {
+        if (stream_id % 2 == 0) return connectionError(Http2Error::PROTOCOL_ERROR);
+        last_stream_id = stream_id;
+
+        auto stream = std::make_unique<Http2Stream>();
+        stream->id = stream_id;
+        stream->remote_closed = end_stream;
+        int error_status = 0;
+        // Decoded even if the stream is refused, to keep the table in step
+        if (!decodeRequest(header_block, *stream, error_status)) {
+            return connectionError(Http2Error::COMPRESSION_ERROR);
+        }
+        stats.add(Counter::HTTP2_STREAMS);
+        if (streams.size() >= static_cast<size_t>(config.getHttp2MaxStreams())) {
+            writeRstStream(stream_id, Http2Error::REFUSED_STREAM);
+            stats.add(Counter::HTTP2_STREAM_ERRORS);
+            return true;
+        }
+        if (error_status < 0 || weight == 0) {
+            writeRstStream(stream_id, Http2Error::PROTOCOL_ERROR);
+            stats.add(Counter::HTTP2_STREAM_ERRORS);
+            return true;
+        }
+
+        Http2Stream& added = addStream(std::move(stream));
+        if (weight != 0xffff) {
+            added.weight = weight;
+            added.incremental = true;
+        }
+        applyPriority(added.request.getHeader("priority"), added);
+        if (error_status > 0) {
+            respondStatus(added, error_status);
+            return true;
+        }
+        beginRequest(added);
+        return true;
+    }
+
+    // Trailers, or a block for a stream already closed: decoded for the
+    // table's sake, otherwise ignored
+    if (!decoder.decode(header_block, [](std::string_view, std::string_view) {})) {
+        return connectionError(Http2Error::COMPRESSION_ERROR);
+    }
+    if (it == streams.end()) return true;
+    Http2Stream& stream = *it->second;
+    if (stream.remote_closed) {
+        resetStream(stream, Http2Error::STREAM_CLOSED);
+    } else if (!end_stream) {
+        resetStream(stream, Http2Error::PROTOCOL_ERROR);
+    } else {
+        stream.remote_closed = true;
+        if (stream.responded) {
+            settle(stream);
+        } else {
+            dispatch(stream);
+        }
+    }
+    return true;
+}
+
+// Decodes a request's header block into stream. Returns false on a
+// compression error; error_status is set to -1 for a malformed request
+// (RFC 9113 8.1.1) or 431 when the fields exceed the limits.
+bool Http2Session::decodeRequest(std::string_view header_block, Http2Stream& stream, int& error_status) {
+    struct Span {
+        size_t offset = 0;
+        size_t length = 0;
+        bool present = false;
+    };
+    std::string& head = stream.head;
+    Span method, scheme, path, authority;
+    std::array<std::pair<Span, Span>, HTTPRequest::MAX_HEADERS> fields;
+    size_t count = 0, list_size = 0;
+    bool regular_seen = false, has_host = false;
+    std::string cookies;
+
+    auto store = [&head](std::string_view bytes) {
+        Span span{head.size(), bytes.size(), true};
+        head += bytes;
+        return span;
+    };
+    auto add = [&](std::string_view name, std::string_view value) {
+        if (count == fields.size()) {
+            error_status = 431;
+            return;
+        }
+        fields[count].first = store(name);
+        fields[count].second = store(value);
+        ++count;
+    };
+
+    bool valid = decoder.decode(header_block, [&](std::string_view name, std::string_view value) {
+        list_size += name.size() + value.size() + 32;
+        if (error_status != 0) return;
+        if (list_size > config.getMaxHeaderSize()) {
+            error_status = 431;
+            return;
+        }
+        if (!validFieldValue(value)) {
+            error_status = -1;
+            return;
+        }
+        if (!name.empty() && name[0] == ':') {
+            Span* pseudo = name == ":method" ? &method : name == ":scheme" ? &scheme :
+                           name == ":path" ? &path : name == ":authority" ? &authority : nullptr;
+            if (regular_seen || !pseudo || pseudo->present) {
+                error_status = -1;
+                return;
+            }
+            *pseudo = store(value);
+            return;
+        }
+        regular_seen = true;
+        if (!validFieldName(name) || isConnectionSpecific(name) || (name == "te" && value != "trailers")) {
+            error_status = -1;
+            return;
+        }
+        // Cookie crumbs are joined back into one field (8.2.3)
+        if (name == "cookie") {
+            if (!cookies.empty()) cookies += "; ";
+            cookies += value;
+            return;
+        }
+        if (name == "host") has_host = true;
+        add(name, value);
+    });
+    if (!valid) return false;
+    if (error_status != 0) return true;
+    if (!method.present || !scheme.present || !path.present || path.length == 0) {
+        error_status = -1;
+        return true;
+    }
+    if (!cookies.empty()) add("cookie", cookies);
+    if (!has_host && authority.present) add("host", std::string_view(head).substr(authority.offset, authority.length));
+    if (error_status != 0) return true;
+
+    // head is complete; views into it stay valid from here on
+    auto view = [&head](Span span) { return std::string_view(head).substr(span.offset, span.length); };
+    HTTPRequest& request = stream.request;
+    request.method = view(method);
+    request.method_id = parseMethod(request.method);
+    std::string_view target = view(path);
+    size_t query_pos = target.find('?');
+    request.path = target.substr(0, query_pos);
+    request.query = query_pos == std::string_view::npos ? std::string_view() : target.substr(query_pos + 1);
+    request.version = "HTTP/2.0";
+    request.header_count = count;
+    for (size_t i = 0; i < count; ++i) request.headers[i] = {view(fields[i].first), view(fields[i].second)};
+
+    std::string_view length = request.getHeader("content-length");
+    if (!length.empty()) {
+        size_t value = 0;
+        auto result = std::from_chars(length.data(), length.data() + length.size(), value);
+        if (result.ec != std::errc() || result.ptr != length.data() + length.size()) {
+            error_status = -1;
+            return true;
+        }
+        stream.expected_length = value;
+    }
+    return true;
+}
+
+Http2Stream& Http2Session::addStream(std::unique_ptr<Http2Stream> stream) {
+    stream->send_window = initial_window;
+    stream->recv_window = STREAM_WINDOW;
+    stream->request_start = std::chrono::steady_clock::now();
+    Http2Stream& added = *stream;
+    streams[added.id] = std::move(stream);
+    return added;
+}
+
+// Routes a new stream's request and answers it at once if it has no body
+void Http2Session::beginRequest(Http2Stream& stream) {
+    if (shedder.isShedding(stream.request_start)) {
+        respondStatus(stream, 503);
+        return;
+    }
+    stream.route = router.find(stream.request);
+    bool streaming = stream.route && stream.route->stream;
+    if (!streaming && stream.expected_length != SIZE_MAX && stream.expected_length > config.getMaxBodySize()) {
+        respondStatus(stream, 413);
+        return;
+    }
+    if (streaming) {
+        try {
+            stream.body_stream = stream.route->stream(stream.request);
+        } catch (const std::exception& e) {
+            logger.error(e.what());
+            respondStatus(stream, 500);
+            return;
+        }
+    }
+
+    if (stream.remote_closed) {
+        dispatch(stream);
+    } else if (equalsIgnoreCase(stream.request.getHeader("expect"), "100-continue")) {
+        block.clear();
+        encoder.beginBlock(block);
+        encoder.encode(block, ":status", "100");
+        writeHeaderBlock(stream.id, block, false);
+    }
+}
+
+bool Http2Session::onData(uint32_t stream_id, bool end_stream, std::string_view data, size_t frame_length) {
+    // The whole frame counts against the windows, padding included
+    recv_window -= frame_length;
+    if (recv_window < 0) return connectionError(Http2Error::FLOW_CONTROL_ERROR);
+    recv_consumed += frame_length;
+    if (recv_consumed >= CONNECTION_WINDOW / 2) {
+        writeWindowUpdate(0, recv_consumed);
+        recv_window += recv_consumed;
+        recv_consumed = 0;
+    }
+
+    auto it = streams.find(stream_id);
+    if (it == streams.end()) {
+        // Frames still in flight for a stream that was reset are dropped
+        return stream_id <= last_stream_id || connectionError(Http2Error::PROTOCOL_ERROR);
+    }
+    Http2Stream& stream = *it->second;
+    if (stream.remote_closed) {
+        resetStream(stream, Http2Error::STREAM_CLOSED);
+        return true;
+    }
+    stream.recv_window -= frame_length;
+    if (stream.recv_window < 0) {
+        resetStream(stream, Http2Error::FLOW_CONTROL_ERROR);
+        return true;
+    }
+
+    stream.received += data.size();
+    if (stream.expected_length != SIZE_MAX && stream.received > stream.expected_length) {
+        resetStream(stream, Http2Error::PROTOCOL_ERROR);
+        return true;
+    }
+    // After an early response (413, 503) the rest of the body is dropped
+    if (!stream.responded && !data.empty()) {
+        if (stream.body_stream) {
+            try {
+                stream.body_stream->onData(stream.request, data);
+            } catch (const std::exception& e) {
+                logger.error(e.what());
+                respondStatus(stream, 500);
+                return true;
+            }
+        } else if (stream.body.size() + data.size() > config.getMaxBodySize()) {
+            respondStatus(stream, 413);
+            return true;
+        } else {
+            stream.body.append(data);
+        }
+    }
+
+    if (end_stream) {
+        stream.remote_closed = true;
+        if (stream.responded) {
+            settle(stream);
+        } else {
+            dispatch(stream);
+        }
+        return true;
+    }
+    stream.recv_consumed += frame_length;
+    if (!stream.responded && stream.recv_consumed >= STREAM_WINDOW / 2) {
+        writeWindowUpdate(stream.id, stream.recv_consumed);
+        stream.recv_window += stream.recv_consumed;
+        stream.recv_consumed = 0;
+    }
+    return true;
+}
+
+bool Http2Session::onWindowUpdate(uint32_t stream_id, std::string_view payload) {
+    if (payload.size() != 4) return connectionError(Http2Error::FRAME_SIZE_ERROR);
+    uint32_t increment = read32(payload.data()) & 0x7fffffff;
+    if (stream_id == 0) {
+        if (increment == 0) return connectionError(Http2Error::PROTOCOL_ERROR);
+        send_window += increment;
+        return send_window <= MAX_WINDOW || connectionError(Http2Error::FLOW_CONTROL_ERROR);
+    }
+
+    auto it = streams.find(stream_id);
+    if (it == streams.end()) {
+        return stream_id <= last_stream_id || connectionError(Http2Error::PROTOCOL_ERROR);
+    }
+    Http2Stream& stream = *it->second;
+    if (increment == 0) {
+        resetStream(stream, Http2Error::PROTOCOL_ERROR);
+        return true;
+    }
+    stream.send_window += increment;
+    if (stream.send_window > MAX_WINDOW) resetStream(stream, Http2Error::FLOW_CONTROL_ERROR);
+    return true;
+}
+
+// Runs the handler for a complete request
+void Http2Session::dispatch(Http2Stream& stream) {
+    if (stream.expected_length != SIZE_MAX && stream.received != stream.expected_length) {
+        resetStream(stream, Http2Error::PROTOCOL_ERROR);
+        return;
+    }
+    if (!stream.body_stream) stream.request.body = stream.body;
+    if (stream.route && stream.route->async) {
+        runAsync(stream);
+        return;
+    }
+
+    bool keep_alive = true;
+    Http2StreamWriter writer(*this, stream);
+    auto handler_start = std::chrono::steady_clock::now();
+    arena.reset();
+    int status = handleRequest(stream.request, stream.route, stream.body_stream.get(), config, keep_alive,
+                               writer, &arena, stream.request_start);
+    auto now = std::chrono::steady_clock::now();
+    stats.recordLatency(Stage::HANDLER, stream.route ? stream.route->id : 0, status,
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(now - handler_start).count());
+    stream.body_stream.reset();
+    settle(stream);
+}
+
+void Http2Session::runAsync(Http2Stream& stream) {
+    if (spare_arenas.empty()) spare_arenas.push_back(std::make_unique<Arena>());
+    stream.arena = std::move(spare_arenas.back());
+    spare_arenas.pop_back();
+    stream.task = serveAsync(stream);
+    stream.task.start();
+    if (!stream.task.done()) {
+        stream.running = true;
+        ++running_tasks;
+        return;
+    }
+    endTask(stream);
+}
+
+Task<void> Http2Session::serveAsync(Http2Stream& stream) {
+    bool keep_alive = true;
+    Http2StreamWriter writer(*this, stream);
+    auto handler_start = std::chrono::steady_clock::now();
+    int status = co_await handleRequestAsync(stream.request, *stream.route, config, keep_alive, writer,
+                                             stream.arena.get(), stream.request_start);
+    auto now = std::chrono::steady_clock::now();
+    stats.recordLatency(Stage::HANDLER, stream.route->id, status,
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(now - handler_start).count());
+    if (stream.running) {
+        if (finished_tasks.empty()) wake();
+        finished_tasks.push_back(&stream);
+    }
+}
+
+// Frees a finished handler's coroutine and arena. A detached stream goes
+// with it; otherwise the stream is settled like any other.
+void Http2Session::endTask(Http2Stream& stream) {
+    stream.task = {};
+    if (spare_arenas.size() < SPARE_ARENAS) {
+        stream.arena->reset();
+        spare_arenas.push_back(std::move(stream.arena));
+    }
+    stream.arena.reset();
+    if (stream.running) {
+        stream.running = false;
+        --running_tasks;
+    }
+    if (stream.detached) {
+        auto it = std::find_if(detached.begin(), detached.end(),
+                               [&stream](const auto& kept) { return kept.get() == &stream; });
+        detached.erase(it);
+        return;
+    }
+    settle(stream);
+}
+
+// Answers a stream with a short error page without running a handler
+void Http2Session::respondStatus(Http2Stream& stream, int code) {
+    arena.reset();
+    HTTPResponse response(config.getDocumentRoot(), &arena);
+    response.setStatus(code, reasonPhrase(code));
+    response.setHeader("Content-Type", "text/html");
+    if (code == 503) response.setHeader("Retry-After", std::to_string(config.getRetryAfter()));
+    HtmlWriter html(&arena);
+    html.write("<h1>", code, " - ", reasonPhrase(code), "</h1>");
+    response.setBody(html.take());
+    stats.add(code == 503 ? Counter::REQUESTS_SHED : Counter::ERROR_RESPONSES);
+    sendResponse(stream, response);
+    settle(stream);
+}
+
+void Http2Session::sendResponse(Http2Stream& stream, HTTPResponse& response) {
+    std::vector<BodyPart> parts;
+    response.takeBody(parts);
+    writeResponse(stream, response.getStatusCode(),
+                  [&response](auto&& field) { response.forEachHeader(field); }, parts);
+}
+
+void Http2Session::sendResponse(Http2Stream& stream, const CachedResponse& cached) {
+    std::vector<BodyPart> parts;
+    if (!cached.body.empty()) parts.push_back(BodyPart::shared(cached.shared_from_this(), cached.body));
+    writeResponse(stream, cached.status, [&cached](auto&& field) { cached.forEachHeader(field); }, parts);
+}
+
+// Encodes the response headers, with the thread's Server/Date block, and
+// queues the body for pump()
+template <typename Headers>
+void Http2Session::writeResponse(Http2Stream& stream, int status, Headers&& headers,
+                                 std::vector<BodyPart>& parts) {
+    if (stream.responded || stream.detached) return;
+    stream.responded = true;
+    stream.status = status;
+    if (!responseHasBody(stream.request.method_id, status)) parts.clear();
+
+    block.clear();
+    encoder.beginBlock(block);
+    char digits[8];
+    auto end = std::to_chars(digits, digits + sizeof(digits), status).ptr;
+    encoder.encode(block, ":status", std::string_view(digits, end - digits));
+    auto field = [this](std::string_view name, std::string_view value) {
+        lowered.assign(name);
+        for (char& c : lowered) {
+            if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+        }
+        if (!isConnectionSpecific(lowered)) encoder.encode(block, lowered, value);
+    };
+    forEachHeaderLine(*commonHeaders(), field);
+    headers(field);
+    writeHeaderBlock(stream.id, block, parts.empty());
+
+    if (parts.empty()) {
+        endResponse(stream);
+        return;
+    }
+    for (BodyPart& part : parts) {
+        if (!part.isFile() && !part.referenced) {
+            auto bytes = std::make_shared<const std::string>(std::move(part.data));
+            part = BodyPart::shared(bytes, *bytes);
+        }
+        stream.pending_bytes += part.size();
+        stream.pending.push_back(std::move(part));
+    }
+    makeReady(stream);
+}
+
+// The response is queued up to END_STREAM; its send latency is measured
+// from here
+void Http2Session::endResponse(Http2Stream& stream) {
+    stream.local_closed = true;
+    unsent.push_back({std::chrono::steady_clock::now(), stream.route ? stream.route->id : 0, stream.status});
+}
+
+// Forgets a stream once both sides are done with it. A response finished
+// before its request ends with RST_STREAM(NO_ERROR), which tells the client
+// to stop sending the rest (RFC 9113 8.1).
+void Http2Session::settle(Http2Stream& stream) {
+    if (!stream.local_closed) return;
+    if (!stream.remote_closed) writeRstStream(stream.id, Http2Error::NO_ERROR);
+    eraseStream(stream);
+}
+
+void Http2Session::resetStream(Http2Stream& stream, Http2Error code) {
+    writeRstStream(stream.id, code);
+    stats.add(Counter::HTTP2_STREAM_ERRORS);
+    eraseStream(stream);
+}
+
+void Http2Session::eraseStream(Http2Stream& stream) {
+    if (stream.ready) {
+        ready.erase(std::find(ready.begin(), ready.end(), &stream));
+        stream.ready = false;
+    }
+    auto it = streams.find(stream.id);
+    if (it == streams.end()) return;
+    if (stream.running) {
+        stream.detached = true;
+        detached.push_back(std::move(it->second));
+    }
+    streams.erase(it);
+}
+
+void Http2Session::makeReady(Http2Stream& stream) {
+    if (stream.ready) return;
+    stream.ready = true;
+    stream.vtime = std::max(stream.vtime, virtual_time);
+    ready.push_back(&stream);
+}
+
+// The next stream to send from: the most urgent one, then among equals the
+// oldest non-incremental stream, or the incremental one furthest behind its
+// weighted share. Streams without send window wait.
+Http2Stream* Http2Session::pick() const {
+    Http2Stream* best = nullptr;
+    for (Http2Stream* stream : ready) {
+        if (stream->send_window <= 0) continue;
+        if (!best) {
+            best = stream;
+            continue;
+        }
+        if (stream->urgency != best->urgency) {
+            if (stream->urgency < best->urgency) best = stream;
+        } else if (stream->incremental != best->incremental) {
+            if (!stream->incremental) best = stream;
+        } else if (stream->incremental && stream->vtime != best->vtime) {
+            if (stream->vtime < best->vtime) best = stream;
+        } else if (stream->id < best->id) {
+            best = stream;
+        }
+    }
+    return best;
+}
+
+// Frames response bodies as DATA until the high-water mark or the windows
+// run out
+void Http2Session::pump() {
+    while (queued < HIGH_WATER && send_window > 0) {
+        Http2Stream* stream = pick();
+        if (!stream) break;
+
+        size_t length = std::min({stream->pending_bytes, peer_max_frame, static_cast<size_t>(send_window),
+                                  static_cast<size_t>(stream->send_window)});
+        bool last = length == stream->pending_bytes;
+        writeFrameHeader(FRAME_DATA, last ? FLAG_END_STREAM : 0, stream->id, length);
+        for (size_t left = length; left > 0;) {
+            const BodyPart& part = stream->pending.front();
+            size_t n = std::min(left, part.size() - stream->pending_offset);
+            write(slice(part, stream->pending_offset, n));
+            stream->pending_offset += n;
+            left -= n;
+            if (stream->pending_offset == part.size()) {
+                stream->pending.pop_front();
+                stream->pending_offset = 0;
+            }
+        }
+        stream->pending_bytes -= length;
+        stream->send_window -= length;
+        send_window -= length;
+        virtual_time = stream->vtime;
+        stream->vtime += (length << 8) / stream->weight;
+
+        if (last) {
+            endResponse(*stream);
+            settle(*stream);
+        }
+    }
+}
@@ -0,0 +1,235 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "admission.hpp"
+#include "arena.hpp"
+#include "config.hpp"
+#include "hpack.hpp"
+#include "http_request.hpp"
+#include "http_response.hpp"
+#include "output_queue.hpp"
+#include "router.hpp"
+#include "stats.hpp"
+#include "task.hpp"
+
+// Cleartext HTTP/2 (RFC 9113), entered with the client connection preface
+// (prior knowledge) or an HTTP/1.1 "Upgrade: h2c" request
+
+constexpr std::string_view HTTP2_PREFACE = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+// Decodes the base64url HTTP2-Settings header of an upgrade request into a
+// SETTINGS frame payload; false if it is malformed
+bool decodeHttp2Settings(std::string_view header, std::string& payload);
+
+enum class Http2Error : uint32_t {
+    NO_ERROR = 0x0, PROTOCOL_ERROR = 0x1, INTERNAL_ERROR = 0x2, FLOW_CONTROL_ERROR = 0x3,
+    STREAM_CLOSED = 0x5, FRAME_SIZE_ERROR = 0x6, REFUSED_STREAM = 0x7, COMPRESSION_ERROR = 0x9,
+    ENHANCE_YOUR_CALM = 0xb
+};
+
+// One request and its response on an HTTP/2 connection
+struct Http2Stream {
+    uint32_t id = 0;
+    bool remote_closed = false;   // the request is complete
+    bool responded = false;       // response headers queued
+    bool local_closed = false;    // the response is queued to its end
+
+    // Request fields are decoded into head, which the request's views point
+    // into; a buffered body is collected in body
+    std::string head;
+    HTTPRequest request;
+    std::string body;
+    size_t expected_length = SIZE_MAX;   // content-length, if sent
+    size_t received = 0;
+    const Router::Route* route = nullptr;
+    std::unique_ptr<BodyStream> body_stream;
+    std::chrono::steady_clock::time_point request_start;
+
+    // Flow control: bytes the peer still accepts, bytes we still accept and
+    // bytes taken since our last WINDOW_UPDATE
+    int64_t send_window = 0;
+    int64_t recv_window = 0;
+    size_t recv_consumed = 0;
+
+    // Response body not yet framed. Every in-memory part is shared, so DATA
+    // frames reference slices of it instead of copying.
+    std::deque<BodyPart> pending;
+    size_t pending_offset = 0;   // bytes of the front part already framed
+    size_t pending_bytes = 0;
+    int status = 0;
+
+    // Scheduling: urgency and incremental from the priority header or a
+    // PRIORITY_UPDATE frame (RFC 9218), weight from RFC 7540 priority
+    // signals. Incremental streams of one urgency share the connection in
+    // proportion to their weights; the others are sent one after another.
+    uint8_t urgency = 3;
+    bool incremental = false;
+    uint16_t weight = 16;
+    uint64_t vtime = 0;
+    bool ready = false;   // listed among the streams with data to send
+
+    // An async handler's coroutine, with an arena of its own since other
+    // streams' handlers reuse the session's while it is suspended. A stream
+    // reset meanwhile is detached: kept until the handler ends, unanswered.
+    Task<void> task;
+    std::unique_ptr<Arena> arena;
+    bool running = false;
+    bool detached = false;
+};
+
+// Server side of one HTTP/2 connection. Frames are parsed from received
+// bytes, and each request runs through the router's handlers when its stream
+// completes, on the connection's thread, just as an HTTP/1.1 request would.
+// Response headers are encoded and queued at once. Bodies are framed into
+// the output queue by pump(), within the flow control windows and most
+// urgent stream first, and only up to a high-water mark beyond what the
+// socket has taken, so later urgent responses don't queue behind a large one.
+class Http2Session {
+private:
+    friend class Http2StreamWriter;
+
+    static constexpr size_t HIGH_WATER = 256 * 1024;
+    static constexpr size_t MAX_FRAME_SIZE = 16384;                 // accepted from the peer
+    static constexpr int64_t DEFAULT_WINDOW = 65535;
+    static constexpr int64_t MAX_WINDOW = 0x7fffffff;
+    static constexpr int64_t STREAM_WINDOW = 1 << 20;               // announced per stream
+    static constexpr int64_t CONNECTION_WINDOW = 16 << 20;
+    static constexpr size_t SPARE_ARENAS = 8;                       // kept for async handlers
+
+    const Config& config;
+    const Router& router;
+    const LoadShedder& shedder;
+    OutputQueue& out;
+    Arena& arena;
+    std::vector<QueuedResponse>& unsent;
+    std::function<void()> wake;   // an async handler finished
+
+    HpackDecoder decoder;
+    HpackEncoder encoder;
+    std::string input;            // received bytes not yet parsed
+    std::string block;            // header block being encoded
+    std::string lowered;          // response header name being lowercased
+    bool preface_received = false;
+    bool settings_received = false;
+
+    std::unordered_map<uint32_t, std::unique_ptr<Http2Stream>> streams;
+    std::vector<Http2Stream*> ready;
+    uint32_t last_stream_id = 0;
+    uint64_t virtual_time = 0;
+
+    std::vector<Http2Stream*> finished_tasks;
+    std::vector<std::unique_ptr<Http2Stream>> detached;
+    std::vector<std::unique_ptr<Arena>> spare_arenas;
+    size_t running_tasks = 0;
+
+    // Header block split across CONTINUATION frames
+    uint32_t continued_stream = 0;
+    bool continued_end_stream = false;
+    uint16_t continued_weight = 0;
+    std::string continued_block;
+
+    // Peer settings and connection flow control
+    int64_t initial_window = DEFAULT_WINDOW;
+    size_t peer_max_frame = 16384;
+    int64_t send_window = DEFAULT_WINDOW;
+    int64_t recv_window = DEFAULT_WINDOW;
+    size_t recv_consumed = 0;
+
+    size_t queued = 0;            // bytes written to out and not yet sent
+    bool goaway_sent = false;
+    bool goaway_received = false;
+
+    void write(std::string_view bytes);
+    void write(BodyPart part);
+    void writeFrameHeader(uint8_t type, uint8_t flags, uint32_t stream_id, size_t length);
+    void writeFrame(uint8_t type, uint8_t flags, uint32_t stream_id, std::string_view payload);
+    void writeRstStream(uint32_t stream_id, Http2Error code);
+    void writeWindowUpdate(uint32_t stream_id, uint32_t increment);
+    void writeHeaderBlock(uint32_t stream_id, std::string_view header_block, bool end_stream);
+    bool connectionError(Http2Error code);
+
+    bool processFrame(uint8_t type, uint8_t flags, uint32_t stream_id, std::string_view payload);
+    bool applySettings(std::string_view payload);
+    bool onHeaderBlock(uint32_t stream_id, std::string_view header_block, bool end_stream, uint16_t weight);
+    bool onData(uint32_t stream_id, bool end_stream, std::string_view data, size_t frame_length);
+    bool onWindowUpdate(uint32_t stream_id, std::string_view payload);
+    bool decodeRequest(std::string_view header_block, Http2Stream& stream, int& error_status);
+    Http2Stream& addStream(std::unique_ptr<Http2Stream> stream);
+    void beginRequest(Http2Stream& stream);
+
+    void dispatch(Http2Stream& stream);
+    void runAsync(Http2Stream& stream);
+    Task<void> serveAsync(Http2Stream& stream);
+    void endTask(Http2Stream& stream);
+    void respondStatus(Http2Stream& stream, int code);
+    void sendResponse(Http2Stream& stream, HTTPResponse& response);
+    void sendResponse(Http2Stream& stream, const CachedResponse& cached);
+    template <typename Headers>
+    void writeResponse(Http2Stream& stream, int status, Headers&& headers, std::vector<BodyPart>& parts);
+    void endResponse(Http2Stream& stream);
+    void settle(Http2Stream& stream);
+    void resetStream(Http2Stream& stream, Http2Error code);
+    void eraseStream(Http2Stream& stream);
+
+    void makeReady(Http2Stream& stream);
+    Http2Stream* pick() const;
+    void pump();
+
+public:
+    // on_task_done is called when an async handler that suspended has
+    // finished, for the connection to call collectTasks()
+    Http2Session(const Config& cfg, const Router& rt, const LoadShedder& load_shedder, OutputQueue& output,
+                 Arena& response_arena, std::vector<QueuedResponse>& unsent_responses,
+                 std::function<void()> on_task_done)
+        : config(cfg), router(rt), shedder(load_shedder), out(output), arena(response_arena),
+          unsent(unsent_responses), wake(std::move(on_task_done)) {}
+
+    // Queues the server's SETTINGS and widens the connection window
+    void start();
+
+    // After a 101 upgrade: applies the client's HTTP2-Settings payload and
+    // answers request, with its route, as stream 1. Returns false if the
+    // settings are invalid.
+    bool startUpgraded(std::string_view settings, const HTTPRequest& request, const Router::Route* route);
+
+    // Parses received bytes, the client preface first, and answers the
+    // requests completed by them
+    void receive(const char* data, size_t size);
+
+    // Accounts for bytes the socket took and frames more of the responses
+    void onSent(size_t bytes);
+
+    // Says goodbye with GOAWAY; the connection closes once it is written
+    void shutdown();
+
+    // Releases finished async handlers and frames their responses
+    void collectTasks();
+
+    // Async handlers suspended, and those among them whose stream still
+    // expects the response
+    size_t runningTasks() const { return running_tasks; }
+    bool awaitingHandlers() const { return running_tasks > detached.size(); }
+
+    // True once the connection should close after its pending output
+    bool finished() const { return goaway_sent || (goaway_received && streams.empty()); }
+
+    // A frame, or the preface, has started arriving but is not complete
+    bool hasPartialFrame() const { return !input.empty(); }
+
+    // Some stream's request is still arriving
+    bool awaitingRequests() const {
+        for (const auto& entry : streams) {
+            if (!entry.second->remote_closed) return true;
+        }
+        return false;
+    }
+};
@@ -0,0 +1,71 @@
+#include "http_request.hpp"
+
+HTTPMethod parseMethod(std::string_view method) {
+    switch (method.size()) {
+        case 3:
+            if (method == "GET") return HTTPMethod::GET;
+            if (method == "PUT") return HTTPMethod::PUT;
+            break;
+        case 4:
+            if (method == "HEAD") return HTTPMethod::HEAD;
+            if (method == "POST") return HTTPMethod::POST;
+            break;
+        case 5:
+            if (method == "PATCH") return HTTPMethod::PATCH;
+            break;
+        case 6:
+            if (method == "DELETE") return HTTPMethod::DELETE;
+            break;
+        case 7:
+            if (method == "OPTIONS") return HTTPMethod::OPTIONS;
+            break;
+    }
+    return HTTPMethod::UNKNOWN;
+}
+
+const char* methodName(HTTPMethod method) {
+    static const char* names[HTTP_METHOD_COUNT] = {
+        "GET", "HEAD", "POST", "PUT", "DELETE", "OPTIONS", "PATCH", "UNKNOWN"
+    };
+    return names[static_cast<size_t>(method)];
+}
+
+bool equalsIgnoreCase(std::string_view a, std::string_view b) {
+    return a.size() == b.size() && strncasecmp(a.data(), b.data(), a.size()) == 0;
+}
+
+bool hasToken(std::string_view value, std::string_view token) {
+    while (!value.empty()) {
+        size_t comma = value.find(',');
+        std::string_view item = value.substr(0, comma);
+        while (!item.empty() && (item.front() == ' ' || item.front() == '\t')) item.remove_prefix(1);
+        while (!item.empty() && (item.back() == ' ' || item.back() == '\t')) item.remove_suffix(1);
+        if (equalsIgnoreCase(item, token)) return true;
+        if (comma == std::string_view::npos) break;
+        value.remove_prefix(comma + 1);
+    }
+    return false;
+}
+
+bool percentDecode(std::string_view encoded, std::string& decoded) {
+    auto hexValue = [](char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    };
+    decoded.clear();
+    decoded.reserve(encoded.size());
+    for (size_t i = 0; i < encoded.size(); ++i) {
+        if (encoded[i] != '%') {
+            decoded += encoded[i];
+            continue;
+        }
+        if (i + 2 >= encoded.size()) return false;
+        int high = hexValue(encoded[i + 1]), low = hexValue(encoded[i + 2]);
+        if (high < 0 || low < 0 || (high == 0 && low == 0)) return false;
+        decoded += static_cast<char>(high * 16 + low);
+        i += 2;
+    }
+    return true;
+}
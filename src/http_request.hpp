@@ -0,0 +1,426 @@
+#pragma once
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include <string.h>
+#include <strings.h>
+
+#include <array>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Request methods known to the router
+enum class HTTPMethod { GET, HEAD, POST, PUT, DELETE, OPTIONS, PATCH, UNKNOWN };
+constexpr size_t HTTP_METHOD_COUNT = static_cast<size_t>(HTTPMethod::UNKNOWN) + 1;
+
+HTTPMethod parseMethod(std::string_view method);
+
+const char* methodName(HTTPMethod method);
+
+// Finds the first occurrence of c in [p, end), sixteen bytes at a time where
+// SSE2 is available. Returns end when c is not present.
+inline const char* findByte(const char* p, const char* end, char c) {
+#ifdef __SSE2__
+    const __m128i needle = _mm_set1_epi8(c);
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+        if (mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#endif
+    while (p < end && *p != c) ++p;
+    return p;
+}
+
+bool equalsIgnoreCase(std::string_view a, std::string_view b);
+
+// True if the comma-separated header value lists token (case-insensitive)
+bool hasToken(std::string_view value, std::string_view token);
+
+// Decodes %XX escapes in a request path; false on a malformed escape or an
+// encoded NUL
+bool percentDecode(std::string_view encoded, std::string& decoded);
+
+struct HTTPHeader {
+    std::string_view name;
+    std::string_view value;
+};
+
+// HTTP Request. All fields are views into the connection's input buffer and
+// stay valid until the request has been answered.
+struct HTTPRequest {
+    static constexpr size_t MAX_HEADERS = 64;
+    
+    std::string_view method;
+    HTTPMethod method_id = HTTPMethod::UNKNOWN;
+    std::string_view path;
+    std::string_view query;
+    std::string_view version;
+    std::array<HTTPHeader, MAX_HEADERS> headers;
+    size_t header_count = 0;
+    std::string_view body;
+    
+    // Case-insensitive header lookup; empty if absent
+    std::string_view getHeader(std::string_view name) const {
+        for (size_t i = 0; i < header_count; ++i) {
+            if (equalsIgnoreCase(headers[i].name, name)) return headers[i].value;
+        }
+        return {};
+    }
+    
+    // Looks up name in the query string; value is left untouched if absent
+    bool findQueryParam(std::string_view name, std::string_view& value) const {
+        std::string_view rest = query;
+        while (!rest.empty()) {
+            size_t amp = rest.find('&');
+            std::string_view pair = rest.substr(0, amp);
+            size_t eq = pair.find('=');
+            if (eq != std::string_view::npos && pair.substr(0, eq) == name) {
+                value = pair.substr(eq + 1);
+                return true;
+            }
+            if (amp == std::string_view::npos) break;
+            rest.remove_prefix(amp + 1);
+        }
+        return false;
+    }
+    
+    bool hasQueryParam(std::string_view name) const {
+        std::string_view value;
+        return findQueryParam(name, value);
+    }
+    
+    std::string_view getQueryParam(std::string_view name) const {
+        std::string_view value;
+        findQueryParam(name, value);
+        return value;
+    }
+    
+    // Connection persistence: HTTP/1.1 defaults to keep-alive, HTTP/1.0 to close
+    bool wantsKeepAlive() const {
+        std::string_view connection = getHeader("Connection");
+        if (version == "HTTP/1.1") return !hasToken(connection, "close");
+        if (version == "HTTP/1.0") return hasToken(connection, "keep-alive");
+        return false;
+    }
+};
+
+enum class ParseStatus { PARTIAL, COMPLETE, ERROR };
+
+// Resumable parser for the request head (request line and headers).
+// parse() is called with all bytes buffered so far for the current request,
+// which may grow (and move) between calls; progress is kept as offsets from
+// the request start, so earlier lines are never rescanned. fillRequest()
+// turns those offsets into views over the buffer's current location.
+class HTTPRequestParser {
+private:
+    enum class State { REQUEST_LINE, HEADERS, DONE };
+    
+    struct Span {
+        size_t offset;
+        size_t length;
+    };
+    
+    size_t max_header_bytes;
+    State state = State::REQUEST_LINE;
+    size_t line_start = 0;
+    size_t scan_pos = 0;
+    Span method{}, target{}, version{};
+    std::array<std::pair<Span, Span>, HTTPRequest::MAX_HEADERS> header_spans;
+    size_t header_count = 0;
+    bool has_content_length = false;
+    bool chunked = false;
+    size_t content_length = 0;
+    size_t head_size = 0;
+    int error_status = 0;
+    
+    ParseStatus fail(int status) {
+        error_status = status;
+        return ParseStatus::ERROR;
+    }
+    
+    static Span spanOf(const char* base, std::string_view part) {
+        return Span{static_cast<size_t>(part.data() - base), part.size()};
+    }
+    
+    static std::string_view view(const char* base, Span span) {
+        return std::string_view(base + span.offset, span.length);
+    }
+    
+    ParseStatus parseRequestLine(const char* base, std::string_view line) {
+        size_t first = line.find(' ');
+        size_t last = line.rfind(' ');
+        if (first == std::string_view::npos || first == 0 || last == first ||
+            last + 1 == line.size()) {
+            return fail(400);
+        }
+        
+        std::string_view uri = line.substr(first + 1, last - first - 1);
+        std::string_view ver = line.substr(last + 1);
+        if (uri.empty() || uri.find(' ') != std::string_view::npos) return fail(400);
+        if (ver.substr(0, 5) != "HTTP/") return fail(400);
+        if (ver.substr(0, 7) != "HTTP/1.") return fail(505);
+        
+        method = spanOf(base, line.substr(0, first));
+        target = spanOf(base, uri);
+        version = spanOf(base, ver);
+        return ParseStatus::PARTIAL;
+    }
+    
+    ParseStatus parseHeaderLine(const char* base, std::string_view line) {
+        // Obsolete line folding is rejected (RFC 7230 3.2.4)
+        if (line.front() == ' ' || line.front() == '\t') return fail(400);
+        
+        const char* colon = findByte(line.data(), line.data() + line.size(), ':');
+        if (colon == line.data() + line.size() || colon == line.data()) return fail(400);
+        
+        std::string_view name(line.data(), colon - line.data());
+        if (name.back() == ' ' || name.back() == '\t') return fail(400);
+        
+        std::string_view value = line.substr(name.size() + 1);
+        while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) value.remove_prefix(1);
+        while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) value.remove_suffix(1);
+        
+        if (header_count == header_spans.size()) return fail(431);
+        header_spans[header_count++] = {spanOf(base, name), spanOf(base, value)};
+        
+        if (equalsIgnoreCase(name, "Content-Length")) {
+            size_t length = 0;
+            auto result = std::from_chars(value.data(), value.data() + value.size(), length);
+            if (value.empty() || result.ec != std::errc() || result.ptr != value.data() + value.size()) {
+                return fail(400);
+            }
+            if (has_content_length && length != content_length) return fail(400);
+            has_content_length = true;
+            content_length = length;
+        } else if (equalsIgnoreCase(name, "Transfer-Encoding")) {
+            // No transfer codings other than chunked are implemented
+            if (!equalsIgnoreCase(value, "chunked")) return fail(501);
+            chunked = true;
+        }
+        return ParseStatus::PARTIAL;
+    }
+
+public:
+    explicit HTTPRequestParser(size_t max_header = 16 * 1024) : max_header_bytes(max_header) {}
+    
+    ParseStatus parse(const char* data, size_t size) {
+        const char* end = data + size;
+        
+        while (state != State::DONE) {
+            const char* lf = findByte(data + scan_pos, end, '\n');
+            if (lf == end) {
+                scan_pos = size;
+                return size > max_header_bytes ? fail(431) : ParseStatus::PARTIAL;
+            }
+            
+            size_t line_end = lf - data;
+            if (line_end >= max_header_bytes) return fail(431);
+            
+            size_t length = line_end - line_start;
+            if (length > 0 && data[line_end - 1] == '\r') length--;
+            std::string_view line(data + line_start, length);
+            line_start = scan_pos = line_end + 1;
+            
+            if (state == State::REQUEST_LINE) {
+                // Empty lines before the request line are ignored (RFC 7230 3.5)
+                if (line.empty()) continue;
+                if (parseRequestLine(data, line) == ParseStatus::ERROR) return ParseStatus::ERROR;
+                state = State::HEADERS;
+            } else if (line.empty()) {
+                head_size = line_start;
+                state = State::DONE;
+            } else if (parseHeaderLine(data, line) == ParseStatus::ERROR) {
+                return ParseStatus::ERROR;
+            }
+        }
+        
+        // A length alongside chunked framing is a smuggling vector (RFC 7230 3.3.3)
+        if (chunked && has_content_length) return fail(400);
+        return ParseStatus::COMPLETE;
+    }
+    
+    // Points req at the head, which starts at data; body is left empty
+    void fillRequest(const char* data, HTTPRequest& req) const {
+        req.method = view(data, method);
+        req.method_id = parseMethod(req.method);
+        std::string_view uri = view(data, target);
+        size_t query_pos = uri.find('?');
+        req.path = uri.substr(0, query_pos);
+        req.query = query_pos == std::string_view::npos ? std::string_view() : uri.substr(query_pos + 1);
+        req.version = view(data, version);
+        req.header_count = header_count;
+        for (size_t i = 0; i < header_count; ++i) {
+            req.headers[i] = {view(data, header_spans[i].first), view(data, header_spans[i].second)};
+        }
+        req.body = std::string_view();
+    }
+    
+    // Valid once parse() returned COMPLETE
+    size_t headSize() const { return head_size; }
+    bool isChunked() const { return chunked; }
+    size_t contentLength() const { return content_length; }
+    
+    // HTTP status to answer with once parse() returned ERROR
+    int errorStatus() const { return error_status; }
+    
+    void reset() {
+        state = State::REQUEST_LINE;
+        line_start = scan_pos = 0;
+        header_count = 0;
+        has_content_length = false;
+        chunked = false;
+        content_length = 0;
+        head_size = 0;
+        error_status = 0;
+    }
+};
+
+// Incremental request body decoder for Content-Length and chunked framing.
+// Chunked bodies are decoded in place: chunk data is moved down over the
+// framing bytes so decoded output is always contiguous at the front.
+class BodyDecoder {
+private:
+    enum class State { LENGTH, CHUNK_SIZE, CHUNK_EXTENSION, CHUNK_DATA, CHUNK_DATA_END, TRAILER, DONE };
+    
+    static constexpr size_t MAX_TRAILER_BYTES = 8192;
+    
+    State state = State::DONE;
+    size_t remaining = 0;
+    size_t total = 0;
+    size_t limit = 0;
+    size_t digits = 0;
+    size_t trailer_bytes = 0;
+    bool line_empty = true;
+    int error_status = 0;
+    
+    ParseStatus fail(int status) {
+        error_status = status;
+        return ParseStatus::ERROR;
+    }
+    
+    // Called at the LF ending a chunk-size line
+    ParseStatus endSizeLine() {
+        if (digits == 0) return fail(400);
+        if (remaining == 0) {
+            state = State::TRAILER;
+            line_empty = true;
+        } else if (remaining > limit - total) {
+            return fail(413);
+        } else {
+            state = State::CHUNK_DATA;
+        }
+        return ParseStatus::PARTIAL;
+    }
+    
+    static int hexValue(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+
+public:
+    void startLength(size_t length) {
+        state = length > 0 ? State::LENGTH : State::DONE;
+        remaining = length;
+        total = 0;
+        error_status = 0;
+    }
+    
+    void startChunked(size_t max_bytes) {
+        state = State::CHUNK_SIZE;
+        remaining = total = digits = trailer_bytes = 0;
+        limit = max_bytes;
+        error_status = 0;
+    }
+    
+    // Decodes data[0, size). On return data[0, decoded) holds body bytes and
+    // consumed input bytes (>= decoded) may be discarded by the caller.
+    ParseStatus decode(char* data, size_t size, size_t& decoded, size_t& consumed) {
+        size_t in = 0, out = 0;
+        
+        while (in < size && state != State::DONE) {
+            char c = data[in];
+            switch (state) {
+                case State::LENGTH: {
+                    size_t n = std::min(remaining, size - in);
+                    in += n;
+                    out += n;
+                    remaining -= n;
+                    if (remaining == 0) state = State::DONE;
+                    break;
+                }
+                case State::CHUNK_SIZE: {
+                    int value = hexValue(c);
+                    in++;
+                    if (value >= 0) {
+                        if (remaining > (SIZE_MAX >> 4)) return fail(400);
+                        remaining = remaining * 16 + value;
+                        digits++;
+                    } else if (c == ';' || c == ' ' || c == '\t') {
+                        state = State::CHUNK_EXTENSION;
+                    } else if (c == '\n') {
+                        if (endSizeLine() == ParseStatus::ERROR) return ParseStatus::ERROR;
+                    } else if (c != '\r') {
+                        return fail(400);
+                    }
+                    break;
+                }
+                case State::CHUNK_EXTENSION: {
+                    const char* lf = findByte(data + in, data + size, '\n');
+                    in = lf - data;
+                    if (in < size) {
+                        in++;
+                        if (endSizeLine() == ParseStatus::ERROR) return ParseStatus::ERROR;
+                    }
+                    break;
+                }
+                case State::CHUNK_DATA: {
+                    size_t n = std::min(remaining, size - in);
+                    if (out != in) memmove(data + out, data + in, n);
+                    in += n;
+                    out += n;
+                    total += n;
+                    remaining -= n;
+                    if (remaining == 0) state = State::CHUNK_DATA_END;
+                    break;
+                }
+                case State::CHUNK_DATA_END:
+                    in++;
+                    if (c == '\n') {
+                        state = State::CHUNK_SIZE;
+                        digits = 0;
+                    } else if (c != '\r') {
+                        return fail(400);
+                    }
+                    break;
+                case State::TRAILER:
+                    // Trailer fields are read and discarded
+                    in++;
+                    if (++trailer_bytes > MAX_TRAILER_BYTES) return fail(431);
+                    if (c == '\n') {
+                        if (line_empty) state = State::DONE;
+                        line_empty = true;
+                    } else if (c != '\r') {
+                        line_empty = false;
+                    }
+                    break;
+                case State::DONE:
+                    break;
+            }
+        }
+        
+        decoded = out;
+        consumed = in;
+        return state == State::DONE ? ParseStatus::COMPLETE : ParseStatus::PARTIAL;
+    }
+    
+    // HTTP status to answer with once decode() returned ERROR
+    int errorStatus() const { return error_status; }
+};
@@ -0,0 +1,113 @@
+#include "http_response.hpp"
+
+#include <ctime>
+
+RangeResult parseRanges(std::string_view value, size_t size, std::vector<ByteRange>& ranges) {
+    static constexpr size_t MAX_RANGES = 16;
+    
+    if (value.substr(0, 6) != "bytes=") return RangeResult::IGNORED;
+    value.remove_prefix(6);
+    
+    size_t specs = 0;
+    while (!value.empty()) {
+        size_t comma = value.find(',');
+        std::string_view spec = value.substr(0, comma);
+        value = comma == std::string_view::npos ? std::string_view() : value.substr(comma + 1);
+        
+        while (!spec.empty() && (spec.front() == ' ' || spec.front() == '\t')) spec.remove_prefix(1);
+        while (!spec.empty() && (spec.back() == ' ' || spec.back() == '\t')) spec.remove_suffix(1);
+        if (spec.empty()) continue;
+        if (++specs > MAX_RANGES) return RangeResult::IGNORED;
+        
+        size_t dash = spec.find('-');
+        if (dash == std::string_view::npos) return RangeResult::IGNORED;
+        std::string_view first_text = spec.substr(0, dash);
+        std::string_view last_text = spec.substr(dash + 1);
+        
+        auto parseNumber = [](std::string_view text, size_t& number) {
+            auto result = std::from_chars(text.data(), text.data() + text.size(), number);
+            return !text.empty() && result.ec == std::errc() && result.ptr == text.data() + text.size();
+        };
+        
+        size_t first = 0, last = 0;
+        if (first_text.empty()) {
+            // Suffix range: the final N bytes
+            size_t suffix;
+            if (!parseNumber(last_text, suffix)) return RangeResult::IGNORED;
+            if (suffix == 0 || size == 0) continue;
+            first = suffix >= size ? 0 : size - suffix;
+            last = size - 1;
+        } else {
+            if (!parseNumber(first_text, first)) return RangeResult::IGNORED;
+            if (last_text.empty()) {
+                last = size - 1;
+            } else if (!parseNumber(last_text, last) || last < first) {
+                return RangeResult::IGNORED;
+            }
+            if (first >= size) continue;
+            last = std::min(last, size - 1);
+        }
+        ranges.push_back(ByteRange{first, last});
+    }
+    
+    if (specs == 0) return RangeResult::IGNORED;
+    return ranges.empty() ? RangeResult::UNSATISFIABLE : RangeResult::SATISFIABLE;
+}
+
+bool ifRangeMatches(const HTTPRequest& req, const FileInfo& info) {
+    std::string_view if_range = req.getHeader("If-Range");
+    if (if_range.empty()) return true;
+    if (if_range.front() == '"') return if_range == info.etag;
+    return if_range == info.last_modified;
+}
+
+const char* reasonPhrase(int code) {
+    switch (code) {
+        case 100: return "Continue";
+        case 200: return "OK";
+        case 201: return "Created";
+        case 204: return "No Content";
+        case 206: return "Partial Content";
+        case 301: return "Moved Permanently";
+        case 302: return "Found";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 408: return "Request Timeout";
+        case 413: return "Payload Too Large";
+        case 416: return "Range Not Satisfiable";
+        case 431: return "Request Header Fields Too Large";
+        case 500: return "Internal Server Error";
+        case 501: return "Not Implemented";
+        case 502: return "Bad Gateway";
+        case 503: return "Service Unavailable";
+        case 504: return "Gateway Timeout";
+        case 505: return "HTTP Version Not Supported";
+        default:  return "Error";
+    }
+}
+
+std::string_view statusLine(int code) {
+    static const std::vector<std::string> lines = [] {
+        std::vector<std::string> rendered(600);
+        for (int i = 100; i < 600; ++i) {
+            rendered[i] = "HTTP/1.1 " + std::to_string(i) + " " + reasonPhrase(i) + "\r\n";
+        }
+        return rendered;
+    }();
+    return lines[code];
+}
+
+std::shared_ptr<const std::string> commonHeaders() {
+    thread_local std::shared_ptr<const std::string> block;
+    thread_local time_t block_second = -1;
+    time_t now = time(nullptr);
+    if (now != block_second) {
+        block = std::make_shared<const std::string>(
+            "Server: C++ HTTP Server 2.0\r\nDate: " + formatHttpDate(now) + "\r\n");
+        block_second = now;
+    }
+    return block;
+}
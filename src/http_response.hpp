@@ -0,0 +1,555 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <iterator>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "body_writer.hpp"
+#include "compression.hpp"
+#include "http_request.hpp"
+#include "logger.hpp"
+#include "output_queue.hpp"
+#include "static_files.hpp"
+
+// Inclusive byte range of a representation
+struct ByteRange {
+    size_t first;
+    size_t last;
+};
+
+enum class RangeResult { IGNORED, SATISFIABLE, UNSATISFIABLE };
+
+// Parses a Range header (RFC 7233 2.1) against a representation of size
+// bytes. Malformed headers and too many ranges are ignored, which means the
+// full representation is sent.
+RangeResult parseRanges(std::string_view value, size_t size, std::vector<ByteRange>& ranges);
+
+// If-Range (RFC 7233 3.2): the range applies only while the validator the
+// client holds is still current. Entity tags must match strongly.
+bool ifRangeMatches(const HTTPRequest& req, const FileInfo& info);
+
+// Canonical reason phrases for the statuses the server generates itself
+const char* reasonPhrase(int code);
+
+// "HTTP/1.1 <code> <reason>\r\n" with the canonical phrase, rendered once
+// for every code
+std::string_view statusLine(int code);
+
+// Server and Date header lines shared by every response a thread writes in
+// the same second. Queued responses keep a reference, so a block is never
+// rewritten while it may still be partly unsent.
+std::shared_ptr<const std::string> commonHeaders();
+
+// Calls fn(name, value) for each "Name: value\r\n" line of a serialized
+// header block
+template <typename Fn>
+void forEachHeaderLine(std::string_view lines, Fn&& fn) {
+    while (!lines.empty()) {
+        size_t end = lines.find("\r\n");
+        std::string_view line = lines.substr(0, end);
+        size_t colon = line.find(':');
+        if (colon != std::string_view::npos) {
+            std::string_view value = line.substr(colon + 1);
+            while (!value.empty() && value.front() == ' ') value.remove_prefix(1);
+            fn(line.substr(0, colon), value);
+        }
+        if (end == std::string_view::npos) break;
+        lines.remove_prefix(end + 2);
+    }
+}
+
+// Whether a response to method with status carries a body (RFC 9110 6.4.1)
+inline bool responseHasBody(HTTPMethod method, int status) {
+    return method != HTTPMethod::HEAD && status >= 200 && status != 204 && status != 304;
+}
+
+// Advanced HTTP Response with file serving
+// Header and body storage come from the memory resource given at
+// construction, normally the connection's per-request arena; the response
+// must not outlive it. writeTo copies what it needs into the output queue.
+class HTTPResponse {
+private:
+    std::string_view status_line = statusLine(200);
+    std::pmr::string custom_status_line;   // set instead for non-canonical phrases
+    int status_code = 200;
+    // Responses carry a handful of headers, so a flat vector searched
+    // linearly is cheaper than a map
+    std::pmr::vector<std::pair<std::pmr::string, std::pmr::string>> headers;
+    std::pmr::string body;
+    std::pmr::vector<BodyPart> body_parts;   // used instead of body when not empty
+    std::shared_ptr<const CachedFile> cached_file;
+    std::pmr::string document_root;
+    
+    // The body when this response holds it in memory: body itself or a
+    // single owned part. File ranges and referenced buffers don't count.
+    bool inMemoryBody(std::string_view& bytes) const {
+        if (body_parts.empty()) {
+            bytes = body;
+            return true;
+        }
+        if (body_parts.size() == 1 && !body_parts[0].isFile() && !body_parts[0].referenced) {
+            bytes = body_parts[0].data;
+            return true;
+        }
+        return false;
+    }
+    
+    // Answers a GET for a file whose bytes come from slice(offset, length),
+    // honoring Range/If-Range
+    template <typename Slice>
+    void sendRepresentation(const HTTPRequest& req, const FileInfo& info, Slice slice) {
+        std::vector<ByteRange> ranges;
+        RangeResult result = RangeResult::IGNORED;
+        std::string_view range_header = req.getHeader("Range");
+        bool get = req.method_id == HTTPMethod::GET || req.method_id == HTTPMethod::HEAD;
+        if (!range_header.empty() && get && ifRangeMatches(req, info)) {
+            result = parseRanges(range_header, info.size, ranges);
+        }
+        
+        if (result == RangeResult::UNSATISFIABLE) {
+            setStatus(416, "Range Not Satisfiable");
+            setHeader("Content-Range", "bytes */" + std::to_string(info.size));
+            setBody("");
+            return;
+        }
+        
+        setHeader("ETag", info.etag);
+        setHeader("Last-Modified", info.last_modified);
+        setHeader("Accept-Ranges", "bytes");
+        if (info.compressible) setHeader("Vary", "Accept-Encoding");
+        
+        if (result == RangeResult::IGNORED) {
+            setStatus(200, "OK");
+            setHeader("Content-Type", info.content_type);
+            setBodyParts({slice(0, info.size)});
+            return;
+        }
+        
+        setStatus(206, "Partial Content");
+        if (ranges.size() == 1) {
+            const ByteRange& range = ranges.front();
+            setHeader("Content-Type", info.content_type);
+            setHeader("Content-Range", "bytes " + std::to_string(range.first) + "-" +
+                      std::to_string(range.last) + "/" + std::to_string(info.size));
+            setBodyParts({slice(range.first, range.last - range.first + 1)});
+            return;
+        }
+        
+        // multipart/byteranges (RFC 7233 Appendix A)
+        static std::atomic<uint64_t> boundary_counter{0};
+        char boundary[32];
+        snprintf(boundary, sizeof(boundary), "%016llx",
+                 static_cast<unsigned long long>(++boundary_counter * 0x9E3779B97F4A7C15ULL));
+        
+        std::vector<BodyPart> parts;
+        for (const ByteRange& range : ranges) {
+            BodyPart part_head;
+            part_head.data = std::string("\r\n--") + boundary + "\r\n"
+                             "Content-Type: " + info.content_type + "\r\n"
+                             "Content-Range: bytes " + std::to_string(range.first) + "-" +
+                             std::to_string(range.last) + "/" + std::to_string(info.size) + "\r\n\r\n";
+            parts.push_back(std::move(part_head));
+            parts.push_back(slice(range.first, range.last - range.first + 1));
+        }
+        BodyPart closing;
+        closing.data = std::string("\r\n--") + boundary + "--\r\n";
+        parts.push_back(std::move(closing));
+        
+        setHeader("Content-Type", std::string("multipart/byteranges; boundary=") + boundary);
+        setBodyParts(std::move(parts));
+    }
+
+    // Answers with the compressed variant of a file if one is worthwhile.
+    // Each coding gets its own entity tag so caches keep variants apart.
+    bool sendEncodedVariant(const HTTPRequest& req, const std::string& full_path, const FileInfo& info,
+                            ContentEncoding encoding, const std::shared_ptr<const CachedFile>& entry,
+                            const std::shared_ptr<FileHandle>& file) {
+        std::string_view contents = entry ? std::string_view(entry->body) : std::string_view();
+        auto variant = compressor.variantFor(full_path, encoding, info, contents, file ? file->fd : -1);
+        if (!variant->available) return false;
+        
+        BodyPart part;
+        if (variant->sibling_path.empty()) {
+            part = BodyPart::shared(variant, variant->body);
+        } else {
+            int fd = open(variant->sibling_path.c_str(), O_RDONLY | O_CLOEXEC);
+            struct stat st;
+            if (fd < 0 || fstat(fd, &st) < 0) {
+                if (fd >= 0) close(fd);
+                return false;
+            }
+            part = BodyPart::file(FileRange{std::make_shared<FileHandle>(fd), 0, static_cast<size_t>(st.st_size)});
+        }
+        
+        FileInfo variant_info = info;
+        variant_info.etag.insert(variant_info.etag.size() - 1, std::string("-") + encodingToken(encoding));
+        setHeader("Vary", "Accept-Encoding");
+        if (isNotModified(req, variant_info)) {
+            setNotModified(variant_info);
+            return true;
+        }
+        
+        setStatus(200, "OK");
+        setHeader("Content-Type", info.content_type);
+        setHeader("Content-Encoding", encodingToken(encoding));
+        setHeader("ETag", variant_info.etag);
+        setHeader("Last-Modified", info.last_modified);
+        setBodyParts({std::move(part)});
+        return true;
+    }
+
+public:
+    explicit HTTPResponse(std::string_view root = ".",
+                          std::pmr::memory_resource* memory = std::pmr::get_default_resource())
+        : custom_status_line(memory), headers(memory), body(memory), body_parts(memory),
+          document_root(root, memory) {
+        headers.reserve(8);
+    }
+    
+    std::pmr::memory_resource* resource() const { return headers.get_allocator().resource(); }
+    
+    void setStatus(int code, std::string_view message) { 
+        status_code = code;
+        if (code >= 100 && code < 600 && message == reasonPhrase(code)) {
+            status_line = statusLine(code);
+            custom_status_line.clear();
+        } else {
+            char code_text[16];
+            int length = snprintf(code_text, sizeof(code_text), "HTTP/1.1 %d ", code);
+            custom_status_line.assign(code_text, length).append(message).append("\r\n");
+        }
+    }
+    
+    int getStatusCode() const { return status_code; }
+    
+    // Bytes of body that will follow the head
+    size_t bodySize() const {
+        if (body_parts.empty()) return body.size();
+        size_t length = 0;
+        for (const BodyPart& part : body_parts) length += part.size();
+        return length;
+    }
+    
+    // Case-insensitive, as proxied responses carry header names as the
+    // upstream spelled them
+    const std::pmr::string* findHeader(std::string_view key) const {
+        for (const auto& header : headers) {
+            if (equalsIgnoreCase(header.first, key)) return &header.second;
+        }
+        return nullptr;
+    }
+    
+    void setHeader(std::string_view key, std::string_view value) {
+        for (auto& header : headers) {
+            if (header.first == key) {
+                header.second.assign(value);
+                return;
+            }
+        }
+        headers.emplace_back(key, value);
+    }
+    
+    // Adds a header line even if one of that name is already set, for
+    // fields that may repeat such as Set-Cookie
+    void addHeader(std::string_view key, std::string_view value) {
+        headers.emplace_back(key, value);
+    }
+    
+    void eraseHeader(std::string_view key) {
+        headers.erase(std::remove_if(headers.begin(), headers.end(),
+                                     [&](const auto& header) { return header.first == key; }),
+                      headers.end());
+    }
+    
+    void setContentLength(size_t length) {
+        char digits[24];
+        auto result = std::to_chars(digits, digits + sizeof(digits), length);
+        setHeader("Content-Length", std::string_view(digits, result.ptr - digits));
+    }
+    
+    // Copies b into the response's own storage
+    void setBody(std::string_view b) {
+        body.assign(b);
+        body_parts.clear();
+        cached_file.reset();
+        setContentLength(body.size());
+    }
+    
+    void setBody(const char* b) { setBody(std::string_view(b)); }
+    
+    // Takes over a body built on the heap; it is queued without a copy
+    void setBody(std::string&& b) {
+        size_t length = b.size();
+        body.clear();
+        body_parts.clear();
+        body_parts.push_back(BodyPart::owned(std::move(b)));
+        cached_file.reset();
+        setContentLength(length);
+    }
+    
+    // Takes over a body built by a BodyWriter; moved rather than copied when
+    // it comes from this response's own resource
+    void setBody(std::pmr::string&& b) {
+        body = std::move(b);
+        body_parts.clear();
+        cached_file.reset();
+        setContentLength(body.size());
+    }
+
+    // Body made of file ranges and referenced buffers, sent without copying
+    void setBodyParts(std::vector<BodyPart> parts) {
+        size_t length = 0;
+        for (const BodyPart& part : parts) length += part.size();
+        body.clear();
+        body_parts.assign(std::make_move_iterator(parts.begin()), std::make_move_iterator(parts.end()));
+        cached_file.reset();
+        setContentLength(length);
+    }
+    
+    // Body and representation headers both come from the cache entry
+    void setCachedBody(std::shared_ptr<const CachedFile> entry) {
+        body.clear();
+        body_parts.clear();
+        body_parts.push_back(BodyPart::shared(entry, entry->body));
+        eraseHeader("Content-Length");
+        cached_file = std::move(entry);
+    }
+    
+    // For a response sent without its body: HEAD and 304 keep the
+    // Content-Length of the body they stand for, 1xx and 204 have none
+    void dropBody() {
+        body.clear();
+        body_parts.clear();
+        if (status_code < 200 || status_code == 204) eraseHeader("Content-Length");
+    }
+    
+    void setNotModified(const FileInfo& info) {
+        setStatus(304, "Not Modified");
+        setHeader("ETag", info.etag);
+        setHeader("Last-Modified", info.last_modified);
+    }
+    
+    // 404 page naming the requested file
+    void fileNotFound(std::string_view filepath) {
+        setStatus(404, "Not Found");
+        setHeader("Content-Type", "text/html");
+        HtmlWriter html(resource());
+        html.write("<h1>404 - File Not Found</h1><p>File: ", filepath, "</p>");
+        setBody(html.take());
+    }
+    
+    // Serve static files. Small files are answered from file_cache; a
+    // conditional request that still matches gets 304 without a body, and
+    // Range requests get 206 with one part or multipart/byteranges.
+    bool serveFile(const std::string& filepath, const HTTPRequest& req) {
+        // Refuse to leave the document root
+        if (filepath.find("/..") != std::string::npos) {
+            fileNotFound(filepath);
+            return false;
+        }
+        
+        std::string full_path = std::string(document_root) + filepath;
+        std::shared_ptr<const CachedFile> entry = file_cache.lookup(full_path);
+        std::shared_ptr<FileHandle> file;
+        std::optional<FileInfo> uncached_info;
+        
+        if (!entry) {
+            int fd = open(full_path.c_str(), O_RDONLY | O_CLOEXEC);
+            struct stat st;
+            if (fd < 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+                if (fd >= 0) close(fd);
+                fileNotFound(filepath);
+                return false;
+            }
+            file = std::make_shared<FileHandle>(fd);
+            
+            std::string contents;
+            if (file_cache.accepts(st.st_size) && readFile(fd, st.st_size, contents)) {
+                entry = std::make_shared<const CachedFile>(full_path, st, std::move(contents));
+                file_cache.insert(full_path, entry);
+            }
+            if (!entry) uncached_info.emplace(full_path, st);
+        }
+        
+        const FileInfo& info = entry ? entry->info : *uncached_info;
+        
+        // Content negotiation; Range requests always get the identity coding
+        std::string_view accept_encoding = req.getHeader("Accept-Encoding");
+        if (!accept_encoding.empty() && req.getHeader("Range").empty()) {
+            ContentEncoding encoding = negotiateEncoding(accept_encoding);
+            if (encoding != ContentEncoding::IDENTITY &&
+                sendEncodedVariant(req, full_path, info, encoding, entry, file)) {
+                return true;
+            }
+        }
+        
+        if (isNotModified(req, info)) {
+            setNotModified(info);
+            if (info.compressible) setHeader("Vary", "Accept-Encoding");
+            return true;
+        }
+        
+        // Plain full-body hits reuse the entry's pre-rendered headers
+        if (entry && req.getHeader("Range").empty()) {
+            setStatus(200, "OK");
+            setCachedBody(std::move(entry));
+            return true;
+        }
+        
+        if (entry) {
+            sendRepresentation(req, info, [&entry](size_t offset, size_t length) {
+                return BodyPart::shared(entry, std::string_view(entry->body).substr(offset, length));
+            });
+        } else {
+            // The body is sent from the file itself when the response goes out
+            sendRepresentation(req, info, [&file](size_t offset, size_t length) {
+                return BodyPart::file(FileRange{file, static_cast<off_t>(offset), length});
+            });
+        }
+        return true;
+    }
+    
+    // Compresses an in-memory body on the fly if the client accepts a coding
+    // and the type and size make it worthwhile
+    void compressBody(const HTTPRequest& req) {
+        std::string_view bytes;
+        if (!inMemoryBody(bytes) || findHeader("Content-Encoding")) return;
+        const std::pmr::string* type = findHeader("Content-Type");
+        if (!type || !isCompressible(*type)) return;
+        if (!compressor.shouldCompress(bytes.size())) return;
+        
+        setHeader("Vary", "Accept-Encoding");
+        ContentEncoding encoding = negotiateEncoding(req.getHeader("Accept-Encoding"));
+        if (encoding == ContentEncoding::IDENTITY) return;
+        
+        std::string compressed;
+        if (!Compressor::compress(encoding, bytes, compressed) || compressed.size() >= bytes.size()) return;
+        setBody(std::move(compressed));
+        setHeader("Content-Encoding", encodingToken(encoding));
+    }
+    
+    // The status line (status_line_size bytes) and header lines, without
+    // the Server/Date block and the blank line, plus the body, for a response
+    // kept serialized. False when the body isn't held in memory.
+    bool serialize(std::string& head, size_t& status_line_size, std::string& body_bytes) const {
+        std::string_view bytes;
+        if (!inMemoryBody(bytes)) return false;
+        head.assign(custom_status_line.empty() ? status_line : std::string_view(custom_status_line));
+        status_line_size = head.size();
+        if (cached_file) head += cached_file->headers;
+        for (const auto& header : headers) {
+            head.append(header.first).append(": ").append(header.second).append("\r\n");
+        }
+        body_bytes.assign(bytes);
+        return true;
+    }
+    
+    // Calls fn(name, value) for every header line of the response, cached
+    // representation headers included
+    template <typename Fn>
+    void forEachHeader(Fn&& fn) const {
+        if (cached_file) forEachHeaderLine(cached_file->headers, fn);
+        for (const auto& header : headers) {
+            fn(std::string_view(header.first), std::string_view(header.second));
+        }
+    }
+    
+    // Moves the body out as a list of parts, for writers that frame it
+    // themselves; an in-memory body is copied out of the arena
+    void takeBody(std::vector<BodyPart>& parts) {
+        if (body_parts.empty()) {
+            if (!body.empty()) parts.push_back(BodyPart::owned(std::string(body)));
+            body.clear();
+            return;
+        }
+        for (BodyPart& part : body_parts) {
+            if (part.size() > 0) parts.push_back(std::move(part));
+        }
+        body_parts.clear();
+    }
+    
+    // Full response as one string, for in-memory bodies
+    std::string build() const {
+        std::string_view line = custom_status_line.empty() ? status_line : std::string_view(custom_status_line);
+        std::shared_ptr<const std::string> common = commonHeaders();
+        std::string response;
+        response.reserve(line.size() + common->size() + 256 + bodySize());
+        response.append(line).append(*common);
+        if (cached_file) response += cached_file->headers;
+        for (const auto& header : headers) {
+            response.append(header.first).append(": ").append(header.second).append("\r\n");
+        }
+        response.append("\r\n");
+        response += body;
+        for (const BodyPart& part : body_parts) {
+            if (!part.isFile()) response += part.bytes();
+        }
+        return response;
+    }
+    
+    // Queues the response as a list of parts for one gathered write: the
+    // cached status line, the thread's Server/Date block, cached
+    // representation headers, this response's header lines, then the body
+    // moved or referenced in place. Header lines and an in-memory body are
+    // copied out of the arena into the queue's own buffer. The body is
+    // consumed.
+    void writeTo(OutputQueue& out) {
+        if (custom_status_line.empty()) {
+            out.append(BodyPart::literal(status_line));
+        } else {
+            out.append(custom_status_line);
+        }
+        std::shared_ptr<const std::string> common = commonHeaders();
+        out.append(BodyPart::shared(common, *common));
+        if (cached_file) out.append(BodyPart::shared(cached_file, cached_file->headers));
+        for (const auto& header : headers) {
+            out.append(header.first);
+            out.append(": ");
+            out.append(header.second);
+            out.append("\r\n");
+        }
+        out.append("\r\n");
+        
+        if (body_parts.empty()) {
+            out.append(body);
+            body.clear();
+        } else {
+            for (BodyPart& part : body_parts) {
+                out.append(std::move(part));
+            }
+            body_parts.clear();
+        }
+    }
+};
+
+struct CachedResponse;
+
+// Where a handler's response goes: serialized HTTP/1.1 in a connection's
+// output queue, or frames on an HTTP/2 stream. keep_alive is the connection
+// decision, announced by HTTP/1.1 in the Connection header.
+class ResponseWriter {
+public:
+    virtual ~ResponseWriter() = default;
+    virtual void send(HTTPResponse& response, bool keep_alive) = 0;
+    virtual void send(const CachedResponse& cached, bool keep_alive) = 0;
+};
+
+// Receives a request body incrementally instead of as one buffered string.
+// A new stream is created for every request to a streaming route.
+class BodyStream {
+public:
+    virtual ~BodyStream() = default;
+    virtual void onData(HTTPRequest& req, std::string_view chunk) = 0;
+    virtual void onComplete(HTTPRequest& req, HTTPResponse& res) = 0;
+};
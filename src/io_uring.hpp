@@ -0,0 +1,164 @@
+#pragma once
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+
+// Thin wrapper over the raw io_uring syscalls (liburing is not required):
+// maps the submission and completion rings, hands out SQEs, submits them in
+// one batch per wait and walks the completions. Owned by a single thread.
+class IoUring {
+private:
+    int ring_fd = -1;
+
+    void* sq_map = MAP_FAILED;
+    void* cq_map = MAP_FAILED;
+    size_t sq_map_size = 0;
+    size_t cq_map_size = 0;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t sqes_size = 0;
+
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned sq_mask = 0;
+    unsigned sq_entries = 0;
+    unsigned sq_local_tail = 0;    // SQEs handed out, published on submit
+    unsigned sq_submitted = 0;     // SQEs published to the kernel
+
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    io_uring_cqe* cqes = nullptr;
+
+    void* buf_ring_map = MAP_FAILED;
+    size_t buf_ring_size = 0;
+
+    template <typename T>
+    static T* at(void* base, uint32_t offset) {
+        return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+    }
+
+    int enter(unsigned to_submit, unsigned min_complete, unsigned flags,
+              const void* arg = nullptr, size_t arg_size = 0) {
+        int ret = static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete,
+                                           flags, arg, arg_size));
+        return ret < 0 ? -errno : ret;
+    }
+
+public:
+    IoUring() = default;
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    ~IoUring() {
+        if (buf_ring_map != MAP_FAILED) munmap(buf_ring_map, buf_ring_size);
+        if (sqes != MAP_FAILED) munmap(sqes, sqes_size);
+        if (cq_map != MAP_FAILED && cq_map != sq_map) munmap(cq_map, cq_map_size);
+        if (sq_map != MAP_FAILED) munmap(sq_map, sq_map_size);
+        if (ring_fd >= 0) close(ring_fd);
+    }
+
+    // Returns 0 or a negative errno
+    int init(unsigned entries, unsigned flags) {
+        io_uring_params params{};
+        params.flags = flags;
+        ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (ring_fd < 0) return -errno;
+
+        sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_map = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_map) sq_map_size = cq_map_size = std::max(sq_map_size, cq_map_size);
+
+        sq_map = mmap(nullptr, sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring_fd, IORING_OFF_SQ_RING);
+        if (sq_map == MAP_FAILED) return -errno;
+        cq_map = single_map ? sq_map
+                            : mmap(nullptr, cq_map_size, PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+        if (cq_map == MAP_FAILED) return -errno;
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe*>(mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+                                               MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES));
+        if (sqes == MAP_FAILED) return -errno;
+
+        sq_head = at<unsigned>(sq_map, params.sq_off.head);
+        sq_tail = at<unsigned>(sq_map, params.sq_off.tail);
+        sq_mask = *at<unsigned>(sq_map, params.sq_off.ring_mask);
+        sq_entries = params.sq_entries;
+        // SQE slots are used in ring order, so the index array is the identity
+        unsigned* array = at<unsigned>(sq_map, params.sq_off.array);
+        for (unsigned i = 0; i < sq_entries; ++i) array[i] = i;
+        sq_local_tail = sq_submitted = *sq_tail;
+
+        cq_head = at<unsigned>(cq_map, params.cq_off.head);
+        cq_tail = at<unsigned>(cq_map, params.cq_off.tail);
+        cq_mask = *at<unsigned>(cq_map, params.cq_off.ring_mask);
+        cqes = at<io_uring_cqe>(cq_map, params.cq_off.cqes);
+        return 0;
+    }
+
+    // A zeroed SQE, submitting queued ones first if the ring is full
+    io_uring_sqe* getSqe() {
+        if (sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries) {
+            submit(0);
+            if (sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries) return nullptr;
+        }
+        io_uring_sqe* sqe = &sqes[sq_local_tail & sq_mask];
+        ++sq_local_tail;
+        memset(sqe, 0, sizeof(*sqe));
+        return sqe;
+    }
+
+    // Submits every queued SQE and waits for at least wait_for completions,
+    // all in one syscall. A timeout bounds the wait (-ETIME when it expires
+    // with nothing submitted). Returns the number submitted or a negative errno.
+    int submit(unsigned wait_for, const __kernel_timespec* timeout = nullptr) {
+        unsigned to_submit = sq_local_tail - sq_submitted;
+        __atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+        sq_submitted = sq_local_tail;
+        if (to_submit == 0 && wait_for == 0) return 0;
+        unsigned flags = wait_for ? IORING_ENTER_GETEVENTS : 0;
+        if (!timeout) return enter(to_submit, wait_for, flags);
+        io_uring_getevents_arg arg{};
+        arg.ts = reinterpret_cast<uint64_t>(timeout);
+        return enter(to_submit, wait_for, flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    }
+
+    // Calls handle for each available completion
+    template <typename Handler>
+    void forEachCompletion(Handler&& handle) {
+        unsigned head = *cq_head;
+        while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+            io_uring_cqe cqe = cqes[head & cq_mask];
+            __atomic_store_n(cq_head, ++head, __ATOMIC_RELEASE);
+            handle(cqe);
+        }
+    }
+
+    // Registers a ring of entries (a power of two) provided buffers under
+    // group; receives with IOSQE_BUFFER_SELECT pick from it. Returns null on
+    // failure.
+    io_uring_buf_ring* registerBufferRing(unsigned entries, uint16_t group) {
+        buf_ring_size = entries * sizeof(io_uring_buf);
+        buf_ring_map = mmap(nullptr, buf_ring_size, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buf_ring_map == MAP_FAILED) return nullptr;
+
+        io_uring_buf_reg reg{};
+        reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring_map);
+        reg.ring_entries = entries;
+        reg.bgid = group;
+        if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+            return nullptr;
+        }
+        return static_cast<io_uring_buf_ring*>(buf_ring_map);
+    }
+};
@@ -0,0 +1,87 @@
+#include "listener.hpp"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "logger.hpp"
+
+// Optional tuning: a kernel without the option still gets a working listener
+static void setOptional(int fd, int level, int option, int value, const char* name) {
+    if (setsockopt(fd, level, option, &value, sizeof(value)) < 0) {
+        logger.warn("⚠️ ", name, " not set: ", strerror(errno));
+    }
+}
+
+static int bindAndListen(const Config& config, const std::string& host, std::string& error) {
+    sockaddr_storage address{};
+    socklen_t address_size;
+    auto* v6 = reinterpret_cast<sockaddr_in6*>(&address);
+    auto* v4 = reinterpret_cast<sockaddr_in*>(&address);
+    if (inet_pton(AF_INET6, host.c_str(), &v6->sin6_addr) == 1) {
+        v6->sin6_family = AF_INET6;
+        v6->sin6_port = htons(config.getPort());
+        address_size = sizeof(sockaddr_in6);
+    } else if (inet_pton(AF_INET, host.c_str(), &v4->sin_addr) == 1) {
+        v4->sin_family = AF_INET;
+        v4->sin_port = htons(config.getPort());
+        address_size = sizeof(sockaddr_in);
+    } else {
+        error = "invalid bind address " + host;
+        return -1;
+    }
+    
+    int fd = socket(address.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        error = std::string("socket: ") + strerror(errno);
+        return -1;
+    }
+    
+    int one = 1;
+    bool ok = setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == 0;
+    if (ok && config.isReusePort()) {
+        ok = setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) == 0;
+    }
+    if (ok && address.ss_family == AF_INET6) {
+        int v6_only = config.isIpv6Only() ? 1 : 0;
+        ok = setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6_only, sizeof(v6_only)) == 0;
+    }
+    if (!ok) {
+        error = std::string("socket options: ") + strerror(errno);
+        close(fd);
+        return -1;
+    }
+    
+    if (config.isTcpNoDelay()) setOptional(fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+    if (config.getDeferAccept() > 0) {
+        setOptional(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, config.getDeferAccept(), "TCP_DEFER_ACCEPT");
+    }
+    if (config.getFastOpenQueue() > 0) {
+        setOptional(fd, IPPROTO_TCP, TCP_FASTOPEN, config.getFastOpenQueue(), "TCP_FASTOPEN");
+    }
+    
+    if (bind(fd, reinterpret_cast<sockaddr*>(&address), address_size) < 0) {
+        error = std::string("bind ") + host + ": " + strerror(errno);
+        close(fd);
+        return -1;
+    }
+    if (listen(fd, config.getBacklog()) < 0) {
+        error = std::string("listen: ") + strerror(errno);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int openListener(const Config& config, std::string& error) {
+    int fd = bindAndListen(config, config.getBindAddress(), error);
+    // The default dual-stack address needs IPv6; fall back to IPv4 only
+    if (fd < 0 && config.getBindAddress() == "::" && errno == EAFNOSUPPORT) {
+        fd = bindAndListen(config, "0.0.0.0", error);
+    }
+    return fd;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <string>
+
+#include "config.hpp"
+
+// Opens a nonblocking listening socket as configured: bind address (IPv6
+// dual-stack by default), backlog, SO_REUSEPORT and the TCP_NODELAY,
+// TCP_DEFER_ACCEPT and TCP_FASTOPEN options, which accepted sockets inherit.
+// Returns the fd, or -1 with the reason in error.
+int openListener(const Config& config, std::string& error);
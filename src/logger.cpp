@@ -0,0 +1,11 @@
+#include "logger.hpp"
+
+std::optional<LogLevel> parseLogLevel(std::string_view name) {
+    if (name == "debug") return LogLevel::DEBUG;
+    if (name == "info") return LogLevel::INFO;
+    if (name == "warn") return LogLevel::WARN;
+    if (name == "error") return LogLevel::ERROR;
+    return std::nullopt;
+}
+
+Logger logger;
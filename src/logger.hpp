@@ -0,0 +1,360 @@
+#pragma once
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Log severities; records below the configured level are never built
+enum class LogLevel { DEBUG, INFO, WARN, ERROR };
+
+std::optional<LogLevel> parseLogLevel(std::string_view name);
+
+// One log entry as it travels from a request thread to the writer. Access
+// records keep their fields unformatted; text holds "METHOD path" for them.
+struct LogRecord {
+    static constexpr size_t TEXT_SIZE = 232;
+    
+    int64_t time_us = 0;    // wall clock, microseconds since the epoch
+    LogLevel level = LogLevel::INFO;
+    bool access = false;
+    uint16_t status = 0;
+    uint32_t length = 0;
+    uint64_t bytes = 0;
+    uint64_t latency_us = 0;
+    char text[TEXT_SIZE];
+};
+
+// Single-producer/single-consumer ring owned by one logging thread. The
+// producer never blocks: when the writer falls behind, records are dropped
+// and counted.
+class LogRing {
+public:
+    static constexpr size_t CAPACITY = 1024;   // power of two
+
+private:
+    std::array<LogRecord, CAPACITY> slots;
+    alignas(64) std::atomic<size_t> head{0};   // next slot to fill, producer side
+    alignas(64) std::atomic<size_t> tail{0};   // next slot to drain, consumer side
+    alignas(64) std::atomic<uint64_t> dropped{0};
+
+public:
+    // Slot to fill, or null (and one more drop) when the ring is full
+    LogRecord* reserve() {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == CAPACITY) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        return &slots[h & (CAPACITY - 1)];
+    }
+    
+    void commit() {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+    
+    // Oldest undrained record, or null; release() frees it for the producer
+    const LogRecord* peek() const {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) return nullptr;
+        return &slots[t & (CAPACITY - 1)];
+    }
+    
+    void release() {
+        tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+    
+    uint64_t droppedCount() const { return dropped.load(std::memory_order_relaxed); }
+};
+
+// Asynchronous logger. Each thread appends to its own LogRing without locks;
+// a background writer drains the rings and writes batches with writev.
+// Messages are passed as pieces (strings and numbers) and are only formatted
+// into the record when their level is enabled.
+class Logger {
+private:
+    static constexpr size_t MAX_IOV = 256;
+    static constexpr int IDLE_SLEEP_MS = 5;
+    
+    std::atomic<int> min_level{static_cast<int>(LogLevel::INFO)};
+    std::atomic<bool> access_log{true};
+    int out_fd = STDOUT_FILENO;
+    
+    std::mutex rings_mutex;   // taken when a thread first logs and by the writer
+    std::vector<std::unique_ptr<LogRing>> rings;
+    uint64_t dropped_reported = 0;
+    
+    std::atomic<bool> running{false};
+    std::thread writer;
+    
+    // Writer-side state: the "[date time] " prefix is formatted once a second
+    std::vector<char> lines = std::vector<char>(MAX_IOV / 2 * (LogRecord::TEXT_SIZE + 64));
+    int64_t prefix_second = -1;
+    char prefix[32];
+    size_t prefix_length = 0;
+    
+    LogRing& localRing() {
+        thread_local LogRing* ring = nullptr;
+        if (!ring) {
+            auto owned = std::make_unique<LogRing>();
+            ring = owned.get();
+            std::lock_guard<std::mutex> lock(rings_mutex);
+            rings.push_back(std::move(owned));
+        }
+        return *ring;
+    }
+    
+    static int64_t nowMicros() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+    
+    static void appendPiece(char*& p, char* end, std::string_view piece) {
+        size_t n = std::min(piece.size(), static_cast<size_t>(end - p));
+        memcpy(p, piece.data(), n);
+        p += n;
+    }
+    
+    static void appendPiece(char*& p, char* end, const std::string& piece) {
+        appendPiece(p, end, std::string_view(piece));
+    }
+    
+    static void appendPiece(char*& p, char* end, const char* piece) {
+        appendPiece(p, end, std::string_view(piece));
+    }
+    
+    static void appendPiece(char*& p, char* end, char piece) {
+        if (p < end) *p++ = piece;
+    }
+    
+    template <typename Number, typename = std::enable_if_t<std::is_arithmetic_v<Number>>>
+    static void appendPiece(char*& p, char* end, Number piece) {
+        auto result = std::to_chars(p, end, piece);
+        if (result.ec == std::errc()) p = result.ptr;
+    }
+    
+    template <typename... Pieces>
+    void enqueue(LogLevel level, const Pieces&... pieces) {
+        LogRing& ring = localRing();
+        LogRecord* record = ring.reserve();
+        if (!record) return;
+        record->time_us = nowMicros();
+        record->level = level;
+        record->access = false;
+        char* p = record->text;
+        char* end = record->text + LogRecord::TEXT_SIZE;
+        (appendPiece(p, end, pieces), ...);
+        record->length = static_cast<uint32_t>(p - record->text);
+        ring.commit();
+    }
+    
+    void refreshPrefix(int64_t second) {
+        if (second == prefix_second) return;
+        prefix_second = second;
+        time_t t = static_cast<time_t>(second);
+        tm local{};
+        localtime_r(&t, &local);
+        prefix_length = strftime(prefix, sizeof(prefix), "[%Y-%m-%d %H:%M:%S] ", &local);
+    }
+    
+    // Writes every iovec, resuming after partial writes
+    void writeAll(iovec* iov, int count) {
+        while (count > 0) {
+            ssize_t written = writev(out_fd, iov, count);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                return;
+            }
+            while (count > 0 && static_cast<size_t>(written) >= iov->iov_len) {
+                written -= iov->iov_len;
+                ++iov;
+                --count;
+            }
+            if (count > 0) {
+                iov->iov_base = static_cast<char*>(iov->iov_base) + written;
+                iov->iov_len -= written;
+            }
+        }
+    }
+    
+    // Drains every ring once. Each line is two iovecs: the shared timestamp
+    // prefix and the record's formatted body. Returns the records written.
+    size_t drain() {
+        iovec iov[MAX_IOV];
+        int count = 0;
+        size_t used = 0;
+        size_t written = 0;
+        
+        auto flushBatch = [&]() {
+            writeAll(iov, count);
+            count = 0;
+            used = 0;
+        };
+        
+        auto emit = [&](int64_t time_us, std::string_view body) {
+            int64_t second = time_us / 1000000;
+            // The prefix buffer is shared by the whole batch, so a new second
+            // starts a new batch
+            if (count > 0 && (second != prefix_second || count + 2 > static_cast<int>(MAX_IOV))) flushBatch();
+            refreshPrefix(second);
+            memcpy(lines.data() + used, body.data(), body.size());
+            iov[count++] = {prefix, prefix_length};
+            iov[count++] = {lines.data() + used, body.size()};
+            used += body.size();
+            ++written;
+        };
+        
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        uint64_t dropped = 0;
+        for (auto& ring : rings) {
+            while (const LogRecord* record = ring->peek()) {
+                char line[LogRecord::TEXT_SIZE + 64];
+                char* p = line;
+                char* end = line + sizeof(line) - 1;
+                std::string_view text(record->text, record->length);
+                if (record->access) {
+                    appendPiece(p, end, text);
+                    appendPiece(p, end, ' ');
+                    appendPiece(p, end, record->status);
+                    appendPiece(p, end, ' ');
+                    appendPiece(p, end, record->bytes);
+                    appendPiece(p, end, "B ");
+                    appendPiece(p, end, record->latency_us);
+                    appendPiece(p, end, "us");
+                } else {
+                    if (record->level == LogLevel::DEBUG) appendPiece(p, end, "[DEBUG] ");
+                    if (record->level == LogLevel::WARN) appendPiece(p, end, "[WARN] ");
+                    if (record->level == LogLevel::ERROR) appendPiece(p, end, "[ERROR] ");
+                    appendPiece(p, end, text);
+                }
+                *p++ = '\n';
+                emit(record->time_us, std::string_view(line, p - line));
+                ring->release();
+            }
+            dropped += ring->droppedCount();
+        }
+        
+        if (dropped > dropped_reported) {
+            char line[64];
+            char* p = line;
+            appendPiece(p, line + sizeof(line) - 1, "[WARN] log buffer full, dropped ");
+            appendPiece(p, line + sizeof(line) - 1, dropped - dropped_reported);
+            appendPiece(p, line + sizeof(line) - 1, " records");
+            *p++ = '\n';
+            emit(nowMicros(), std::string_view(line, p - line));
+            dropped_reported = dropped;
+        }
+        if (count > 0) flushBatch();
+        return written;
+    }
+    
+    void run() {
+        while (running.load(std::memory_order_relaxed)) {
+            if (drain() == 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(IDLE_SLEEP_MS));
+            }
+        }
+        drain();
+    }
+
+public:
+    ~Logger() { stop(); }
+    
+    void setLevel(LogLevel level) { min_level = static_cast<int>(level); }
+    void setVerbose(bool v) { if (v) setLevel(LogLevel::DEBUG); }
+    void setAccessLog(bool enabled) { access_log = enabled; }
+    
+    // Sends output to path (appended) instead of stdout
+    bool openFile(const std::string& path) {
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0) return false;
+        out_fd = fd;
+        return true;
+    }
+    
+    void start() {
+        if (running.exchange(true)) return;
+        writer = std::thread(&Logger::run, this);
+    }
+    
+    // Flushes what is queued and stops the writer
+    void stop() {
+        if (!running.exchange(false)) return;
+        writer.join();
+    }
+    
+    bool enabled(LogLevel level) const {
+        return static_cast<int>(level) >= min_level.load(std::memory_order_relaxed);
+    }
+    
+    bool accessEnabled() const { return access_log.load(std::memory_order_relaxed); }
+    
+    // Records lost because a thread's ring was full
+    uint64_t droppedCount() {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        uint64_t dropped = 0;
+        for (auto& ring : rings) dropped += ring->droppedCount();
+        return dropped;
+    }
+    
+    template <typename... Pieces>
+    void debug(const Pieces&... pieces) {
+        if (enabled(LogLevel::DEBUG)) enqueue(LogLevel::DEBUG, pieces...);
+    }
+    
+    template <typename... Pieces>
+    void log(const Pieces&... pieces) {
+        if (enabled(LogLevel::INFO)) enqueue(LogLevel::INFO, pieces...);
+    }
+    
+    template <typename... Pieces>
+    void warn(const Pieces&... pieces) {
+        if (enabled(LogLevel::WARN)) enqueue(LogLevel::WARN, pieces...);
+    }
+    
+    template <typename... Pieces>
+    void error(const Pieces&... pieces) {
+        if (enabled(LogLevel::ERROR)) enqueue(LogLevel::ERROR, pieces...);
+    }
+    
+    // One access-log line: "METHOD path status bytesB latencyus"
+    void access(std::string_view method, std::string_view path, int status,
+                uint64_t bytes, uint64_t latency_us) {
+        if (!accessEnabled()) return;
+        LogRing& ring = localRing();
+        LogRecord* record = ring.reserve();
+        if (!record) return;
+        record->time_us = nowMicros();
+        record->level = LogLevel::INFO;
+        record->access = true;
+        record->status = static_cast<uint16_t>(status);
+        record->bytes = bytes;
+        record->latency_us = latency_us;
+        char* p = record->text;
+        char* end = record->text + LogRecord::TEXT_SIZE;
+        appendPiece(p, end, method);
+        appendPiece(p, end, ' ');
+        appendPiece(p, end, path);
+        record->length = static_cast<uint32_t>(p - record->text);
+        ring.commit();
+    }
+};
+
+extern Logger logger;
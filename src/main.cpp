@@ -0,0 +1,174 @@
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "blocking_pool.hpp"
+#include "compression.hpp"
+#include "config.hpp"
+#include "directory_index.hpp"
+#include "event_loop.hpp"
+#include "listener.hpp"
+#include "logger.hpp"
+#include "response_cache.hpp"
+#include "routes.hpp"
+#include "static_files.hpp"
+#include "stats.hpp"
+#include "uring_loop.hpp"
+
+int main(int argc, char* argv[]) {
+    Config config = Config::parseArgs(argc, argv);
+    std::optional<LogLevel> level = parseLogLevel(config.getLogLevel());
+    if (!level) {
+        std::cerr << "Unknown log level: " << config.getLogLevel() << "\n";
+        return 1;
+    }
+    if (!config.getLogFile().empty() && !logger.openFile(config.getLogFile())) {
+        std::cerr << "Cannot open log file: " << config.getLogFile() << "\n";
+        return 1;
+    }
+    if (config.getIoBackend() != "epoll" && config.getIoBackend() != "io_uring") {
+        std::cerr << "Unknown I/O backend: " << config.getIoBackend() << "\n";
+        return 1;
+    }
+    if (config.getProxyBalance() != "round-robin" && config.getProxyBalance() != "least-outstanding") {
+        std::cerr << "Unknown proxy balancing: " << config.getProxyBalance() << "\n";
+        return 1;
+    }
+    // Sends use MSG_NOSIGNAL, but sendfile and splice to a socket the
+    // client reset would still raise SIGPIPE
+    signal(SIGPIPE, SIG_IGN);
+    logger.setLevel(*level);
+    logger.setVerbose(config.isVerbose());
+    logger.setAccessLog(config.isAccessLogEnabled());
+    logger.start();
+    
+    logger.log("🚀 Starting C++ HTTP Server 2.0...");
+    logger.log("📋 Configuration: port=" + std::to_string(config.getPort()) + 
+               ", document_root=" + config.getDocumentRoot() +
+               ", keep_alive_timeout=" + std::to_string(config.getKeepAliveTimeout()) + "s" +
+               ", max_connections=" + std::to_string(config.getMaxConnections()) +
+               ", verbose=" + (config.isVerbose() ? "true" : "false"));
+    
+    // One SO_REUSEPORT listener per event loop lets the kernel spread
+    // connections across them; otherwise the loops share one listener
+    int listener_count = config.isReusePort() ? config.getMaxThreads() : 1;
+    std::vector<int> listeners;
+    for (int i = 0; i < listener_count; ++i) {
+        std::string error;
+        int fd = openListener(config, error);
+        if (fd < 0) {
+            logger.error("❌ Listen failed (", error, ") - try changing port or killing existing process");
+            return 1;
+        }
+        listeners.push_back(fd);
+    }
+    auto listenerFor = [&](int loop) { return listeners[loop % listeners.size()]; };
+    
+    logger.log("✅ Server listening on http://localhost:" + std::to_string(config.getPort()) +
+               " (bind " + config.getBindAddress() + ", " + std::to_string(listeners.size()) +
+               " listener(s), backlog " + std::to_string(config.getBacklog()) + ")");
+    logger.log("📊 Available routes: /, /api, /stats, /metrics, /files, /hello, /static/*, /check, /delay, /echo (POST)");
+    
+    // Create some test files in document root
+    std::string root = config.getDocumentRoot();
+    std::ofstream test_file(root + "/test.html");
+    test_file << "<html><body><h1>Test File</h1><p>Served by C++ HTTP Server from " << root << "!</p></body></html>";
+    test_file.close();
+    
+    std::ofstream api_file(root + "/api.json");
+    api_file << "{\"message\": \"Static JSON file from " << root << "\"}";
+    api_file.close();
+
+    logger.debug("Created test files in ", root);
+    
+    // /files is answered from this index, which follows the tree via inotify
+    directory_index.start(root);
+    
+    file_cache.configure(config.getCacheSize(), config.getCacheMaxFile());
+    compressor.configure(config.getCompressMinSize(), config.getCompressMaxSize(), config.getCacheSize() / 4);
+    response_cache.setCapacity(config.getCacheSize() / 4);
+    
+    // Async handlers offload blocking calls to these threads
+    blocking_pool.start(config.getBlockingThreads());
+    
+    // Routes are built once and shared read-only by all event loops
+    Router routes = setupRoutes(config.getDocumentRoot());
+    ProxyOptions proxy_options;
+    proxy_options.balance = config.getProxyBalance() == "least-outstanding" ? ProxyBalance::LEAST_OUTSTANDING
+                                                                            : ProxyBalance::ROUND_ROBIN;
+    proxy_options.timeout = std::chrono::seconds(config.getProxyTimeout());
+    proxy_options.max_idle = config.getProxyMaxIdle();
+    proxy_options.max_fails = config.getProxyMaxFails();
+    proxy_options.fail_timeout = std::chrono::seconds(config.getProxyFailTimeout());
+    proxy_options.max_buffered_body = std::max(config.getMaxBodySize(), proxy_options.max_buffered_body);
+    for (const std::string& spec : config.getProxies()) {
+        size_t equals = spec.find('=');
+        if (equals == std::string::npos || equals == 0 || equals + 1 == spec.size()) {
+            logger.error("❌ Bad --proxy ", spec, ", expected PATTERN=UPSTREAM[,UPSTREAM...]");
+            return 1;
+        }
+        std::string pattern = spec.substr(0, equals);
+        std::vector<std::string> upstreams;
+        size_t start = equals + 1;
+        while (start <= spec.size()) {
+            size_t comma = std::min(spec.find(',', start), spec.size());
+            if (comma > start) upstreams.push_back(spec.substr(start, comma - start));
+            start = comma + 1;
+        }
+        try {
+            routes.proxy(pattern, upstreams, proxy_options);
+        } catch (const std::invalid_argument& e) {
+            logger.error("❌ Proxy route ", pattern, ": ", e.what());
+            return 1;
+        }
+        logger.log("🔀 Proxying " + pattern + " to " + spec.substr(equals + 1));
+    }
+    const Router router = std::move(routes);
+    stats.setRouteNames(router.routeNames());
+    
+    // Connection caps are enforced across all loops
+    ConnectionLimiter limiter(config.getMaxConnections(), config.getMaxConnectionsPerIp());
+    
+    // Event loops accept for themselves; the main thread only waits
+    if (config.getIoBackend() == "io_uring") {
+        std::vector<std::unique_ptr<UringLoop>> uring_loops;
+        int ret = 0;
+        for (int i = 0; i < config.getMaxThreads() && ret == 0; ++i) {
+            uring_loops.push_back(std::make_unique<UringLoop>(config, router, limiter, listenerFor(i)));
+            ret = uring_loops.back()->start();
+        }
+        if (ret == 0) {
+            logger.log("🧵 io_uring event loop threads: " + std::to_string(uring_loops.size()));
+            while (true) pause();
+        }
+        if (uring_loops.size() > 1) {
+            // Loops already running keep serving their listeners
+            logger.error("❌ io_uring event loop creation failed: ", strerror(-ret));
+            return 1;
+        }
+        logger.warn("⚠️ io_uring unavailable (", strerror(-ret), "), falling back to epoll");
+    }
+    
+    // Start event loops
+    std::vector<std::unique_ptr<EventLoop>> loops;
+    for (int i = 0; i < config.getMaxThreads(); ++i) {
+        loops.push_back(std::make_unique<EventLoop>(config, router, limiter, listenerFor(i)));
+        if (!loops.back()->start()) {
+            logger.error("❌ Event loop creation failed");
+            return 1;
+        }
+    }
+    logger.log("🧵 Event loop threads: " + std::to_string(loops.size()));
+    
+    while (true) pause();
+}
@@ -0,0 +1,263 @@
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Open file descriptor shared by the responses that send from it
+struct FileHandle {
+    int fd;
+    
+    explicit FileHandle(int file_fd) : fd(file_fd) {}
+    ~FileHandle() { close(fd); }
+    FileHandle(const FileHandle&) = delete;
+    FileHandle& operator=(const FileHandle&) = delete;
+};
+
+// Byte range of an open file, sent straight from the page cache with sendfile.
+// A piped range is instead the next length bytes waiting in a pipe, file
+// being its read end; they are spliced out in order and offset is unused.
+struct FileRange {
+    std::shared_ptr<FileHandle> file;
+    off_t offset = 0;
+    size_t length = 0;
+    bool piped = false;
+};
+
+// One piece of a response: owned bytes, bytes kept alive by owner (e.g. a
+// cache entry) or static storage and referenced in place, or a range of an
+// open file or a pipe
+struct BodyPart {
+    std::string data;
+    std::shared_ptr<const void> owner;
+    std::string_view view;
+    bool referenced = false;   // view is used instead of data
+    FileRange range;
+    
+    static BodyPart owned(std::string bytes) {
+        BodyPart part;
+        part.data = std::move(bytes);
+        return part;
+    }
+    
+    static BodyPart shared(std::shared_ptr<const void> owner, std::string_view bytes) {
+        BodyPart part;
+        part.owner = std::move(owner);
+        part.view = bytes;
+        part.referenced = true;
+        return part;
+    }
+    
+    // Bytes that live for the whole program, such as string literals
+    static BodyPart literal(std::string_view bytes) {
+        return shared(nullptr, bytes);
+    }
+    
+    static BodyPart file(const FileRange& range) {
+        BodyPart part;
+        part.range = range;
+        return part;
+    }
+    
+    static BodyPart pipe(std::shared_ptr<FileHandle> read_end, size_t length) {
+        BodyPart part;
+        part.range.file = std::move(read_end);
+        part.range.length = length;
+        part.range.piped = true;
+        return part;
+    }
+    
+    bool isFile() const { return range.file != nullptr; }
+    std::string_view bytes() const { return referenced ? view : std::string_view(data); }
+    size_t size() const { return isFile() ? range.length : bytes().size(); }
+};
+
+// Ordered queue of pending output for one connection. In-memory parts are
+// gathered into a single sendmsg(2); small owned writes are coalesced, larger
+// ones are moved in. File ranges are sent with sendfile(2) and piped ones
+// with splice(2), with MSG_MORE on whatever precedes them so headers share
+// packets with the file data.
+class OutputQueue {
+private:
+    static constexpr size_t COALESCE_LIMIT = 256;
+    static constexpr size_t SPARE_LIMIT = 64 * 1024;
+    
+    // A flat vector consumed from head: unlike a deque it keeps its storage
+    // when drained, so steady keep-alive traffic doesn't allocate
+    std::vector<BodyPart> parts;
+    size_t head = 0;
+    size_t offset = 0;   // bytes of the front in-memory part already sent
+    size_t queued = 0;   // unsent bytes over all parts
+    bool sealed = false; // the back part is being written and must not grow
+    std::string spare;   // buffer of a sent owned part, reused by the next one
+    
+    bool backIsOwned() const {
+        return !sealed && !empty() && !parts.back().isFile() && !parts.back().referenced;
+    }
+    
+    void recycle(BodyPart& part) {
+        if (!part.isFile() && !part.referenced && part.data.capacity() > spare.capacity() &&
+            part.data.capacity() <= SPARE_LIMIT) {
+            spare.swap(part.data);
+        }
+    }
+    
+    void popFront() {
+        recycle(parts[head]);
+        parts[head] = BodyPart();
+        offset = 0;
+        if (++head == parts.size()) {
+            parts.clear();
+            head = 0;
+        } else if (head >= 32 && head * 2 >= parts.size()) {
+            parts.erase(parts.begin(), parts.begin() + head);
+            head = 0;
+        }
+    }
+    
+public:
+    static constexpr int MAX_IOV = 64;
+    
+    bool empty() const { return head == parts.size(); }
+    
+    // Bytes queued and not yet sent
+    size_t size() const { return queued; }
+    
+    // Owned bytes always live on the heap (never in a short string's inline
+    // buffer), so growing the vector never moves bytes an asynchronous send
+    // is reading
+    void append(std::string_view data) {
+        if (data.empty()) return;
+        queued += data.size();
+        if (!backIsOwned()) {
+            parts.emplace_back();
+            spare.clear();
+            parts.back().data.swap(spare);
+            parts.back().data.reserve(COALESCE_LIMIT);
+            sealed = false;
+        }
+        parts.back().data += data;
+    }
+    
+    void append(BodyPart part) {
+        if (part.size() == 0) return;
+        if (!part.isFile() && !part.referenced && part.data.size() <= COALESCE_LIMIT) {
+            append(std::string_view(part.data));
+            return;
+        }
+        queued += part.size();
+        parts.push_back(std::move(part));
+        sealed = false;
+    }
+    
+    void clear() {
+        for (size_t i = head; i < parts.size(); ++i) recycle(parts[i]);
+        parts.clear();
+        head = 0;
+        offset = 0;
+        queued = 0;
+        sealed = false;
+    }
+    
+    // Keeps later appends out of the current parts, whose bytes an
+    // asynchronous send is still reading
+    void seal() { sealed = true; }
+    
+    // The unsent in-memory run at the front, up to the next file range, as at
+    // most max iovecs. Returns the count, 0 when a file range is at the front.
+    // more is set when parts remain after the gathered ones.
+    int gather(iovec* iov, int max, bool& more) const {
+        int count = 0;
+        size_t next = head;
+        for (; next < parts.size() && count < max && !parts[next].isFile(); ++next) {
+            std::string_view bytes = parts[next].bytes();
+            size_t skip = next == head ? offset : 0;
+            iov[count++] = {const_cast<char*>(bytes.data()) + skip, bytes.size() - skip};
+        }
+        more = next < parts.size();
+        return count;
+    }
+    
+    // Drops in-memory parts from the front once sent bytes cover them
+    void consume(size_t sent) {
+        queued -= sent;
+        while (sent > 0) {
+            size_t remaining = parts[head].bytes().size() - offset;
+            if (sent < remaining) {
+                offset += sent;
+                return;
+            }
+            sent -= remaining;
+            popFront();
+        }
+    }
+    
+    // File range at the front, or null if the front is in memory
+    FileRange* frontFile() {
+        return !empty() && parts[head].isFile() ? &parts[head].range : nullptr;
+    }
+    
+    // Advances the front file range past bytes written elsewhere
+    void consumeFile(size_t sent) {
+        FileRange& range = parts[head].range;
+        queued -= sent;
+        range.offset += sent;
+        range.length -= sent;
+        if (range.length == 0) popFront();
+    }
+    
+    // Writes until drained (true) or the socket would block or fails (false,
+    // errno tells which)
+    bool flush(int fd, size_t& bytes_sent) {
+        bytes_sent = 0;
+        while (!empty()) {
+            BodyPart& front = parts[head];
+            ssize_t sent;
+            
+            if (front.isFile()) {
+                if (front.range.piped) {
+                    sent = splice(front.range.file->fd, nullptr, fd, nullptr, front.range.length,
+                                  SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                } else {
+                    sent = sendfile(fd, front.range.file->fd, &front.range.offset, front.range.length);
+                }
+                if (sent > 0) {
+                    queued -= sent;
+                    front.range.length -= sent;
+                    if (front.range.length == 0) popFront();
+                } else if (sent == 0) {
+                    // File shrank underneath us, or the pipe's writer went
+                    // away; the response can't be completed
+                    errno = EIO;
+                    return false;
+                }
+            } else {
+                iovec iov[MAX_IOV];
+                bool more;
+                msghdr msg{};
+                msg.msg_iov = iov;
+                msg.msg_iovlen = gather(iov, MAX_IOV, more);
+                int flags = MSG_NOSIGNAL;
+                if (more) flags |= MSG_MORE;
+                sent = sendmsg(fd, &msg, flags);
+                if (sent > 0) consume(sent);
+            }
+            
+            if (sent > 0) {
+                bytes_sent += sent;
+            } else if (errno != EINTR) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
@@ -0,0 +1,900 @@
+#include "proxy.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <charconv>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "body_writer.hpp"
+#include "executor.hpp"
+#include "logger.hpp"
+#include "stats.hpp"
+
+static constexpr size_t READ_SIZE = 16 * 1024;
+static constexpr size_t MAX_RESPONSE_HEAD = 64 * 1024;
+static constexpr size_t SPLICE_MIN = 64 * 1024;     // fixed-length bodies at least this long are spliced
+static constexpr int PIPE_SIZE = 1024 * 1024;
+static constexpr size_t HIGH_WATER = 256 * 1024;    // copied bodies wait for the client above this
+
+// Outcome of one step of talking to an upstream
+enum class Io { OK, CLOSED, TIMEOUT, FAILED, ABORTED };
+
+// Status line and header fields of an upstream response; the views point
+// into the exchange's buffer and last until more is read into it
+struct UpstreamResponse {
+    int status = 0;
+    std::string_view reason;
+    std::vector<HTTPHeader> headers;
+    std::string_view connection;
+    bool chunked = false;
+    bool has_length = false;
+    size_t content_length = 0;
+    bool close = false;   // the upstream closes the connection after this response
+    size_t head_size = 0;
+};
+
+// Parses a response head at the start of data. Framing that is ambiguous
+// (RFC 9112 6.3) or obsolete line folding is an error, as is a transfer
+// coding other than chunked.
+static ParseStatus parseResponseHead(std::string_view data, UpstreamResponse& response) {
+    response.headers.clear();
+    response.connection = {};
+    response.chunked = response.has_length = false;
+    response.content_length = 0;
+
+    size_t pos = 0;
+    bool http10 = false;
+    bool status_line = true;
+    while (true) {
+        size_t lf = data.find('\n', pos);
+        if (lf == std::string_view::npos) {
+            return data.size() > MAX_RESPONSE_HEAD ? ParseStatus::ERROR : ParseStatus::PARTIAL;
+        }
+        std::string_view line = data.substr(pos, lf - pos);
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        pos = lf + 1;
+        if (pos > MAX_RESPONSE_HEAD) return ParseStatus::ERROR;
+
+        if (status_line) {
+            // "HTTP/1.x 200 OK", the reason phrase possibly empty
+            if (line.size() < 12 || line.substr(0, 7) != "HTTP/1." || line[8] != ' ') return ParseStatus::ERROR;
+            http10 = line[7] == '0';
+            int status = 0;
+            auto result = std::from_chars(line.data() + 9, line.data() + 12, status);
+            if (result.ec != std::errc() || result.ptr != line.data() + 12 || status < 100 || status > 599) {
+                return ParseStatus::ERROR;
+            }
+            if (line.size() > 12 && line[12] != ' ') return ParseStatus::ERROR;
+            response.status = status;
+            response.reason = line.size() > 13 ? line.substr(13) : std::string_view();
+            status_line = false;
+            continue;
+        }
+        if (line.empty()) break;
+        if (line.front() == ' ' || line.front() == '\t') return ParseStatus::ERROR;
+
+        size_t colon = line.find(':');
+        if (colon == std::string_view::npos || colon == 0) return ParseStatus::ERROR;
+        std::string_view name = line.substr(0, colon);
+        if (name.back() == ' ' || name.back() == '\t') return ParseStatus::ERROR;
+        std::string_view value = line.substr(colon + 1);
+        while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) value.remove_prefix(1);
+        while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) value.remove_suffix(1);
+
+        if (equalsIgnoreCase(name, "Content-Length")) {
+            size_t length = 0;
+            auto result = std::from_chars(value.data(), value.data() + value.size(), length);
+            if (value.empty() || result.ec != std::errc() || result.ptr != value.data() + value.size()) {
+                return ParseStatus::ERROR;
+            }
+            if (response.has_length && length != response.content_length) return ParseStatus::ERROR;
+            response.has_length = true;
+            response.content_length = length;
+        } else if (equalsIgnoreCase(name, "Transfer-Encoding")) {
+            if (!equalsIgnoreCase(value, "chunked")) return ParseStatus::ERROR;
+            response.chunked = true;
+        } else if (equalsIgnoreCase(name, "Connection")) {
+            response.connection = value;
+        }
+        response.headers.push_back({name, value});
+    }
+
+    if (response.chunked && response.has_length) return ParseStatus::ERROR;
+    response.close = http10 ? !hasToken(response.connection, "keep-alive") : hasToken(response.connection, "close");
+    response.head_size = pos;
+    return ParseStatus::COMPLETE;
+}
+
+// Fields that describe one connection rather than the message (RFC 9110
+// 7.6.1), and Content-Length, which the proxy sets itself
+static bool isHopByHop(std::string_view name) {
+    for (std::string_view hop : {"Connection", "Keep-Alive", "Proxy-Connection", "TE", "Trailer",
+                                 "Transfer-Encoding", "Upgrade", "Content-Length"}) {
+        if (equalsIgnoreCase(name, hop)) return true;
+    }
+    return false;
+}
+
+// True for a response header that is not passed on to the client; Date and
+// Server come from this server
+static bool dropsResponseHeader(std::string_view name, std::string_view connection) {
+    return isHopByHop(name) || equalsIgnoreCase(name, "Date") || equalsIgnoreCase(name, "Server") ||
+           (!connection.empty() && hasToken(connection, name));
+}
+
+static bool isIdempotent(HTTPMethod method) {
+    return method == HTTPMethod::GET || method == HTTPMethod::HEAD || method == HTTPMethod::PUT ||
+           method == HTTPMethod::DELETE || method == HTTPMethod::OPTIONS;
+}
+
+static int64_t steadyNanoseconds() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Idle keep-alive connections of one event loop, by upstream. Only the loop's
+// thread touches them, so there is no locking.
+class IdlePool {
+private:
+    std::unordered_map<const ReverseProxy::Upstream*, std::vector<int>> idle;
+
+public:
+    ~IdlePool() {
+        for (auto& [upstream, fds] : idle) {
+            for (int fd : fds) close(fd);
+        }
+    }
+
+    static IdlePool& local() {
+        thread_local IdlePool pool;
+        return pool;
+    }
+
+    // Most recently used connection first; ones the upstream has closed
+    // meanwhile (readable with EOF, or with bytes nobody asked for) are dropped
+    int take(const ReverseProxy::Upstream& upstream) {
+        auto found = idle.find(&upstream);
+        if (found == idle.end()) return -1;
+        std::vector<int>& fds = found->second;
+        while (!fds.empty()) {
+            int fd = fds.back();
+            fds.pop_back();
+            char byte;
+            if (recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT) < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return fd;
+            }
+            close(fd);
+        }
+        return -1;
+    }
+
+    void put(const ReverseProxy::Upstream& upstream, int fd, size_t max_idle) {
+        std::vector<int>& fds = idle[&upstream];
+        if (fds.size() >= max_idle) {
+            close(fd);
+            return;
+        }
+        fds.push_back(fd);
+    }
+};
+
+// One request's trip to an upstream: the connection, the response head and
+// the framing of the body still to come
+struct ProxyExchange {
+    enum class Body { NONE, LENGTH, CHUNKED, CLOSE };
+
+    ReverseProxy::Upstream* upstream = nullptr;
+    size_t max_idle = 0;
+    int fd = -1;
+    bool reused = false;   // fd came from the idle pool
+    bool sent = false;     // some of the request reached the upstream
+    bool body_sent = false;  // part of a streamed body is gone from the client's buffer, so no retry
+    std::string buffer;    // bytes read from the upstream and not yet passed on
+    size_t taken = 0;      // of buffer, bytes passed on
+    UpstreamResponse response;
+    Body body = Body::NONE;
+    size_t body_left = 0;  // of a fixed-length body
+    BodyDecoder decoder;   // of a chunked one
+    bool finished = false; // the whole body was passed on
+
+    explicit ProxyExchange(size_t idle_limit) : max_idle(idle_limit) {}
+    ProxyExchange(const ProxyExchange&) = delete;
+    ProxyExchange& operator=(const ProxyExchange&) = delete;
+    ~ProxyExchange() { end(false); }
+
+    void attach(ReverseProxy::Upstream& target) {
+        upstream = &target;
+        upstream->outstanding.fetch_add(1, std::memory_order_relaxed);
+        reused = sent = false;
+        buffer.clear();
+        taken = 0;
+    }
+
+    // Closes the connection or returns it to the idle pool, and stops
+    // counting the request against the upstream
+    void end(bool reusable) {
+        if (fd >= 0) {
+            if (reusable) {
+                IdlePool::local().put(*upstream, fd, max_idle);
+            } else {
+                close(fd);
+            }
+            fd = -1;
+        }
+        if (upstream) {
+            upstream->outstanding.fetch_sub(1, std::memory_order_relaxed);
+            upstream = nullptr;
+        }
+    }
+
+    // Only a response whose end was found by its framing, with nothing read
+    // past it, leaves the connection usable for the next request
+    bool reusable() const {
+        return finished && body != Body::CLOSE && !response.close && taken == buffer.size();
+    }
+
+    // Drops the bytes passed on so far, before reading more
+    void compact() {
+        if (taken == 0) return;
+        buffer.erase(0, taken);
+        taken = 0;
+    }
+
+    // Called once the head is parsed. No body follows a response to HEAD,
+    // a 204 or a 304 (RFC 9112 6.3).
+    void startBody(bool head_request) {
+        taken += response.head_size;
+        finished = false;
+        if (head_request || response.status == 204 || response.status == 304) {
+            body = Body::NONE;
+            finished = true;
+        } else if (response.chunked) {
+            body = Body::CHUNKED;
+            decoder.startChunked(SIZE_MAX);
+        } else if (response.has_length) {
+            body = Body::LENGTH;
+            body_left = response.content_length;
+            finished = body_left == 0;
+        } else {
+            body = Body::CLOSE;
+        }
+    }
+
+    // The body bytes among those buffered, which stay valid until the next
+    // read. False on malformed chunked framing.
+    bool takeBody(std::string_view& bytes) {
+        char* data = buffer.data() + taken;
+        size_t available = buffer.size() - taken;
+        bytes = {};
+        if (available == 0 || finished) return true;
+        switch (body) {
+            case Body::LENGTH: {
+                size_t n = std::min(body_left, available);
+                bytes = std::string_view(data, n);
+                taken += n;
+                body_left -= n;
+                finished = body_left == 0;
+                break;
+            }
+            case Body::CHUNKED: {
+                size_t decoded = 0, consumed = 0;
+                ParseStatus status = decoder.decode(data, available, decoded, consumed);
+                if (status == ParseStatus::ERROR) return false;
+                bytes = std::string_view(data, decoded);
+                taken += consumed;
+                finished = status == ParseStatus::COMPLETE;
+                break;
+            }
+            case Body::CLOSE:
+                bytes = std::string_view(data, available);
+                taken += available;
+                break;
+            case Body::NONE:
+                break;
+        }
+        return true;
+    }
+};
+
+static Task<Io> connectTo(const ReverseProxy::Upstream& upstream, std::chrono::milliseconds timeout, int& fd) {
+    int family = upstream.address.ss_family;
+    fd = socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) co_return Io::FAILED;
+    if (family != AF_UNIX) {
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+
+    Io io = Io::OK;
+    if (connect(fd, reinterpret_cast<const sockaddr*>(&upstream.address), upstream.address_size) < 0) {
+        if (errno != EINPROGRESS) {
+            io = Io::FAILED;
+        } else if (co_await writable(fd, timeout) == 0) {
+            io = Io::TIMEOUT;
+        } else {
+            int error = 0;
+            socklen_t length = sizeof(error);
+            if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error != 0) io = Io::FAILED;
+        }
+    }
+    if (io != Io::OK) {
+        close(fd);
+        fd = -1;
+    }
+    co_return io;
+}
+
+// Writes the request head and body with gathered writes
+static Task<Io> sendRequest(ProxyExchange& exchange, std::string_view head, std::string_view body,
+                            std::chrono::milliseconds timeout) {
+    size_t total = head.size() + body.size();
+    size_t written = 0;
+    while (written < total) {
+        iovec iov[2];
+        int count = 0;
+        if (written < head.size()) {
+            iov[count++] = {const_cast<char*>(head.data()) + written, head.size() - written};
+        }
+        size_t body_written = written > head.size() ? written - head.size() : 0;
+        if (body_written < body.size()) {
+            iov[count++] = {const_cast<char*>(body.data()) + body_written, body.size() - body_written};
+        }
+        msghdr message{};
+        message.msg_iov = iov;
+        message.msg_iovlen = count;
+        ssize_t n = sendmsg(exchange.fd, &message, MSG_NOSIGNAL);
+        if (n > 0) {
+            written += n;
+            exchange.sent = true;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (co_await writable(exchange.fd, timeout) == 0) co_return Io::TIMEOUT;
+        } else {
+            co_return Io::FAILED;
+        }
+    }
+    co_return Io::OK;
+}
+
+// Sends a request body as the client delivers it, in chunks of whatever has
+// arrived when its length isn't known. Bytes are taken from the source only
+// once written, and never held across a suspension, since the connection's
+// buffer may move when more arrives.
+static Task<Io> sendBody(ProxyExchange& exchange, ProxySource& body, std::chrono::milliseconds timeout) {
+    bool chunked = body.length() == SIZE_MAX;
+    char frame[32];          // chunk framing: the CRLF ending the last chunk, then a size line or the last-chunk
+    size_t frame_size = 0, frame_sent = 0;
+    size_t chunk_left = 0;   // of the current chunk, data bytes not yet written
+    bool in_chunk = false;   // a chunk's data went out without its CRLF
+    bool ending = false;
+    while (true) {
+        if (frame_sent == frame_size && chunk_left == 0) {
+            if (ending) co_return Io::OK;
+            if (body.failed()) co_return Io::ABORTED;
+            frame_size = frame_sent = 0;
+            std::string_view bytes = body.available();
+            if (bytes.empty() && !body.complete()) {
+                co_await body.wait();
+                continue;
+            }
+            if (chunked) {
+                if (in_chunk) {
+                    frame[frame_size++] = '\r';
+                    frame[frame_size++] = '\n';
+                }
+                auto end = std::to_chars(frame + frame_size, frame + sizeof(frame) - 4, bytes.size(), 16).ptr;
+                frame_size = end - frame;
+                memcpy(frame + frame_size, bytes.empty() ? "\r\n\r\n" : "\r\n", bytes.empty() ? 4 : 2);
+                frame_size += bytes.empty() ? 4 : 2;
+                in_chunk = !bytes.empty();
+            }
+            chunk_left = bytes.size();
+            ending = bytes.empty();
+            if (ending && frame_size == 0) co_return Io::OK;
+        }
+
+        iovec iov[2];
+        int count = 0;
+        if (frame_sent < frame_size) iov[count++] = {frame + frame_sent, frame_size - frame_sent};
+        if (chunk_left > 0) iov[count++] = {const_cast<char*>(body.available().data()), chunk_left};
+        msghdr message{};
+        message.msg_iov = iov;
+        message.msg_iovlen = count;
+        ssize_t n = sendmsg(exchange.fd, &message, MSG_NOSIGNAL);
+        if (n > 0) {
+            exchange.sent = true;
+            size_t framing = std::min(static_cast<size_t>(n), frame_size - frame_sent);
+            frame_sent += framing;
+            size_t data = n - framing;
+            if (data > 0) {
+                body.consume(data);
+                chunk_left -= data;
+                exchange.body_sent = true;
+            }
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (co_await writable(exchange.fd, timeout) == 0) co_return Io::TIMEOUT;
+        } else {
+            co_return Io::FAILED;
+        }
+    }
+}
+
+// Reads what the upstream has, up to READ_SIZE bytes, onto the buffer
+static Task<Io> receive(ProxyExchange& exchange, std::chrono::milliseconds timeout) {
+    exchange.compact();
+    std::string& buffer = exchange.buffer;
+    size_t used = buffer.size();
+    buffer.resize(used + READ_SIZE);
+    while (true) {
+        ssize_t n = recv(exchange.fd, buffer.data() + used, READ_SIZE, 0);
+        if (n > 0) {
+            buffer.resize(used + n);
+            co_return Io::OK;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (co_await readable(exchange.fd, timeout) != 0) continue;
+            buffer.resize(used);
+            co_return Io::TIMEOUT;
+        }
+        buffer.resize(used);
+        co_return n == 0 ? Io::CLOSED : Io::FAILED;
+    }
+}
+
+// Reads up to the end of the final response head; interim 1xx responses
+// are dropped, and switching protocols is not supported
+static Task<Io> readHead(ProxyExchange& exchange, bool head_request, std::chrono::milliseconds timeout) {
+    while (true) {
+        std::string_view data = std::string_view(exchange.buffer).substr(exchange.taken);
+        ParseStatus status = data.empty() ? ParseStatus::PARTIAL : parseResponseHead(data, exchange.response);
+        if (status == ParseStatus::ERROR) co_return Io::FAILED;
+        if (status == ParseStatus::COMPLETE) {
+            if (exchange.response.status == 101) co_return Io::FAILED;
+            if (exchange.response.status >= 200) break;
+            exchange.taken += exchange.response.head_size;
+            continue;
+        }
+        Io io = co_await receive(exchange, timeout);
+        if (io != Io::OK) co_return io;
+    }
+    // The head's views stay valid until the next read
+    exchange.startBody(head_request);
+    co_return Io::OK;
+}
+
+// Sends the request to the exchange's upstream and reads the response head,
+// over an idle connection if there is one. A pooled connection the upstream
+// dropped before answering is replaced by a new one if the request can safely
+// be sent twice. Io::ABORTED means the client's body failed.
+static Task<Io> exchangeHead(ProxyExchange& exchange, const std::string& head, const HTTPRequest& request,
+                             ProxySource* body, const ProxyOptions& options) {
+    bool head_request = request.method_id == HTTPMethod::HEAD;
+    while (true) {
+        exchange.fd = IdlePool::local().take(*exchange.upstream);
+        exchange.reused = exchange.fd >= 0;
+        if (exchange.reused) {
+            stats.add(Counter::UPSTREAM_REUSES);
+        } else {
+            Io io = co_await connectTo(*exchange.upstream, options.connect_timeout, exchange.fd);
+            if (io != Io::OK) co_return io;
+            stats.add(Counter::UPSTREAM_CONNECTS);
+        }
+
+        Io io = co_await sendRequest(exchange, head, body ? std::string_view() : request.body, options.timeout);
+        if (io == Io::OK && body) io = co_await sendBody(exchange, *body, options.timeout);
+        if (io == Io::OK) io = co_await readHead(exchange, head_request, options.timeout);
+        if (io == Io::OK) co_return io;
+
+        bool stale = exchange.reused && exchange.buffer.empty() && (io == Io::CLOSED || io == Io::FAILED) &&
+                     (!exchange.sent || isIdempotent(request.method_id)) && !exchange.body_sent;
+        close(exchange.fd);
+        exchange.fd = -1;
+        if (!stale) co_return io == Io::CLOSED ? Io::FAILED : io;
+        exchange.sent = false;
+    }
+}
+
+// Reads the body of a fixed-length response through a pipe: splice moves
+// socket pages into it and the client's output queue splices them out, so
+// the body never enters user space
+static Task<Io> spliceBody(ProxyExchange& exchange, ProxySink& sink, int pipe_fds[2],
+                           std::chrono::milliseconds timeout, size_t& relayed) {
+    auto read_end = std::make_shared<FileHandle>(pipe_fds[0]);
+    FileHandle write_end(pipe_fds[1]);
+    int capacity = fcntl(write_end.fd, F_SETPIPE_SZ, PIPE_SIZE);
+    if (capacity < 0) capacity = fcntl(write_end.fd, F_GETPIPE_SZ);
+
+    while (exchange.body_left > 0) {
+        if (sink.gone()) co_return Io::ABORTED;
+        ssize_t n = splice(exchange.fd, nullptr, write_end.fd, nullptr, exchange.body_left,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n > 0) {
+            exchange.body_left -= n;
+            relayed += n;
+            sink.write(BodyPart::pipe(read_end, n));
+            continue;
+        }
+        if (n == 0) co_return Io::CLOSED;
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN) co_return Io::FAILED;
+
+        // Either the socket has nothing or the pipe is full
+        int in_pipe = 0;
+        ioctl(read_end->fd, FIONREAD, &in_pipe);
+        if (in_pipe < capacity) {
+            if (co_await readable(exchange.fd, timeout) == 0) co_return Io::TIMEOUT;
+        } else {
+            co_await sink.drain(sink.pending() - in_pipe / 2);
+        }
+    }
+    exchange.finished = true;
+    co_return Io::OK;
+}
+
+ReverseProxy::ReverseProxy(std::string strip_prefix, const std::vector<std::string>& addresses,
+                           ProxyOptions proxy_options)
+    : prefix(std::move(strip_prefix)), options(proxy_options) {
+    if (addresses.empty()) throw std::invalid_argument("proxy route without upstreams");
+    if (addresses.size() > MAX_UPSTREAMS) throw std::invalid_argument("too many upstreams for one proxy route");
+
+    for (const std::string& address : addresses) {
+        auto upstream = std::make_unique<Upstream>();
+        upstream->name = address;
+
+        if (address.rfind("unix:", 0) == 0) {
+            std::string path = address.substr(5);
+            auto* un = reinterpret_cast<sockaddr_un*>(&upstream->address);
+            if (path.empty() || path.size() >= sizeof(un->sun_path)) {
+                throw std::invalid_argument("bad unix socket path in upstream " + address);
+            }
+            un->sun_family = AF_UNIX;
+            memcpy(un->sun_path, path.c_str(), path.size() + 1);
+            upstream->address_size = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + path.size() + 1);
+        } else {
+            // host:port or [v6]:port
+            size_t colon = address.rfind(':');
+            if (colon == std::string::npos || colon == 0 || colon + 1 == address.size()) {
+                throw std::invalid_argument("upstream " + address + " is not host:port or unix:/path");
+            }
+            std::string host = address.substr(0, colon);
+            std::string port = address.substr(colon + 1);
+            if (host.front() == '[' && host.back() == ']') host = host.substr(1, host.size() - 2);
+
+            addrinfo hints{};
+            hints.ai_socktype = SOCK_STREAM;
+            addrinfo* found = nullptr;
+            int error = getaddrinfo(host.c_str(), port.c_str(), &hints, &found);
+            if (error != 0 || !found) {
+                throw std::invalid_argument("cannot resolve upstream " + address + ": " + gai_strerror(error));
+            }
+            memcpy(&upstream->address, found->ai_addr, found->ai_addrlen);
+            upstream->address_size = found->ai_addrlen;
+            freeaddrinfo(found);
+        }
+        upstreams.push_back(std::move(upstream));
+    }
+}
+
+size_t ReverseProxy::pick(uint64_t tried) {
+    int64_t now = steadyNanoseconds();
+    size_t count = upstreams.size();
+    size_t start = next.fetch_add(1, std::memory_order_relaxed);
+    size_t best = SIZE_MAX;
+    uint32_t best_outstanding = UINT32_MAX;
+
+    for (size_t i = 0; i < count; ++i) {
+        size_t index = (start + i) % count;
+        const Upstream& upstream = *upstreams[index];
+        if (tried & (uint64_t(1) << index)) continue;
+        if (upstream.down_until.load(std::memory_order_relaxed) > now) continue;
+        if (options.balance == ProxyBalance::ROUND_ROBIN) return index;
+        uint32_t outstanding = upstream.outstanding.load(std::memory_order_relaxed);
+        if (outstanding < best_outstanding) {
+            best = index;
+            best_outstanding = outstanding;
+        }
+    }
+    if (best != SIZE_MAX || tried != 0) return best;
+
+    // Every upstream is marked down: probe the one that comes back first
+    // rather than failing the request outright
+    int64_t earliest = INT64_MAX;
+    for (size_t index = 0; index < count; ++index) {
+        int64_t down_until = upstreams[index]->down_until.load(std::memory_order_relaxed);
+        if (down_until < earliest) {
+            earliest = down_until;
+            best = index;
+        }
+    }
+    return best;
+}
+
+void ReverseProxy::recordFailure(Upstream& upstream) {
+    stats.add(Counter::UPSTREAM_ERRORS);
+    int failures = upstream.failures.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (failures != options.max_fails) return;
+    upstream.down_until.store(steadyNanoseconds() + std::chrono::nanoseconds(options.fail_timeout).count(),
+                              std::memory_order_relaxed);
+    upstream.failures.store(0, std::memory_order_relaxed);
+    logger.warn("⚠️  Upstream ", upstream.name, " failed ", failures, " times in a row, skipped for ",
+                options.fail_timeout.count(), " ms");
+}
+
+std::string ReverseProxy::requestHead(const HTTPRequest& request, const ProxySource* body,
+                                      const Upstream& upstream) const {
+    std::string_view path = request.path;
+    if (path.substr(0, prefix.size()) == prefix) path.remove_prefix(prefix.size());
+
+    std::string head;
+    head.reserve(256 + path.size() + request.query.size());
+    head.append(request.method).append(" ");
+    if (path.empty() || path.front() != '/') head += '/';
+    head.append(path);
+    if (!request.query.empty()) head.append("?").append(request.query);
+    head.append(" HTTP/1.1\r\n");
+
+    std::string_view connection = request.getHeader("Connection");
+    bool has_host = false;
+    for (size_t i = 0; i < request.header_count; ++i) {
+        const HTTPHeader& header = request.headers[i];
+        if (isHopByHop(header.name) || equalsIgnoreCase(header.name, "Expect") ||
+            (!connection.empty() && hasToken(connection, header.name))) {
+            continue;
+        }
+        if (equalsIgnoreCase(header.name, "Host")) has_host = true;
+        head.append(header.name).append(": ").append(header.value).append("\r\n");
+    }
+    if (!has_host) {
+        bool unix_socket = upstream.address.ss_family == AF_UNIX;
+        head.append("Host: ").append(unix_socket ? "localhost" : upstream.name).append("\r\n");
+    }
+    if (body && body->length() == SIZE_MAX) {
+        head.append("Transfer-Encoding: chunked\r\n");
+    } else if (body) {
+        head.append("Content-Length: ").append(std::to_string(body->length())).append("\r\n");
+    } else if (!request.body.empty() || request.method_id == HTTPMethod::POST ||
+               request.method_id == HTTPMethod::PUT || request.method_id == HTTPMethod::PATCH) {
+        head.append("Content-Length: ").append(std::to_string(request.body.size())).append("\r\n");
+    }
+    head.append("\r\n");
+    return head;
+}
+
+// Tries upstreams until one answers with a response head. Returns 0, or the
+// status to answer with when none did: 504 if the last one timed out, 502
+// otherwise, or the body's own error status if the client failed to send it.
+Task<int> ReverseProxy::begin(const HTTPRequest& request, ProxySource* body, ProxyExchange& exchange) {
+    bool idempotent = isIdempotent(request.method_id);
+    uint64_t tried = 0;
+    int status = 502;
+    while (true) {
+        size_t index = pick(tried);
+        if (index == SIZE_MAX) co_return status;
+        if (body && body->failed()) co_return body->errorStatus();
+        tried |= uint64_t(1) << index;
+        Upstream& upstream = *upstreams[index];
+
+        exchange.attach(upstream);
+        Io io = co_await exchangeHead(exchange, requestHead(request, body, upstream), request, body, options);
+        if (io == Io::OK) {
+            if (upstream.failures.load(std::memory_order_relaxed) != 0) {
+                upstream.failures.store(0, std::memory_order_relaxed);
+            }
+            co_return 0;
+        }
+
+        bool sent = exchange.sent;
+        exchange.end(false);
+        if (io == Io::ABORTED) co_return body->errorStatus();
+        recordFailure(upstream);
+        status = io == Io::TIMEOUT ? 504 : 502;
+        if ((sent && !idempotent) || exchange.body_sent) co_return status;
+    }
+}
+
+// Error page for a request no upstream answered
+static void gatewayError(HTTPResponse& response, int status) {
+    response.setStatus(status, reasonPhrase(status));
+    response.setHeader("Content-Type", "text/html");
+    HtmlWriter html(response.resource());
+    html.write("<h1>", status, " - ", reasonPhrase(status), "</h1>");
+    response.setBody(html.take());
+}
+
+Task<ProxyResult> ReverseProxy::relay(const HTTPRequest& request, ProxySource* body, ProxySink& sink,
+                                      bool& keep_alive) {
+    ProxyResult result;
+    bool head_request = request.method_id == HTTPMethod::HEAD;
+    ProxyExchange exchange(options.max_idle);
+
+    int error = co_await begin(request, body, exchange);
+    // The rest of an unsent body can't be told apart from the next request
+    if (body && !body->complete()) keep_alive = false;
+    if (error != 0) {
+        HTTPResponse response;
+        gatewayError(response, error);
+        response.setHeader("Connection", keep_alive ? "keep-alive" : "close");
+        std::string text = response.build();
+        if (head_request) text.resize(text.size() - response.bodySize());
+        sink.write(BodyPart::owned(std::move(text)));
+        result.status = error;
+        co_return result;
+    }
+
+    Upstream& upstream = *exchange.upstream;
+    const UpstreamResponse& response = exchange.response;
+    result.status = response.status;
+    result.answered = true;
+
+    // The client gets the upstream's head with this server's connection
+    // handling: fixed lengths pass through, other bodies are chunked again
+    // for HTTP/1.1 clients and delimited by the close for HTTP/1.0 ones
+    std::string head;
+    head.reserve(response.head_size + 160);
+    if (response.reason == reasonPhrase(response.status)) {
+        head.append(statusLine(response.status));
+    } else {
+        head.append("HTTP/1.1 ").append(std::to_string(response.status)).append(" ");
+        head.append(response.reason).append("\r\n");
+    }
+    head.append(*commonHeaders());
+    for (const HTTPHeader& header : response.headers) {
+        if (dropsResponseHeader(header.name, response.connection)) continue;
+        head.append(header.name).append(": ").append(header.value).append("\r\n");
+    }
+    bool rechunk = false;
+    if (exchange.body == ProxyExchange::Body::LENGTH ||
+        (exchange.body == ProxyExchange::Body::NONE && response.has_length)) {
+        head.append("Content-Length: ").append(std::to_string(response.content_length)).append("\r\n");
+    } else if (exchange.body != ProxyExchange::Body::NONE) {
+        if (request.version == "HTTP/1.1") {
+            rechunk = true;
+            head.append("Transfer-Encoding: chunked\r\n");
+        } else {
+            keep_alive = false;
+        }
+    }
+    head.append(keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n");
+    sink.write(BodyPart::owned(std::move(head)));
+
+    Io io = Io::OK;
+    int pipe_fds[2];
+    while (!exchange.finished) {
+        if (sink.gone()) {
+            io = Io::ABORTED;
+            break;
+        }
+        std::string_view bytes;
+        if (!exchange.takeBody(bytes)) {
+            io = Io::FAILED;
+            break;
+        }
+        if (!bytes.empty()) {
+            result.body_bytes += bytes.size();
+            if (rechunk) {
+                char size_line[24];
+                auto end = std::to_chars(size_line, size_line + sizeof(size_line) - 2, bytes.size(), 16).ptr;
+                *end++ = '\r';
+                *end++ = '\n';
+                std::string chunk;
+                chunk.reserve((end - size_line) + bytes.size() + 2);
+                chunk.append(size_line, end - size_line).append(bytes).append("\r\n");
+                sink.write(BodyPart::owned(std::move(chunk)));
+            } else {
+                sink.write(BodyPart::owned(std::string(bytes)));
+            }
+            if (sink.pending() > HIGH_WATER) co_await sink.drain(HIGH_WATER / 2);
+            continue;
+        }
+        if (exchange.finished) break;
+
+        if (exchange.body == ProxyExchange::Body::LENGTH && exchange.body_left >= SPLICE_MIN &&
+            pipe2(pipe_fds, O_CLOEXEC | O_NONBLOCK) == 0) {
+            io = co_await spliceBody(exchange, sink, pipe_fds, options.timeout, result.body_bytes);
+            break;
+        }
+        io = co_await receive(exchange, options.timeout);
+        if (io == Io::CLOSED && exchange.body == ProxyExchange::Body::CLOSE) {
+            exchange.finished = true;
+            io = Io::OK;
+        }
+        if (io != Io::OK) break;
+    }
+
+    if (io == Io::OK) {
+        if (rechunk) sink.write(BodyPart::literal("0\r\n\r\n"));
+        exchange.end(exchange.reusable());
+        co_return result;
+    }
+
+    // The head is out, so all that is left is to cut the response short
+    keep_alive = false;
+    if (io != Io::ABORTED) {
+        logger.warn("⚠️  Upstream ", upstream.name, " ended the response to ", request.path, " early");
+        recordFailure(upstream);
+    }
+    exchange.end(false);
+    co_return result;
+}
+
+Task<void> ReverseProxy::forward(const HTTPRequest& request, HTTPResponse& response) {
+    ProxyExchange exchange(options.max_idle);
+    int error = co_await begin(request, nullptr, exchange);
+    if (error != 0) {
+        gatewayError(response, error);
+        co_return;
+    }
+
+    // The head's views don't survive reading the body
+    Upstream& upstream = *exchange.upstream;
+    const UpstreamResponse& head = exchange.response;
+    int status = head.status;
+    std::string reason(head.reason);
+    std::vector<std::pair<std::string, std::string>> headers;
+    for (const HTTPHeader& header : head.headers) {
+        if (!dropsResponseHeader(header.name, head.connection)) headers.emplace_back(header.name, header.value);
+    }
+    bool no_body = exchange.body == ProxyExchange::Body::NONE;
+    bool has_length = head.has_length;
+    size_t content_length = head.content_length;
+
+    std::string body;
+    if (exchange.body == ProxyExchange::Body::LENGTH) body.reserve(std::min(content_length, options.max_buffered_body));
+    Io io = Io::OK;
+    bool too_large = false;
+    while (!exchange.finished) {
+        std::string_view bytes;
+        if (!exchange.takeBody(bytes)) {
+            io = Io::FAILED;
+            break;
+        }
+        body.append(bytes);
+        if (body.size() > options.max_buffered_body) {
+            too_large = true;
+            break;
+        }
+        if (exchange.finished) break;
+        io = co_await receive(exchange, options.timeout);
+        if (io == Io::CLOSED && exchange.body == ProxyExchange::Body::CLOSE) {
+            exchange.finished = true;
+            io = Io::OK;
+        }
+        if (io != Io::OK) break;
+    }
+
+    if (too_large || io != Io::OK) {
+        if (too_large) {
+            logger.warn("⚠️  Response to ", request.path, " from upstream ", upstream.name,
+                        " exceeds the ", options.max_buffered_body, " bytes buffered for HTTP/2");
+        } else {
+            recordFailure(upstream);
+        }
+        exchange.end(false);
+        gatewayError(response, io == Io::TIMEOUT ? 504 : 502);
+        co_return;
+    }
+    exchange.end(exchange.reusable());
+
+    response.setStatus(status, reason);
+    for (const auto& [name, value] : headers) response.addHeader(name, value);
+    if (!no_body) {
+        response.setBody(std::move(body));
+    } else if (has_length) {
+        response.setContentLength(content_length);
+    }
+}
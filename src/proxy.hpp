@@ -0,0 +1,145 @@
+#pragma once
+
+#include <sys/socket.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "http_request.hpp"
+#include "http_response.hpp"
+#include "output_queue.hpp"
+#include "task.hpp"
+
+struct ProxyExchange;
+
+enum class ProxyBalance { ROUND_ROBIN, LEAST_OUTSTANDING };
+
+struct ProxyOptions {
+    ProxyBalance balance = ProxyBalance::ROUND_ROBIN;
+    std::chrono::milliseconds connect_timeout{5000};
+    std::chrono::milliseconds timeout{30000};          // longest pause while an upstream reads or answers
+    size_t max_idle = 32;                              // idle connections kept per upstream and event loop
+    int max_fails = 3;                                 // failures in a row that take an upstream out
+    std::chrono::milliseconds fail_timeout{10000};     // for this long
+    size_t max_buffered_body = 8 * 1024 * 1024;        // limit for responses relayed to HTTP/2 streams
+};
+
+// Takes a response relayed to an HTTP/1.1 client as it arrives: the
+// connection's output queue, seen from the proxy
+class ProxySink {
+public:
+    virtual ~ProxySink() = default;
+
+    // Queues bytes for the client and has the connection send them
+    virtual void write(BodyPart part) = 0;
+
+    // Bytes queued and not yet sent
+    virtual size_t pending() const = 0;
+
+    // Suspends until at most low_water bytes are pending, or the client is gone
+    virtual Task<void> drain(size_t low_water) = 0;
+
+    // True once the client can no longer be written to
+    virtual bool gone() const = 0;
+};
+
+// Gives a request body to the proxy as an HTTP/1.1 client sends it: the
+// decoded bytes the connection has read and the proxy hasn't sent on yet
+class ProxySource {
+public:
+    virtual ~ProxySource() = default;
+
+    // Bytes of the body length, or SIZE_MAX for a chunked body
+    virtual size_t length() const = 0;
+
+    // Body bytes waiting to be sent; valid until the proxy next suspends
+    virtual std::string_view available() const = 0;
+
+    // Drops bytes from the front of available() once they are sent
+    virtual void consume(size_t bytes) = 0;
+
+    // True once the whole body has arrived
+    virtual bool complete() const = 0;
+
+    // True if the body will never be complete: malformed, timed out or the
+    // client went away
+    virtual bool failed() const = 0;
+
+    // Status to answer a failed body with
+    virtual int errorStatus() const = 0;
+
+    // Suspends until more of the body arrives or it fails
+    virtual Task<void> wait() = 0;
+};
+
+// What became of a relayed request, for statistics and the access log
+struct ProxyResult {
+    int status = 0;
+    size_t body_bytes = 0;
+    bool answered = false;   // an upstream answered; otherwise the proxy sent the error itself
+};
+
+// Forwards the requests of a route to a group of HTTP/1.1 upstreams, over
+// TCP ("host:port", "[v6]:port") or Unix sockets ("unix:/path"). The
+// route's prefix is stripped, so "/svc/*" sends /svc/a as /a.
+//
+// Each event loop keeps its own idle keep-alive connections to every
+// upstream, so a connection is only ever used by one thread. Upstreams are
+// picked round robin or by fewest requests outstanding; those counters and
+// the passive health state are atomics shared by all loops. An upstream that
+// fails max_fails times in a row (connect refused or timed out, reset,
+// timeout, malformed response) is skipped for fail_timeout. Failed requests
+// move on to the next upstream if nothing was sent yet or the method is
+// idempotent.
+//
+// Bodies of HTTP/1.1 requests go to the upstream as they arrive, so no
+// limit applies to them; such a request is never retried once part of its
+// body was sent. HTTP/2 requests are sent as buffered by the stream.
+// Responses reach HTTP/1.1 clients as they arrive: large fixed-length bodies are spliced from
+// the upstream socket into a pipe that the client's output queue splices
+// out, others are copied through with backpressure. HTTP/2 streams get the
+// response buffered, up to max_buffered_body.
+class ReverseProxy {
+public:
+    static constexpr size_t MAX_UPSTREAMS = 64;
+
+    struct Upstream {
+        std::string name;
+        sockaddr_storage address{};
+        socklen_t address_size = 0;
+        std::atomic<uint32_t> outstanding{0};
+        std::atomic<int> failures{0};
+        std::atomic<int64_t> down_until{0};   // steady clock nanoseconds
+    };
+
+private:
+    std::string prefix;
+    std::vector<std::unique_ptr<Upstream>> upstreams;
+    ProxyOptions options;
+    std::atomic<size_t> next{0};
+
+    size_t pick(uint64_t tried);
+    void recordFailure(Upstream& upstream);
+    std::string requestHead(const HTTPRequest& request, const ProxySource* body, const Upstream& upstream) const;
+    Task<int> begin(const HTTPRequest& request, ProxySource* body, ProxyExchange& exchange);
+
+public:
+    // Throws std::invalid_argument for an address that can't be resolved
+    ReverseProxy(std::string strip_prefix, const std::vector<std::string>& addresses, ProxyOptions proxy_options);
+
+    // Streams the response to an HTTP/1.1 client, and the request body from
+    // it when body is given; otherwise request.body is sent. keep_alive comes
+    // in as the connection's wish and goes out false if the response can't
+    // be delimited for it or ended early, or the body wasn't read to its end.
+    Task<ProxyResult> relay(const HTTPRequest& request, ProxySource* body, ProxySink& sink, bool& keep_alive);
+
+    // Buffers the response into response, for HTTP/2 streams
+    Task<void> forward(const HTTPRequest& request, HTTPResponse& response);
+
+    const std::vector<std::unique_ptr<Upstream>>& members() const { return upstreams; }
+};
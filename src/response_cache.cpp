@@ -0,0 +1,3 @@
+#include "response_cache.hpp"
+
+ResponseCache response_cache;
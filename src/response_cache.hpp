@@ -0,0 +1,154 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+
+#include "compression.hpp"
+#include "http_request.hpp"
+#include "http_response.hpp"
+#include "output_queue.hpp"
+#include "router.hpp"
+#include "static_files.hpp"
+#include "stats.hpp"
+
+// A route's response kept fully serialized: the status line and header
+// lines, and the body. Only the Server/Date block and the Connection header
+// are added per request.
+struct CachedResponse : std::enable_shared_from_this<CachedResponse> {
+    int status = 200;
+    std::string head;
+    size_t status_line_size = 0;   // the Server/Date block goes after it
+    std::string body;
+    std::chrono::steady_clock::time_point expires;
+
+    size_t cost() const { return head.size() + body.size() + 64; }
+
+    // Queues the response without copying it; the queue keeps the entry
+    // alive until it is sent. with_body is false for HEAD.
+    void writeTo(OutputQueue& out, bool keep_alive, bool with_body) const {
+        std::shared_ptr<const CachedResponse> self = shared_from_this();
+        std::shared_ptr<const std::string> common = commonHeaders();
+        std::string_view bytes = head;
+        out.append(BodyPart::shared(self, bytes.substr(0, status_line_size)));
+        out.append(BodyPart::shared(common, *common));
+        out.append(BodyPart::shared(self, bytes.substr(status_line_size)));
+        out.append(BodyPart::literal(keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n"));
+        if (with_body) out.append(BodyPart::shared(self, body));
+    }
+    
+    // Calls fn(name, value) for every stored header line
+    template <typename Fn>
+    void forEachHeader(Fn&& fn) const {
+        forEachHeaderLine(std::string_view(head).substr(status_line_size), fn);
+    }
+};
+
+// TTL cache for routes registered with a CachePolicy, shared by all event
+// loops. Misses are coalesced: one request per key runs the handler while
+// others for the same key serve the expired entry if there is one, or wait
+// for the fresh one.
+class ResponseCache {
+private:
+    ShardedLruCache<CachedResponse> entries;
+    std::mutex fill_mutex;
+    std::condition_variable filled;
+    std::unordered_set<std::string> filling;   // keys whose handler is running
+
+    void finish(const std::string& key, std::shared_ptr<const CachedResponse> entry) {
+        if (entry) entries.insert(key, std::move(entry));
+        std::lock_guard<std::mutex> lock(fill_mutex);
+        filling.erase(key);
+        filled.notify_all();
+    }
+
+public:
+    // Held by the request that runs the handler on a miss. store() caches
+    // the response it built; otherwise waiting requests are released empty.
+    class Fill {
+    private:
+        ResponseCache& cache;
+        std::string key;
+        std::chrono::milliseconds ttl;
+        bool done = false;
+
+    public:
+        Fill(ResponseCache& owner, std::string entry_key, std::chrono::milliseconds time_to_live)
+            : cache(owner), key(std::move(entry_key)), ttl(time_to_live) {}
+        Fill(const Fill&) = delete;
+        Fill& operator=(const Fill&) = delete;
+        ~Fill() {
+            if (!done) cache.finish(key, nullptr);
+        }
+
+        void store(const HTTPResponse& response) {
+            std::shared_ptr<CachedResponse> entry;
+            if (response.getStatusCode() == 200) {
+                entry = std::make_shared<CachedResponse>();
+                entry->status = 200;
+                entry->expires = std::chrono::steady_clock::now() + ttl;
+                if (!response.serialize(entry->head, entry->status_line_size, entry->body)) entry.reset();
+            }
+            done = true;
+            cache.finish(key, std::move(entry));
+        }
+    };
+
+    void setCapacity(size_t total_bytes) { entries.setCapacity(total_bytes); }
+
+    // Entry for the request if one is fresh, or stale while another request
+    // refreshes it. Returns null on a miss, with fill set: the caller runs
+    // the handler and stores the response through it.
+    std::shared_ptr<const CachedResponse> lookup(const Router::Route& route, const HTTPRequest& request,
+                                                 std::optional<Fill>& fill) {
+        // Fields are length-prefixed so values cannot run into each other
+        thread_local std::string key;
+        auto field = [](std::string_view value) {
+            key += std::to_string(value.size());
+            key += ':';
+            key += value;
+        };
+        key.clear();
+        key += std::to_string(route.id);
+        field(request.path);
+        field(encodingToken(negotiateEncoding(request.getHeader("Accept-Encoding"))));
+        for (const std::string& name : route.cache.query_params) field(request.getQueryParam(name));
+        for (const std::string& name : route.cache.headers) field(request.getHeader(name));
+
+        auto now = std::chrono::steady_clock::now();
+        std::shared_ptr<const CachedResponse> entry = entries.find(key);
+        if (entry && now < entry->expires) {
+            stats.add(Counter::RESPONSE_CACHE_HITS);
+            return entry;
+        }
+
+        std::unique_lock<std::mutex> lock(fill_mutex);
+        while (true) {
+            if (entry && now < entry->expires) {
+                stats.add(Counter::RESPONSE_CACHE_COALESCED);
+                return entry;
+            }
+            if (filling.insert(key).second) {
+                stats.add(Counter::RESPONSE_CACHE_MISSES);
+                fill.emplace(*this, key, route.cache.ttl);
+                return nullptr;
+            }
+            if (entry) {
+                stats.add(Counter::RESPONSE_CACHE_COALESCED);
+                return entry;
+            }
+            filled.wait(lock, [&] { return filling.count(key) == 0; });
+            // Nothing fresh means the handler's response wasn't cacheable;
+            // this request then runs the handler itself
+            entry = entries.find(key);
+            now = std::chrono::steady_clock::now();
+        }
+    }
+};
+
+extern ResponseCache response_cache;
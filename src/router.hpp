@@ -0,0 +1,216 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "http_request.hpp"
+#include "http_response.hpp"
+#include "proxy.hpp"
+#include "task.hpp"
+
+// Opt-in micro-cache for a GET route. A 200 response with an in-memory body
+// is kept fully serialized for ttl and answers later requests without
+// running the handler. Entries are keyed by route, path, negotiated content
+// coding and the values of the listed query parameters and request headers.
+struct CachePolicy {
+    std::chrono::milliseconds ttl{0};   // zero: not cached
+    std::vector<std::string> query_params{};
+    std::vector<std::string> headers{};
+};
+
+// Handlers returning Task<void> are coroutines: they may co_await sleeps,
+// socket readiness and offload() while their loop serves other connections
+template <typename F>
+concept AsyncRouteHandler = std::is_same_v<std::invoke_result_t<F&, HTTPRequest&, HTTPResponse&>, Task<void>>;
+
+// Route handler system. Routes are compiled into one radix trie per method
+// at startup; the router is then shared read-only by every event loop.
+class Router {
+public:
+    using Handler = std::function<void(HTTPRequest&, HTTPResponse&)>;
+    using StreamFactory = std::function<std::unique_ptr<BodyStream>(HTTPRequest&)>;
+    using AsyncHandler = std::function<Task<void>(HTTPRequest&, HTTPResponse&)>;
+    
+    // Exactly one of handler (buffered body), stream (streamed body) or
+    // async (buffered body, handler may suspend) is set. Proxy routes also
+    // set proxy, which HTTP/1.1 connections relay through directly; async
+    // then buffers the upstream's response for HTTP/2 streams.
+    struct Route {
+        Handler handler{};
+        StreamFactory stream{};
+        AsyncHandler async{};
+        std::shared_ptr<ReverseProxy> proxy{};
+        size_t id = 0;        // 1-based registration order; 0 means no route
+        std::string name{};   // "METHOD pattern", used to label statistics
+        CachePolicy cache{};
+    };
+
+private:
+    // Compressed trie node: label is the path fragment on the edge into it
+    struct Node {
+        std::string label;
+        std::vector<std::unique_ptr<Node>> children;
+        int exact = -1;      // handler index for a path ending here
+        int wildcard = -1;   // handler index for "<path so far>*"
+    };
+    
+    std::vector<Route> routes;
+    std::array<Node, HTTP_METHOD_COUNT> trees;
+    std::string document_root;
+    
+    static Node* findChild(const Node& node, char c) {
+        for (const auto& child : node.children) {
+            if (child->label[0] == c) return child.get();
+        }
+        return nullptr;
+    }
+    
+    // A trailing "*" registers a prefix route, e.g. "/static/*"
+    void add(HTTPMethod method, const std::string& pattern, Route route) {
+        bool is_wildcard = !pattern.empty() && pattern.back() == '*';
+        std::string key = is_wildcard ? pattern.substr(0, pattern.size() - 1) : pattern;
+        
+        Node* node = &trees[static_cast<size_t>(method)];
+        size_t pos = 0;
+        while (pos < key.size()) {
+            Node* child = findChild(*node, key[pos]);
+            if (!child) {
+                auto leaf = std::make_unique<Node>();
+                leaf->label = key.substr(pos);
+                node->children.push_back(std::move(leaf));
+                node = node->children.back().get();
+                break;
+            }
+            
+            size_t common = 0;
+            while (common < child->label.size() && pos + common < key.size() &&
+                   child->label[common] == key[pos + common]) {
+                common++;
+            }
+            
+            // Split the edge where the new key diverges from it
+            if (common < child->label.size()) {
+                auto tail = std::make_unique<Node>();
+                tail->label = child->label.substr(common);
+                tail->children = std::move(child->children);
+                tail->exact = child->exact;
+                tail->wildcard = child->wildcard;
+                
+                child->label.resize(common);
+                child->children.clear();
+                child->children.push_back(std::move(tail));
+                child->exact = -1;
+                child->wildcard = -1;
+            }
+            
+            node = child;
+            pos += common;
+        }
+        
+        route.id = routes.size() + 1;
+        route.name = std::string(methodName(method)) + " " + pattern;
+        routes.push_back(std::move(route));
+        int index = static_cast<int>(routes.size()) - 1;
+        (is_wildcard ? node->wildcard : node->exact) = index;
+    }
+    
+    // Exact match wins, otherwise the longest matching wildcard prefix
+    int match(HTTPMethod method, std::string_view path) const {
+        const Node* node = &trees[static_cast<size_t>(method)];
+        int wildcard = node->wildcard;
+        size_t pos = 0;
+        
+        while (pos < path.size()) {
+            const Node* child = findChild(*node, path[pos]);
+            if (!child || path.compare(pos, child->label.size(), child->label) != 0) {
+                return wildcard;
+            }
+            node = child;
+            pos += child->label.size();
+            if (node->wildcard >= 0) wildcard = node->wildcard;
+        }
+        return node->exact >= 0 ? node->exact : wildcard;
+    }
+
+public:
+    Router(const std::string& root = ".") : document_root(root) {}
+
+    void get(const std::string& path, Handler handler, CachePolicy cache = {}) {
+        Route route{.handler = std::move(handler)};
+        route.cache = std::move(cache);
+        add(HTTPMethod::GET, path, std::move(route));
+    }
+    
+    void post(const std::string& path, Handler handler) {
+        add(HTTPMethod::POST, path, Route{.handler = std::move(handler)});
+    }
+    
+    // Coroutine handlers. A lambda's captures are referenced, not copied,
+    // by its coroutines, which is safe as routes live as long as the router.
+    // Their responses are not cached.
+    template <AsyncRouteHandler F>
+    void get(const std::string& path, F handler) {
+        add(HTTPMethod::GET, path, Route{.async = AsyncHandler(std::move(handler))});
+    }
+    
+    template <AsyncRouteHandler F>
+    void post(const std::string& path, F handler) {
+        add(HTTPMethod::POST, path, Route{.async = AsyncHandler(std::move(handler))});
+    }
+    
+    // Forwards every method under pattern to upstreams, see ReverseProxy.
+    // The pattern up to its last '/' is stripped from forwarded paths.
+    // Throws std::invalid_argument for an upstream that can't be resolved.
+    void proxy(const std::string& pattern, const std::vector<std::string>& upstreams, ProxyOptions options = {}) {
+        size_t slash = pattern.rfind('/');
+        std::string prefix = slash == std::string::npos ? std::string() : pattern.substr(0, slash);
+        proxy(pattern, std::make_shared<ReverseProxy>(prefix, upstreams, options));
+    }
+    
+    void proxy(const std::string& pattern, std::shared_ptr<ReverseProxy> reverse_proxy) {
+        ReverseProxy* target = reverse_proxy.get();
+        for (size_t method = 0; method < static_cast<size_t>(HTTPMethod::UNKNOWN); ++method) {
+            Route route{.async = [target](HTTPRequest& req, HTTPResponse& res) {
+                return target->forward(req, res);
+            }};
+            route.proxy = reverse_proxy;
+            add(static_cast<HTTPMethod>(method), pattern, std::move(route));
+        }
+    }
+    
+    // POST route whose body is delivered chunk by chunk as it arrives
+    void postStream(const std::string& path, StreamFactory factory) {
+        add(HTTPMethod::POST, path, Route{.stream = std::move(factory)});
+    }
+    
+    // HEAD falls back to the GET route, whose response goes out without
+    // its body
+    const Route* find(const HTTPRequest& req) const {
+        if (req.method_id == HTTPMethod::UNKNOWN) return nullptr;
+        int index = match(req.method_id, req.path);
+        if (index < 0 && req.method_id == HTTPMethod::HEAD) index = match(HTTPMethod::GET, req.path);
+        return index < 0 ? nullptr : &routes[index];
+    }
+    
+    bool handle(HTTPRequest& req, HTTPResponse& res) const {
+        const Route* route = find(req);
+        if (!route || !route->handler) return false;
+        route->handler(req, res);
+        return true;
+    }
+
+    std::string getDocumentRoot() const { return document_root; }
+    
+    // Route names indexed by Route::id
+    std::vector<std::string> routeNames() const {
+        std::vector<std::string> names = {"unmatched"};
+        for (const Route& route : routes) names.push_back(route.name);
+        return names;
+    }
+};
@@ -0,0 +1,423 @@
+#include "routes.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <ctime>
+#include <filesystem>
+#include <memory>
+
+#include "body_writer.hpp"
+#include "directory_index.hpp"
+#include "executor.hpp"
+#include "logger.hpp"
+#include "stats.hpp"
+
+namespace fs = std::filesystem;
+
+// Body stream behind /upload: counts bytes and computes an FNV-1a digest
+class UploadDigest : public BodyStream {
+private:
+    size_t bytes = 0;
+    uint64_t digest = 14695981039346656037ULL;
+
+public:
+    void onData(HTTPRequest&, std::string_view chunk) override {
+        bytes += chunk.size();
+        for (unsigned char c : chunk) {
+            digest = (digest ^ c) * 1099511628211ULL;
+        }
+    }
+    
+    void onComplete(HTTPRequest&, HTTPResponse& res) override {
+        char hex[17];
+        snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(digest));
+        res.setStatus(200, "OK");
+        res.setHeader("Content-Type", "application/json");
+        JsonWriter json(res.resource());
+        json.write("{\n"
+                   "  \"received_bytes\": ", bytes, ",\n"
+                   "  \"fnv1a\": \"", Raw{std::string_view(hex, 16)}, "\"\n"
+                   "}");
+        res.setBody(json.take());
+    }
+};
+
+// Percent-encodes everything in a path but unreserved characters and '/'.
+// The result needs no further HTML escaping.
+static void writeUrlEncoded(HtmlWriter& html, std::string_view path) {
+    static const char hex[] = "0123456789ABCDEF";
+    size_t run = 0;
+    for (size_t i = 0; i < path.size(); ++i) {
+        unsigned char c = path[i];
+        if (isalnum(c) || c == '-' || c == '.' || c == '_' || c == '~' || c == '/') continue;
+        const char escape[3] = {'%', hex[c >> 4], hex[c & 15]};
+        html.write(Raw{path.substr(run, i - run)}, Raw{std::string_view(escape, 3)});
+        run = i + 1;
+    }
+    html.write(Raw{path.substr(run)});
+}
+
+static size_t parseCount(std::string_view value, size_t fallback) {
+    size_t count;
+    auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), count);
+    return error == std::errc() && end == value.data() + value.size() ? count : fallback;
+}
+
+// /files[/dir]: one page of a directory from directory_index, as HTML or
+// with ?format=json. ?sort= takes name, size or mtime, with a leading '-'
+// for descending; ?offset= and ?limit= select the page. The ETag is the
+// directory's index generation, so an unchanged listing costs a 304.
+static void listDirectory(const std::string& document_root, const HTTPRequest& req, HTTPResponse& res) {
+    static constexpr size_t DEFAULT_LIMIT = 200;
+    static constexpr size_t MAX_LIMIT = 5000;
+    
+    std::string relative;
+    if (!percentDecode(req.path.substr(6), relative)) {   // Remove "/files"
+        res.setStatus(400, "Bad Request");
+        res.setBody("Malformed path");
+        return;
+    }
+    size_t first = relative.find_first_not_of('/');
+    relative.erase(0, std::min(first, relative.size()));
+    while (!relative.empty() && relative.back() == '/') relative.pop_back();
+    
+    std::shared_ptr<const DirectoryListing> listing = directory_index.find(relative);
+    if (!listing) {
+        res.setStatus(404, "Not Found");
+        res.setHeader("Content-Type", "text/html");
+        HtmlWriter html(res.resource());
+        html.write("<h1>404 - Directory Not Found</h1><p>Directory: /", relative, "</p>");
+        res.setBody(html.take());
+        return;
+    }
+    
+    char etag[32];
+    snprintf(etag, sizeof(etag), "W/\"%llx\"", static_cast<unsigned long long>(listing->generation));
+    res.setHeader("ETag", etag);
+    res.setHeader("Cache-Control", "no-cache");
+    std::string_view if_none_match = req.getHeader("If-None-Match");
+    if (if_none_match == "*" || hasToken(if_none_match, etag)) {
+        res.setStatus(304, "Not Modified");
+        return;
+    }
+    
+    std::string_view sort_name = req.getQueryParam("sort");
+    bool descending = !sort_name.empty() && sort_name.front() == '-';
+    if (descending) sort_name.remove_prefix(1);
+    IndexSort sort = IndexSort::NAME;
+    if (sort_name == "size") {
+        sort = IndexSort::SIZE;
+    } else if (sort_name == "mtime") {
+        sort = IndexSort::MTIME;
+    } else {
+        sort_name = "name";
+    }
+    const char* sort_sign = descending ? "-" : "";
+    
+    size_t total = listing->entries.size();
+    size_t offset = std::min(parseCount(req.getQueryParam("offset"), 0), total);
+    size_t limit = std::min(parseCount(req.getQueryParam("limit"), DEFAULT_LIMIT), MAX_LIMIT);
+    size_t end = offset + std::min(limit, total - offset);
+    
+    res.setStatus(200, "OK");
+    if (req.getQueryParam("format") == "json") {
+        JsonWriter json(res.resource());
+        json.reserve(256 + (end - offset) * 96);
+        json.write("{\n  \"path\": \"/", relative,
+                   "\",\n  \"generation\": ", listing->generation,
+                   ",\n  \"total\": ", total,
+                   ",\n  \"offset\": ", offset,
+                   ",\n  \"limit\": ", limit,
+                   ",\n  \"sort\": \"", sort_sign, sort_name, "\",\n  \"entries\": [");
+        for (size_t i = offset; i < end; ++i) {
+            const IndexEntry& entry = listing->at(sort, i, descending);
+            json.write(i == offset ? "\n    {\"name\": \"" : ",\n    {\"name\": \"", entry.name,
+                       entry.is_directory ? "\", \"type\": \"directory\"" : "\", \"type\": \"file\"",
+                       ", \"size\": ", entry.size, ", \"mtime\": ", entry.mtime, "}");
+        }
+        json.write(end > offset ? "\n  ]\n}" : "]\n}");
+        res.setHeader("Content-Type", "application/json");
+        res.setBody(json.take());
+        return;
+    }
+    
+    HtmlWriter html(res.resource());
+    html.reserve(1024 + (end - offset) * 160);
+    auto pageLink = [&](size_t page_offset, const char* page_sign, std::string_view page_sort, const char* label) {
+        html.write("<a href='/files/");
+        writeUrlEncoded(html, relative);
+        html.write(relative.empty() ? "" : "/", "?offset=", page_offset, "&amp;limit=", limit,
+                   "&amp;sort=", page_sign, page_sort, "'>", label, "</a>");
+    };
+    
+    html.write("<html><head><title>File Browser</title></head><body><h1>📁 File Browser - ",
+               document_root, "/", relative, "</h1><p>", total, " entries, sorted by ");
+    pageLink(0, "", "name", "name");
+    html.write(" | ");
+    pageLink(0, "-", "size", "size");
+    html.write(" | ");
+    pageLink(0, "-", "mtime", "date");
+    html.write("</p><ul>");
+    if (!relative.empty()) {
+        size_t slash = relative.rfind('/');
+        html.write("<li>📁 <a href='/files/");
+        if (slash != std::string::npos) {
+            writeUrlEncoded(html, std::string_view(relative).substr(0, slash));
+            html.write("/");
+        }
+        html.write("'>..</a></li>");
+    }
+    for (size_t i = offset; i < end; ++i) {
+        const IndexEntry& entry = listing->at(sort, i, descending);
+        html.write(entry.is_directory ? "<li>📁 <a href='/files/" : "<li>📄 <a href='/static/");
+        if (!relative.empty()) {
+            writeUrlEncoded(html, relative);
+            html.write("/");
+        }
+        writeUrlEncoded(html, entry.name);
+        html.write(entry.is_directory ? "/'>" : "'>", entry.name, "</a>");
+        if (!entry.is_directory) html.write(" (", entry.size, " bytes)");
+        html.write("</li>");
+    }
+    html.write("</ul><p>");
+    if (offset > 0) {
+        pageLink(offset - std::min(offset, limit), sort_sign, sort_name, "← Previous");
+        html.write(" ");
+    }
+    if (end < total) pageLink(end, sort_sign, sort_name, "Next →");
+    html.write("</p></body></html>");
+    res.setHeader("Content-Type", "text/html");
+    res.setBody(html.take());
+}
+
+Router setupRoutes(const std::string& document_root) {
+    Router router(document_root);
+    
+    // Homepage
+    router.get("/", [document_root](HTTPRequest&, HTTPResponse& res) {
+        res.setStatus(200, "OK");
+        res.setHeader("Content-Type", "text/html");
+        HtmlWriter html(res.resource());
+        html.write(
+            "<html><head><title>C++ HTTP Server</title><style>"
+            "body { font-family: Arial, sans-serif; max-width: 800px; margin: 0 auto; padding: 20px; }"
+            ".card { border: 1px solid #ddd; padding: 20px; margin: 10px 0; border-radius: 5px; }"
+            "</style></head><body>"
+            "<h1>C++ HTTP Server 2.0</h1>"
+            "<div class='card'><h3>Available Routes:</h3>"
+            "<ul>"
+            "<li><a href='/'>Home</a></li>"
+            "<li><a href='/api'>API</a></li>"
+            "<li><a href='/stats'>Statistics</a></li>"
+            "<li><a href='/files'>File Browser</a></li>"
+            "<li><a href='/hello?name=Visitor'>Hello with params</a></li>"
+            "</ul></div>"
+            "<p><strong>Document Root:</strong> ", document_root, "</p>"
+            "<p><strong>Thread ID:</strong> ", std::hash<std::thread::id>{}(std::this_thread::get_id()), "</p>"
+            "</body></html>"
+        );
+        res.setBody(html.take());
+    }, CachePolicy{.ttl = std::chrono::seconds(60)});
+    
+    // JSON API; the timestamp only changes once a second
+    router.get("/api", [document_root](HTTPRequest&, HTTPResponse& res) {
+        res.setStatus(200, "OK");
+        res.setHeader("Content-Type", "application/json");
+        JsonWriter json(res.resource());
+        json.write(
+            "{\n"
+            "  \"server\": \"C++ HTTP Server\",\n"
+            "  \"version\": \"2.0\",\n"
+            "  \"document_root\": \"", document_root, "\",\n"
+            "  \"thread\": \"", std::hash<std::thread::id>{}(std::this_thread::get_id()), "\",\n"
+            "  \"timestamp\": ", time(nullptr), ",\n"
+            "  \"status\": \"running\"\n"
+            "}"
+        );
+        res.setBody(json.take());
+    }, CachePolicy{.ttl = std::chrono::seconds(1)});
+    
+    // Statistics: HTML by default, JSON with ?format=json
+    router.get("/stats", [document_root](HTTPRequest& req, HTTPResponse& res) {
+        res.setStatus(200, "OK");
+        if (req.getQueryParam("format") == "json") {
+            res.setHeader("Content-Type", "application/json");
+            JsonWriter json(res.resource());
+            stats.renderJson(json, logger.droppedCount());
+            res.setBody(json.take());
+            return;
+        }
+        
+        HistogramSnapshot handler = stats.latency(Stage::HANDLER);
+        auto micros = [](uint64_t nanos) { return Fixed{nanos / 1e3, 1}; };
+        res.setHeader("Content-Type", "text/html");
+        HtmlWriter html(res.resource());
+        html.write(
+            "<html><head><title>Server Statistics</title></head><body>"
+            "<h1>📊 Server Statistics</h1>"
+            "<div style='border: 1px solid #ccc; padding: 20px; border-radius: 5px;'>"
+            "<p><strong>Total Requests:</strong> ", stats.total(Counter::REQUESTS), "</p>"
+            "<p><strong>Active Connections:</strong> ", stats.activeConnections(), "</p>"
+            "<p><strong>Success Responses:</strong> ", stats.total(Counter::SUCCESS_RESPONSES), "</p>"
+            "<p><strong>Error Responses:</strong> ", stats.total(Counter::ERROR_RESPONSES), "</p>"
+            "<p><strong>Bytes Received / Sent:</strong> ", stats.total(Counter::BYTES_RECEIVED),
+            " / ", stats.total(Counter::BYTES_SENT), "</p>"
+            "<p><strong>Response Cache Hits / Misses / Coalesced:</strong> ",
+            stats.total(Counter::RESPONSE_CACHE_HITS), " / ",
+            stats.total(Counter::RESPONSE_CACHE_MISSES), " / ",
+            stats.total(Counter::RESPONSE_CACHE_COALESCED), "</p>"
+            "<p><strong>Handler Latency p50 / p99 / p999:</strong> ", micros(handler.percentile(0.5)),
+            " / ", micros(handler.percentile(0.99)), " / ", micros(handler.percentile(0.999)), " µs</p>"
+            "<p><strong>Uptime:</strong> ", stats.uptimeSeconds(), " seconds</p>"
+            "<p><strong>Document Root:</strong> ", document_root, "</p>"
+            "</div></body></html>"
+        );
+        res.setBody(html.take());
+    });
+    
+    // Prometheus scrape endpoint
+    router.get("/metrics", [](HTTPRequest&, HTTPResponse& res) {
+        res.setStatus(200, "OK");
+        res.setHeader("Content-Type", "text/plain; version=0.0.4");
+        res.setBody(stats.renderPrometheus(logger.droppedCount()));
+    });
+    
+    // File browser, served from the in-memory directory index
+    router.get("/files", [document_root](HTTPRequest& req, HTTPResponse& res) {
+        listDirectory(document_root, req, res);
+    });
+    router.get("/files/*", [document_root](HTTPRequest& req, HTTPResponse& res) {
+        listDirectory(document_root, req, res);
+    });
+    
+    // Static file serving
+    router.get("/static/*", [document_root](HTTPRequest& req, HTTPResponse& res) {
+        std::string filepath;
+        if (!percentDecode(req.path.substr(7), filepath)) { // Remove "/static"
+            res.setStatus(400, "Bad Request");
+            res.setBody("Malformed path");
+            return;
+        }
+        // On a miss file_response holds the escaped 404 page
+        HTTPResponse file_response(document_root, res.resource());
+        file_response.serveFile(filepath, req);
+        res = std::move(file_response);
+    });
+    
+    // Parameter example
+    router.get("/hello", [](HTTPRequest& req, HTTPResponse& res) {
+        std::string_view name = "World";
+        if (req.hasQueryParam("name")) {
+            name = req.getQueryParam("name");
+        }
+        
+        res.setStatus(200, "OK");
+        res.setHeader("Content-Type", "text/html");
+        HtmlWriter html(res.resource());
+        html.write(
+            "<html><body>"
+            "<h1>👋 Hello, ", name, "!</h1>"
+            "<p>Try adding <code>?name=YourName</code> to the URL</p>"
+            "</body></html>"
+        );
+        res.setBody(html.take());
+    }, CachePolicy{.ttl = std::chrono::seconds(60), .query_params = {"name"}});
+
+    // The stat can block on a slow disk, so it runs on the blocking pool
+    router.get("/check", [document_root](HTTPRequest& req, HTTPResponse& res) -> Task<void> {
+        if (req.hasQueryParam("file")) {
+            std::string filename(req.getQueryParam("file"));
+            std::string full_path = document_root + "/" + filename;
+            
+            bool exists = co_await offload([&full_path] {
+                return fs::exists(full_path) && fs::is_regular_file(full_path);
+            });
+            
+            res.setStatus(200, "OK");
+            res.setHeader("Content-Type", "application/json");
+            JsonWriter json(res.resource());
+            json.write(
+                "{\n"
+                "  \"file\": \"", filename, "\",\n"
+                "  \"exists\": ", exists, ",\n"
+                "  \"path\": \"", full_path, "\",\n"
+                "  \"timestamp\": ", time(nullptr), "\n"
+                "}"
+            );
+            res.setBody(json.take());
+        } else {
+            res.setStatus(400, "Bad Request");
+            res.setHeader("Content-Type", "application/json");
+            res.setBody(
+                "{\n"
+                "  \"error\": \"Missing 'file' parameter\",\n"
+                "  \"usage\": \"/check?file=filename.txt\"\n"
+                "}"
+            );
+        }
+    });
+
+    // Answers after ?ms= milliseconds (at most 10 s) without holding up the loop
+    router.get("/delay", [](HTTPRequest& req, HTTPResponse& res) -> Task<void> {
+        int ms = 0;
+        std::string_view value = req.getQueryParam("ms");
+        std::from_chars(value.data(), value.data() + value.size(), ms);
+        ms = std::clamp(ms, 0, 10000);
+        co_await sleepFor(std::chrono::milliseconds(ms));
+        
+        res.setStatus(200, "OK");
+        res.setHeader("Content-Type", "application/json");
+        JsonWriter json(res.resource());
+        json.write("{\"delayed_ms\": ", ms, "}");
+        res.setBody(json.take());
+    });
+
+    router.get("/health", [](HTTPRequest&, HTTPResponse& res) {
+        res.setStatus(200, "OK");
+        res.setHeader("Content-Type", "application/json");
+        // Built in the request arena: the health check is polled often and
+        // allocates nothing
+        JsonWriter json(res.resource());
+        json.write("{\n"
+                   "  \"status\": \"healthy\",\n"
+                   "  \"uptime\": ", stats.total(Counter::REQUESTS), ",\n"
+                   "  \"timestamp\": ", time(nullptr), "\n"
+                   "}");
+        res.setBody(json.take());
+    });
+
+    router.get("/info", [](HTTPRequest&, HTTPResponse& res) {
+        res.setStatus(200, "OK");
+        res.setHeader("Content-Type", "application/json");
+        JsonWriter json(res.resource());
+        json.write(
+            "{\n"
+            "  \"server\": \"C++ HTTP Server\",\n"
+            "  \"status\": \"running\",\n"
+            "  \"timestamp\": ", time(nullptr), "\n"
+            "}"
+        );
+        res.setBody(json.take());
+    }, CachePolicy{.ttl = std::chrono::seconds(1)});
+    
+    // Streaming upload: the body is digested as it arrives, never buffered whole
+    router.postStream("/upload", [](HTTPRequest&) {
+        return std::make_unique<UploadDigest>();
+    });
+    
+    // POST example
+    router.post("/echo", [](HTTPRequest& req, HTTPResponse& res) {
+        res.setStatus(200, "OK");
+        res.setHeader("Content-Type", "application/json");
+        JsonWriter json(res.resource());
+        json.write(
+            "{\n"
+            "  \"received_body\": \"", req.body, "\",\n"
+            "  \"content_length\": ", req.body.length(), "\n"
+            "}"
+        );
+        res.setBody(json.take());
+    });
+    
+    return router;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <string>
+
+#include "router.hpp"
+
+// Initialize routes
+Router setupRoutes(const std::string& document_root);
@@ -0,0 +1,77 @@
+#include "static_files.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+std::string formatHttpDate(time_t when) {
+    char buffer[64];
+    struct tm parts;
+    gmtime_r(&when, &parts);
+    strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &parts);
+    return buffer;
+}
+
+time_t parseHttpDate(std::string_view value) {
+    std::string text(value);
+    struct tm parts{};
+    const char* end = strptime(text.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &parts);
+    if (!end || *end != '\0') return -1;
+    return timegm(&parts);
+}
+
+const std::string& mimeType(const std::string& extension) {
+    static const std::unordered_map<std::string, std::string> mime_types = {
+        {".html", "text/html"},
+        {".css", "text/css"},
+        {".js", "application/javascript"},
+        {".json", "application/json"},
+        {".png", "image/png"},
+        {".jpg", "image/jpeg"},
+        {".txt", "text/plain"}
+    };
+    static const std::string fallback = "application/octet-stream";
+    
+    auto it = mime_types.find(extension);
+    return it != mime_types.end() ? it->second : fallback;
+}
+
+bool isCompressible(std::string_view content_type) {
+    return content_type.substr(0, 5) == "text/" ||
+           content_type == "application/javascript" ||
+           content_type == "application/json" ||
+           content_type == "application/xml" ||
+           content_type == "image/svg+xml";
+}
+
+bool isNotModified(const HTTPRequest& req, const FileInfo& info) {
+    std::string_view if_none_match = req.getHeader("If-None-Match");
+    if (!if_none_match.empty()) {
+        return if_none_match == "*" || hasToken(if_none_match, info.etag) ||
+               hasToken(if_none_match, "W/" + info.etag);
+    }
+    
+    std::string_view if_modified_since = req.getHeader("If-Modified-Since");
+    if (!if_modified_since.empty()) {
+        time_t since = parseHttpDate(if_modified_since);
+        return since != -1 && info.mtime <= since;
+    }
+    return false;
+}
+
+int64_t steadyNanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+StaticFileCache file_cache;
+
+bool readFile(int fd, size_t size, std::string& contents) {
+    contents.assign(size, '\0');
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = pread(fd, &contents[done], size - done, done);
+        if (n <= 0) return false;
+        done += n;
+    }
+    return true;
+}
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <sys/stat.h>
+
+#include <atomic>
+#include <ctime>
+#include <filesystem>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "http_request.hpp"
+#include "output_queue.hpp"
+
+// HTTP-date (RFC 7231 7.1.1.1), e.g. "Sun, 06 Nov 1994 08:49:37 GMT"
+std::string formatHttpDate(time_t when);
+
+// Returns -1 if value is not a valid HTTP-date
+time_t parseHttpDate(std::string_view value);
+
+const std::string& mimeType(const std::string& extension);
+
+// Types worth compressing; images and archives already are
+bool isCompressible(std::string_view content_type);
+
+// Validators and representation headers of a file on disk
+struct FileInfo {
+    std::string content_type;
+    std::string etag;
+    std::string last_modified;
+    time_t mtime = 0;
+    size_t size = 0;
+    bool compressible = false;
+    
+    FileInfo(const std::string& path, const struct stat& st) {
+        char tag[64];
+        snprintf(tag, sizeof(tag), "\"%lx-%lx\"", static_cast<unsigned long>(st.st_mtime),
+                 static_cast<unsigned long>(st.st_size));
+        content_type = mimeType(std::filesystem::path(path).extension().string());
+        etag = tag;
+        last_modified = formatHttpDate(st.st_mtime);
+        mtime = st.st_mtime;
+        size = st.st_size;
+        compressible = isCompressible(content_type);
+    }
+};
+
+// Conditional GET (RFC 7232 6): If-None-Match takes precedence over
+// If-Modified-Since
+bool isNotModified(const HTTPRequest& req, const FileInfo& info);
+
+int64_t steadyNanos();
+
+// Small static file held in memory together with its ready-to-send headers
+struct CachedFile {
+    FileInfo info;
+    std::string headers;   // representation header lines, each ending in CRLF
+    std::string body;
+    dev_t device;
+    ino_t inode;
+    timespec modified;
+    mutable std::atomic<int64_t> checked_at;   // steady clock ns of last stat
+    
+    CachedFile(const std::string& path, const struct stat& st, std::string contents)
+        : info(path, st), body(std::move(contents)), device(st.st_dev), inode(st.st_ino),
+          modified(st.st_mtim), checked_at(steadyNanos()) {
+        headers = "Content-Type: " + info.content_type + "\r\n"
+                  "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                  "ETag: " + info.etag + "\r\n"
+                  "Last-Modified: " + info.last_modified + "\r\n"
+                  "Accept-Ranges: bytes\r\n";
+        if (info.compressible) headers += "Vary: Accept-Encoding\r\n";
+    }
+    
+    bool matches(const struct stat& st) const {
+        return st.st_dev == device && st.st_ino == inode &&
+               static_cast<size_t>(st.st_size) == body.size() &&
+               st.st_mtim.tv_sec == modified.tv_sec && st.st_mtim.tv_nsec == modified.tv_nsec;
+    }
+    
+    size_t cost() const { return body.size() + headers.size(); }
+};
+
+// Sharded LRU map from string keys to shared immutable values, bounded by
+// the sum of Value::cost(). Values stay alive while a response uses them.
+template <typename Value>
+class ShardedLruCache {
+private:
+    static constexpr size_t SHARD_COUNT = 16;
+    
+    struct Shard {
+        std::mutex mutex;
+        std::list<std::string> lru;   // most recently used first
+        std::unordered_map<std::string, std::pair<std::shared_ptr<const Value>,
+                                                  std::list<std::string>::iterator>> entries;
+        size_t bytes = 0;
+    };
+    
+    std::array<Shard, SHARD_COUNT> shards;
+    size_t shard_capacity = 0;
+    
+    Shard& shardFor(const std::string& key) {
+        return shards[std::hash<std::string>{}(key) % SHARD_COUNT];
+    }
+    
+    void eraseLocked(Shard& shard, const std::string& key) {
+        auto it = shard.entries.find(key);
+        if (it == shard.entries.end()) return;
+        shard.bytes -= it->second.first->cost();
+        shard.lru.erase(it->second.second);
+        shard.entries.erase(it);
+    }
+
+public:
+    void setCapacity(size_t total_bytes) { shard_capacity = total_bytes / SHARD_COUNT; }
+    size_t shardCapacity() const { return shard_capacity; }
+    
+    std::shared_ptr<const Value> find(const std::string& key) {
+        Shard& shard = shardFor(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.entries.find(key);
+        if (it == shard.entries.end()) return nullptr;
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second.second);
+        return it->second.first;
+    }
+    
+    void insert(const std::string& key, std::shared_ptr<const Value> value) {
+        Shard& shard = shardFor(key);
+        size_t cost = value->cost();
+        if (cost > shard_capacity) return;
+        
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        eraseLocked(shard, key);
+        while (shard.bytes + cost > shard_capacity && !shard.lru.empty()) {
+            eraseLocked(shard, shard.lru.back());
+        }
+        shard.lru.push_front(key);
+        shard.entries[key] = {std::move(value), shard.lru.begin()};
+        shard.bytes += cost;
+    }
+    
+    // Removes key only if it still maps to expected
+    void erase(const std::string& key, const std::shared_ptr<const Value>& expected) {
+        Shard& shard = shardFor(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.entries.find(key);
+        if (it != shard.entries.end() && it->second.first == expected) eraseLocked(shard, key);
+    }
+};
+
+// Cache of hot small static files keyed by full path. Entries are
+// revalidated against the file's stat data at most once per second, so hits
+// between checks cost no syscalls.
+class StaticFileCache {
+private:
+    static constexpr int64_t REVALIDATE_NANOS = 1000000000;
+    
+    ShardedLruCache<CachedFile> entries;
+    size_t max_file_size = 0;
+
+public:
+    void configure(size_t total_bytes, size_t file_bytes) {
+        entries.setCapacity(total_bytes);
+        max_file_size = std::min(file_bytes, entries.shardCapacity());
+    }
+    
+    bool accepts(size_t size) const { return size <= max_file_size && max_file_size > 0; }
+    
+    // Returns the entry for path if present and still current
+    std::shared_ptr<const CachedFile> lookup(const std::string& path) {
+        std::shared_ptr<const CachedFile> entry = entries.find(path);
+        if (!entry) return nullptr;
+        
+        int64_t now = steadyNanos();
+        if (now - entry->checked_at.load(std::memory_order_relaxed) < REVALIDATE_NANOS) return entry;
+        
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0 && entry->matches(st)) {
+            entry->checked_at.store(now, std::memory_order_relaxed);
+            return entry;
+        }
+        entries.erase(path, entry);
+        return nullptr;
+    }
+    
+    void insert(const std::string& path, std::shared_ptr<const CachedFile> entry) {
+        entries.insert(path, std::move(entry));
+    }
+};
+
+extern StaticFileCache file_cache;
+
+// Reads a whole regular file of known size; false on a short read
+bool readFile(int fd, size_t size, std::string& contents);
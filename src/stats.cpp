@@ -0,0 +1,3 @@
+#include "stats.hpp"
+
+ServerStats stats;
@@ -0,0 +1,357 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "body_writer.hpp"
+
+// Latency histogram in nanoseconds with HDR-style buckets: values below 16
+// get a bucket each; above that every power of two is split into 16 linear
+// sub-buckets, so a value is reported within 1/16 of itself. Written by one
+// thread and read by any.
+class LatencyHistogram {
+public:
+    static constexpr int SUB_BITS = 4;
+    static constexpr size_t SUB_BUCKETS = size_t(1) << SUB_BITS;
+    static constexpr int MAX_BITS = 36;   // about 68 seconds
+    static constexpr size_t BUCKETS = (MAX_BITS - SUB_BITS + 1) * SUB_BUCKETS;
+    
+    std::array<std::atomic<uint64_t>, BUCKETS> counts;
+    std::atomic<uint64_t> sum;
+    
+    static size_t bucketFor(uint64_t value) {
+        if (value < SUB_BUCKETS) return value;
+        int msb = 63 - __builtin_clzll(value);
+        if (msb >= MAX_BITS) return BUCKETS - 1;
+        int shift = msb - SUB_BITS;
+        return (shift + 1) * SUB_BUCKETS + ((value >> shift) & (SUB_BUCKETS - 1));
+    }
+    
+    // Largest value that falls into bucket
+    static uint64_t bucketLimit(size_t bucket) {
+        if (bucket < SUB_BUCKETS) return bucket;
+        int shift = static_cast<int>(bucket / SUB_BUCKETS) - 1;
+        uint64_t sub = SUB_BUCKETS + bucket % SUB_BUCKETS;
+        return ((sub + 1) << shift) - 1;
+    }
+    
+    // Owner thread only, so plain load/store instead of locked increments
+    void record(uint64_t value) {
+        std::atomic<uint64_t>& count = counts[bucketFor(value)];
+        count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        sum.store(sum.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+};
+
+// Sum of any number of histograms, taken at read time
+struct HistogramSnapshot {
+    std::array<uint64_t, LatencyHistogram::BUCKETS> counts{};
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    
+    void add(const LatencyHistogram& histogram) {
+        for (size_t i = 0; i < LatencyHistogram::BUCKETS; ++i) {
+            uint64_t n = histogram.counts[i].load(std::memory_order_relaxed);
+            counts[i] += n;
+            count += n;
+        }
+        sum += histogram.sum.load(std::memory_order_relaxed);
+    }
+    
+    // Value at quantile q (0..1), as the upper bound of its bucket
+    uint64_t percentile(double q) const {
+        if (count == 0) return 0;
+        uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(q * count + 0.5));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < LatencyHistogram::BUCKETS; ++i) {
+            seen += counts[i];
+            if (seen >= rank) return LatencyHistogram::bucketLimit(i);
+        }
+        return LatencyHistogram::bucketLimit(LatencyHistogram::BUCKETS - 1);
+    }
+};
+
+enum class Counter {
+    REQUESTS, SUCCESS_RESPONSES, ERROR_RESPONSES, BYTES_RECEIVED, BYTES_SENT,
+    CONNECTIONS_OPENED, CONNECTIONS_CLOSED,
+    // Overload protection: connections turned away at accept by the total or
+    // per-IP cap, requests answered with 503 while shedding, and connections
+    // closed by each timeout
+    CONNECTIONS_REJECTED, PEER_CONNECTIONS_REJECTED, REQUESTS_SHED,
+    HEADER_TIMEOUTS, BODY_TIMEOUTS, IDLE_TIMEOUTS, WRITE_TIMEOUTS,
+    // Response cache: fresh hits, misses that ran the handler, and requests
+    // that shared another's miss (served stale or waited for it)
+    RESPONSE_CACHE_HITS, RESPONSE_CACHE_MISSES, RESPONSE_CACHE_COALESCED,
+    // HTTP/2: connections switched to it, streams opened, streams refused
+    // or reset by the server
+    HTTP2_CONNECTIONS, HTTP2_STREAMS, HTTP2_STREAM_ERRORS,
+    // Reverse proxy: upstream connections opened, requests sent over an idle
+    // pooled connection, and connects, sends or responses that failed
+    UPSTREAM_CONNECTS, UPSTREAM_REUSES, UPSTREAM_ERRORS, COUNT
+};
+
+// Parse: first byte to complete head. Handler: routing, handler and
+// serialization. Send: response queued to last byte accepted by the socket.
+enum class Stage { PARSE, HANDLER, SEND, COUNT };
+
+// A response queued on a connection but not yet fully sent, for send latency
+struct QueuedResponse {
+    std::chrono::steady_clock::time_point queued;
+    size_t route;
+    int status;
+};
+
+constexpr size_t STATS_MAX_ROUTES = 64;    // route ids past this share the last slot
+constexpr size_t STATS_STATUS_CLASSES = 5;  // 1xx .. 5xx
+
+// One thread's counters and histograms, on their own cache lines so threads
+// never write to a line another thread writes
+struct alignas(64) StatsShard {
+    static constexpr size_t HISTOGRAMS =
+        static_cast<size_t>(Stage::COUNT) * STATS_MAX_ROUTES * STATS_STATUS_CLASSES;
+    
+    std::array<std::atomic<uint64_t>, static_cast<size_t>(Counter::COUNT)> counters;
+    // Indexed by stage, route and status class; allocated on first use
+    std::array<std::atomic<LatencyHistogram*>, HISTOGRAMS> histograms;
+    
+    static size_t slot(Stage stage, size_t route, size_t status_class) {
+        return (static_cast<size_t>(stage) * STATS_MAX_ROUTES + route) * STATS_STATUS_CLASSES + status_class;
+    }
+    
+    ~StatsShard() {
+        for (auto& histogram : histograms) delete histogram.load();
+    }
+};
+
+// Server statistics, sharded per thread: each thread updates its own shard
+// without contention and readers sum the shards.
+class ServerStats {
+private:
+    std::mutex shards_mutex;   // taken when a thread first records and by readers
+    std::vector<std::unique_ptr<StatsShard>> shards;
+    std::vector<std::string> route_names;   // index 0 is requests no route matched
+    
+    StatsShard& localShard() {
+        thread_local StatsShard* shard = nullptr;
+        if (!shard) {
+            auto owned = std::make_unique<StatsShard>();
+            shard = owned.get();
+            std::lock_guard<std::mutex> lock(shards_mutex);
+            shards.push_back(std::move(owned));
+        }
+        return *shard;
+    }
+    
+    static size_t statusClass(int status) {
+        return static_cast<size_t>(std::clamp(status / 100, 1, 5) - 1);
+    }
+    
+    static std::string_view stageName(size_t stage) {
+        static const char* names[] = {"parse", "handler", "send"};
+        return names[stage];
+    }
+    
+    static std::string formatSeconds(uint64_t nanos) {
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "%.9f", nanos / 1e9);
+        return buffer;
+    }
+    
+    // Calls f(stage, route, status_class, snapshot) for every combination
+    // that has recorded something
+    template <typename F>
+    void forEachHistogram(F f) {
+        std::lock_guard<std::mutex> lock(shards_mutex);
+        for (size_t i = 0; i < StatsShard::HISTOGRAMS; ++i) {
+            HistogramSnapshot merged;
+            bool recorded = false;
+            for (auto& shard : shards) {
+                const LatencyHistogram* histogram = shard->histograms[i].load(std::memory_order_acquire);
+                if (!histogram) continue;
+                merged.add(*histogram);
+                recorded = true;
+            }
+            if (!recorded || merged.count == 0) continue;
+            size_t status_class = i % STATS_STATUS_CLASSES;
+            size_t route = i / STATS_STATUS_CLASSES % STATS_MAX_ROUTES;
+            size_t stage = i / STATS_STATUS_CLASSES / STATS_MAX_ROUTES;
+            f(stage, route, status_class, merged);
+        }
+    }
+
+public:
+    const std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+    
+    // Called once at startup, before any request is recorded
+    void setRouteNames(std::vector<std::string> names) { route_names = std::move(names); }
+    
+    std::string routeName(size_t route) const {
+        if (route >= STATS_MAX_ROUTES - 1 && route_names.size() > STATS_MAX_ROUTES) return "other";
+        return route < route_names.size() ? route_names[route] : "unknown";
+    }
+    
+    void add(Counter counter, uint64_t n = 1) {
+        std::atomic<uint64_t>& value = localShard().counters[static_cast<size_t>(counter)];
+        value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    
+    void recordLatency(Stage stage, size_t route, int status, uint64_t nanos) {
+        route = std::min(route, STATS_MAX_ROUTES - 1);
+        std::atomic<LatencyHistogram*>& slot =
+            localShard().histograms[StatsShard::slot(stage, route, statusClass(status))];
+        LatencyHistogram* histogram = slot.load(std::memory_order_relaxed);
+        if (!histogram) {
+            histogram = new LatencyHistogram();
+            slot.store(histogram, std::memory_order_release);
+        }
+        histogram->record(nanos);
+    }
+    
+    uint64_t total(Counter counter) {
+        std::lock_guard<std::mutex> lock(shards_mutex);
+        uint64_t sum = 0;
+        for (auto& shard : shards) {
+            sum += shard->counters[static_cast<size_t>(counter)].load(std::memory_order_relaxed);
+        }
+        return sum;
+    }
+    
+    uint64_t activeConnections() {
+        uint64_t opened = total(Counter::CONNECTIONS_OPENED);
+        uint64_t closed = total(Counter::CONNECTIONS_CLOSED);
+        return opened > closed ? opened - closed : 0;
+    }
+    
+    long uptimeSeconds() const {
+        return std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::steady_clock::now() - start_time).count();
+    }
+    
+    // One stage over all routes and statuses
+    HistogramSnapshot latency(Stage stage) {
+        HistogramSnapshot total_snapshot;
+        forEachHistogram([&](size_t s, size_t, size_t, const HistogramSnapshot& snapshot) {
+            if (s != static_cast<size_t>(stage)) return;
+            for (size_t i = 0; i < LatencyHistogram::BUCKETS; ++i) total_snapshot.counts[i] += snapshot.counts[i];
+            total_snapshot.count += snapshot.count;
+            total_snapshot.sum += snapshot.sum;
+        });
+        return total_snapshot;
+    }
+    
+    // Prometheus text exposition format
+    std::string renderPrometheus(uint64_t log_dropped) {
+        std::string out;
+        auto metric = [&](const char* name, const char* type, const char* help, uint64_t value) {
+            out += std::string("# HELP ") + name + " " + help + "\n# TYPE " + name + " " + type + "\n" +
+                   name + " " + std::to_string(value) + "\n";
+        };
+        metric("http_requests_total", "counter", "Requests handled.", total(Counter::REQUESTS));
+        metric("http_responses_success_total", "counter", "Requests answered by a route.", total(Counter::SUCCESS_RESPONSES));
+        metric("http_responses_error_total", "counter", "Requests answered with an error.", total(Counter::ERROR_RESPONSES));
+        metric("http_received_bytes_total", "counter", "Bytes read from clients.", total(Counter::BYTES_RECEIVED));
+        metric("http_sent_bytes_total", "counter", "Bytes written to clients.", total(Counter::BYTES_SENT));
+        metric("http_connections_opened_total", "counter", "Connections accepted.", total(Counter::CONNECTIONS_OPENED));
+        metric("http_connections_active", "gauge", "Connections currently open.", activeConnections());
+        metric("http_connections_rejected_total", "counter", "Connections refused at the connection limit.", total(Counter::CONNECTIONS_REJECTED));
+        metric("http_connections_rejected_per_ip_total", "counter", "Connections refused at the per-IP limit.", total(Counter::PEER_CONNECTIONS_REJECTED));
+        metric("http_requests_shed_total", "counter", "Requests answered with 503 while overloaded.", total(Counter::REQUESTS_SHED));
+        out += "# HELP http_response_cache_requests_total Requests to cached routes by outcome.\n"
+               "# TYPE http_response_cache_requests_total counter\n"
+               "http_response_cache_requests_total{result=\"hit\"} " + std::to_string(total(Counter::RESPONSE_CACHE_HITS)) + "\n"
+               "http_response_cache_requests_total{result=\"miss\"} " + std::to_string(total(Counter::RESPONSE_CACHE_MISSES)) + "\n"
+               "http_response_cache_requests_total{result=\"coalesced\"} " + std::to_string(total(Counter::RESPONSE_CACHE_COALESCED)) + "\n";
+        metric("http2_connections_total", "counter", "Connections that switched to HTTP/2.", total(Counter::HTTP2_CONNECTIONS));
+        metric("http2_streams_total", "counter", "HTTP/2 streams opened by clients.", total(Counter::HTTP2_STREAMS));
+        metric("http2_stream_errors_total", "counter", "HTTP/2 streams refused or reset by the server.", total(Counter::HTTP2_STREAM_ERRORS));
+        metric("http_upstream_connects_total", "counter", "Connections opened to proxy upstreams.", total(Counter::UPSTREAM_CONNECTS));
+        metric("http_upstream_reuses_total", "counter", "Proxied requests sent over a pooled upstream connection.", total(Counter::UPSTREAM_REUSES));
+        metric("http_upstream_errors_total", "counter", "Upstream connects, sends or responses that failed.", total(Counter::UPSTREAM_ERRORS));
+        out += "# HELP http_timeouts_total Connections closed by a timeout.\n# TYPE http_timeouts_total counter\n"
+               "http_timeouts_total{phase=\"header\"} " + std::to_string(total(Counter::HEADER_TIMEOUTS)) + "\n"
+               "http_timeouts_total{phase=\"body\"} " + std::to_string(total(Counter::BODY_TIMEOUTS)) + "\n"
+               "http_timeouts_total{phase=\"idle\"} " + std::to_string(total(Counter::IDLE_TIMEOUTS)) + "\n"
+               "http_timeouts_total{phase=\"write\"} " + std::to_string(total(Counter::WRITE_TIMEOUTS)) + "\n";
+        metric("http_log_dropped_total", "counter", "Log records dropped because a buffer was full.", log_dropped);
+        metric("http_uptime_seconds", "gauge", "Seconds since the server started.", uptimeSeconds());
+        
+        out += "# HELP http_request_duration_seconds Request latency by stage, route and status class.\n"
+               "# TYPE http_request_duration_seconds summary\n";
+        forEachHistogram([&](size_t stage, size_t route, size_t status_class, const HistogramSnapshot& snapshot) {
+            std::string labels = "stage=\"" + std::string(stageName(stage)) + "\",route=\"";
+            for (char c : routeName(route)) {
+                if (c == '"' || c == '\\') labels += '\\';
+                labels += c;
+            }
+            labels += "\",status=\"" + std::to_string(status_class + 1) + "xx\"";
+            for (const char* quantile : {"0.5", "0.99", "0.999"}) {
+                out += "http_request_duration_seconds{" + labels + ",quantile=\"" + quantile + "\"} " +
+                       formatSeconds(snapshot.percentile(std::stod(quantile))) + "\n";
+            }
+            out += "http_request_duration_seconds_sum{" + labels + "} " + formatSeconds(snapshot.sum) + "\n";
+            out += "http_request_duration_seconds_count{" + labels + "} " + std::to_string(snapshot.count) + "\n";
+        });
+        return out;
+    }
+    
+    void renderJson(JsonWriter& json, uint64_t log_dropped) {
+        auto percentiles = [&json](const HistogramSnapshot& snapshot) {
+            json.write("{\"count\": ", snapshot.count, ", \"p50\": ", snapshot.percentile(0.5),
+                       ", \"p99\": ", snapshot.percentile(0.99), ", \"p999\": ", snapshot.percentile(0.999), "}");
+        };
+        
+        json.write("{\n"
+            "  \"uptime_seconds\": ", uptimeSeconds(), ",\n"
+            "  \"total_requests\": ", total(Counter::REQUESTS), ",\n"
+            "  \"success_responses\": ", total(Counter::SUCCESS_RESPONSES), ",\n"
+            "  \"error_responses\": ", total(Counter::ERROR_RESPONSES), ",\n"
+            "  \"active_connections\": ", activeConnections(), ",\n"
+            "  \"bytes_received\": ", total(Counter::BYTES_RECEIVED), ",\n"
+            "  \"bytes_sent\": ", total(Counter::BYTES_SENT), ",\n"
+            "  \"connections_rejected\": ", total(Counter::CONNECTIONS_REJECTED), ",\n"
+            "  \"connections_rejected_per_ip\": ", total(Counter::PEER_CONNECTIONS_REJECTED), ",\n"
+            "  \"requests_shed\": ", total(Counter::REQUESTS_SHED), ",\n"
+            "  \"timeouts\": {\"header\": ", total(Counter::HEADER_TIMEOUTS),
+            ", \"body\": ", total(Counter::BODY_TIMEOUTS),
+            ", \"idle\": ", total(Counter::IDLE_TIMEOUTS),
+            ", \"write\": ", total(Counter::WRITE_TIMEOUTS), "},\n"
+            "  \"response_cache\": {\"hits\": ", total(Counter::RESPONSE_CACHE_HITS),
+            ", \"misses\": ", total(Counter::RESPONSE_CACHE_MISSES),
+            ", \"coalesced\": ", total(Counter::RESPONSE_CACHE_COALESCED), "},\n"
+            "  \"http2\": {\"connections\": ", total(Counter::HTTP2_CONNECTIONS),
+            ", \"streams\": ", total(Counter::HTTP2_STREAMS),
+            ", \"stream_errors\": ", total(Counter::HTTP2_STREAM_ERRORS), "},\n"
+            "  \"upstream\": {\"connects\": ", total(Counter::UPSTREAM_CONNECTS),
+            ", \"reuses\": ", total(Counter::UPSTREAM_REUSES),
+            ", \"errors\": ", total(Counter::UPSTREAM_ERRORS), "},\n"
+            "  \"log_dropped\": ", log_dropped, ",\n"
+            "  \"latency_ns\": {");
+        for (size_t stage = 0; stage < static_cast<size_t>(Stage::COUNT); ++stage) {
+            json.write(stage ? ", \"" : "\"", stageName(stage), "\": ");
+            percentiles(latency(static_cast<Stage>(stage)));
+        }
+        json.write("},\n  \"routes\": [");
+        
+        bool first = true;
+        forEachHistogram([&](size_t stage, size_t route, size_t status_class, const HistogramSnapshot& snapshot) {
+            if (stage != static_cast<size_t>(Stage::HANDLER)) return;
+            json.write(first ? "\n    {\"route\": \"" : ",\n    {\"route\": \"", routeName(route),
+                       "\", \"status\": \"", status_class + 1, "xx\", \"handler_ns\": ");
+            percentiles(snapshot);
+            json.write("}");
+            first = false;
+        });
+        json.write("\n  ]\n}");
+    }
+};
+
+extern ServerStats stats;
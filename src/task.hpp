@@ -0,0 +1,174 @@
+#pragma once
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <new>
+#include <optional>
+#include <utility>
+
+// Coroutine frames are carved by size class from per-thread free lists, so
+// once a loop has run a few handlers of a kind, suspending one allocates
+// nothing. A frame is freed on the thread that created it, as coroutines
+// are always resumed on their own loop. Frames above the largest class,
+// and frames beyond what a list retains, go to the heap.
+class FramePool {
+private:
+    static constexpr size_t GRANULE = 64;
+    static constexpr size_t CLASSES = 32;   // frames up to 2 KB
+    static constexpr size_t RETAIN = 1024;  // free frames kept per class
+
+    struct FreeFrame {
+        FreeFrame* next;
+    };
+    FreeFrame* free_lists[CLASSES] = {};
+    size_t free_counts[CLASSES] = {};
+
+    static size_t classOf(size_t size) { return (size + GRANULE - 1) / GRANULE; }
+
+public:
+    FramePool() = default;
+    FramePool(const FramePool&) = delete;
+    FramePool& operator=(const FramePool&) = delete;
+
+    ~FramePool() {
+        for (FreeFrame* frame : free_lists) {
+            while (frame) {
+                FreeFrame* next = frame->next;
+                ::operator delete(frame);
+                frame = next;
+            }
+        }
+    }
+
+    static FramePool& local() {
+        thread_local FramePool pool;
+        return pool;
+    }
+
+    void* allocate(size_t size) {
+        size_t index = classOf(size);
+        if (index >= CLASSES) return ::operator new(size);
+        if (FreeFrame* frame = free_lists[index]) {
+            free_lists[index] = frame->next;
+            --free_counts[index];
+            return frame;
+        }
+        return ::operator new(index * GRANULE);
+    }
+
+    void release(void* frame, size_t size) {
+        size_t index = classOf(size);
+        if (index >= CLASSES || free_counts[index] >= RETAIN) {
+            ::operator delete(frame);
+            return;
+        }
+        auto* free_frame = static_cast<FreeFrame*>(frame);
+        free_frame->next = free_lists[index];
+        free_lists[index] = free_frame;
+        ++free_counts[index];
+    }
+};
+
+template <typename T = void>
+class Task;
+
+// Shared by the promises of every Task: frames from the pool, a lazy start
+// and, at the end, a jump straight back to whoever awaited the task
+struct TaskPromiseBase {
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+    std::exception_ptr error;
+
+    static void* operator new(size_t size) { return FramePool::local().allocate(size); }
+    static void operator delete(void* frame, size_t size) { FramePool::local().release(frame, size); }
+
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> done) noexcept {
+            return done.promise().continuation;
+        }
+        void await_resume() noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { error = std::current_exception(); }
+};
+
+template <typename T>
+struct TaskPromise : TaskPromiseBase {
+    std::optional<T> value;
+
+    Task<T> get_return_object();
+    template <typename U>
+    void return_value(U&& result) { value.emplace(std::forward<U>(result)); }
+
+    T take() {
+        if (error) std::rethrow_exception(error);
+        return std::move(*value);
+    }
+};
+
+template <>
+struct TaskPromise<void> : TaskPromiseBase {
+    Task<void> get_return_object();
+    void return_void() {}
+
+    void take() {
+        if (error) std::rethrow_exception(error);
+    }
+};
+
+// Lazily started coroutine returning T. Awaiting a task runs it until it
+// completes, suspending the awaiting coroutine for as long as it is
+// suspended. Plain code starts one with start() and checks done(); the
+// Task object owns the frame and must outlive the coroutine's last step.
+template <typename T>
+class [[nodiscard]] Task {
+public:
+    using promise_type = TaskPromise<T>;
+
+private:
+    std::coroutine_handle<promise_type> handle;
+
+public:
+    Task() = default;
+    explicit Task(std::coroutine_handle<promise_type> frame) : handle(frame) {}
+    Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            if (handle) handle.destroy();
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+    ~Task() {
+        if (handle) handle.destroy();
+    }
+
+    // Runs the coroutine until it first suspends or completes
+    void start() { handle.resume(); }
+
+    // True once the coroutine completed, or if there is none
+    bool done() const { return !handle || handle.done(); }
+
+    // The completed coroutine's value; rethrows what escaped it
+    T result() { return handle.promise().take(); }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        handle.promise().continuation = awaiting;
+        return handle;
+    }
+    T await_resume() { return handle.promise().take(); }
+};
+
+template <typename T>
+Task<T> TaskPromise<T>::get_return_object() {
+    return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() {
+    return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
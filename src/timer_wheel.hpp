@@ -0,0 +1,132 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+// Intrusive hook for TimerWheel: an object with a deadline derives from it.
+// Unlinks itself when destroyed.
+struct TimerNode {
+    TimerNode* prev = nullptr;
+    TimerNode* next = nullptr;
+    uint64_t expires = 0;   // tick at which the timer fires
+
+    TimerNode() = default;
+    TimerNode(const TimerNode&) = delete;
+    TimerNode& operator=(const TimerNode&) = delete;
+    ~TimerNode() { unlink(); }
+
+    bool scheduled() const { return next != nullptr; }
+
+    void unlink() {
+        if (!next) return;
+        prev->next = next;
+        next->prev = prev;
+        prev = next = nullptr;
+    }
+};
+
+// Hierarchical timing wheel with 100 ms ticks: four levels of 64 slots cover
+// about 19 days. Scheduling and cancelling are O(1) list operations, so a
+// deadline can be pushed back on every read without a syscall. Level 0 holds
+// timers due within 64 ticks; each time it wraps, the next level's current
+// slot is redistributed into the levels below. Owned by a single thread.
+class TimerWheel {
+public:
+    using Clock = std::chrono::steady_clock;
+    static constexpr auto TICK = std::chrono::milliseconds(100);
+
+private:
+    static constexpr int LEVELS = 4;
+    static constexpr int SLOT_BITS = 6;
+    static constexpr uint64_t SLOTS = uint64_t(1) << SLOT_BITS;
+    static constexpr uint64_t SLOT_MASK = SLOTS - 1;
+
+    // List heads; an empty slot points to itself
+    std::array<TimerNode, LEVELS * SLOTS> slots;
+    Clock::time_point origin = Clock::now();
+    uint64_t current = 0;   // last tick processed
+
+    uint64_t tickOf(Clock::time_point time) const {
+        if (time <= origin) return 0;
+        return static_cast<uint64_t>((time - origin) / TICK);
+    }
+
+    void link(TimerNode& node) {
+        uint64_t delta = node.expires - current;
+        int level = 0;
+        while (level < LEVELS - 1 && delta >= (SLOTS << (level * SLOT_BITS))) ++level;
+        uint64_t slot = level == LEVELS - 1 && delta >= (SLOTS << (level * SLOT_BITS))
+            ? (current >> (level * SLOT_BITS)) - 1   // beyond the horizon: the farthest slot
+            : node.expires >> (level * SLOT_BITS);
+        TimerNode& head = slots[level * SLOTS + (slot & SLOT_MASK)];
+        node.prev = head.prev;
+        node.next = &head;
+        head.prev->next = &node;
+        head.prev = &node;
+    }
+
+    // Moves every timer in a higher level slot down to where it now belongs
+    void cascade(int level) {
+        TimerNode& head = slots[level * SLOTS + ((current >> (level * SLOT_BITS)) & SLOT_MASK)];
+        TimerNode pending;
+        if (head.next == &head) return;
+        // Splice the whole list out first: relinking may land in this slot again
+        pending.next = head.next;
+        pending.prev = head.prev;
+        pending.next->prev = &pending;
+        pending.prev->next = &pending;
+        head.next = head.prev = &head;
+        while (pending.next != &pending) {
+            TimerNode& node = *pending.next;
+            node.unlink();
+            link(node);
+        }
+    }
+
+public:
+    TimerWheel() {
+        for (TimerNode& head : slots) head.prev = head.next = &head;
+    }
+
+    // (Re)schedules node to fire on the first tick at or after deadline
+    void schedule(TimerNode& node, Clock::time_point deadline) {
+        node.unlink();
+        node.expires = std::max(tickOf(deadline) + 1, current + 1);
+        link(node);
+    }
+
+    void cancel(TimerNode& node) { node.unlink(); }
+
+    // Processes every tick up to now, calling expire for each timer due.
+    // The node is unlinked first, so expire may reschedule or destroy it.
+    template <typename Expire>
+    void advance(Clock::time_point now, Expire&& expire) {
+        uint64_t target = tickOf(now);
+        while (current < target) {
+            ++current;
+            for (int level = 1; level < LEVELS; ++level) {
+                if ((current & ((uint64_t(1) << (level * SLOT_BITS)) - 1)) != 0) break;
+                cascade(level);
+            }
+            TimerNode& head = slots[current & SLOT_MASK];
+            while (head.next != &head) {
+                TimerNode& node = *head.next;
+                node.unlink();
+                expire(node);
+            }
+        }
+    }
+
+    // When advance() next has work: the first occupied level 0 slot, or the
+    // next cascade. Lets a loop sleep instead of waking every tick.
+    Clock::time_point nextWakeup() const {
+        uint64_t tick = current + 1;
+        for (; tick & SLOT_MASK; ++tick) {
+            const TimerNode& head = slots[tick & SLOT_MASK];
+            if (head.next != &head) break;
+        }
+        return origin + tick * TICK;
+    }
+};
@@ -0,0 +1,500 @@
+#pragma once
+
+#include <fcntl.h>
+#include <linux/time_types.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "config.hpp"
+#include "event_loop.hpp"
+#include "io_uring.hpp"
+#include "logger.hpp"
+#include "output_queue.hpp"
+#include "router.hpp"
+#include "stats.hpp"
+
+// Client connection served through io_uring. The object outlives the socket
+// until every operation that references it has completed.
+struct alignas(16) UringConnection : Connection {
+    bool recv_armed = false;    // multishot receive active
+    bool cancel_sent = false;   // receive cancellation queued
+    bool close_sent = false;    // close queued, possibly linked behind the last send
+    bool fd_closed = false;
+    bool failed = false;        // socket error: pending output is dropped
+    int sends_in_flight = 0;    // a send, or a linked splice pair
+    int inflight = 0;           // operations whose final completion is still due
+
+    // Static file bytes go file -> pipe -> socket without a user-space copy
+    int pipe_fds[2] = {-1, -1};
+    size_t pipe_capacity = 0;
+    size_t pipe_pending = 0;    // spliced into the pipe, not yet out to the socket
+    size_t splice_chunk = 0;
+    std::chrono::steady_clock::time_point splice_start;
+
+    iovec iov[OutputQueue::MAX_IOV];
+    msghdr msg{};
+
+    UringConnection(int client_fd, size_t max_header_size) : Connection(client_fd, max_header_size) {}
+
+    ~UringConnection() {
+        if (pipe_fds[0] >= 0) close(pipe_fds[0]);
+        if (pipe_fds[1] >= 0) close(pipe_fds[1]);
+    }
+};
+
+// io_uring event loop: accepts with a multishot accept on the shared listening
+// socket, receives into a registered ring of provided buffers, sends with
+// sendmsg and splices static files. Everything a pass over the completions
+// queues goes to the kernel in the same io_uring_enter that waits for the
+// next ones. Needs Linux 6.1 or later; start() fails otherwise.
+class UringLoop : private RequestProcessor {
+private:
+    static constexpr unsigned RING_ENTRIES = 4096;
+    static constexpr unsigned BUFFER_COUNT = 256;   // power of two
+    static constexpr unsigned BUFFER_SIZE = 8192;
+    static constexpr uint16_t BUFFER_GROUP = 0;
+    static constexpr size_t PAGE_SIZE = 4096;
+    static constexpr int PIPE_SIZE = 1 << 20;
+    static constexpr size_t MIN_SPLICE_CHUNK = 64 * 1024;
+    static constexpr auto FAST_SPLICE = std::chrono::milliseconds(100);
+
+    // Operation kind, kept in the low bits of user_data next to the connection
+    enum Op : uint64_t {
+        OP_ACCEPT, OP_RECV, OP_SEND, OP_SPLICE_IN, OP_SPLICE_OUT, OP_PIPE_OUT, OP_CLOSE, OP_CANCEL, OP_SHUTDOWN,
+        OP_EXECUTOR
+    };
+    static constexpr uint64_t OP_MASK = 15;
+
+    int listen_fd;
+    IoUring ring;
+    io_uring_buf_ring* buffer_ring = nullptr;
+    std::unique_ptr<char[]> buffers;
+    uint16_t buffer_tail = 0;
+    std::unordered_map<UringConnection*, std::unique_ptr<UringConnection>> connections;
+    bool tasks_ready = false;
+    std::thread thread;
+
+    static uint64_t tag(UringConnection* conn, Op op) {
+        return reinterpret_cast<uint64_t>(conn) | op;
+    }
+
+    io_uring_sqe* prepare(UringConnection* conn, Op op, uint8_t opcode, int fd) {
+        io_uring_sqe* sqe = ring.getSqe();
+        sqe->opcode = opcode;
+        sqe->fd = fd;
+        sqe->user_data = tag(conn, op);
+        if (conn) ++conn->inflight;
+        return sqe;
+    }
+
+    // Hands a provided buffer back to the kernel. Entries are indexed by hand:
+    // in C++ the header's flexible bufs array sits past an empty placeholder.
+    void recycleBuffer(uint16_t id) {
+        io_uring_buf& buf = reinterpret_cast<io_uring_buf*>(buffer_ring)[buffer_tail & (BUFFER_COUNT - 1)];
+        buf.addr = reinterpret_cast<uint64_t>(buffers.get() + static_cast<size_t>(id) * BUFFER_SIZE);
+        buf.len = BUFFER_SIZE;
+        buf.bid = id;
+        __atomic_store_n(&buffer_ring->tail, ++buffer_tail, __ATOMIC_RELEASE);
+    }
+
+    void armAccept() {
+        io_uring_sqe* sqe = prepare(nullptr, OP_ACCEPT, IORING_OP_ACCEPT, listen_fd);
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_CLOEXEC;
+    }
+
+    // One-shot, so readiness left over after a poll() is seen on rearming
+    void armExecutor() {
+        io_uring_sqe* sqe = prepare(nullptr, OP_EXECUTOR, IORING_OP_POLL_ADD, executor.fd());
+        sqe->poll32_events = POLLIN;
+    }
+
+    void armRecv(UringConnection& conn) {
+        io_uring_sqe* sqe = prepare(&conn, OP_RECV, IORING_OP_RECV, conn.fd);
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = BUFFER_GROUP;
+        conn.recv_armed = true;
+    }
+
+    // The socket stays open while a receive holds it, so stop that first
+    void cancelRecv(UringConnection& conn) {
+        if (!conn.recv_armed || conn.cancel_sent) return;
+        io_uring_sqe* sqe = prepare(&conn, OP_CANCEL, IORING_OP_ASYNC_CANCEL, -1);
+        sqe->addr = tag(&conn, OP_RECV);
+        conn.cancel_sent = true;
+    }
+
+    void queueClose(UringConnection& conn) {
+        prepare(&conn, OP_CLOSE, IORING_OP_CLOSE, conn.fd);
+        conn.close_sent = true;
+    }
+
+    // Writes the in-memory run at the front of the output queue. The last
+    // response on a closing connection is linked to the close.
+    void sendOutput(UringConnection& conn) {
+        bool more;
+        conn.msg.msg_iov = conn.iov;
+        conn.msg.msg_iovlen = conn.out.gather(conn.iov, OutputQueue::MAX_IOV, more);
+        conn.out.seal();
+
+        bool last = conn.closing && !more;
+        if (last) cancelRecv(conn);
+        io_uring_sqe* sqe = prepare(&conn, OP_SEND, IORING_OP_SENDMSG, conn.fd);
+        sqe->addr = reinterpret_cast<uint64_t>(&conn.msg);
+        sqe->len = 1;
+        sqe->msg_flags = MSG_NOSIGNAL | (more ? MSG_MORE : 0);
+        conn.sends_in_flight = 1;
+        if (last) {
+            // A short send breaks the link and the close completes as canceled
+            sqe->msg_flags |= MSG_WAITALL;
+            sqe->flags |= IOSQE_IO_LINK;
+            queueClose(conn);
+        }
+    }
+
+    bool openPipe(UringConnection& conn) {
+        if (pipe2(conn.pipe_fds, O_CLOEXEC) < 0) return false;
+        int size = fcntl(conn.pipe_fds[1], F_SETPIPE_SZ, PIPE_SIZE);
+        if (size < 0) size = fcntl(conn.pipe_fds[1], F_GETPIPE_SZ);
+        conn.pipe_capacity = size > 0 ? size : 16 * PAGE_SIZE;
+        conn.splice_chunk = std::min(MIN_SPLICE_CHUNK, conn.pipe_capacity);
+        return true;
+    }
+
+    void spliceOut(UringConnection& conn, size_t length) {
+        io_uring_sqe* sqe = prepare(&conn, OP_SPLICE_OUT, IORING_OP_SPLICE, conn.fd);
+        sqe->splice_fd_in = conn.pipe_fds[0];
+        sqe->splice_off_in = static_cast<uint64_t>(-1);
+        sqe->off = static_cast<uint64_t>(-1);
+        sqe->len = length;
+        ++conn.sends_in_flight;
+    }
+
+    // Splices the next chunk of the front file range into the pipe and, linked
+    // behind it, out to the socket. File reads that miss the page cache run in
+    // the kernel's worker threads, not on this loop. Chunks grow while the
+    // reader keeps up and shrink when it doesn't, so a slow reader still
+    // shows progress within the keep-alive timeout.
+    void spliceFile(UringConnection& conn, const FileRange& range) {
+        // Each pipe slot holds one page, so an unaligned start costs a slot;
+        // a splice that comes up short would break the link
+        size_t length = std::min(range.length, conn.splice_chunk - range.offset % PAGE_SIZE);
+        conn.splice_start = std::chrono::steady_clock::now();
+        io_uring_sqe* sqe = prepare(&conn, OP_SPLICE_IN, IORING_OP_SPLICE, conn.pipe_fds[1]);
+        sqe->splice_fd_in = range.file->fd;
+        sqe->splice_off_in = range.offset;
+        sqe->off = static_cast<uint64_t>(-1);
+        sqe->len = length;
+        sqe->flags = IOSQE_IO_LINK;
+        conn.sends_in_flight = 1;
+        spliceOut(conn, length);
+    }
+
+    // Splices a piped range, a proxied body the upstream's bytes were
+    // spliced into, straight from its pipe to the socket
+    void pipeOut(UringConnection& conn, const FileRange& range) {
+        io_uring_sqe* sqe = prepare(&conn, OP_PIPE_OUT, IORING_OP_SPLICE, conn.fd);
+        sqe->splice_fd_in = range.file->fd;
+        sqe->splice_off_in = static_cast<uint64_t>(-1);
+        sqe->off = static_cast<uint64_t>(-1);
+        sqe->len = range.length;
+        conn.sends_in_flight = 1;
+    }
+
+    // Starts the next write, or the close once everything is written
+    void service(UringConnection& conn) {
+        if (conn.sends_in_flight > 0 || conn.close_sent) return;
+        if (conn.failed) {
+            conn.out.clear();
+            conn.pipe_pending = 0;
+            conn.closing = true;
+            conn.gone = true;
+            wakeWriter(conn);
+        }
+
+        if (conn.pipe_pending > 0) {
+            spliceOut(conn, conn.pipe_pending);
+        } else if (FileRange* range = conn.out.frontFile(); range && range->piped) {
+            pipeOut(conn, *range);
+        } else if (FileRange* range = conn.out.frontFile()) {
+            if (conn.pipe_fds[0] < 0 && !openPipe(conn)) {
+                logger.error("❌ Failed to create splice pipe");
+                conn.failed = true;
+                service(conn);
+                return;
+            }
+            spliceFile(conn, *range);
+        } else if (!conn.out.empty()) {
+            sendOutput(conn);
+        } else if (conn.closing && (conn.failed || !conn.awaiting_handler)) {
+            cancelRecv(conn);
+            queueClose(conn);
+        }
+    }
+
+    void onAccept(const io_uring_cqe& cqe) {
+        if (!(cqe.flags & IORING_CQE_F_MORE)) armAccept();
+        if (cqe.res < 0) {
+            if (cqe.res != -ECANCELED) logger.error("❌ Accept failed");
+            return;
+        }
+
+        // Multishot accept has no per-connection address buffer, so the
+        // peer is looked up only when the per-IP cap needs it
+        sockaddr_storage address{};
+        if (limiter.limitsPeers()) {
+            socklen_t address_size = sizeof(address);
+            getpeername(cqe.res, reinterpret_cast<sockaddr*>(&address), &address_size);
+        }
+        PeerAddress peer;
+        if (!admit(cqe.res, address, peer)) return;
+
+        stats.add(Counter::CONNECTIONS_OPENED);
+        auto conn = std::make_unique<UringConnection>(cqe.res, config.getMaxHeaderSize());
+        conn->peer = peer;
+        armRecv(*conn);
+        updateTimer(*conn, false);
+        connections[conn.get()] = std::move(conn);
+    }
+
+    void onRecv(UringConnection& conn, const io_uring_cqe& cqe) {
+        if (!(cqe.flags & IORING_CQE_F_MORE)) conn.recv_armed = false;
+
+        if (cqe.res > 0) {
+            uint16_t id = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+            onReceived(conn, buffers.get() + static_cast<size_t>(id) * BUFFER_SIZE, cqe.res);
+            recycleBuffer(id);
+            conn.last_active = std::chrono::steady_clock::now();
+        } else if (cqe.res == 0) {
+            onInputClosed(conn);
+        } else if (cqe.res != -ENOBUFS && cqe.res != -ECANCELED) {
+            conn.failed = true;
+        }
+
+        // Out of buffers ends a multishot receive; resume once some are back.
+        // A proxied body with a full window stops it until the relay catches up.
+        if (conn.read_paused) {
+            cancelRecv(conn);
+        } else if (!conn.recv_armed && !conn.closing && !conn.failed && !conn.cancel_sent) {
+            armRecv(conn);
+        }
+        service(conn);
+    }
+
+    void onSend(UringConnection& conn, const io_uring_cqe& cqe) {
+        conn.sends_in_flight = 0;
+        if (cqe.res > 0) {
+            conn.out.consume(cqe.res);
+            onSent(conn, cqe.res, conn.out.empty());
+        } else {
+            conn.failed = true;
+        }
+        service(conn);
+    }
+
+    void onSpliceIn(UringConnection& conn, const io_uring_cqe& cqe) {
+        --conn.sends_in_flight;
+        if (cqe.res > 0) {
+            conn.out.consumeFile(cqe.res);
+            conn.pipe_pending += cqe.res;
+        } else {
+            // Zero means the file shrank underneath us
+            conn.failed = true;
+        }
+        service(conn);
+    }
+
+    void onSpliceOut(UringConnection& conn, const io_uring_cqe& cqe) {
+        --conn.sends_in_flight;
+        if (cqe.res > 0) {
+            conn.pipe_pending -= cqe.res;
+            onSent(conn, cqe.res, conn.out.empty() && conn.pipe_pending == 0);
+            if (conn.last_active - conn.splice_start < FAST_SPLICE) {
+                conn.splice_chunk = std::min(conn.splice_chunk * 2, conn.pipe_capacity);
+            } else {
+                conn.splice_chunk = std::max(conn.splice_chunk / 2, std::min(MIN_SPLICE_CHUNK, conn.pipe_capacity));
+            }
+        } else if (cqe.res != -ECANCELED) {
+            conn.failed = true;
+        }
+        service(conn);
+    }
+
+    void onPipeOut(UringConnection& conn, const io_uring_cqe& cqe) {
+        conn.sends_in_flight = 0;
+        if (cqe.res > 0) {
+            conn.out.consumeFile(cqe.res);
+            onSent(conn, cqe.res, conn.out.empty());
+        } else {
+            conn.failed = true;
+        }
+        service(conn);
+    }
+
+    void onClose(UringConnection& conn, const io_uring_cqe& cqe) {
+        if (cqe.res == -ECANCELED) {
+            // The linked send came up short; whatever is left is dropped
+            conn.close_sent = false;
+            conn.failed = true;
+            service(conn);
+            return;
+        }
+        conn.fd_closed = true;
+        conn.gone = true;
+        wakeWriter(conn);
+        limiter.release(conn.peer);
+        stats.add(Counter::CONNECTIONS_CLOSED);
+    }
+
+    // Keeps the timer on what the connection waits for; none is needed once
+    // only the close is left
+    void touch(UringConnection& conn) {
+        bool writing = conn.sends_in_flight > 0 || conn.pipe_pending > 0 || !conn.out.empty();
+        if (conn.fd_closed || (conn.close_sent && !writing)) {
+            timers.cancel(conn);
+        } else {
+            updateTimer(conn, writing);
+        }
+    }
+
+    // A 408 for a slow request is still sent, behind its own write timeout.
+    // Otherwise pending output is dropped, and a shutdown wakes any send
+    // still waiting on the socket, even one the close is linked behind.
+    void onTimeout(UringConnection& conn) {
+        Timeout timeout = conn.timeout;
+        expire(conn);
+        if (timeout == Timeout::IDLE || timeout == Timeout::WRITE) {
+            conn.failed = true;
+            if (conn.sends_in_flight > 0) {
+                io_uring_sqe* sqe = prepare(&conn, OP_SHUTDOWN, IORING_OP_SHUTDOWN, conn.fd);
+                sqe->len = SHUT_RDWR;
+            }
+        }
+        service(conn);
+        touch(conn);
+    }
+
+    void onCompletion(const io_uring_cqe& cqe) {
+        Op op = static_cast<Op>(cqe.user_data & OP_MASK);
+        if (op == OP_ACCEPT) {
+            onAccept(cqe);
+            return;
+        }
+        if (op == OP_EXECUTOR) {
+            tasks_ready = true;
+            return;
+        }
+
+        auto* conn = reinterpret_cast<UringConnection*>(cqe.user_data & ~OP_MASK);
+        if (!(cqe.flags & IORING_CQE_F_MORE)) --conn->inflight;
+        switch (op) {
+            case OP_RECV: onRecv(*conn, cqe); break;
+            case OP_SEND: onSend(*conn, cqe); break;
+            case OP_SPLICE_IN: onSpliceIn(*conn, cqe); break;
+            case OP_SPLICE_OUT: onSpliceOut(*conn, cqe); break;
+            case OP_PIPE_OUT: onPipeOut(*conn, cqe); break;
+            case OP_CLOSE: onClose(*conn, cqe); break;
+            default: break;
+        }
+        touch(*conn);
+        if (conn->fd_closed && conn->inflight == 0 && !conn->hasTasks()) connections.erase(conn);
+    }
+
+    // Sends what finished async handlers answered, and receives again for a
+    // proxy that took enough of a request body. A connection closed while
+    // they ran goes once the last one is done.
+    void onTasksDone(Connection& connection) {
+        auto& conn = static_cast<UringConnection&>(connection);
+        if (std::exchange(conn.resume_reading, false) && !conn.closing && !conn.failed && !conn.close_sent) {
+            conn.cancel_sent = false;
+            if (!conn.recv_armed) armRecv(conn);
+        }
+        service(conn);
+        touch(conn);
+        if (conn.fd_closed && conn.inflight == 0 && !conn.hasTasks()) connections.erase(&conn);
+    }
+
+    // Sets up the ring on the loop thread, which then is its only submitter
+    int setup() {
+        int ret = ring.init(RING_ENTRIES, IORING_SETUP_SUBMIT_ALL | IORING_SETUP_SINGLE_ISSUER |
+                                          IORING_SETUP_DEFER_TASKRUN);
+        if (ret < 0) return ret;
+
+        buffer_ring = ring.registerBufferRing(BUFFER_COUNT, BUFFER_GROUP);
+        if (!buffer_ring) return -errno;
+        buffers = std::make_unique<char[]>(static_cast<size_t>(BUFFER_COUNT) * BUFFER_SIZE);
+        for (unsigned id = 0; id < BUFFER_COUNT; ++id) recycleBuffer(id);
+
+        armAccept();
+        if (!executor.open()) return -errno;
+        armExecutor();
+        return 0;
+    }
+
+    void run(std::promise<int> ready) {
+        int ret = setup();
+        ready.set_value(ret);
+        if (ret < 0) return;
+
+        auto now = std::chrono::steady_clock::now();
+        executor.makeCurrent();
+        while (true) {
+            // Wait no longer than until the timer wheel or a sleeping
+            // handler next has work
+            auto wake = std::min(timers.nextWakeup(), executor.nextDeadline());
+            auto wait = std::chrono::duration_cast<std::chrono::nanoseconds>(wake - now);
+            wait = std::max(wait, std::chrono::nanoseconds::zero());
+            __kernel_timespec timeout{static_cast<long long>(wait.count() / 1000000000),
+                                      static_cast<long long>(wait.count() % 1000000000)};
+            ret = ring.submit(1, &timeout);
+            if (ret < 0 && ret != -EINTR && ret != -EBUSY && ret != -ETIME) {
+                logger.error("❌ io_uring_enter failed: ", strerror(-ret));
+                return;
+            }
+            auto pass_start = std::chrono::steady_clock::now();
+            bool completed = false;
+            ring.forEachCompletion([&](const io_uring_cqe& cqe) {
+                onCompletion(cqe);
+                completed = true;
+            });
+            now = std::chrono::steady_clock::now();
+            if (tasks_ready || executor.nextDeadline() <= now) {
+                if (tasks_ready) armExecutor();
+                tasks_ready = false;
+                runTasks(now, [this](Connection& conn) { onTasksDone(conn); });
+                now = std::chrono::steady_clock::now();
+            }
+            if (completed) shedder.record(pass_start, now);
+            timers.advance(now, [this](TimerNode& node) { onTimeout(static_cast<UringConnection&>(node)); });
+        }
+    }
+
+public:
+    UringLoop(const Config& cfg, const Router& rt, ConnectionLimiter& limiter, int listen_socket)
+        : RequestProcessor(cfg, rt, limiter), listen_fd(listen_socket) {}
+
+    // Returns 0 once the loop runs, or the negative errno that kept the ring
+    // from being set up
+    int start() {
+        std::promise<int> ready;
+        std::future<int> result = ready.get_future();
+        thread = std::thread(&UringLoop::run, this, std::move(ready));
+        int ret = result.get();
+        if (ret < 0) {
+            thread.join();
+        } else {
+            thread.detach();
+        }
+        return ret;
+    }
+};
@@ -0,0 +1,315 @@
+// HPACK against the examples of RFC 7541 Appendix C, plus the malformed
+// input a decoder must refuse: bad Huffman padding, oversized integers and
+// table size updates out of place or over the limit.
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "hpack.hpp"
+#include "test_support.hpp"
+
+using Fields = std::vector<std::pair<std::string, std::string>>;
+
+// Bytes from the RFC's hex dumps; spaces are ignored
+static std::string hex(std::string_view digits) {
+    std::string bytes;
+    int high = -1;
+    for (char c : digits) {
+        if (c == ' ') continue;
+        int value = c <= '9' ? c - '0' : c - 'a' + 10;
+        if (high < 0) {
+            high = value;
+        } else {
+            bytes += static_cast<char>(high << 4 | value);
+            high = -1;
+        }
+    }
+    return bytes;
+}
+
+static std::ostream& operator<<(std::ostream& os, const Fields& fields) {
+    for (const auto& [name, value] : fields) os << "[" << name << ": " << value << "]";
+    return os;
+}
+
+static bool decode(HpackDecoder& decoder, std::string_view block, Fields& fields) {
+    fields.clear();
+    return decoder.decode(block, [&fields](std::string_view name, std::string_view value) {
+        fields.emplace_back(name, value);
+    });
+}
+
+static Fields decodeHex(HpackDecoder& decoder, std::string_view digits) {
+    Fields fields;
+    CHECK(decode(decoder, hex(digits), fields));
+    return fields;
+}
+
+// The dynamic table, newest entry first, read back through indexed fields,
+// which leave it unchanged
+static Fields dynamicTable(HpackDecoder& decoder) {
+    Fields entries, field;
+    std::string index;
+    for (uint64_t i = HPACK_STATIC_TABLE_SIZE + 1;; ++i) {
+        index.clear();
+        hpackEncodeInteger(index, 0x80, 7, i);
+        if (!decode(decoder, index, field)) return entries;
+        entries.push_back(field[0]);
+    }
+}
+
+static size_t tableSize(const Fields& entries) {
+    size_t size = 0;
+    for (const auto& [name, value] : entries) size += name.size() + value.size() + 32;
+    return size;
+}
+
+TEST(integer_representation) {
+    // C.1.1 to C.1.3
+    std::string out;
+    hpackEncodeInteger(out, 0x00, 5, 10);
+    CHECK_EQ(out, hex("0a"));
+    out.clear();
+    hpackEncodeInteger(out, 0x00, 5, 1337);
+    CHECK_EQ(out, hex("1f9a0a"));
+    out.clear();
+    hpackEncodeInteger(out, 0x00, 8, 42);
+    CHECK_EQ(out, hex("2a"));
+
+    size_t pos = 0;
+    uint64_t value = 0;
+    CHECK(hpackDecodeInteger(hex("1f9a0a"), pos, 5, value));
+    CHECK_EQ(value, uint64_t(1337));
+    CHECK_EQ(pos, size_t(3));
+}
+
+TEST(integer_overflow) {
+    size_t pos = 0;
+    uint64_t value = 0;
+    // Continuation bytes past 2^35 are refused rather than wrapped
+    CHECK(!hpackDecodeInteger(hex("1fffffffffff7f"), pos, 5, value));
+    pos = 0;
+    CHECK(!hpackDecodeInteger(hex("ffffffffffffffffffffff01"), pos, 7, value));
+    // Truncated: the continuation bit promises another byte
+    pos = 0;
+    CHECK(!hpackDecodeInteger(hex("1f9a"), pos, 5, value));
+    pos = 0;
+    CHECK(!hpackDecodeInteger("", pos, 5, value));
+
+    // A string length or index that large fails the block
+    HpackDecoder decoder;
+    Fields fields;
+    CHECK(!decode(decoder, hex("ffffffffffff7f"), fields));
+    CHECK(!decode(decoder, hex("407fffffffffff7f"), fields));
+    CHECK(!decode(decoder, hex("40 0a 6375 7374"), fields));
+}
+
+TEST(header_field_representations) {
+    HpackDecoder decoder;
+    // C.2.1 literal with incremental indexing
+    CHECK_EQ(decodeHex(decoder, "400a 6375 7374 6f6d 2d6b 6579 0d63 7573 746f 6d2d 6865 6164 6572"),
+             Fields({{"custom-key", "custom-header"}}));
+    Fields table = dynamicTable(decoder);
+    CHECK_EQ(table, Fields({{"custom-key", "custom-header"}}));
+    CHECK_EQ(tableSize(table), size_t(55));
+
+    // C.2.2 literal without indexing and C.2.3 never indexed leave the table alone
+    HpackDecoder fresh;
+    CHECK_EQ(decodeHex(fresh, "040c 2f73 616d 706c 652f 7061 7468"), Fields({{":path", "/sample/path"}}));
+    CHECK_EQ(decodeHex(fresh, "1008 7061 7373 776f 7264 0673 6563 7265 74"), Fields({{"password", "secret"}}));
+    CHECK(dynamicTable(fresh).empty());
+
+    // C.2.4 indexed field
+    CHECK_EQ(decodeHex(fresh, "82"), Fields({{":method", "GET"}}));
+    Fields fields;
+    CHECK(!decode(fresh, hex("80"), fields));   // index 0
+    CHECK(!decode(fresh, hex("be"), fields));   // empty dynamic table
+}
+
+static const Fields FIRST_REQUEST = {
+    {":method", "GET"}, {":scheme", "http"}, {":path", "/"}, {":authority", "www.example.com"}};
+static const Fields SECOND_REQUEST = {
+    {":method", "GET"}, {":scheme", "http"}, {":path", "/"}, {":authority", "www.example.com"},
+    {"cache-control", "no-cache"}};
+static const Fields THIRD_REQUEST = {
+    {":method", "GET"}, {":scheme", "https"}, {":path", "/index.html"}, {":authority", "www.example.com"},
+    {"custom-key", "custom-value"}};
+
+static void checkRequests(const char* first, const char* second, const char* third) {
+    HpackDecoder decoder;
+    CHECK_EQ(decodeHex(decoder, first), FIRST_REQUEST);
+    CHECK_EQ(dynamicTable(decoder), Fields({{":authority", "www.example.com"}}));
+    CHECK_EQ(tableSize(dynamicTable(decoder)), size_t(57));
+
+    CHECK_EQ(decodeHex(decoder, second), SECOND_REQUEST);
+    CHECK_EQ(dynamicTable(decoder), Fields({{"cache-control", "no-cache"}, {":authority", "www.example.com"}}));
+    CHECK_EQ(tableSize(dynamicTable(decoder)), size_t(110));
+
+    CHECK_EQ(decodeHex(decoder, third), THIRD_REQUEST);
+    CHECK_EQ(dynamicTable(decoder), Fields({{"custom-key", "custom-value"}, {"cache-control", "no-cache"},
+                                            {":authority", "www.example.com"}}));
+    CHECK_EQ(tableSize(dynamicTable(decoder)), size_t(164));
+}
+
+TEST(requests_without_huffman) {
+    // C.3
+    checkRequests("8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d",
+                  "8286 84be 5808 6e6f 2d63 6163 6865",
+                  "8287 85bf 400a 6375 7374 6f6d 2d6b 6579 0c63 7573 746f 6d2d 7661 6c75 65");
+}
+
+TEST(requests_with_huffman) {
+    // C.4
+    checkRequests("8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff",
+                  "8286 84be 5886 a8eb 1064 9cbf",
+                  "8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf");
+}
+
+static const std::string DATE_21 = "Mon, 21 Oct 2013 20:13:21 GMT";
+static const std::string DATE_22 = "Mon, 21 Oct 2013 20:13:22 GMT";
+static const std::string LOCATION = "https://www.example.com";
+static const std::string COOKIE = "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1";
+
+// C.5 and C.6 run with a 256 byte table, so entries are evicted. The
+// decoder is told so by a table size update ahead of the first block.
+static void checkResponses(const char* first, const char* second, const char* third) {
+    HpackDecoder decoder;
+    CHECK_EQ(decodeHex(decoder, std::string("3fe101 ") + first),
+             Fields({{":status", "302"}, {"cache-control", "private"}, {"date", DATE_21}, {"location", LOCATION}}));
+    CHECK_EQ(dynamicTable(decoder), Fields({{"location", LOCATION}, {"date", DATE_21},
+                                            {"cache-control", "private"}, {":status", "302"}}));
+    CHECK_EQ(tableSize(dynamicTable(decoder)), size_t(222));
+
+    // ":status: 307" takes the place of the oldest entry
+    CHECK_EQ(decodeHex(decoder, second),
+             Fields({{":status", "307"}, {"cache-control", "private"}, {"date", DATE_21}, {"location", LOCATION}}));
+    CHECK_EQ(dynamicTable(decoder), Fields({{":status", "307"}, {"location", LOCATION}, {"date", DATE_21},
+                                            {"cache-control", "private"}}));
+    CHECK_EQ(tableSize(dynamicTable(decoder)), size_t(222));
+
+    CHECK_EQ(decodeHex(decoder, third),
+             Fields({{":status", "200"}, {"cache-control", "private"}, {"date", DATE_22}, {"location", LOCATION},
+                     {"content-encoding", "gzip"}, {"set-cookie", COOKIE}}));
+    CHECK_EQ(dynamicTable(decoder), Fields({{"set-cookie", COOKIE}, {"content-encoding", "gzip"},
+                                            {"date", DATE_22}}));
+    CHECK_EQ(tableSize(dynamicTable(decoder)), size_t(215));
+}
+
+TEST(responses_without_huffman) {
+    checkResponses(
+        "4803 3330 3258 0770 7269 7661 7465 611d 4d6f 6e2c 2032 3120 4f63 7420 3230 3133 2032 303a 3133 3a32 "
+        "3120 474d 546e 1768 7474 7073 3a2f 2f77 7777 2e65 7861 6d70 6c65 2e63 6f6d",
+        "4803 3330 37c1 c0bf",
+        "88c1 611d 4d6f 6e2c 2032 3120 4f63 7420 3230 3133 2032 303a 3133 3a32 3220 474d 54c0 5a04 677a 6970 "
+        "7738 666f 6f3d 4153 444a 4b48 514b 425a 584f 5157 454f 5049 5541 5851 5745 4f49 553b 206d 6178 2d61 "
+        "6765 3d33 3630 303b 2076 6572 7369 6f6e 3d31");
+}
+
+TEST(responses_with_huffman) {
+    checkResponses(
+        "4882 6402 5885 aec3 771a 4b61 96d0 7abe 9410 54d4 44a8 2005 9504 0b81 66e0 82a6 2d1b ff6e 919d 29ad "
+        "1718 63c7 8f0b 97c8 e9ae 82ae 43d3",
+        "4883 640e ffc1 c0bf",
+        "88c1 6196 d07a be94 1054 d444 a820 0595 040b 8166 e084 a62d 1bff c05a 839b d9ab 77ad 94e7 821d d7f2 "
+        "e6c7 b335 dfdf cd5b 3960 d5af 2708 7f36 72c1 ab27 0fb5 291f 9587 3160 65c0 03ed 4ee5 b106 3d50 07");
+}
+
+TEST(huffman_padding) {
+    std::string value;
+    size_t pos = 0;
+    // "a" is 00011, padded with the top three bits of EOS
+    CHECK(hpackDecodeString(hex("811f"), pos, value));
+    CHECK_EQ(value, "a");
+    // Padding of zeros rather than EOS bits
+    pos = 0;
+    CHECK(!hpackDecodeString(hex("8118"), pos, value));
+    // A whole byte or more of padding
+    pos = 0;
+    CHECK(!hpackDecodeString(hex("821fff"), pos, value));
+    // EOS itself, 30 ones
+    pos = 0;
+    CHECK(!hpackDecodeString(hex("84ffffffff"), pos, value));
+    // The length runs past the block
+    pos = 0;
+    CHECK(!hpackDecodeString(hex("851f"), pos, value));
+}
+
+TEST(huffman_round_trip) {
+    std::string all_bytes;
+    for (int c = 0; c < 256; ++c) all_bytes += static_cast<char>(c);
+    for (const std::string& text : {std::string("www.example.com"), std::string("no-cache"), COOKIE, all_bytes,
+                                    std::string(1000, 'e'), std::string()}) {
+        std::string encoded;
+        hpackEncodeString(encoded, text);
+        std::string decoded;
+        size_t pos = 0;
+        CHECK(hpackDecodeString(encoded, pos, decoded));
+        CHECK_EQ(pos, encoded.size());
+        CHECK(decoded == text);
+    }
+}
+
+TEST(table_size_update) {
+    HpackDecoder decoder;
+    decodeHex(decoder, "8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d");
+    CHECK_EQ(dynamicTable(decoder).size(), size_t(1));
+
+    // Shrinking to zero empties the table; growing again keeps it empty
+    Fields fields;
+    CHECK(decode(decoder, hex("20 3fe11f 82"), fields));
+    CHECK(dynamicTable(decoder).empty());
+
+    // Up to the 4096 bytes announced in SETTINGS, and only before the first field
+    CHECK(!decode(decoder, hex("3fe21f"), fields));
+    HpackDecoder late;
+    CHECK(!decode(late, hex("82 20"), fields));
+}
+
+TEST(eviction) {
+    // An entry as large as the table fits alone; a larger one empties it
+    HpackTable table;
+    table.setMaxSize(100);
+    table.add("name", std::string(64 - 4, 'v'));   // 96 bytes
+    CHECK_EQ(table.count(), size_t(1));
+    table.add("n", "v");                            // 34 bytes: the first is evicted
+    CHECK_EQ(table.count(), size_t(1));
+    CHECK_EQ(table.at(0).name, "n");
+    table.add("n", "v");
+    CHECK_EQ(table.count(), size_t(2));
+    table.add("big", std::string(100, 'x'));
+    CHECK_EQ(table.count(), size_t(0));
+
+    // A new entry may reuse the name of the entry it evicts
+    HpackDecoder decoder;
+    Fields fields;
+    std::string block = hex("3f 45");   // table of 100 bytes
+    block += hex("40 04") + "name" + hex("3c") + std::string(60, 'v');
+    CHECK(decode(decoder, block, fields));
+    CHECK(decode(decoder, hex("7e 01") + "w", fields));
+    CHECK_EQ(fields, Fields({{"name", "w"}}));
+    CHECK_EQ(dynamicTable(decoder), Fields({{"name", "w"}}));
+}
+
+// Blocks from one encoder decode to the same fields, across table resizes
+TEST(encoder_round_trip) {
+    HpackEncoder encoder;
+    HpackDecoder decoder;
+    const Fields response = {{":status", "200"}, {"content-type", "text/html"}, {"server", "HTTP-Server-CPP"},
+                             {"content-length", "1234"}, {"etag", "\"abc\""}, {"x-custom", "value"}};
+    for (size_t limit : {4096, 4096, 256, 0, 4096, 100000}) {
+        encoder.setLimit(limit);
+        for (int block_number = 0; block_number < 3; ++block_number) {
+            std::string block;
+            encoder.beginBlock(block);
+            for (const auto& [name, value] : response) encoder.encode(block, name, value);
+            Fields fields;
+            CHECK(decode(decoder, block, fields));
+            CHECK_EQ(fields, response);
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    return runTests(argc, argv);
+}
@@ -0,0 +1,142 @@
+// HTTP/1.1 connections against the real event loops: responses that carry
+// no body must leave the next pipelined response correctly framed.
+
+#include <stdlib.h>
+
+#include <fstream>
+#include <string>
+
+#include "routes.hpp"
+#include "test_support.hpp"
+
+static const std::string& documentRoot() {
+    static const std::string root = [] {
+        char pattern[] = "/tmp/http1_test.XXXXXX";
+        std::string dir = mkdtemp(pattern);
+        std::ofstream(dir + "/page.txt") << "0123456789abcdefghijklmnopqrstuvwxyz";
+        return dir;
+    }();
+    return root;
+}
+
+static const char* const HEALTH_HEAD = "HEAD /health HTTP/1.1\r\nHost: test\r\n\r\n";
+static const char* const HEALTH_GET = "GET /health HTTP/1.1\r\nHost: test\r\n\r\n";
+
+TEST(head_uses_get_route) {
+    Router router;
+    router.get("/page", [](HTTPRequest&, HTTPResponse&) {});
+    router.post("/form", [](HTTPRequest&, HTTPResponse&) {});
+    HTTPRequest request;
+    request.method_id = HTTPMethod::HEAD;
+    request.path = "/page";
+    const Router::Route* route = router.find(request);
+    CHECK(route != nullptr);
+    CHECK(route && route->name == "GET /page");
+    request.path = "/form";
+    CHECK(router.find(request) == nullptr);
+}
+
+TEST(pipelined_head_then_get) {
+    for (const std::string& backend : testBackends()) {
+        TestServer& server = startServer(setupRoutes(documentRoot()), backend);
+        if (!server.running()) continue;
+        TestClient client(server.port());
+        CHECK(client.send(std::string(HEALTH_HEAD) + HEALTH_GET));
+
+        Reply head = client.read(true);
+        CHECK_EQ(head.status, 200);
+        CHECK(std::stoul("0" + head.header("Content-Length")) > 0);
+        CHECK_EQ(head.header("Connection"), "keep-alive");
+
+        Reply get = client.read();
+        CHECK_EQ(get.status, 200);
+        CHECK(get.body.find("\"status\": \"healthy\"") != std::string::npos);
+        CHECK(client.pending().empty());
+    }
+}
+
+TEST(pipelined_head_for_missing_route) {
+    for (const std::string& backend : testBackends()) {
+        TestServer& server = startServer(setupRoutes(documentRoot()), backend);
+        if (!server.running()) continue;
+        TestClient client(server.port());
+        CHECK(client.send(std::string("HEAD /no/such/route HTTP/1.1\r\nHost: test\r\n\r\n") + HEALTH_GET));
+
+        Reply missing = client.read(true);
+        CHECK_EQ(missing.status, 404);
+        CHECK(missing.hasHeader("Content-Length"));
+        CHECK_EQ(client.read().status, 200);
+        CHECK(client.pending().empty());
+    }
+}
+
+// HEAD reports the length GET sends, whether the response cache is cold or warm
+TEST(head_matches_get_length) {
+    TestServer& server = startServer(setupRoutes(documentRoot()));
+    TestClient client(server.port());
+    std::string head = "HEAD /hello?name=head HTTP/1.1\r\nHost: test\r\n\r\n";
+    CHECK(client.send(head + head + "GET /hello?name=head HTTP/1.1\r\nHost: test\r\n\r\n"));
+
+    Reply cold = client.read(true);
+    Reply warm = client.read(true);
+    Reply get = client.read();
+    CHECK_EQ(cold.status, 200);
+    CHECK_EQ(warm.status, 200);
+    CHECK_EQ(get.status, 200);
+    CHECK_EQ(cold.header("Content-Length"), std::to_string(get.body.size()));
+    CHECK_EQ(warm.header("Content-Length"), std::to_string(get.body.size()));
+    CHECK(client.pending().empty());
+}
+
+TEST(head_for_async_route) {
+    TestServer& server = startServer(setupRoutes(documentRoot()));
+    TestClient client(server.port());
+    CHECK(client.send("HEAD /delay?ms=1 HTTP/1.1\r\nHost: test\r\n\r\n"
+                      "GET /delay?ms=1 HTTP/1.1\r\nHost: test\r\n\r\n"));
+    Reply head = client.read(true);
+    Reply get = client.read();
+    CHECK_EQ(head.status, 200);
+    CHECK_EQ(head.header("Content-Length"), std::to_string(get.body.size()));
+    CHECK_EQ(get.body, "{\"delayed_ms\": 1}");
+}
+
+TEST(head_with_range) {
+    for (const std::string& backend : testBackends()) {
+        TestServer& server = startServer(setupRoutes(documentRoot()), backend);
+        if (!server.running()) continue;
+        TestClient client(server.port());
+        std::string range = "/static/page.txt HTTP/1.1\r\nHost: test\r\nRange: bytes=0-9\r\n\r\n";
+        CHECK(client.send("HEAD " + range + "GET " + range));
+
+        Reply head = client.read(true);
+        CHECK_EQ(head.status, 206);
+        CHECK_EQ(head.header("Content-Length"), "10");
+        CHECK_EQ(head.header("Content-Range"), "bytes 0-9/36");
+        Reply get = client.read();
+        CHECK_EQ(get.status, 206);
+        CHECK_EQ(get.body, "0123456789");
+        CHECK(client.pending().empty());
+    }
+}
+
+TEST(pipelined_not_modified_then_get) {
+    TestServer& server = startServer(setupRoutes(documentRoot()));
+    TestClient client(server.port());
+    CHECK(client.send("GET /static/page.txt HTTP/1.1\r\nHost: test\r\n\r\n"));
+    Reply first = client.read();
+    CHECK_EQ(first.status, 200);
+    std::string etag = first.header("ETag");
+    CHECK(!etag.empty());
+
+    CHECK(client.send("GET /static/page.txt HTTP/1.1\r\nHost: test\r\nIf-None-Match: " + etag + "\r\n\r\n" +
+                      "GET /static/page.txt HTTP/1.1\r\nHost: test\r\n\r\n"));
+    CHECK_EQ(client.read().status, 304);
+    Reply again = client.read();
+    CHECK_EQ(again.status, 200);
+    CHECK_EQ(again.body, "0123456789abcdefghijklmnopqrstuvwxyz");
+    CHECK(client.pending().empty());
+}
+
+int main(int argc, char* argv[]) {
+    return runTests(argc, argv);
+}
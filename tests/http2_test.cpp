@@ -0,0 +1,516 @@
+// HTTP/2 connections against the real event loops and routes: h2c by prior
+// knowledge and by Upgrade, HEAD, and the framing rules a client can get
+// wrong: CONTINUATION, padding, flow control windows and RST_STREAM.
+
+#include <poll.h>
+#include <stdlib.h>
+
+#include <fstream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "hpack.hpp"
+#include "http2.hpp"
+#include "routes.hpp"
+#include "test_support.hpp"
+
+static const std::string& documentRoot() {
+    static const std::string root = [] {
+        char pattern[] = "/tmp/http2_test.XXXXXX";
+        std::string dir = mkdtemp(pattern);
+        std::ofstream(dir + "/page.txt") << "0123456789abcdefghijklmnopqrstuvwxyz";
+        return dir;
+    }();
+    return root;
+}
+
+// RFC 9113 6
+enum : uint8_t { DATA = 0x0, HEADERS = 0x1, RST_STREAM = 0x3, SETTINGS = 0x4, PING = 0x6, GOAWAY = 0x7,
+                 WINDOW_UPDATE = 0x8, CONTINUATION = 0x9 };
+enum : uint8_t { END_STREAM = 0x1, ACK = 0x1, END_HEADERS = 0x4, PADDED = 0x8 };
+constexpr uint32_t NO_FRAME = 0xffffffff;
+
+static std::string u32(uint32_t value) {
+    return {static_cast<char>(value >> 24), static_cast<char>(value >> 16), static_cast<char>(value >> 8),
+            static_cast<char>(value)};
+}
+
+static uint32_t readU32(std::string_view bytes) {
+    return static_cast<uint32_t>(static_cast<uint8_t>(bytes[0])) << 24 |
+           static_cast<uint32_t>(static_cast<uint8_t>(bytes[1])) << 16 |
+           static_cast<uint32_t>(static_cast<uint8_t>(bytes[2])) << 8 | static_cast<uint8_t>(bytes[3]);
+}
+
+static std::string setting(uint16_t id, uint32_t value) {
+    return std::string{static_cast<char>(id >> 8), static_cast<char>(id)} + u32(value);
+}
+
+struct Frame {
+    uint8_t type = 0xff;   // 0xff: none arrived
+    uint8_t flags = 0;
+    uint32_t stream = 0;
+    std::string payload;
+};
+
+using Fields = std::vector<std::pair<std::string, std::string>>;
+
+// What came back on one stream
+struct H2Reply {
+    int status = 0;
+    Fields headers;
+    std::string body;
+    int data_frames = 0;
+    bool ended = false;               // END_STREAM seen
+    uint32_t reset = NO_FRAME;        // RST_STREAM error code
+    uint32_t goaway = NO_FRAME;       // GOAWAY error code
+
+    std::string header(std::string_view name) const {
+        for (const auto& [key, value] : headers) {
+            if (key == name) return value;
+        }
+        return "";
+    }
+};
+
+// Blocking HTTP/2 client speaking raw frames, so tests can send what a
+// well-behaved client never would
+class H2Client {
+private:
+    int fd = -1;
+    std::string buffer;
+    HpackEncoder encoder;
+    HpackDecoder decoder;
+    std::string block;   // header block arriving in CONTINUATION frames
+    std::map<uint32_t, H2Reply> replies;
+    uint32_t goaway = NO_FRAME;
+
+    bool fill(int timeout_ms) {
+        pollfd readable{fd, POLLIN, 0};
+        if (poll(&readable, 1, timeout_ms) <= 0) return false;
+        char chunk[16384];
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) return false;
+        buffer.append(chunk, n);
+        return true;
+    }
+
+    // Files a frame under its stream's reply; false if none arrived. Header
+    // blocks are decoded as they come, keeping the HPACK table in step.
+    bool take(const Frame& frame) {
+        if (frame.type == 0xff) return false;
+        if (frame.type == GOAWAY) {
+            goaway = readU32(std::string_view(frame.payload).substr(4));
+            return true;
+        }
+        if (frame.stream == 0) return true;
+        H2Reply& reply = replies[frame.stream];
+        if (frame.type == RST_STREAM) {
+            reply.reset = readU32(frame.payload);
+        } else if (frame.type == HEADERS || frame.type == CONTINUATION) {
+            block += frame.payload;
+            if (!(frame.flags & END_HEADERS)) return true;
+            CHECK(decoder.decode(block, [&reply](std::string_view name, std::string_view value) {
+                if (name == ":status") {
+                    reply.status = std::atoi(std::string(value).c_str());
+                } else {
+                    reply.headers.emplace_back(name, value);
+                }
+            }));
+            block.clear();
+        } else if (frame.type == DATA) {
+            reply.body += frame.payload;
+            ++reply.data_frames;
+        }
+        // A 100 Continue is followed by the final response
+        if ((frame.flags & END_STREAM) && (frame.type == HEADERS || frame.type == DATA)) reply.ended = true;
+        return true;
+    }
+
+public:
+    explicit H2Client(int port) {
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    H2Client(const H2Client&) = delete;
+    H2Client& operator=(const H2Client&) = delete;
+    ~H2Client() {
+        if (fd >= 0) close(fd);
+    }
+
+    void send(std::string_view bytes) {
+        while (!bytes.empty()) {
+            ssize_t n = ::send(fd, bytes.data(), bytes.size(), MSG_NOSIGNAL);
+            if (n <= 0) return;
+            bytes.remove_prefix(n);
+        }
+    }
+
+    void sendFrame(uint8_t type, uint8_t flags, uint32_t stream, std::string_view payload) {
+        std::string frame = u32(static_cast<uint32_t>(payload.size()) << 8 | type);
+        frame += static_cast<char>(flags);
+        frame += u32(stream);
+        frame += payload;
+        send(frame);
+    }
+
+    // Client preface and SETTINGS (prior knowledge, or after a 101)
+    void start(std::string_view settings = {}) {
+        send(HTTP2_PREFACE);
+        sendFrame(SETTINGS, 0, 0, settings);
+    }
+
+    // Reads up to the end of an HTTP/1.1 response head
+    std::string readHttp1Head() {
+        size_t end;
+        while ((end = buffer.find("\r\n\r\n")) == std::string::npos) {
+            if (!fill(5000)) return "";
+        }
+        std::string head = buffer.substr(0, end + 4);
+        buffer.erase(0, end + 4);
+        return head;
+    }
+
+    std::string encode(const Fields& fields) {
+        std::string encoded;
+        encoder.beginBlock(encoded);
+        for (const auto& [name, value] : fields) encoder.encode(encoded, name, value);
+        return encoded;
+    }
+
+    Frame readFrame(int timeout_ms = 5000) {
+        Frame frame;
+        while (buffer.size() < 9 || buffer.size() < 9 + (readU32(buffer) >> 8)) {
+            if (!fill(timeout_ms)) return frame;
+        }
+        size_t length = readU32(buffer) >> 8;
+        frame.type = static_cast<uint8_t>(buffer[3]);
+        frame.flags = static_cast<uint8_t>(buffer[4]);
+        frame.stream = readU32(std::string_view(buffer).substr(5)) & 0x7fffffff;
+        frame.payload = buffer.substr(9, length);
+        buffer.erase(0, 9 + length);
+        return frame;
+    }
+
+    // Collects stream's response until it ends or is reset, the connection
+    // goes away, or nothing arrives for timeout_ms
+    H2Reply read(uint32_t stream, int timeout_ms = 5000) {
+        while (true) {
+            H2Reply& reply = replies[stream];
+            if (reply.ended || reply.reset != NO_FRAME || goaway != NO_FRAME ||
+                !take(readFrame(timeout_ms))) {
+                H2Reply done = std::move(replies[stream]);
+                done.goaway = goaway;
+                replies.erase(stream);
+                return done;
+            }
+        }
+    }
+
+    // The error code of the GOAWAY the server ends with, NO_FRAME if none
+    uint32_t goawayCode() {
+        while (goaway == NO_FRAME && take(readFrame())) {}
+        return goaway;
+    }
+
+    // True if the connection still answers a PING
+    bool alive() {
+        sendFrame(PING, 0, 0, "12345678");
+        while (true) {
+            Frame frame = readFrame();
+            if (frame.type == PING && (frame.flags & ACK)) return frame.payload == "12345678";
+            if (!take(frame) || goaway != NO_FRAME) return false;
+        }
+    }
+};
+
+static Fields requestFields(std::string_view method, std::string_view path) {
+    return {{":method", std::string(method)}, {":scheme", "http"}, {":path", std::string(path)},
+            {":authority", "test"}};
+}
+
+static void sendRequest(H2Client& client, uint32_t stream, std::string_view method, std::string_view path,
+                        std::string_view body = {}) {
+    Fields fields = requestFields(method, path);
+    if (!body.empty()) fields.emplace_back("content-length", std::to_string(body.size()));
+    client.sendFrame(HEADERS, END_HEADERS | (body.empty() ? END_STREAM : 0), stream, client.encode(fields));
+    if (!body.empty()) client.sendFrame(DATA, END_STREAM, stream, body);
+}
+
+TEST(prior_knowledge_round_trip) {
+    for (const std::string& backend : testBackends()) {
+        TestServer& server = startServer(setupRoutes(documentRoot()), backend);
+        if (!server.running()) continue;
+        H2Client client(server.port());
+        client.start();
+        sendRequest(client, 1, "GET", "/health");
+        sendRequest(client, 3, "POST", "/echo", "hello h2");
+        sendRequest(client, 5, "GET", "/static/page.txt");
+
+        H2Reply health = client.read(1);
+        CHECK_EQ(health.status, 200);
+        CHECK(health.body.find("\"status\": \"healthy\"") != std::string::npos);
+        H2Reply echo = client.read(3);
+        CHECK_EQ(echo.status, 200);
+        CHECK(echo.body.find("\"received_body\": \"hello h2\"") != std::string::npos);
+        H2Reply page = client.read(5);
+        CHECK_EQ(page.status, 200);
+        CHECK_EQ(page.body, "0123456789abcdefghijklmnopqrstuvwxyz");
+        CHECK(page.ended);
+        CHECK(client.alive());
+    }
+}
+
+// HTTP2-Settings of MAX_CONCURRENT_STREAMS 100 and INITIAL_WINDOW_SIZE 65535
+static std::string upgradeRequest(std::string_view method, std::string_view target) {
+    return std::string(method) + " " + std::string(target) +
+           " HTTP/1.1\r\nHost: test\r\nConnection: Upgrade, HTTP2-Settings\r\nUpgrade: h2c\r\n"
+           "HTTP2-Settings: AAMAAABkAAQAAP__\r\n\r\n";
+}
+
+TEST(upgrade_round_trip) {
+    for (const std::string& backend : testBackends()) {
+        TestServer& server = startServer(setupRoutes(documentRoot()), backend);
+        if (!server.running()) continue;
+        H2Client client(server.port());
+        client.send(upgradeRequest("GET", "/hello?name=upgrade"));
+        std::string head = client.readHttp1Head();
+        CHECK(head.compare(0, 12, "HTTP/1.1 101") == 0);
+        client.start();
+
+        // The upgrade request is answered as stream 1
+        H2Reply first = client.read(1);
+        CHECK_EQ(first.status, 200);
+        CHECK(first.body.find("Hello, upgrade!") != std::string::npos);
+        sendRequest(client, 3, "GET", "/health");
+        CHECK_EQ(client.read(3).status, 200);
+    }
+}
+
+TEST(upgrade_with_head) {
+    TestServer& server = startServer(setupRoutes(documentRoot()));
+    H2Client client(server.port());
+    client.send(upgradeRequest("HEAD", "/static/page.txt"));
+    CHECK(client.readHttp1Head().compare(0, 12, "HTTP/1.1 101") == 0);
+    client.start();
+    H2Reply head = client.read(1);
+    CHECK_EQ(head.status, 200);
+    CHECK(head.ended);
+    CHECK_EQ(head.data_frames, 0);
+    CHECK_EQ(head.header("content-length"), "36");
+}
+
+// HEAD is answered from the GET route: its headers, END_STREAM on the
+// HEADERS frame and no DATA, whether the response cache is cold or warm
+TEST(head_request) {
+    for (const std::string& backend : testBackends()) {
+        TestServer& server = startServer(setupRoutes(documentRoot()), backend);
+        if (!server.running()) continue;
+        H2Client client(server.port());
+        client.start();
+        sendRequest(client, 1, "HEAD", "/hello?name=head");
+        sendRequest(client, 3, "HEAD", "/hello?name=head");
+        sendRequest(client, 5, "GET", "/hello?name=head");
+        sendRequest(client, 7, "HEAD", "/no/such/route");
+
+        H2Reply cold = client.read(1);
+        H2Reply warm = client.read(3);
+        H2Reply get = client.read(5);
+        for (const H2Reply* head : {&cold, &warm}) {
+            CHECK_EQ(head->status, 200);
+            CHECK(head->ended);
+            CHECK_EQ(head->data_frames, 0);
+            CHECK_EQ(head->header("content-length"), std::to_string(get.body.size()));
+        }
+        CHECK_EQ(get.status, 200);
+        CHECK(get.data_frames > 0);
+        H2Reply missing = client.read(7);
+        CHECK_EQ(missing.status, 404);
+        CHECK_EQ(missing.data_frames, 0);
+        CHECK(client.alive());
+    }
+}
+
+TEST(continuation_frames) {
+    TestServer& server = startServer(setupRoutes(documentRoot()));
+    H2Client client(server.port());
+    client.start();
+    Fields fields = requestFields("GET", "/static/page.txt");
+    fields.emplace_back("x-filler", std::string(300, 'f'));
+    std::string encoded = client.encode(fields);
+    size_t third = encoded.size() / 3;
+    client.sendFrame(HEADERS, END_STREAM, 1, encoded.substr(0, third));
+    client.sendFrame(CONTINUATION, 0, 1, encoded.substr(third, third));
+    client.sendFrame(CONTINUATION, END_HEADERS, 1, encoded.substr(2 * third));
+    H2Reply reply = client.read(1);
+    CHECK_EQ(reply.status, 200);
+    CHECK_EQ(reply.body, "0123456789abcdefghijklmnopqrstuvwxyz");
+}
+
+// A header block may grow to four times --max-header-size across
+// CONTINUATION frames: a request within that is answered 431, one beyond
+// ends the connection
+TEST(continuation_limit) {
+    TestServer& server = startServer(setupRoutes(documentRoot()), "epoll", {"--max-header-size", "1024"});
+    H2Client client(server.port());
+    client.start();
+    Fields fields = requestFields("GET", "/health");
+    fields.emplace_back("x-filler", std::string(3000, 'f'));
+    std::string encoded = client.encode(fields);
+    CHECK(encoded.size() > 2048 && encoded.size() <= 4096);
+    client.sendFrame(HEADERS, END_STREAM, 1, encoded.substr(0, 1000));
+    client.sendFrame(CONTINUATION, 0, 1, encoded.substr(1000, 1000));
+    client.sendFrame(CONTINUATION, END_HEADERS, 1, encoded.substr(2000));
+    CHECK_EQ(client.read(1).status, 431);
+
+    H2Client flood(server.port());
+    flood.start();
+    std::string junk(1000, 'x');
+    flood.sendFrame(HEADERS, 0, 1, junk);
+    for (int i = 0; i < 5; ++i) flood.sendFrame(CONTINUATION, 0, 1, junk);
+    CHECK_EQ(flood.goawayCode(), uint32_t(0xb));   // ENHANCE_YOUR_CALM
+}
+
+TEST(continuation_out_of_place) {
+    TestServer& server = startServer(setupRoutes(documentRoot()));
+    std::string encoded;
+    {
+        // Another frame between HEADERS and its CONTINUATION
+        H2Client client(server.port());
+        client.start();
+        encoded = client.encode(requestFields("GET", "/health"));
+        client.sendFrame(HEADERS, END_STREAM, 1, encoded.substr(0, 2));
+        client.sendFrame(PING, 0, 0, "12345678");
+        CHECK_EQ(client.goawayCode(), uint32_t(0x1));
+    }
+    {
+        // CONTINUATION for a different stream
+        H2Client client(server.port());
+        client.start();
+        encoded = client.encode(requestFields("GET", "/health"));
+        client.sendFrame(HEADERS, END_STREAM, 1, encoded.substr(0, 2));
+        client.sendFrame(CONTINUATION, END_HEADERS, 3, encoded.substr(2));
+        CHECK_EQ(client.goawayCode(), uint32_t(0x1));
+    }
+    {
+        // CONTINUATION with no header block open
+        H2Client client(server.port());
+        client.start();
+        client.sendFrame(CONTINUATION, END_HEADERS, 1, "");
+        CHECK_EQ(client.goawayCode(), uint32_t(0x1));
+    }
+}
+
+// Padding is stripped from HEADERS and DATA, and must be shorter than the frame
+TEST(padded_frames) {
+    TestServer& server = startServer(setupRoutes(documentRoot()));
+    H2Client client(server.port());
+    client.start();
+    Fields fields = requestFields("POST", "/echo");
+    fields.emplace_back("content-length", "6");
+    std::string padding(10, '\0');
+    client.sendFrame(HEADERS, END_HEADERS | PADDED, 1, std::string(1, '\x0a') + client.encode(fields) + padding);
+    client.sendFrame(DATA, PADDED, 1, std::string(1, '\x0a') + "padded" + padding);
+    client.sendFrame(DATA, END_STREAM | PADDED, 1, std::string(1, '\x00'));
+    H2Reply reply = client.read(1);
+    CHECK_EQ(reply.status, 200);
+    CHECK(reply.body.find("\"received_body\": \"padded\"") != std::string::npos);
+
+    client.sendFrame(HEADERS, END_HEADERS, 3, client.encode(requestFields("POST", "/echo")));
+    client.sendFrame(DATA, END_STREAM | PADDED, 3, std::string(1, '\x05') + "abcd");
+    CHECK_EQ(client.goawayCode(), uint32_t(0x1));
+}
+
+// Response DATA stays within the stream window the client set, and resumes
+// when the client widens it
+TEST(flow_control_window) {
+    for (const std::string& backend : testBackends()) {
+        TestServer& server = startServer(setupRoutes(documentRoot()), backend);
+        if (!server.running()) continue;
+        H2Client client(server.port());
+        client.start(setting(0x4, 10));   // SETTINGS_INITIAL_WINDOW_SIZE
+        sendRequest(client, 1, "GET", "/static/page.txt");
+
+        H2Reply first = client.read(1, 300);
+        CHECK_EQ(first.status, 200);
+        CHECK_EQ(first.body, "0123456789");
+        CHECK(!first.ended);
+
+        client.sendFrame(WINDOW_UPDATE, 0, 1, u32(16));
+        H2Reply second = client.read(1, 300);
+        CHECK_EQ(second.body, "abcdefghijklmnop");
+        CHECK(!second.ended);
+
+        client.sendFrame(WINDOW_UPDATE, 0, 1, u32(100));
+        H2Reply rest = client.read(1);
+        CHECK_EQ(rest.body, "qrstuvwxyz");
+        CHECK(rest.ended);
+    }
+}
+
+TEST(flow_control_errors) {
+    TestServer& server = startServer(setupRoutes(documentRoot()));
+    {
+        // A stream window past 2^31-1 resets the stream
+        H2Client client(server.port());
+        client.start();
+        client.sendFrame(HEADERS, END_HEADERS, 1, client.encode(requestFields("POST", "/echo")));
+        client.sendFrame(WINDOW_UPDATE, 0, 1, u32(0x7fffffff));
+        CHECK_EQ(client.read(1).reset, uint32_t(0x3));   // FLOW_CONTROL_ERROR
+        // and a zero increment is a stream error too
+        client.sendFrame(HEADERS, END_HEADERS, 3, client.encode(requestFields("POST", "/echo")));
+        client.sendFrame(WINDOW_UPDATE, 0, 3, u32(0));
+        CHECK_EQ(client.read(3).reset, uint32_t(0x1));
+        CHECK(client.alive());
+    }
+    {
+        // The connection window overflowing ends the connection
+        H2Client client(server.port());
+        client.start();
+        client.sendFrame(WINDOW_UPDATE, 0, 0, u32(0x7fffffff));
+        CHECK_EQ(client.goawayCode(), uint32_t(0x3));
+    }
+    {
+        // An initial window past 2^31-1
+        H2Client client(server.port());
+        client.start(setting(0x4, 0x80000000));
+        CHECK_EQ(client.goawayCode(), uint32_t(0x3));
+    }
+}
+
+// RST_STREAM for a stream never opened is a connection error; for one that
+// has finished it is harmless
+TEST(rst_stream_on_idle_stream) {
+    TestServer& server = startServer(setupRoutes(documentRoot()));
+    {
+        H2Client client(server.port());
+        client.start();
+        client.sendFrame(RST_STREAM, 0, 1, u32(0x8));
+        CHECK_EQ(client.goawayCode(), uint32_t(0x1));
+    }
+    {
+        H2Client client(server.port());
+        client.start();
+        sendRequest(client, 1, "GET", "/health");
+        CHECK_EQ(client.read(1).status, 200);
+        client.sendFrame(RST_STREAM, 0, 1, u32(0x8));
+        CHECK(client.alive());
+        // A later stream id is still idle
+        client.sendFrame(RST_STREAM, 0, 3, u32(0x8));
+        CHECK_EQ(client.goawayCode(), uint32_t(0x1));
+    }
+}
+
+int main(int argc, char* argv[]) {
+    return runTests(argc, argv);
+}
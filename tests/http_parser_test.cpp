@@ -0,0 +1,313 @@
+// HTTPRequestParser and BodyDecoder on their own: input split at every byte
+// offset, each error status, Content-Length and Transfer-Encoding edge cases.
+
+#include <string>
+#include <vector>
+
+#include "test_support.hpp"
+
+static const std::string REQUEST =
+    "GET /search?q=cats&page=2 HTTP/1.1\r\n"
+    "Host: example.test\r\n"
+    "user-agent: parser-test\r\n"
+    "Accept:  */* \t\r\n"
+    "X-Empty:\r\n"
+    "\r\n";
+
+// Head parse of the whole input at once: status, and the error or head size
+static ParseStatus parseHead(const std::string& head, int& detail, size_t max_header = 16 * 1024) {
+    HTTPRequestParser parser(max_header);
+    ParseStatus status = parser.parse(head.data(), head.size());
+    detail = status == ParseStatus::ERROR ? parser.errorStatus() : static_cast<int>(parser.headSize());
+    return status;
+}
+
+static int headError(const std::string& head) {
+    int detail = 0;
+    return parseHead(head, detail) == ParseStatus::ERROR ? detail : 0;
+}
+
+// Decodes a body delivered in the given pieces the way connections do:
+// decoded bytes are taken, consumed ones dropped, the rest kept for the
+// next read. Returns the final status; error is set on ERROR.
+static ParseStatus decodeChunked(const std::vector<std::string>& pieces, std::string& body, int& error,
+                                 size_t limit = 1024 * 1024) {
+    BodyDecoder decoder;
+    decoder.startChunked(limit);
+    std::string pending;
+    ParseStatus status = ParseStatus::PARTIAL;
+    for (const std::string& piece : pieces) {
+        pending += piece;
+        size_t decoded = 0, consumed = 0;
+        status = decoder.decode(pending.data(), pending.size(), decoded, consumed);
+        if (status == ParseStatus::ERROR) {
+            error = decoder.errorStatus();
+            return status;
+        }
+        body.append(pending, 0, decoded);
+        pending.erase(0, consumed);
+        if (status == ParseStatus::COMPLETE) break;
+    }
+    return status;
+}
+
+static int chunkedError(const std::string& encoded, size_t limit = 1024 * 1024) {
+    std::string body;
+    int error = 0;
+    return decodeChunked({encoded}, body, error, limit) == ParseStatus::ERROR ? error : 0;
+}
+
+static void checkRequest(const HTTPRequest& req) {
+    CHECK_EQ(req.method, "GET");
+    CHECK(req.method_id == HTTPMethod::GET);
+    CHECK_EQ(req.path, "/search");
+    CHECK_EQ(req.query, "q=cats&page=2");
+    CHECK_EQ(req.getQueryParam("page"), "2");
+    CHECK_EQ(req.version, "HTTP/1.1");
+    CHECK_EQ(req.header_count, size_t(4));
+    CHECK_EQ(req.getHeader("User-Agent"), "parser-test");
+    CHECK_EQ(req.getHeader("accept"), "*/*");
+    CHECK(req.getHeader("X-Empty").empty());
+}
+
+TEST(parses_whole_head) {
+    HTTPRequestParser parser;
+    CHECK(parser.parse(REQUEST.data(), REQUEST.size()) == ParseStatus::COMPLETE);
+    CHECK_EQ(parser.headSize(), REQUEST.size());
+    HTTPRequest req;
+    parser.fillRequest(REQUEST.data(), req);
+    checkRequest(req);
+}
+
+// The first read ends at every possible offset, and the buffer moves
+// before the rest arrives
+TEST(head_split_at_every_offset) {
+    std::string input = REQUEST + "GET /next HTTP/1.1\r\n";
+    for (size_t split = 0; split < REQUEST.size(); ++split) {
+        HTTPRequestParser parser;
+        std::string first = input.substr(0, split);
+        CHECK(parser.parse(first.data(), first.size()) == ParseStatus::PARTIAL);
+        std::string moved = input;
+        CHECK(parser.parse(moved.data(), moved.size()) == ParseStatus::COMPLETE);
+        CHECK_EQ(parser.headSize(), REQUEST.size());
+        HTTPRequest req;
+        parser.fillRequest(moved.data(), req);
+        checkRequest(req);
+    }
+}
+
+// Every input grown one byte at a time
+TEST(head_fed_byte_by_byte) {
+    HTTPRequestParser parser;
+    std::string buffer;
+    ParseStatus status = ParseStatus::PARTIAL;
+    for (char c : REQUEST) {
+        CHECK(status == ParseStatus::PARTIAL);
+        buffer += c;
+        status = parser.parse(buffer.data(), buffer.size());
+    }
+    CHECK(status == ParseStatus::COMPLETE);
+    HTTPRequest req;
+    parser.fillRequest(buffer.data(), req);
+    checkRequest(req);
+}
+
+TEST(reset_parses_next_request) {
+    HTTPRequestParser parser;
+    CHECK(parser.parse(REQUEST.data(), REQUEST.size()) == ParseStatus::COMPLETE);
+    parser.reset();
+    std::string next = "\r\nPOST /form HTTP/1.0\r\nContent-Length: 3\r\n\r\n";
+    CHECK(parser.parse(next.data(), next.size()) == ParseStatus::COMPLETE);
+    HTTPRequest req;
+    parser.fillRequest(next.data(), req);
+    CHECK(req.method_id == HTTPMethod::POST);
+    CHECK_EQ(req.header_count, size_t(1));
+    CHECK_EQ(parser.contentLength(), size_t(3));
+    CHECK(!parser.isChunked());
+}
+
+TEST(lowercase_header_names) {
+    HTTPRequestParser parser;
+    std::string head = "POST /echo HTTP/1.1\r\nhost: a\r\ncontent-length: 12\r\n\r\n";
+    CHECK(parser.parse(head.data(), head.size()) == ParseStatus::COMPLETE);
+    CHECK_EQ(parser.contentLength(), size_t(12));
+    HTTPRequest req;
+    parser.fillRequest(head.data(), req);
+    CHECK_EQ(req.getHeader("Content-Length"), "12");
+    CHECK_EQ(req.getHeader("HOST"), "a");
+
+    parser.reset();
+    head = "POST /echo HTTP/1.1\r\ntransfer-encoding: CHUNKED\r\n\r\n";
+    CHECK(parser.parse(head.data(), head.size()) == ParseStatus::COMPLETE);
+    CHECK(parser.isChunked());
+}
+
+TEST(duplicate_content_length) {
+    HTTPRequestParser parser;
+    std::string same = "POST / HTTP/1.1\r\nContent-Length: 5\r\ncontent-length: 5\r\n\r\n";
+    CHECK(parser.parse(same.data(), same.size()) == ParseStatus::COMPLETE);
+    CHECK_EQ(parser.contentLength(), size_t(5));
+
+    CHECK_EQ(headError("POST / HTTP/1.1\r\nContent-Length: 5\r\nContent-Length: 6\r\n\r\n"), 400);
+    CHECK_EQ(headError("POST / HTTP/1.1\r\nContent-Length: 5\r\nContent-Length: 5, 5\r\n\r\n"), 400);
+    // A length next to chunked framing is rejected, in either order
+    CHECK_EQ(headError("POST / HTTP/1.1\r\nContent-Length: 5\r\nTransfer-Encoding: chunked\r\n\r\n"), 400);
+    CHECK_EQ(headError("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\ncontent-length: 5\r\n\r\n"), 400);
+}
+
+TEST(malformed_content_length) {
+    for (const char* value : {"", "-1", "+5", "5x", "0x10", "1 2", "99999999999999999999999"}) {
+        CHECK_EQ(headError(std::string("POST / HTTP/1.1\r\nContent-Length: ") + value + "\r\n\r\n"), 400);
+    }
+}
+
+TEST(bad_request_status) {
+    for (const char* head : {
+             "GET\r\n\r\n",
+             "GET /\r\n\r\n",
+             " GET / HTTP/1.1\r\n\r\n",
+             "GET  HTTP/1.1\r\n\r\n",
+             "GET / HTTP/1.1 \r\n\r\n",
+             "GET /a b HTTP/1.1\r\n\r\n",
+             "GET / FTP/1.1\r\n\r\n",
+             "GET / HTTP/1.1\r\nNoColon\r\n\r\n",
+             "GET / HTTP/1.1\r\n: no name\r\n\r\n",
+             "GET / HTTP/1.1\r\nHost : a\r\n\r\n",
+             "GET / HTTP/1.1\r\nHost: a\r\n folded\r\n\r\n",
+         }) {
+        CHECK_EQ(headError(head), 400);
+    }
+}
+
+TEST(version_not_supported_status) {
+    CHECK_EQ(headError("GET / HTTP/2.0\r\n\r\n"), 505);
+    CHECK_EQ(headError("GET / HTTP/0.9\r\n\r\n"), 505);
+    CHECK_EQ(headError("GET / HTTP/1.0\r\n\r\n"), 0);
+}
+
+TEST(not_implemented_status) {
+    CHECK_EQ(headError("POST / HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\n"), 501);
+    CHECK_EQ(headError("POST / HTTP/1.1\r\nTransfer-Encoding: gzip, chunked\r\n\r\n"), 501);
+}
+
+TEST(header_too_large_status) {
+    int detail = 0;
+    std::string long_line = "GET / HTTP/1.1\r\nX-Long: " + std::string(2000, 'a') + "\r\n\r\n";
+    CHECK(parseHead(long_line, detail, 1024) == ParseStatus::ERROR);
+    CHECK_EQ(detail, 431);
+    // Without a line end yet, the limit still applies to what is buffered
+    std::string unfinished = "GET / HTTP/1.1\r\nX-Long: " + std::string(2000, 'a');
+    CHECK(parseHead(unfinished, detail, 1024) == ParseStatus::ERROR);
+    CHECK_EQ(detail, 431);
+    CHECK(parseHead(unfinished.substr(0, 1000), detail, 1024) == ParseStatus::PARTIAL);
+
+    std::string many = "GET / HTTP/1.1\r\n";
+    for (size_t i = 0; i < HTTPRequest::MAX_HEADERS; ++i) many += "X-" + std::to_string(i) + ": v\r\n";
+    CHECK_EQ(headError(many + "\r\n"), 0);
+    CHECK_EQ(headError(many + "X-One-More: v\r\n\r\n"), 431);
+}
+
+TEST(content_length_body) {
+    BodyDecoder decoder;
+    decoder.startLength(5);
+    std::string input = "hel";
+    size_t decoded = 0, consumed = 0;
+    CHECK(decoder.decode(input.data(), input.size(), decoded, consumed) == ParseStatus::PARTIAL);
+    CHECK_EQ(decoded, size_t(3));
+    input = "loGET";
+    CHECK(decoder.decode(input.data(), input.size(), decoded, consumed) == ParseStatus::COMPLETE);
+    CHECK_EQ(decoded, size_t(2));
+    CHECK_EQ(consumed, size_t(2));
+}
+
+static const std::string CHUNKED =
+    "5\r\nhello\r\n"
+    "1;name=value;flag\r\n \r\n"
+    "A \r\n0123456789\r\n"
+    "0\r\n"
+    "Trailer-Field: x\r\n"
+    "\r\n";
+
+TEST(chunked_body_split_at_every_offset) {
+    for (size_t split = 0; split <= CHUNKED.size(); ++split) {
+        std::string body;
+        int error = 0;
+        ParseStatus status = decodeChunked({CHUNKED.substr(0, split), CHUNKED.substr(split) + "NEXT"}, body, error);
+        CHECK(status == ParseStatus::COMPLETE);
+        CHECK_EQ(body, "hello 0123456789");
+    }
+    std::vector<std::string> bytes;
+    for (char c : CHUNKED) bytes.emplace_back(1, c);
+    std::string body;
+    int error = 0;
+    CHECK(decodeChunked(bytes, body, error) == ParseStatus::COMPLETE);
+    CHECK_EQ(body, "hello 0123456789");
+}
+
+// The decoder stops at the body's end, leaving a pipelined request in place
+TEST(chunked_body_stops_at_end) {
+    std::string input = "3\r\nabc\r\n0\r\n\r\nGET / HTTP/1.1\r\n\r\n";
+    BodyDecoder decoder;
+    decoder.startChunked(1024);
+    size_t decoded = 0, consumed = 0;
+    CHECK(decoder.decode(input.data(), input.size(), decoded, consumed) == ParseStatus::COMPLETE);
+    CHECK_EQ(input.substr(0, decoded), "abc");
+    CHECK_EQ(input.substr(consumed), "GET / HTTP/1.1\r\n\r\n");
+}
+
+TEST(malformed_chunk_size) {
+    for (const char* encoded : {
+             "\r\n",                               // no digits
+             ";ext\r\n",                           // extension without a size
+             "g\r\n",                              // not hex
+             "-1\r\n",
+             "0x5\r\nhello\r\n0\r\n\r\n",
+             "5\r\nhelloX\r\n0\r\n\r\n",          // data longer than its size
+             "10000000000000000\r\n",              // wraps a 64-bit size
+         }) {
+        CHECK_EQ(chunkedError(encoded), 400);
+    }
+}
+
+TEST(chunk_extensions) {
+    // Extensions are skipped up to the line end, whatever they contain
+    std::string body;
+    int error = 0;
+    CHECK(decodeChunked({"3;a=\"quoted;value\"\r\nabc\r\n0;last\r\n\r\n"}, body, error) == ParseStatus::COMPLETE);
+    CHECK_EQ(body, "abc");
+    body.clear();
+    CHECK(decodeChunked({"3\t; x\r\nabc\r\n0\r\n\r\n"}, body, error) == ParseStatus::COMPLETE);
+    CHECK_EQ(body, "abc");
+}
+
+TEST(chunked_body_too_large_status) {
+    CHECK_EQ(chunkedError("4\r\nabcd\r\n0\r\n\r\n", 4), 0);
+    CHECK_EQ(chunkedError("5\r\nabcde\r\n0\r\n\r\n", 4), 413);
+    CHECK_EQ(chunkedError("2\r\nab\r\n3\r\ncde\r\n0\r\n\r\n", 4), 413);
+    CHECK_EQ(chunkedError("ffffffffffffffff\r\n", 4), 413);
+}
+
+TEST(chunked_trailer_too_large_status) {
+    std::string trailer = "0\r\nX-Trailer: " + std::string(9000, 'a') + "\r\n\r\n";
+    CHECK_EQ(chunkedError(trailer), 431);
+}
+
+// A declared length over --max-body-size is refused by the connection
+// before any of the body is read
+TEST(content_length_too_large_status) {
+    Router router;
+    router.post("/echo", [](HTTPRequest&, HTTPResponse& res) { res.setBody("ok"); });
+    TestServer& server = startServer(std::move(router), "epoll", {"--max-body-size", "16"});
+    TestClient client(server.port());
+    CHECK(client.send("POST /echo HTTP/1.1\r\nHost: test\r\nContent-Length: 17\r\n\r\n"));
+    CHECK_EQ(client.read().status, 413);
+
+    TestClient chunked(server.port());
+    CHECK(chunked.send("POST /echo HTTP/1.1\r\nHost: test\r\nTransfer-Encoding: chunked\r\n\r\n"
+                       "10\r\n0123456789abcdef\r\n1\r\nx\r\n0\r\n\r\n"));
+    CHECK_EQ(chunked.read().status, 413);
+}
+
+int main(int argc, char* argv[]) {
+    return runTests(argc, argv);
+}
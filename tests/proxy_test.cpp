@@ -0,0 +1,342 @@
+// Reverse proxy routes against stand-in upstreams on loopback: request
+// bodies streamed and re-chunked, gateway errors, failover, no retry once a
+// streamed body was partly sent, and bodiless responses relayed as such.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "test_support.hpp"
+
+// A request as an upstream received it
+struct StubRequest {
+    std::string method;
+    std::string target;
+    std::vector<std::pair<std::string, std::string>> headers;
+    std::string body;
+
+    std::string header(std::string_view name) const {
+        for (const auto& [key, value] : headers) {
+            if (equalsIgnoreCase(key, name)) return value;
+        }
+        return "";
+    }
+};
+
+// One upstream connection, read with blocking calls
+class StubConnection {
+private:
+    int fd;
+    std::string buffer;
+
+    bool fill() {
+        char chunk[65536];
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) return false;
+        buffer.append(chunk, n);
+        return true;
+    }
+
+    bool readLine(std::string& line) {
+        size_t end;
+        while ((end = buffer.find("\r\n")) == std::string::npos) {
+            if (!fill()) return false;
+        }
+        line = buffer.substr(0, end);
+        buffer.erase(0, end + 2);
+        return true;
+    }
+
+    bool readExactly(size_t bytes, std::string& into) {
+        while (buffer.size() < bytes) {
+            if (!fill()) return false;
+        }
+        into.append(buffer, 0, bytes);
+        buffer.erase(0, bytes);
+        return true;
+    }
+
+public:
+    explicit StubConnection(int socket) : fd(socket) {}
+    ~StubConnection() { close(fd); }
+
+    bool readHead(StubRequest& request) {
+        std::string line;
+        if (!readLine(line)) return false;
+        size_t space = line.find(' ');
+        request.method = line.substr(0, space);
+        request.target = line.substr(space + 1, line.rfind(' ') - space - 1);
+        while (readLine(line)) {
+            if (line.empty()) return true;
+            size_t colon = line.find(':');
+            request.headers.emplace_back(line.substr(0, colon), line.substr(line.find_first_not_of(' ', colon + 1)));
+        }
+        return false;
+    }
+
+    bool readBody(StubRequest& request) {
+        if (equalsIgnoreCase(request.header("Transfer-Encoding"), "chunked")) {
+            std::string line;
+            while (readLine(line)) {
+                size_t size = std::stoul(line, nullptr, 16);
+                if (size == 0) return readLine(line);
+                if (!readExactly(size, request.body) || !readLine(line)) return false;
+            }
+            return false;
+        }
+        std::string length = request.header("Content-Length");
+        return length.empty() || readExactly(std::stoul(length), request.body);
+    }
+
+    // Reads up to bytes of the body and then resets the connection
+    void resetAfter(size_t bytes) {
+        std::string ignored;
+        readExactly(bytes, ignored);
+        linger reset{1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+    }
+
+    // Waits until the proxy gives up on the connection
+    void hang() {
+        while (fill()) {}
+    }
+
+    void write(std::string_view bytes) { ::send(fd, bytes.data(), bytes.size(), MSG_NOSIGNAL); }
+};
+
+// Stand-in upstream on 127.0.0.1. behave answers a request whose head was
+// read, and returns false to close the connection.
+class StubUpstream {
+public:
+    using Behavior = std::function<bool(StubConnection&, StubRequest&)>;
+
+private:
+    int listen_fd;
+    int bound_port = 0;
+    Behavior behave;
+
+public:
+    std::atomic<int> requests{0};
+
+    explicit StubUpstream(Behavior behavior) : behave(std::move(behavior)) {
+        listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+        listen(listen_fd, 64);
+        socklen_t size = sizeof(address);
+        getsockname(listen_fd, reinterpret_cast<sockaddr*>(&address), &size);
+        bound_port = ntohs(address.sin_port);
+
+        std::thread([this] {
+            while (true) {
+                int fd = accept(listen_fd, nullptr, nullptr);
+                if (fd < 0) continue;
+                std::thread([this, fd] {
+                    StubConnection conn(fd);
+                    while (true) {
+                        StubRequest request;
+                        if (!conn.readHead(request)) return;
+                        ++requests;
+                        if (!behave(conn, request)) return;
+                    }
+                }).detach();
+            }
+        }).detach();
+    }
+
+    std::string address() const { return "127.0.0.1:" + std::to_string(bound_port); }
+};
+
+// Like the servers, stubs live until the process exits
+static StubUpstream& startStub(StubUpstream::Behavior behavior) {
+    return *new StubUpstream(std::move(behavior));
+}
+
+// A loopback address nothing listens on, so connecting is refused
+static std::string deadAddress() {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+    socklen_t size = sizeof(address);
+    getsockname(fd, reinterpret_cast<sockaddr*>(&address), &size);
+    close(fd);
+    return "127.0.0.1:" + std::to_string(ntohs(address.sin_port));
+}
+
+static std::string respond(int status, std::string_view reason, std::string_view body,
+                           std::string_view extra_headers = "") {
+    return "HTTP/1.1 " + std::to_string(status) + " " + std::string(reason) + "\r\n" + std::string(extra_headers) +
+           "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + std::string(body);
+}
+
+// Answers with what arrived: framing header, byte count and a checksum
+static bool echoBody(StubConnection& conn, StubRequest& request) {
+    if (!conn.readBody(request)) return false;
+    uint64_t sum = 0;
+    for (unsigned char c : request.body) sum = sum * 31 + c;
+    std::string framing = request.header("Transfer-Encoding").empty()
+        ? "length " + request.header("Content-Length") : "te " + request.header("Transfer-Encoding");
+    conn.write(respond(200, "OK", request.target + " " + framing + " " + std::to_string(request.body.size()) +
+                                  " " + std::to_string(sum)));
+    return true;
+}
+
+static std::string checksum(std::string_view body) {
+    uint64_t sum = 0;
+    for (unsigned char c : body) sum = sum * 31 + c;
+    return std::to_string(sum);
+}
+
+static Router proxyRoutes(const std::vector<std::string>& upstreams) {
+    ProxyOptions options;
+    options.timeout = std::chrono::milliseconds(300);
+    options.connect_timeout = std::chrono::milliseconds(300);
+    Router router;
+    router.proxy("/svc/*", upstreams, options);
+    return router;
+}
+
+static std::string patterned(size_t size) {
+    std::string body(size, '\0');
+    for (size_t i = 0; i < size; ++i) body[i] = static_cast<char>('a' + (i * 7 + i / 4093) % 26);
+    return body;
+}
+
+// A body four times --max-body-size goes through, sent as it arrives
+TEST(streams_content_length_body) {
+    StubUpstream& stub = startStub(echoBody);
+    std::string body = patterned(4 * 1024 * 1024);
+    for (const std::string& backend : testBackends()) {
+        TestServer& server = startServer(proxyRoutes({stub.address()}), backend);
+        if (!server.running()) continue;
+        TestClient client(server.port());
+        std::thread sender([&] {
+            client.send("PUT /svc/upload HTTP/1.1\r\nHost: test\r\nContent-Length: " + std::to_string(body.size()) +
+                        "\r\n\r\n" + body);
+        });
+        Reply reply = client.read();
+        sender.join();
+        CHECK_EQ(reply.status, 200);
+        CHECK_EQ(reply.body, "/upload length " + std::to_string(body.size()) + " " +
+                             std::to_string(body.size()) + " " + checksum(body));
+    }
+}
+
+TEST(rechunks_chunked_body) {
+    StubUpstream& stub = startStub(echoBody);
+    for (const std::string& backend : testBackends()) {
+        TestServer& server = startServer(proxyRoutes({stub.address()}), backend);
+        if (!server.running()) continue;
+        TestClient client(server.port());
+        CHECK(client.send("POST /svc/chunks HTTP/1.1\r\nHost: test\r\nTransfer-Encoding: chunked\r\n\r\n"
+                          "5\r\nhello\r\n"));
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        CHECK(client.send("1;ext=1\r\n \r\n6\r\nworld!\r\n0\r\n\r\n"
+                          "GET /svc/after HTTP/1.1\r\nHost: test\r\n\r\n"));
+        Reply reply = client.read();
+        CHECK_EQ(reply.status, 200);
+        CHECK_EQ(reply.body, "/chunks te chunked 12 " + checksum("hello world!"));
+        // The request pipelined after the body is served on the same connection
+        Reply after = client.read();
+        CHECK_EQ(after.status, 200);
+        CHECK_EQ(after.body, "/after length  0 0");
+    }
+}
+
+TEST(bad_gateway_for_dead_upstream) {
+    TestServer& server = startServer(proxyRoutes({deadAddress()}));
+    TestClient client(server.port());
+    CHECK(client.send("POST /svc/x HTTP/1.1\r\nHost: test\r\nContent-Length: 5\r\n\r\nhello"));
+    CHECK_EQ(client.read().status, 502);
+}
+
+TEST(gateway_timeout_for_silent_upstream) {
+    StubUpstream& stub = startStub([](StubConnection& conn, StubRequest&) {
+        conn.hang();
+        return false;
+    });
+    TestServer& server = startServer(proxyRoutes({stub.address()}));
+    TestClient client(server.port());
+    CHECK(client.send("GET /svc/slow HTTP/1.1\r\nHost: test\r\n\r\n"));
+    CHECK_EQ(client.read().status, 504);
+}
+
+TEST(fails_over_to_next_upstream) {
+    StubUpstream& stub = startStub(echoBody);
+    TestServer& server = startServer(proxyRoutes({deadAddress(), stub.address()}));
+    // Round robin starts on each upstream in turn; every request lands on the live one
+    for (int i = 0; i < 4; ++i) {
+        TestClient client(server.port());
+        CHECK(client.send("POST /svc/failover HTTP/1.1\r\nHost: test\r\nContent-Length: 2\r\n\r\nok"));
+        Reply reply = client.read();
+        CHECK_EQ(reply.status, 200);
+        CHECK_EQ(reply.body, "/failover length 2 2 " + checksum("ok"));
+    }
+    CHECK_EQ(stub.requests.load(), 4);
+}
+
+// Once part of a streamed body left the client's buffer it can't be sent
+// again, so even an idempotent request is not retried elsewhere
+TEST(no_retry_after_partial_body) {
+    auto cut = [](StubConnection& conn, StubRequest&) {
+        conn.resetAfter(1000);
+        return false;
+    };
+    StubUpstream& first = startStub(cut);
+    StubUpstream& second = startStub(cut);
+    TestServer& server = startServer(proxyRoutes({first.address(), second.address()}));
+    TestClient client(server.port());
+    std::string body = patterned(200 * 1024);
+    CHECK(client.send("PUT /svc/cut HTTP/1.1\r\nHost: test\r\nContent-Length: " + std::to_string(body.size()) +
+                      "\r\n\r\n" + body));
+    CHECK_EQ(client.read().status, 502);
+    CHECK_EQ(first.requests.load() + second.requests.load(), 1);
+}
+
+// Responses without a body leave the next response on the connection intact
+TEST(relays_head_and_not_modified_without_body) {
+    StubUpstream& stub = startStub([](StubConnection& conn, StubRequest& request) {
+        if (request.method == "HEAD") {
+            conn.write("HTTP/1.1 200 OK\r\nContent-Length: 1234\r\nContent-Type: text/plain\r\n\r\n");
+        } else if (!request.header("If-None-Match").empty()) {
+            conn.write("HTTP/1.1 304 Not Modified\r\nETag: \"v1\"\r\n\r\n");
+        } else {
+            conn.write(respond(200, "OK", "full body", "ETag: \"v1\"\r\n"));
+        }
+        return true;
+    });
+    for (const std::string& backend : testBackends()) {
+        TestServer& server = startServer(proxyRoutes({stub.address()}), backend);
+        if (!server.running()) continue;
+        TestClient client(server.port());
+        CHECK(client.send("HEAD /svc/doc HTTP/1.1\r\nHost: test\r\n\r\n"
+                          "GET /svc/doc HTTP/1.1\r\nHost: test\r\nIf-None-Match: \"v1\"\r\n\r\n"
+                          "GET /svc/doc HTTP/1.1\r\nHost: test\r\n\r\n"));
+        Reply head = client.read(true);
+        CHECK_EQ(head.status, 200);
+        CHECK_EQ(head.header("Content-Length"), "1234");
+        Reply not_modified = client.read();
+        CHECK_EQ(not_modified.status, 304);
+        CHECK_EQ(not_modified.header("ETag"), "\"v1\"");
+        Reply full = client.read();
+        CHECK_EQ(full.status, 200);
+        CHECK_EQ(full.body, "full body");
+        CHECK(client.pending().empty());
+    }
+}
+
+int main(int argc, char* argv[]) {
+    return runTests(argc, argv);
+}
@@ -0,0 +1,303 @@
+#pragma once
+
+// Shared by the test programs: a minimal harness, a server run in-process
+// on an ephemeral loopback port, and a blocking HTTP/1.1 client that frames
+// responses strictly, so a stray byte shows up as a broken next response.
+//
+//   TEST(name) { CHECK(cond); CHECK_EQ(actual, expected); }
+//   int main(int argc, char* argv[]) { return runTests(argc, argv); }
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "admission.hpp"
+#include "config.hpp"
+#include "event_loop.hpp"
+#include "http_request.hpp"
+#include "listener.hpp"
+#include "logger.hpp"
+#include "router.hpp"
+#include "stats.hpp"
+#include "uring_loop.hpp"
+
+struct TestCase {
+    const char* name;
+    void (*run)();
+};
+
+inline std::vector<TestCase>& testCases() {
+    static std::vector<TestCase> cases;
+    return cases;
+}
+
+inline int test_failures = 0;
+
+inline bool registerTest(const char* name, void (*run)()) {
+    testCases().push_back({name, run});
+    return true;
+}
+
+#define TEST(name)                                                   \
+    static void name();                                              \
+    static const bool name##_registered = registerTest(#name, name); \
+    static void name()
+
+// A failed check is reported and the case goes on
+#define CHECK(condition)                                                                   \
+    do {                                                                                   \
+        if (!(condition)) {                                                                \
+            ++test_failures;                                                               \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #condition ") failed\n"; \
+        }                                                                                  \
+    } while (0)
+
+#define CHECK_EQ(actual, expected)                                                           \
+    do {                                                                                     \
+        const auto& check_actual = (actual);                                                 \
+        const auto& check_expected = (expected);                                             \
+        if (!(check_actual == check_expected)) {                                             \
+            ++test_failures;                                                                 \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK_EQ(" #actual ", " #expected \
+                      << ") failed: " << check_actual << " != " << check_expected << "\n";   \
+        }                                                                                    \
+    } while (0)
+
+// Runs every case, or those whose name contains argv[1]. Event loop threads
+// never stop, so the process ends with _Exit rather than running static
+// destructors under them.
+inline int runTests(int argc, char* argv[]) {
+    signal(SIGPIPE, SIG_IGN);
+    logger.setLevel(LogLevel::ERROR);
+    logger.setAccessLog(false);
+    std::string_view filter = argc > 1 ? argv[1] : "";
+    int ran = 0;
+    for (const TestCase& test : testCases()) {
+        if (std::string_view(test.name).find(filter) == std::string_view::npos) continue;
+        int before = test_failures;
+        test.run();
+        ++ran;
+        std::cout << (test_failures == before ? "ok    " : "FAIL  ") << test.name << std::endl;
+    }
+    std::cout << ran << " cases, " << test_failures << " failed checks" << std::endl;
+    std::fflush(nullptr);
+    std::_Exit(test_failures == 0 && ran > 0 ? 0 : 1);
+}
+
+// Config from command line style arguments
+inline Config testConfig(std::vector<std::string> args) {
+    std::vector<char*> argv = {const_cast<char*>("test")};
+    for (std::string& arg : args) argv.push_back(arg.data());
+    return Config::parseArgs(static_cast<int>(argv.size()), argv.data());
+}
+
+// One event loop serving router on 127.0.0.1 and a port of the kernel's
+// choosing. Loops have no stop, so servers come from startServer() and live
+// until the process exits.
+class TestServer {
+private:
+    Config config;
+    Router router;
+    ConnectionLimiter limiter;
+    std::unique_ptr<EventLoop> epoll_loop;
+    std::unique_ptr<UringLoop> uring_loop;
+    int listen_fd = -1;
+    int bound_port = 0;
+
+public:
+    // backend is "epoll" or "io_uring"; extra are more server options
+    TestServer(Router routes, const std::string& backend = "epoll", std::vector<std::string> extra = {})
+        : config(testConfig([&] {
+              std::vector<std::string> args = {"-p", "0", "-b", "127.0.0.1", "--no-reuse-port", "-t", "1"};
+              args.insert(args.end(), extra.begin(), extra.end());
+              return args;
+          }())),
+          router(std::move(routes)),
+          limiter(config.getMaxConnections(), config.getMaxConnectionsPerIp()) {
+        std::string error;
+        listen_fd = openListener(config, error);
+        if (listen_fd < 0) throw std::runtime_error("listen: " + error);
+        sockaddr_in address{};
+        socklen_t size = sizeof(address);
+        getsockname(listen_fd, reinterpret_cast<sockaddr*>(&address), &size);
+        bound_port = ntohs(address.sin_port);
+        stats.setRouteNames(router.routeNames());
+
+        if (backend == "io_uring") {
+            uring_loop = std::make_unique<UringLoop>(config, router, limiter, listen_fd);
+            if (uring_loop->start() != 0) uring_loop.reset();
+        } else {
+            epoll_loop = std::make_unique<EventLoop>(config, router, limiter, listen_fd);
+            if (!epoll_loop->start()) epoll_loop.reset();
+        }
+    }
+
+    TestServer(const TestServer&) = delete;
+    TestServer& operator=(const TestServer&) = delete;
+
+    // False when the backend can't run here, e.g. io_uring on an old kernel
+    bool running() const { return epoll_loop || uring_loop; }
+    int port() const { return bound_port; }
+};
+
+inline TestServer& startServer(Router routes, const std::string& backend = "epoll",
+                               std::vector<std::string> extra = {}) {
+    return *new TestServer(std::move(routes), backend, std::move(extra));
+}
+
+// Cases run against each; one that can't start here is skipped
+inline std::vector<std::string> testBackends() {
+    return {"epoll", "io_uring"};
+}
+
+struct Reply {
+    int status = 0;   // 0 when no well-formed response arrived
+    std::vector<std::pair<std::string, std::string>> headers;
+    std::string body;
+
+    std::string header(std::string_view name) const {
+        for (const auto& [key, value] : headers) {
+            if (equalsIgnoreCase(key, name)) return value;
+        }
+        return "";
+    }
+    bool hasHeader(std::string_view name) const {
+        for (const auto& header : headers) {
+            if (equalsIgnoreCase(header.first, name)) return true;
+        }
+        return false;
+    }
+};
+
+// Blocking client for one connection, with a receive timeout so a missing
+// response fails the test instead of hanging it
+class TestClient {
+private:
+    int fd = -1;
+    std::string buffer;
+
+    bool fill() {
+        char chunk[16384];
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) return false;
+        buffer.append(chunk, n);
+        return true;
+    }
+
+    bool readExactly(size_t bytes, std::string& into) {
+        while (buffer.size() < bytes) {
+            if (!fill()) return false;
+        }
+        into.append(buffer, 0, bytes);
+        buffer.erase(0, bytes);
+        return true;
+    }
+
+    bool readLine(std::string& line) {
+        size_t end;
+        while ((end = buffer.find("\r\n")) == std::string::npos) {
+            if (!fill()) return false;
+        }
+        line = buffer.substr(0, end);
+        buffer.erase(0, end + 2);
+        return true;
+    }
+
+public:
+    explicit TestClient(int port, int timeout_ms = 5000) {
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        timeval timeout{timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    TestClient(const TestClient&) = delete;
+    TestClient& operator=(const TestClient&) = delete;
+    ~TestClient() {
+        if (fd >= 0) close(fd);
+    }
+
+    bool connected() const { return fd >= 0; }
+
+    bool send(std::string_view bytes) {
+        while (!bytes.empty()) {
+            ssize_t n = ::send(fd, bytes.data(), bytes.size(), MSG_NOSIGNAL);
+            if (n <= 0) return false;
+            bytes.remove_prefix(n);
+        }
+        return true;
+    }
+
+    void shutdownWrite() { shutdown(fd, SHUT_WR); }
+
+    // Reads one response. Its body is framed as RFC 9112 6.3 says, so
+    // without_body must be set for a response to HEAD.
+    Reply read(bool without_body = false) {
+        Reply reply;
+        std::string line;
+        if (!readLine(line) || line.compare(0, 5, "HTTP/") != 0 || line.size() < 12) return reply;
+        int status = std::atoi(line.c_str() + 9);
+        while (true) {
+            if (!readLine(line)) return reply;
+            if (line.empty()) break;
+            size_t colon = line.find(':');
+            if (colon == std::string::npos) return reply;
+            size_t value = line.find_first_not_of(' ', colon + 1);
+            reply.headers.emplace_back(line.substr(0, colon),
+                                       value == std::string::npos ? "" : line.substr(value));
+        }
+
+        if (without_body || status < 200 || status == 204 || status == 304) {
+            // nothing follows the head
+        } else if (equalsIgnoreCase(reply.header("Transfer-Encoding"), "chunked")) {
+            while (true) {
+                if (!readLine(line)) return reply;
+                size_t size = std::strtoul(line.c_str(), nullptr, 16);
+                if (size == 0) {
+                    if (!readLine(line)) return reply;
+                    break;
+                }
+                if (!readExactly(size, reply.body) || !readLine(line) || !line.empty()) return reply;
+            }
+        } else if (reply.hasHeader("Content-Length")) {
+            if (!readExactly(std::strtoul(reply.header("Content-Length").c_str(), nullptr, 10), reply.body)) {
+                return reply;
+            }
+        } else {
+            while (fill()) {}
+            reply.body = std::move(buffer);
+            buffer.clear();
+        }
+        reply.status = status;
+        return reply;
+    }
+
+    // True once the server closed the connection with nothing more sent
+    bool closedByPeer() {
+        char byte;
+        return buffer.empty() && recv(fd, &byte, 1, 0) == 0;
+    }
+
+    // Bytes received and not yet read as part of a response
+    const std::string& pending() const { return buffer; }
+};